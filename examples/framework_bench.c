@@ -8,7 +8,6 @@ using the full HTTP framework stack (without any DB support).
 #include "http.h"
 
 #include "fio_cli.h"
-#include "fio_hashmap.h"
 
 /* *****************************************************************************
 Internal Helpers
@@ -26,18 +25,8 @@ static FIOBJ HTTP_VALUE_SERVER;
 static FIOBJ JSON_KEY;
 static FIOBJ JSON_VALUE;
 
-/* *****************************************************************************
-Routing
-***************************************************************************** */
-
-/* adds a route to our simple router */
-static void route_add(char *path, void (*handler)(http_s *));
-
-/* routes a request to the correct handler */
-static void route_perform(http_s *);
-
-/* cleanup for our router */
-static void route_clear(void);
+/* the route table */
+static http_router_s *router;
 
 /* *****************************************************************************
 Request handlers
@@ -49,6 +38,9 @@ static void on_request_json(http_s *h);
 /* handles plain text requests (Hello World) */
 static void on_request_plain_text(http_s *h);
 
+/* adds the required Server header */
+static void add_server_header(http_s *h);
+
 /* *****************************************************************************
 The main function
 ***************************************************************************** */
@@ -57,8 +49,11 @@ int main(int argc, char const *argv[]) {
   cli_init(argc, argv);
 
   /* sertup routes */
-  route_add("/json", on_request_json);
-  route_add("/plaintext", on_request_plain_text);
+  router = http_router_new();
+  http_route(router, .path = "/json", .handler = on_request_json,
+             .methods = HTTP_METHOD_GET);
+  http_route(router, .path = "/plaintext", .handler = on_request_plain_text,
+             .methods = HTTP_METHOD_GET);
 
   /* Server name and header */
   HTTP_HEADER_SERVER = fiobj_str_new("server", 6);
@@ -76,7 +71,7 @@ int main(int argc, char const *argv[]) {
 
   /* listen to HTTP connections */
   http_listen(fio_cli_get("-port"), fio_cli_get("-address"),
-              .on_request = route_perform, .public_folder = public_folder,
+              .router = router, .public_folder = public_folder,
               .log = fio_cli_get_bool("-log"));
 
   /* Start the facil.io reactor */
@@ -93,6 +88,7 @@ Request handlers
 
 /* handles JSON requests */
 static void on_request_json(http_s *h) {
+  add_server_header(h);
   http_set_header(h, HTTP_HEADER_CONTENT_TYPE, http_mimetype_find("json", 4));
   FIOBJ json;
   /* create a new Hash to be serialized for every request */
@@ -107,10 +103,16 @@ static void on_request_json(http_s *h) {
 
 /* handles plain text requests (Hello World) */
 static void on_request_plain_text(http_s *h) {
+  add_server_header(h);
   http_set_header(h, HTTP_HEADER_CONTENT_TYPE, http_mimetype_find("txt", 3));
   http_send_body(h, "Hello, World!", 13);
 }
 
+/* adds the required Server header */
+static void add_server_header(http_s *h) {
+  http_set_header(h, HTTP_HEADER_SERVER, fiobj_dup(HTTP_VALUE_SERVER));
+}
+
 /* *****************************************************************************
 CLI
 ***************************************************************************** */
@@ -149,41 +151,6 @@ static void cli_init(int argc, char const *argv[]) {
   }
 }
 
-/* *****************************************************************************
-Routing
-***************************************************************************** */
-
-/* the router is a simple hash map */
-static fio_hash_s routes;
-
-/* adds a route to our simple router */
-static void route_add(char *path, void (*handler)(http_s *)) {
-  /* add handler to the hash map */
-  size_t len = strlen(path);
-  uint64_t hash = fio_siphash(path, len);
-  fio_hash_insert(&routes, hash, (void *)(uintptr_t)handler);
-}
-
-/* routes a request to the correct handler */
-static void route_perform(http_s *h) {
-  /* add required Serevr header */
-  http_set_header(h, HTTP_HEADER_SERVER, fiobj_dup(HTTP_VALUE_SERVER));
-  /* collect path from hash map */
-  fio_cstr_s tmp = fiobj_obj2cstr(h->path);
-  uint64_t hash = fio_siphash(tmp.data, tmp.len);
-  void (*handler)(http_s *) =
-      (void (*)(http_s *))(uintptr_t)fio_hash_find(&routes, hash);
-  /* forward request or send error */
-  if (handler) {
-    handler(h);
-    return;
-  }
-  http_send_error(h, 404);
-}
-
-/* cleanup for our router */
-static void route_clear(void) { fio_hash_free(&routes); }
-
 /* *****************************************************************************
 Cleanup
 ***************************************************************************** */
@@ -196,5 +163,5 @@ static void cleanup(void) {
   fiobj_free(JSON_KEY);
   fiobj_free(JSON_VALUE);
 
-  route_clear();
+  http_router_free(router);
 }
@@ -10,6 +10,7 @@ Feel free to copy, use and enjoy according to the license provided.
 
 #include <errno.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
@@ -39,6 +40,15 @@ Compile time settings
 #define DEFER_THROTTLE_PROGRESSIVE 1
 #endif
 
+#ifndef DEFER_SHARED_QUEUE_INTERVAL
+/**
+ * Thread pool workers prefer their local queue, but review the shared queue
+ * first once every `DEFER_SHARED_QUEUE_INTERVAL` tasks, so tasks deferred by
+ * other threads aren't starved by tasks that keep rescheduling themselves.
+ */
+#define DEFER_SHARED_QUEUE_INTERVAL 32
+#endif
+
 #ifndef DEFER_QUEUE_BLOCK_COUNT
 #if UINTPTR_MAX <= 0xFFFFFFFF
 /* Almost a page of memory on most 32 bit machines: ((4096/4)-5)/3 */
@@ -69,17 +79,30 @@ typedef struct queue_block_s {
   unsigned char state;
 } queue_block_s;
 
-static queue_block_s static_queue;
-
-/* the state machine - this holds all the data about the task queue and pool */
-static struct {
-  /* a lock for the state machine, used for multi-threading support */
+/* a task queue - the shared (injection) queue and each worker's local queue */
+typedef struct {
+  /* a lock for the queue, used for multi-threading support */
   spn_lock_i lock;
+  /* the number of queued tasks, for lockless reviews (see `queue_has_tasks`) */
+  size_t count;
   /* current active block to pop tasks */
   queue_block_s *reader;
   /* current active block to push tasks */
   queue_block_s *writer;
-} deferred = {.reader = &static_queue, .writer = &static_queue};
+  /* the first block is part of the queue, saving an allocation */
+  queue_block_s static_queue;
+} queue_s;
+
+/* the shared queue, used by any thread that isn't a thread pool worker */
+static queue_s deferred = {.reader = &deferred.static_queue,
+                           .writer = &deferred.static_queue};
+
+/* the active thread pools (if any), for queue reviews */
+static struct defer_pool *deferred_pools;
+static spn_lock_i deferred_pools_lock = SPN_LOCK_INIT;
+
+/* a thread pool worker's local queue (NULL for non-worker threads) */
+static __thread queue_s *deferred_local;
 
 /* *****************************************************************************
 Internal Data API
@@ -99,122 +122,154 @@ static size_t count_alloc, count_dealloc;
 #define COUNT_RESET
 #endif
 
-static inline void push_task(task_s task) {
-  spn_lock(&deferred.lock);
+static inline void push_task(queue_s *queue, task_s task) {
+  spn_lock(&queue->lock);
 
   /* test if full */
-  if (deferred.writer->state &&
-      deferred.writer->write == deferred.writer->read) {
+  if (queue->writer->state && queue->writer->write == queue->writer->read) {
     /* return to static buffer or allocate new buffer */
-    if (static_queue.state == 2) {
-      deferred.writer->next = &static_queue;
+    if (queue->static_queue.state == 2) {
+      queue->writer->next = &queue->static_queue;
     } else {
-      deferred.writer->next = malloc(sizeof(*deferred.writer->next));
+      queue->writer->next = malloc(sizeof(*queue->writer->next));
       COUNT_ALLOC;
-      if (!deferred.writer->next)
+      if (!queue->writer->next)
         goto critical_error;
     }
-    deferred.writer = deferred.writer->next;
-    deferred.writer->write = 0;
-    deferred.writer->read = 0;
-    deferred.writer->state = 0;
-    deferred.writer->next = NULL;
+    queue->writer = queue->writer->next;
+    queue->writer->write = 0;
+    queue->writer->read = 0;
+    queue->writer->state = 0;
+    queue->writer->next = NULL;
   }
 
   /* place task and finish */
-  deferred.writer->tasks[deferred.writer->write++] = task;
+  queue->writer->tasks[queue->writer->write++] = task;
+  __atomic_store_n(&queue->count, queue->count + 1, __ATOMIC_RELEASE);
   /* cycle buffer */
-  if (deferred.writer->write == DEFER_QUEUE_BLOCK_COUNT) {
-    deferred.writer->write = 0;
-    deferred.writer->state = 1;
+  if (queue->writer->write == DEFER_QUEUE_BLOCK_COUNT) {
+    queue->writer->write = 0;
+    queue->writer->state = 1;
   }
-  spn_unlock(&deferred.lock);
+  spn_unlock(&queue->lock);
   return;
 
 critical_error:
-  spn_unlock(&deferred.lock);
+  spn_unlock(&queue->lock);
   perror("ERROR CRITICAL: defer can't allocate task");
   kill(0, SIGINT);
   exit(errno);
 }
 
-static inline task_s pop_task(void) {
+/*
+ * Tests (without locking) if a queue might have tasks.
+ *
+ * Other threads might be popping tasks (and freeing blocks), so the blocks
+ * aren't accessed. The counter is only updated within the lock.
+ */
+static inline int queue_has_tasks(queue_s *queue) {
+  return __atomic_load_n(&queue->count, __ATOMIC_ACQUIRE) != 0;
+}
+
+static inline task_s pop_task(queue_s *queue) {
   task_s ret = (task_s){.func = NULL};
   queue_block_s *to_free = NULL;
   /* lock the state machine, grab/create a task and place it at the tail */
-  spn_lock(&deferred.lock);
+  spn_lock(&queue->lock);
 
   /* empty? */
-  if (deferred.reader->write == deferred.reader->read &&
-      !deferred.reader->state)
+  if (queue->reader->write == queue->reader->read && !queue->reader->state)
     goto finish;
   /* collect task */
-  ret = deferred.reader->tasks[deferred.reader->read++];
+  ret = queue->reader->tasks[queue->reader->read++];
+  __atomic_store_n(&queue->count, queue->count - 1, __ATOMIC_RELEASE);
   /* cycle */
-  if (deferred.reader->read == DEFER_QUEUE_BLOCK_COUNT) {
-    deferred.reader->read = 0;
-    deferred.reader->state = 0;
+  if (queue->reader->read == DEFER_QUEUE_BLOCK_COUNT) {
+    queue->reader->read = 0;
+    queue->reader->state = 0;
   }
   /* did we finish the queue in the buffer? */
-  if (deferred.reader->write == deferred.reader->read) {
-    if (deferred.reader->next) {
-      to_free = deferred.reader;
-      deferred.reader = deferred.reader->next;
+  if (queue->reader->write == queue->reader->read) {
+    if (queue->reader->next) {
+      to_free = queue->reader;
+      queue->reader = queue->reader->next;
     } else {
-      if (deferred.reader != &static_queue && static_queue.state == 2) {
-        to_free = deferred.reader;
-        deferred.writer = &static_queue;
-        deferred.reader = &static_queue;
+      if (queue->reader != &queue->static_queue &&
+          queue->static_queue.state == 2) {
+        to_free = queue->reader;
+        queue->writer = &queue->static_queue;
+        queue->reader = &queue->static_queue;
       }
-      deferred.reader->write = deferred.reader->read = deferred.reader->state =
-          0;
+      queue->reader->write = queue->reader->read = queue->reader->state = 0;
     }
     goto finish;
   }
 
 finish:
-  if (to_free == &static_queue) {
-    static_queue.state = 2;
-    static_queue.next = NULL;
+  if (to_free == &queue->static_queue) {
+    queue->static_queue.state = 2;
+    queue->static_queue.next = NULL;
   }
-  spn_unlock(&deferred.lock);
+  spn_unlock(&queue->lock);
 
-  if (to_free && to_free != &static_queue) {
+  if (to_free && to_free != &queue->static_queue) {
     free(to_free);
     COUNT_DEALLOC;
   }
   return ret;
 }
 
-static inline void clear_tasks(void) {
-  spn_lock(&deferred.lock);
-  while (deferred.reader) {
-    queue_block_s *tmp = deferred.reader;
-    deferred.reader = deferred.reader->next;
-    if (tmp != &static_queue) {
+static inline void clear_tasks(queue_s *queue) {
+  spn_lock(&queue->lock);
+  while (queue->reader) {
+    queue_block_s *tmp = queue->reader;
+    queue->reader = queue->reader->next;
+    if (tmp != &queue->static_queue) {
       COUNT_DEALLOC;
       free(tmp);
     }
   }
-  static_queue = (queue_block_s){.next = NULL};
-  deferred.reader = deferred.writer = &static_queue;
-  spn_unlock(&deferred.lock);
+  queue->static_queue = (queue_block_s){.next = NULL};
+  queue->reader = queue->writer = &queue->static_queue;
+  __atomic_store_n(&queue->count, 0, __ATOMIC_RELEASE);
+  spn_unlock(&queue->lock);
 }
 
-void defer_on_fork(void) { deferred.lock = SPN_LOCK_INIT; }
+static inline void queue_init(queue_s *queue) {
+  *queue = (queue_s){.lock = SPN_LOCK_INIT};
+  queue->reader = queue->writer = &queue->static_queue;
+}
+
+/* moves any tasks left in a worker's local queue to the shared queue. */
+static inline void queue_flush2shared(queue_s *queue) {
+  task_s task;
+  while ((task = pop_task(queue)).func)
+    push_task(&deferred, task);
+  clear_tasks(queue);
+}
+
+void defer_on_fork(void) {
+  deferred.lock = SPN_LOCK_INIT;
+  /* the thread pools (and their local queues) didn't survive the `fork` */
+  deferred_pools = NULL;
+  deferred_pools_lock = SPN_LOCK_INIT;
+  deferred_local = NULL;
+}
 
-#define push_task(...) push_task((task_s){__VA_ARGS__})
 
 /* *****************************************************************************
 API
 ***************************************************************************** */
 
+static task_s steal_task(void);
+
 /** Defer an execution of a function for later. */
 int defer(void (*func)(void *, void *), void *arg1, void *arg2) {
   /* must have a task to defer */
   if (!func)
     goto call_error;
-  push_task(.func = func, .arg1 = arg1, .arg2 = arg2);
+  push_task((deferred_local ? deferred_local : &deferred),
+            (task_s){.func = func, .arg1 = arg1, .arg2 = arg2});
   defer_thread_signal();
   return 0;
 
@@ -222,22 +277,49 @@ call_error:
   return -1;
 }
 
+/**
+ * Pops a task, seeking the local queue, the shared queue and (for thread pool
+ * workers) the other workers' queues, in this order (the shared queue is
+ * periodically reviewed first, see `DEFER_SHARED_QUEUE_INTERVAL`).
+ */
+static inline task_s defer_pop_any(void) {
+  static __thread size_t tick;
+  task_s task = (task_s){.func = NULL};
+  if (deferred_local && (++tick % DEFER_SHARED_QUEUE_INTERVAL) == 0 &&
+      queue_has_tasks(&deferred)) {
+    task = pop_task(&deferred);
+    if (task.func)
+      return task;
+  }
+  if (deferred_local) {
+    task = pop_task(deferred_local);
+    if (task.func)
+      return task;
+  }
+  if (queue_has_tasks(&deferred)) {
+    task = pop_task(&deferred);
+    if (task.func)
+      return task;
+  }
+  if (deferred_local)
+    task = steal_task();
+  return task;
+}
+
 /** Performs all deferred functions until the queue had been depleted. */
 void defer_perform(void) {
-  task_s task = pop_task();
+  task_s task = defer_pop_any();
   while (task.func) {
     task.func(task.arg1, task.arg2);
-    task = pop_task();
+    task = defer_pop_any();
   }
 }
 
 /** Returns true if there are deferred functions waiting for execution. */
-int defer_has_queue(void) {
-  return deferred.reader->read != deferred.reader->write;
-}
+int defer_has_queue(void);
 
 /** Clears the queue. */
-void defer_clear_queue(void) { clear_tasks(); }
+void defer_clear_queue(void);
 
 /* *****************************************************************************
 Thread Pool Support
@@ -247,12 +329,65 @@ Thread Pool Support
 struct defer_pool {
   volatile unsigned int flag;
   unsigned int count;
+  /* the next active pool (see `deferred_pools`) */
+  struct defer_pool *next;
   struct thread_msg_s {
     pool_pt pool;
     void *thrd;
+    queue_s queue;
   } threads[];
 };
 
+/* steals a task from another worker in the current thread's pool. */
+static task_s steal_task(void) {
+  task_s task = (task_s){.func = NULL};
+  struct thread_msg_s *self =
+      (struct thread_msg_s *)((uintptr_t)deferred_local -
+                              offsetof(struct thread_msg_s, queue));
+  pool_pt pool = self->pool;
+  const size_t count = pool->count;
+  const size_t pos = (size_t)(self - pool->threads);
+  for (size_t i = 1; i < count; ++i) {
+    queue_s *victim = &pool->threads[(pos + i) % count].queue;
+    if (!queue_has_tasks(victim))
+      continue;
+    task = pop_task(victim);
+    if (task.func)
+      return task;
+  }
+  return task;
+}
+
+/** Returns true if there are deferred functions waiting for execution. */
+int defer_has_queue(void) {
+  if (queue_has_tasks(&deferred))
+    return 1;
+  int ret = 0;
+  spn_lock(&deferred_pools_lock);
+  for (pool_pt pool = deferred_pools; pool && !ret; pool = pool->next) {
+    for (size_t i = 0; i < pool->count; ++i) {
+      if (queue_has_tasks(&pool->threads[i].queue)) {
+        ret = 1;
+        break;
+      }
+    }
+  }
+  spn_unlock(&deferred_pools_lock);
+  return ret;
+}
+
+/** Clears the queue. */
+void defer_clear_queue(void) {
+  clear_tasks(&deferred);
+  spn_lock(&deferred_pools_lock);
+  for (pool_pt pool = deferred_pools; pool; pool = pool->next) {
+    for (size_t i = 0; i < pool->count; ++i) {
+      clear_tasks(&pool->threads[i].queue);
+    }
+  }
+  spn_unlock(&deferred_pools_lock);
+}
+
 #if defined(__unix__) || defined(__APPLE__) || defined(__linux__) ||           \
     defined(DEBUG)
 #include <pthread.h>
@@ -361,6 +496,7 @@ void defer_thread_signal(void) { (void)0; }
 static void *defer_worker_thread(void *pool_) {
   struct thread_msg_s volatile *data = pool_;
   signal(SIGPIPE, SIG_IGN);
+  deferred_local = (queue_s *)&data->queue;
   /* perform any available tasks */
   defer_perform();
   /* as long as the flag is true, wait for and perform tasks. */
@@ -368,6 +504,9 @@ static void *defer_worker_thread(void *pool_) {
     defer_thread_wait(data->pool, data->thrd);
     defer_perform();
   } while (data->pool->flag);
+  /* leftovers (if any) are handed over to the shared queue */
+  queue_flush2shared((queue_s *)&data->queue);
+  deferred_local = NULL;
   return NULL;
 }
 
@@ -391,9 +530,20 @@ int defer_pool_is_active(pool_pt pool) { return (int)pool->flag; }
  * `pool_pt`).
  */
 void defer_pool_wait(pool_pt pool) {
-  while (pool->count) {
-    pool->count--;
-    defer_join_thread(pool->threads[pool->count].thrd);
+  for (size_t i = pool->count; i;) {
+    --i;
+    defer_join_thread(pool->threads[i].thrd);
+  }
+  spn_lock(&deferred_pools_lock);
+  for (pool_pt *pos = &deferred_pools; *pos; pos = &(*pos)->next) {
+    if (*pos == pool) {
+      *pos = pool->next;
+      break;
+    }
+  }
+  spn_unlock(&deferred_pools_lock);
+  for (size_t i = 0; i < pool->count; ++i) {
+    queue_flush2shared(&pool->threads[i].queue);
   }
   free(pool);
 }
@@ -402,7 +552,15 @@ void defer_pool_wait(pool_pt pool) {
 static inline pool_pt defer_pool_initialize(unsigned int thread_count,
                                             pool_pt pool) {
   pool->flag = 1;
+  for (size_t i = 0; i < thread_count; ++i) {
+    queue_init(&pool->threads[i].queue);
+    pool->threads[i].thrd = NULL;
+  }
   pool->count = 0;
+  spn_lock(&deferred_pools_lock);
+  pool->next = deferred_pools;
+  deferred_pools = pool;
+  spn_unlock(&deferred_pools_lock);
   while (pool->count < thread_count &&
          (pool->threads[pool->count].pool = pool) &&
          (pool->threads[pool->count].thrd = defer_new_thread(
@@ -412,7 +570,9 @@ static inline pool_pt defer_pool_initialize(unsigned int thread_count,
   if (pool->count == thread_count) {
     return pool;
   }
+  /* joins the threads that started and unlinks the pool before freeing it */
   defer_pool_stop(pool);
+  defer_pool_wait(pool);
   return NULL;
 }
 
@@ -542,6 +702,62 @@ void defer_test(void) {
     TEST_ASSERT(i_count == i_count_should_be, "ERROR: defer count invalid\n");
   }
 
+  fprintf(stderr, "\n");
+
+  /* contention benchmark: tasks scheduled by (and stolen from) workers */
+  for (size_t thread_count = 1; thread_count <= ((size_t)cpu_count << 1);
+       thread_count <<= 1) {
+    struct timespec t_start, t_end;
+    const size_t tasks = 4096;
+    const size_t per_task = TOTAL_COUNT / tasks;
+    COUNT_RESET;
+    i_count = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    pool_pt pool = defer_pool_start(thread_count);
+    for (size_t j = 0; j < tasks; ++j) {
+      defer(sched_sample_task, (void *)per_task, NULL);
+    }
+    defer_pool_stop(pool);
+    defer_pool_wait(pool);
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    double seconds =
+        (t_end.tv_sec - t_start.tv_sec) +
+        ((double)(t_end.tv_nsec - t_start.tv_nsec) / 1000000000.0);
+    fprintf(stderr,
+            "- Defer contention, %zu threads: %.0lf tasks/sec "
+            "(%lu tasks, %lu/%lu free/malloc)\n",
+            thread_count, (i_count + tasks) / seconds,
+            (unsigned long)(i_count + tasks), (unsigned long)count_dealloc,
+            (unsigned long)count_alloc);
+    TEST_ASSERT(i_count == i_count_should_be, "ERROR: defer count invalid\n");
+  }
+
+  /* concurrent pools are tracked (and released) independently */
+  {
+    COUNT_RESET;
+    i_count = 0;
+    pool_pt pool1 = defer_pool_start(2);
+    pool_pt pool2 = defer_pool_start(2);
+    TEST_ASSERT(pool1 && pool2 && deferred_pools == pool2 &&
+                    pool2->next == pool1,
+                "ERROR: concurrent pools should be listed\n");
+    for (size_t j = 0; j < 64; ++j) {
+      defer(sched_sample_task, (void *)(TOTAL_COUNT / 64), NULL);
+    }
+    defer_pool_stop(pool1);
+    defer_pool_wait(pool1);
+    TEST_ASSERT(deferred_pools == pool2 && !pool2->next,
+                "ERROR: a finished pool should be removed\n");
+    defer_pool_stop(pool2);
+    defer_pool_wait(pool2);
+    TEST_ASSERT(!deferred_pools, "ERROR: pools should be removed\n");
+    defer_perform();
+    TEST_ASSERT(i_count == i_count_should_be && !defer_has_queue() &&
+                    !deferred.count,
+                "ERROR: concurrent pools count invalid\n");
+    fprintf(stderr, "* Defer concurrent pools passed.\n\n");
+  }
+
   COUNT_RESET;
   i_count = 0;
   for (size_t i = 0; i < 1024; i++) {
@@ -13,6 +13,10 @@ This is an `epoll` / `kqueue` ONE-SHOT polling wrapper, allowing for portability
 between BSD and Linux polling machanisms and routing events to hard-coded
 callbacks (weak function symbols).
 
+On Linux, an `io_uring` engine can be selected at compile time by defining
+`EVIO_ENGINE_URING` (requires Linux 5.11 or later). When using the `io_uring`
+engine, `evio_remove` MUST be called for closed file descriptors.
+
 The callbacks supported by thils library:
 
 * `evio_on_data(intptr_t)` called when data is available or on timer.
@@ -26,7 +30,11 @@ The callbacks supported by thils library:
 #define LIB_EVIO_VERSION_MINOR 2
 #define LIB_EVIO_VERSION_PATCH 0
 
-#if defined(__linux__)
+#if defined(__linux__) && defined(EVIO_ENGINE_URING) && EVIO_ENGINE_URING
+/* io_uring was requested (Linux 5.11 or later), i.e., `FLAGS:=EVIO_ENGINE_URING`
+ */
+#elif defined(__linux__)
+#undef EVIO_ENGINE_URING
 #define EVIO_ENGINE_EPOLL 1
 #elif defined(__APPLE__) || defined(__unix__)
 #define EVIO_ENGINE_KQUEUE 1
@@ -142,6 +150,9 @@ int evio_open_timer(void);
 /**
 Adds a timer file descriptor, so that callbacks will be called for it's events.
 
+The timer fires once (after `milliseconds`), call `evio_set_timer` again to
+re-arm it (or to move an armed timer's deadline).
+
 Returns -1 on error, otherwise return value is system dependent.
 */
 int evio_set_timer(int fd, void *callback_arg, unsigned long milliseconds);
@@ -176,6 +176,8 @@ error:
 
 /**
 Adds a timer file descriptor, so that callbacks will be called for it's events.
+
+The timer fires once, call `evio_set_timer` again to re-arm it.
 */
 int evio_set_timer(int fd, void *callback_arg, unsigned long milliseconds) {
 
@@ -185,12 +187,11 @@ int evio_set_timer(int fd, void *callback_arg, unsigned long milliseconds) {
   char data[8]; // void * is 8 byte long
   if (read(fd, &data, 8) < 0)
     data[0] = 0;
-  /* set file's time value */
-  struct itimerspec new_t_data;
-  new_t_data.it_value.tv_sec = new_t_data.it_interval.tv_sec =
-      milliseconds / 1000;
-  new_t_data.it_value.tv_nsec = new_t_data.it_interval.tv_nsec =
-      (milliseconds % 1000) * 1000000;
+  /* set file's time value (a one-shot timer, re-set for every deadline) */
+  struct itimerspec new_t_data = {
+      .it_value.tv_sec = milliseconds / 1000,
+      .it_value.tv_nsec = (milliseconds % 1000) * 1000000,
+  };
   if (timerfd_settime(fd, 0, &new_t_data, NULL) == -1)
     return -1;
   /* add to epoll */
@@ -0,0 +1,472 @@
+/*
+Copyright: Boaz Segev, 2016-2017
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "evio.h"
+
+#ifdef EVIO_ENGINE_URING
+
+#include "spnlock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+/* *****************************************************************************
+Linux `io_uring` implementation
+
+Readiness polling is performed using ONE SHOT `IORING_OP_POLL_ADD` requests.
+
+Rearming a file descriptor only places a request in the submission queue. While
+`evio_review` is busy (called with a zero timeout), requests are submitted in
+batches by the next `evio_review` call, avoiding a system call per rearm. While
+`evio_review` is blocking, requests are submitted immediately by the thread
+that placed them in the queue.
+
+Polling requests hold a reference to the file, so the file descriptor (and
+connection) will remain open until the request completes or is removed. For
+this reason, `evio_remove` MUST be called once a polled file descriptor is
+closed (`facil` does this automatically).
+***************************************************************************** */
+
+#ifndef EVIO_URING_ENTRIES
+/** The number of submission queue entries (the CQ is twice as large). */
+#define EVIO_URING_ENTRIES 4096
+#endif
+
+/* user_data layout: [generation:32][fd:30][internal:1][write:1] */
+#define EVIO_URING_WRITE ((uint64_t)1)
+#define EVIO_URING_INTERNAL ((uint64_t)2)
+#define EVIO_URING_UDATA(fd, gen, dir)                                         \
+  (((uint64_t)(gen) << 32) | ((uint64_t)(fd) << 2) | (dir))
+
+typedef struct {
+  void *udata;
+  uint32_t gen;
+  uint8_t armed;
+} evio_uring_fd_s;
+
+static struct {
+  int fd;
+  /** submission queue (and fd state) lock */
+  spn_lock_i lock;
+  /** protects the completion queue */
+  spn_lock_i review;
+  /** set while `evio_review` might block, so submissions are immediate. */
+  volatile uint8_t waiting;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  size_t sq_ring_len;
+  void *cq_ring;
+  size_t cq_ring_len;
+  size_t sqes_len;
+  evio_uring_fd_s *fds;
+  size_t capa;
+} evio_uring = {.fd = -1};
+
+static inline int evio_uring_enter(unsigned to_submit, unsigned min_complete,
+                                   unsigned flags, void *arg, size_t arg_len) {
+  return (int)syscall(__NR_io_uring_enter, evio_uring.fd, to_submit,
+                      min_complete, flags, arg, arg_len);
+}
+
+/** Closes the `epoll` / `kqueue` object, releasing it's resources. */
+void evio_close() {
+  if (evio_uring.fd == -1)
+    return;
+  if (evio_uring.sqes)
+    munmap(evio_uring.sqes, evio_uring.sqes_len);
+  if (evio_uring.cq_ring && evio_uring.cq_ring != evio_uring.sq_ring)
+    munmap(evio_uring.cq_ring, evio_uring.cq_ring_len);
+  if (evio_uring.sq_ring)
+    munmap(evio_uring.sq_ring, evio_uring.sq_ring_len);
+  close(evio_uring.fd);
+  free(evio_uring.fds);
+  evio_uring = (__typeof__(evio_uring)){.fd = -1};
+}
+
+/**
+returns true if the evio is available for adding or removing file descriptors.
+*/
+int evio_isactive(void) { return evio_uring.fd >= 0; }
+
+/**
+Creates the `io_uring` object.
+*/
+intptr_t evio_create() {
+  evio_close();
+  struct io_uring_params params = {.flags = IORING_SETUP_CLAMP};
+  evio_uring.fd =
+      (int)syscall(__NR_io_uring_setup, EVIO_URING_ENTRIES, &params);
+  if (evio_uring.fd == -1)
+    goto error;
+  /* we require `io_uring_enter` timeouts (Linux 5.11) */
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    errno = ENOSYS;
+    goto error;
+  }
+  evio_uring.sq_ring_len =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  evio_uring.cq_ring_len =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (evio_uring.cq_ring_len > evio_uring.sq_ring_len)
+      evio_uring.sq_ring_len = evio_uring.cq_ring_len;
+    evio_uring.cq_ring_len = evio_uring.sq_ring_len;
+  }
+  evio_uring.sq_ring = mmap(NULL, evio_uring.sq_ring_len,
+                            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            evio_uring.fd, IORING_OFF_SQ_RING);
+  if (evio_uring.sq_ring == MAP_FAILED) {
+    evio_uring.sq_ring = NULL;
+    goto error;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    evio_uring.cq_ring = evio_uring.sq_ring;
+  } else {
+    evio_uring.cq_ring = mmap(NULL, evio_uring.cq_ring_len,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, evio_uring.fd,
+                              IORING_OFF_CQ_RING);
+    if (evio_uring.cq_ring == MAP_FAILED) {
+      evio_uring.cq_ring = NULL;
+      goto error;
+    }
+  }
+  evio_uring.sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  evio_uring.sqes =
+      mmap(NULL, evio_uring.sqes_len, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, evio_uring.fd, IORING_OFF_SQES);
+  if (evio_uring.sqes == MAP_FAILED) {
+    evio_uring.sqes = NULL;
+    goto error;
+  }
+  uint8_t *sq = evio_uring.sq_ring;
+  uint8_t *cq = evio_uring.cq_ring;
+  evio_uring.sq_head = (unsigned *)(sq + params.sq_off.head);
+  evio_uring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  evio_uring.sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  evio_uring.sq_entries = *(unsigned *)(sq + params.sq_off.ring_entries);
+  evio_uring.cq_head = (unsigned *)(cq + params.cq_off.head);
+  evio_uring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  evio_uring.cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  evio_uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  /* the SQE index array is an identity map, so it's only set once. */
+  unsigned *array = (unsigned *)(sq + params.sq_off.array);
+  for (unsigned i = 0; i < evio_uring.sq_entries; ++i)
+    array[i] = i;
+  evio_uring.lock = SPN_LOCK_INIT;
+  evio_uring.review = SPN_LOCK_INIT;
+  return 0;
+error:
+#if DEBUG
+  perror("ERROR: (evio) failed to initialize io_uring");
+#endif
+  evio_close();
+  return -1;
+}
+
+/* *****************************************************************************
+Submission queue helpers (call only while holding the lock)
+***************************************************************************** */
+
+/** Submits all the pending requests. */
+static inline void evio_uring_submit_unsafe(void) {
+  while (evio_uring_enter(evio_uring.sq_entries, 0, 0, NULL, 0) == -1 &&
+         errno == EINTR)
+    ;
+}
+
+/** Returns a cleared SQE, flushing the queue if it's full. */
+static inline struct io_uring_sqe *evio_uring_sqe_unsafe(void) {
+  while (*evio_uring.sq_tail -
+             __atomic_load_n(evio_uring.sq_head, __ATOMIC_ACQUIRE) >=
+         evio_uring.sq_entries) {
+    evio_uring_submit_unsafe();
+    if (*evio_uring.sq_tail -
+            __atomic_load_n(evio_uring.sq_head, __ATOMIC_ACQUIRE) <
+        evio_uring.sq_entries)
+      break;
+    /* the completion queue might be full, let `evio_review` reap events. */
+    spn_unlock(&evio_uring.lock);
+    reschedule_thread();
+    spn_lock(&evio_uring.lock);
+  }
+  struct io_uring_sqe *sqe =
+      evio_uring.sqes + (*evio_uring.sq_tail & evio_uring.sq_mask);
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+/** Publishes the SQE returned by `evio_uring_sqe_unsafe`. */
+static inline void evio_uring_commit_unsafe(void) {
+  __atomic_store_n(evio_uring.sq_tail, *evio_uring.sq_tail + 1,
+                   __ATOMIC_RELEASE);
+  if (evio_uring.waiting)
+    evio_uring_submit_unsafe();
+}
+
+static inline int evio_uring_reserve_unsafe(int fd) {
+  if ((size_t)fd < evio_uring.capa)
+    return 0;
+  size_t capa = evio_uring.capa ? evio_uring.capa : 1024;
+  while (capa <= (size_t)fd)
+    capa <<= 1;
+  evio_uring_fd_s *tmp = realloc(evio_uring.fds, capa * sizeof(*tmp));
+  if (!tmp)
+    return -1;
+  memset(tmp + evio_uring.capa, 0, (capa - evio_uring.capa) * sizeof(*tmp));
+  evio_uring.fds = tmp;
+  evio_uring.capa = capa;
+  return 0;
+}
+
+/* *****************************************************************************
+Adding and removing file descriptors
+***************************************************************************** */
+
+/**
+Removes a file descriptor from the polling object.
+*/
+void evio_remove(int fd) {
+  if (evio_uring.fd < 0 || fd < 0)
+    return;
+  spn_lock(&evio_uring.lock);
+  if ((size_t)fd >= evio_uring.capa) {
+    spn_unlock(&evio_uring.lock);
+    return;
+  }
+  evio_uring_fd_s *s = evio_uring.fds + fd;
+  if (s->armed) {
+    for (uint64_t dir = 0; dir < 2; ++dir) {
+      if (!(s->armed & (1 << dir)))
+        continue;
+      struct io_uring_sqe *sqe = evio_uring_sqe_unsafe();
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = EVIO_URING_UDATA(fd, s->gen, dir);
+      sqe->user_data = EVIO_URING_UDATA(fd, s->gen, dir) | EVIO_URING_INTERNAL;
+      __atomic_store_n(evio_uring.sq_tail, *evio_uring.sq_tail + 1,
+                       __ATOMIC_RELEASE);
+    }
+    /* the polling request holds the file open, release it now. */
+    evio_uring_submit_unsafe();
+  }
+  s->armed = 0;
+  s->udata = NULL;
+  ++s->gen;
+  spn_unlock(&evio_uring.lock);
+}
+
+static inline int evio_add2(int fd, void *callback_arg, uint64_t dir,
+                            uint16_t events) {
+  if (evio_uring.fd < 0 || fd < 0) {
+    errno = EBADF;
+    return -1;
+  }
+  spn_lock(&evio_uring.lock);
+  if (evio_uring_reserve_unsafe(fd)) {
+    spn_unlock(&evio_uring.lock);
+    errno = ENOMEM;
+    return -1;
+  }
+  evio_uring_fd_s *s = evio_uring.fds + fd;
+  s->udata = callback_arg;
+  if (!(s->armed & (1 << dir))) {
+    struct io_uring_sqe *sqe = evio_uring_sqe_unsafe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll_events = events;
+    sqe->user_data = EVIO_URING_UDATA(fd, s->gen, dir);
+    s->armed |= (1 << dir);
+    evio_uring_commit_unsafe();
+  }
+  spn_unlock(&evio_uring.lock);
+  return 0;
+}
+
+/**
+Adds a file descriptor to the polling object.
+*/
+int evio_add(int fd, void *callback_arg) {
+  if (evio_add2(fd, callback_arg, 0, (POLLIN | POLLRDHUP | POLLHUP)) == -1)
+    return -1;
+  return evio_add2(fd, callback_arg, EVIO_URING_WRITE,
+                   (POLLOUT | POLLRDHUP | POLLHUP));
+}
+
+/**
+Adds a file descriptor to the polling object (ONE SHOT), to be polled for
+incoming data (`evio_on_data` wil be called).
+*/
+int evio_add_read(int fd, void *callback_arg) {
+  return evio_add2(fd, callback_arg, 0, (POLLIN | POLLRDHUP | POLLHUP));
+}
+
+/**
+Adds a file descriptor to the polling object (ONE SHOT), to be polled for
+outgoing buffer readiness data (`evio_on_ready` wil be called).
+*/
+int evio_add_write(int fd, void *callback_arg) {
+  return evio_add2(fd, callback_arg, EVIO_URING_WRITE,
+                   (POLLOUT | POLLRDHUP | POLLHUP));
+}
+
+/* *****************************************************************************
+Timers
+***************************************************************************** */
+
+/**
+Creates a timer file descriptor, system dependent.
+*/
+int evio_open_timer(void) {
+  return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+}
+
+/**
+Adds a timer file descriptor, so that callbacks will be called for it's events.
+
+The timer fires once, call `evio_set_timer` again to re-arm it.
+*/
+int evio_set_timer(int fd, void *callback_arg, unsigned long milliseconds) {
+  if (evio_uring.fd < 0)
+    return -1;
+  /* clear out existing timer marker, if exists. */
+  char data[8]; // void * is 8 byte long
+  if (read(fd, &data, 8) < 0)
+    data[0] = 0;
+  /* set file's time value (a one-shot timer, re-set for every deadline) */
+  struct itimerspec new_t_data = {
+      .it_value.tv_sec = milliseconds / 1000,
+      .it_value.tv_nsec = (milliseconds % 1000) * 1000000,
+  };
+  if (timerfd_settime(fd, 0, &new_t_data, NULL) == -1)
+    return -1;
+  return evio_add2(fd, callback_arg, 0, POLLIN);
+}
+
+/* *****************************************************************************
+Reviewing events
+***************************************************************************** */
+
+/**
+Reviews any pending events (up to EVIO_MAX_EVENTS per pass, repeated while the
+completion queue isn't empty) and calls any callbacks.
+ */
+int evio_review(const int timeout_millisec) {
+  if (evio_uring.fd < 0)
+    return -1;
+  if (spn_trylock(&evio_uring.review))
+    return 0;
+  int total = 0;
+  /* submit pending requests and wait (if required) */
+  spn_lock(&evio_uring.lock);
+  evio_uring.waiting = (timeout_millisec != 0);
+  spn_unlock(&evio_uring.lock);
+  if (__atomic_load_n(evio_uring.cq_tail, __ATOMIC_ACQUIRE) ==
+      *evio_uring.cq_head) {
+    struct __kernel_timespec ts = {
+        .tv_sec = timeout_millisec / 1000,
+        .tv_nsec = ((long long)timeout_millisec % 1000) * 1000000,
+    };
+    struct io_uring_getevents_arg arg = {.ts = (uint64_t)(uintptr_t)&ts};
+    if (evio_uring_enter(evio_uring.sq_entries, (timeout_millisec != 0),
+                         IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                         sizeof(arg)) == -1 &&
+        errno != ETIME && errno != EINTR && errno != EBUSY) {
+      evio_uring.waiting = 0;
+      spn_unlock(&evio_uring.review);
+      return -1;
+    }
+  } else {
+    spn_lock(&evio_uring.lock);
+    evio_uring_submit_unsafe();
+    spn_unlock(&evio_uring.lock);
+  }
+  evio_uring.waiting = 0;
+
+  /* reap events in batches, so callbacks aren't called while locked */
+  for (;;) {
+    struct {
+      void *udata;
+      int32_t res;
+    } events[EVIO_MAX_EVENTS];
+    int count = 0;
+    unsigned head = *evio_uring.cq_head;
+    unsigned tail = __atomic_load_n(evio_uring.cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+      break;
+    spn_lock(&evio_uring.lock);
+    for (; head != tail && count < EVIO_MAX_EVENTS; ++head) {
+      struct io_uring_cqe *cqe = evio_uring.cqes + (head & evio_uring.cq_mask);
+      const uint64_t ud = cqe->user_data;
+      if ((ud & EVIO_URING_INTERNAL) || cqe->res == -ECANCELED)
+        continue;
+      const size_t fd = (size_t)((ud & 0xFFFFFFFFULL) >> 2);
+      const uint8_t bit = (uint8_t)(1 << (ud & EVIO_URING_WRITE));
+      if (fd >= evio_uring.capa || evio_uring.fds[fd].gen != (ud >> 32) ||
+          !(evio_uring.fds[fd].armed & bit))
+        continue;
+      evio_uring.fds[fd].armed &= ~bit;
+      events[count].udata = evio_uring.fds[fd].udata;
+      events[count].res = cqe->res;
+      ++count;
+    }
+    spn_unlock(&evio_uring.lock);
+    __atomic_store_n(evio_uring.cq_head, head, __ATOMIC_RELEASE);
+    for (int i = 0; i < count; ++i) {
+      if (events[i].res < 0 || (events[i].res & (~(POLLIN | POLLOUT)))) {
+        // errors are hendled as disconnections (on_close)
+        evio_on_error(events[i].udata);
+      } else {
+        // no error, then it's an active event(s)
+        if (events[i].res & POLLOUT)
+          evio_on_ready(events[i].udata);
+        if (events[i].res & POLLIN)
+          evio_on_data(events[i].udata);
+      }
+    }
+    total += count;
+  }
+  spn_unlock(&evio_uring.review);
+  return total;
+}
+
+/** Waits up to `timeout_millisec` for events. No events are signaled. */
+int evio_wait(const int timeout_millisec) {
+  if (evio_uring.fd < 0)
+    return -1;
+  struct pollfd pollfd = {
+      .fd = evio_uring.fd, .events = POLLIN,
+  };
+  return poll(&pollfd, 1, timeout_millisec);
+}
+
+#endif /* system dependent code */
@@ -4,6 +4,10 @@ License: MIT
 
 Feel free to copy, use and enjoy according to the license provided.
 */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "spnlock.h"
 
 #include "evio.h"
@@ -21,9 +25,21 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#if defined(__linux__) && defined(SO_REUSEPORT)
+/* workers can open their own listening sockets (balanced by the kernel). */
+#define FACIL_WORKER_REUSEPORT 1
+#else
+#define FACIL_WORKER_REUSEPORT 0
+#endif
+
 #if !defined(__GNUC__) && !defined(__clang__)
 #define __attribute__(...)
 #endif
@@ -34,6 +50,7 @@ Patch for OSX version < 10.12 from https://stackoverflow.com/a/9781275/4025095
 #if defined(__MACH__) && !defined(CLOCK_REALTIME)
 #include <sys/time.h>
 #define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 0
 #define clock_gettime patch_clock_gettime
 // clock_gettime is not implemented on older versions of OS X (< 10.12).
 // If implemented, CLOCK_REALTIME will have already been defined.
@@ -52,6 +69,16 @@ static inline int patch_clock_gettime(int clk_id, struct timespec *t) {
 /* *****************************************************************************
 Data Structures
 ***************************************************************************** */
+
+#ifndef FACIL_TIMEOUT_BUCKETS
+/**
+ * The number of (one second) buckets used for tracking connection timeouts.
+ *
+ * Must be a power of 2, larger than the longest timeout (300 seconds).
+ */
+#define FACIL_TIMEOUT_BUCKETS 512
+#endif
+
 typedef struct ProtocolMetadata {
   spn_lock_i locks[3];
   unsigned rsv : 8;
@@ -66,6 +93,8 @@ union protocol_metadata_union_u {
 struct connection_data_s {
   protocol_s *protocol;
   time_t active;
+  /* the connection's timeout bucket (next == NULL when not tracked) */
+  fio_ls_embd_s timeout_node;
   uint8_t timeout;
   spn_lock_i scheduled;
   spn_lock_i lock;
@@ -75,13 +104,22 @@ static struct facil_data_s {
   spn_lock_i global_lock;
   uint8_t need_review;
   uint8_t spindown;
+  uint8_t pin_cpus;
   uint16_t active;
   uint16_t threads;
+  /* the worker's index (set after `fork`) */
+  uint16_t worker_id;
+  /* the first CPU core the worker was pinned to (-1 if not pinned) */
+  int worker_cpu;
   pid_t parent;
   pool_pt thread_pool;
   ssize_t capacity;
   size_t connection_count;
   struct timespec last_cycle;
+  /* the last second reviewed for timeouts */
+  time_t timeout_reviewed;
+  spn_lock_i timeout_lock;
+  fio_ls_embd_s timeouts[FACIL_TIMEOUT_BUCKETS];
   struct connection_data_s conn[];
 } * facil_data;
 
@@ -117,6 +155,83 @@ inline static void protocol_unlock(protocol_s *pr,
   spn_unlock(&prt_meta(pr).locks[type]);
 }
 
+/* *****************************************************************************
+Connection timeout tracking
+***************************************************************************** */
+
+/*
+ * Connections are placed in a bucket according to the second in which they
+ * should be reviewed (`active + timeout`). Only the buckets for the seconds
+ * that passed are reviewed, so the cost is relative to the number of
+ * connections that might have expired rather than the number of connections.
+ *
+ * `sock_touch` only updates the `active` field. Connections that were active
+ * since they were placed in the bucket are moved to a later bucket when their
+ * bucket is reviewed.
+ */
+
+/* the second at which the connection's timeout should be reviewed. */
+static inline time_t facil_timeout_due(intptr_t fd) {
+  const time_t timeout = fd_data(fd).timeout ? fd_data(fd).timeout : 300;
+  return fd_data(fd).active + timeout + 1;
+}
+
+/* places the connection in a bucket. Call only while the lock is held. */
+static inline void facil_timeout_place_unsafe(intptr_t fd, time_t due) {
+  if (due <= facil_data->timeout_reviewed)
+    due = facil_data->timeout_reviewed + 1;
+  else if (due >= facil_data->timeout_reviewed + FACIL_TIMEOUT_BUCKETS)
+    due = facil_data->timeout_reviewed + FACIL_TIMEOUT_BUCKETS - 1;
+  if (fd_data(fd).timeout_node.next)
+    fio_ls_embd_remove(&fd_data(fd).timeout_node);
+  fio_ls_embd_unshift(
+      facil_data->timeouts + (due & (FACIL_TIMEOUT_BUCKETS - 1)),
+      &fd_data(fd).timeout_node);
+}
+
+/*
+ * (re)places a connection in the bucket matching it's timeout.
+ *
+ * Closed connections (no protocol) are skipped, since `sock_on_close` might
+ * have already removed them.
+ */
+static inline void facil_timeout_update(intptr_t fd) {
+  spn_lock(&facil_data->timeout_lock);
+  if (fd_data(fd).protocol)
+    facil_timeout_place_unsafe(fd, facil_timeout_due(fd));
+  spn_unlock(&facil_data->timeout_lock);
+}
+
+/* stops tracking the connection's timeout. Call only while the lock is held. */
+static inline void facil_timeout_remove_unsafe(intptr_t fd) {
+  if (fd_data(fd).timeout_node.next) {
+    fio_ls_embd_remove(&fd_data(fd).timeout_node);
+    fd_data(fd).timeout_node = (fio_ls_embd_s){.next = NULL};
+  }
+}
+
+/* stops tracking the connection's timeout. */
+static inline void facil_timeout_remove(intptr_t fd) {
+  spn_lock(&facil_data->timeout_lock);
+  facil_timeout_remove_unsafe(fd);
+  spn_unlock(&facil_data->timeout_lock);
+}
+
+/* resets the timeout buckets, tracking all the existing connections. */
+static void facil_timeout_on_start(void) {
+  facil_data->timeout_lock = SPN_LOCK_INIT;
+  facil_data->timeout_reviewed = facil_data->last_cycle.tv_sec;
+  for (size_t i = 0; i < FACIL_TIMEOUT_BUCKETS; ++i) {
+    facil_data->timeouts[i] =
+        (fio_ls_embd_s)FIO_LS_INIT(facil_data->timeouts[i]);
+  }
+  for (intptr_t i = 0; i < facil_data->capacity; ++i) {
+    fd_data(i).timeout_node = (fio_ls_embd_s){.next = NULL};
+    if (fd_data(i).protocol)
+      facil_timeout_place_unsafe(i, facil_timeout_due(i));
+  }
+}
+
 /* *****************************************************************************
 Internal Protocol Names
 ***************************************************************************** */
@@ -395,11 +510,14 @@ static void deferred_on_shutdown(void *arg, void *arg2) {
     }
     pr->ping = mock_ping2;
     protocol_unlock(pr, FIO_PR_LOCK_TASK);
+    facil_timeout_update(sock_uuid2fd(arg));
   } else {
     spn_add(&facil_data->connection_count, 1);
     uuid_data(arg).timeout = 8;
     pr->ping = mock_ping;
     protocol_unlock(pr, FIO_PR_LOCK_TASK);
+    /* `sock_close` might reset the connection's data (see `sock_on_close`) */
+    facil_timeout_update(sock_uuid2fd(arg));
     sock_close((intptr_t)arg);
   }
   return;
@@ -511,9 +629,17 @@ void sock_on_close(intptr_t uuid) {
   // fprintf(stderr, "INFO: facil.io, on-close called for %u (set to %p)\n",
   //         (unsigned int)sock_uuid2fd(uuid), (void
   //         *)uuid_data(uuid).protocol);
+#ifdef EVIO_ENGINE_URING
+  /* io_uring polling requests keep the file open until they are removed. */
+  evio_remove(sock_uuid2fd(uuid));
+#endif
   spn_lock(&uuid_data(uuid).lock);
   struct connection_data_s old_data = uuid_data(uuid);
+  /* reset the timeout node along with the data, so it can't be relinked */
+  spn_lock(&facil_data->timeout_lock);
+  facil_timeout_remove_unsafe(sock_uuid2fd(uuid));
   uuid_data(uuid) = (struct connection_data_s){.lock = uuid_data(uuid).lock};
+  spn_unlock(&facil_data->timeout_lock);
   spn_unlock(&uuid_data(uuid).lock);
   if (old_data.protocol) {
     defer(deferred_on_close, (void *)uuid, old_data.protocol);
@@ -574,6 +700,10 @@ static void facil_lib_init(void) {
       .capacity = capa,
       .parent = getpid(),
   };
+  for (size_t i = 0; i < FACIL_TIMEOUT_BUCKETS; ++i) {
+    facil_data->timeouts[i] =
+        (fio_ls_embd_s)FIO_LS_INIT(facil_data->timeouts[i]);
+  }
   facil_external_root_init();
   atexit(facil_libcleanup);
 #ifdef DEBUG
@@ -617,6 +747,11 @@ struct ListenerProtocol {
   char *port;
   char *address;
   uint8_t quite;
+  /* each worker opens it's own socket (SO_REUSEPORT) */
+  uint8_t reuse_port;
+  uint8_t incoming_cpu;
+  /* set once a worker opened it's own socket */
+  uint8_t reopened;
 };
 
 static void listener_ping(intptr_t uuid, protocol_s *plistener) {
@@ -688,6 +823,9 @@ listener_alloc(struct facil_listen_args settings) {
         .udata = settings.udata,
         .on_start = settings.on_start,
         .on_finish = settings.on_finish,
+        .reuse_port = (settings.port && settings.reuse_port &&
+                       FACIL_WORKER_REUSEPORT),
+        .incoming_cpu = settings.incoming_cpu,
     };
     if (settings.port) {
       listener->port = (char *)(listener + 1);
@@ -724,6 +862,50 @@ inline static void listener_on_start(int fd) {
   }
 }
 
+#if FACIL_WORKER_REUSEPORT
+/* opens a worker specific listening socket (SO_REUSEPORT) for the listener
+ * inherited from the root process. */
+static void listener_reopen(int fd) {
+  struct ListenerProtocol *listener =
+      (struct ListenerProtocol *)fd_data(fd).protocol;
+  intptr_t old = sock_fd2uuid(fd);
+  intptr_t uuid = sock_listen_reuseport(listener->address, listener->port);
+  if (uuid == -1 || old == -1) {
+    perror("ERROR: couldn't open the worker's listening socket");
+    kill(0, SIGINT);
+    exit(4);
+  }
+#if defined(SO_INCOMING_CPU)
+  if (listener->incoming_cpu && facil_data->worker_cpu >= 0) {
+    setsockopt(sock_uuid2fd(uuid), SOL_SOCKET, SO_INCOMING_CPU,
+               &facil_data->worker_cpu, sizeof(facil_data->worker_cpu));
+  }
+#endif
+  /* move the listener to the new socket, without calling `on_close` */
+  spn_lock(&fd_data(fd).lock);
+  fd_data(fd).protocol = NULL;
+  spn_unlock(&fd_data(fd).lock);
+  facil_timeout_remove(fd);
+  /* `sock_hijack` releases the polling request (see `evio_remove`) */
+  close(sock_hijack(old));
+  listener->reopened = 1;
+  facil_attach(uuid, &listener->protocol);
+}
+
+/* stops the root process from accepting connections on listening sockets
+ * that will be opened by each worker (SO_REUSEPORT). The socket remains bound
+ * (and the listener remains available for respawned workers). */
+static void listener_pause_reuseport(void) {
+  for (int i = 0; i < facil_data->capacity; i++) {
+    if (fd_data(i).protocol &&
+        fd_data(i).protocol->service == LISTENER_PROTOCOL_NAME &&
+        ((struct ListenerProtocol *)fd_data(i).protocol)->reuse_port) {
+      shutdown(i, SHUT_RD);
+    }
+  }
+}
+#endif
+
 /**
 Listens to a server with the following server settings (which MUST include
 a default protocol).
@@ -739,7 +921,10 @@ intptr_t facil_listen(struct facil_listen_args settings) {
       (settings.port[0] == '0' && settings.port[1] == 0)) {
     settings.port = NULL;
   }
-  intptr_t uuid = sock_listen(settings.address, settings.port);
+  intptr_t uuid =
+      (settings.port && settings.reuse_port && FACIL_WORKER_REUSEPORT)
+          ? sock_listen_reuseport(settings.address, settings.port)
+          : sock_listen(settings.address, settings.port);
   if (uuid == -1) {
     return -1;
   }
@@ -846,131 +1031,482 @@ Timers
 ***************************************************************************** */
 
 /* *******
-Timer Protocol
+Timer Wheel
 ******* */
-typedef struct {
-  protocol_s protocol;
+
+/*
+ * Timers are stored in a hierarchical timer wheel with a 1ms resolution. Every
+ * level has 64 slots and each slot covers 64 times the time span of a slot in
+ * the previous level, so adding or cancelling a timer is an O(1) operation.
+ *
+ * The reactor reviews the wheel once per cycle and bounds the `evio_review`
+ * timeout by the next expiry. A single timer file descriptor (per process) is
+ * used to wake the reactor when an earlier timer is added by another thread.
+ */
+
+#define FACIL_TIMER_BITS 6
+#define FACIL_TIMER_SLOTS (1 << FACIL_TIMER_BITS)
+#define FACIL_TIMER_MASK (FACIL_TIMER_SLOTS - 1)
+#define FACIL_TIMER_LEVELS 5
+/* the longest delay a timer can be placed at (~12.4 days), longer delays are
+ * placed at the end of the wheel and cascade back into it when reached. */
+#define FACIL_TIMER_SPAN (1ULL << (FACIL_TIMER_BITS * FACIL_TIMER_LEVELS))
+
+enum facil_timer_state_e {
+  FACIL_TIMER_IN_WHEEL = 0,
+  FACIL_TIMER_RUNNING,
+};
+
+struct facil_timer_s {
+  /* the wheel's slot */
+  fio_ls_embd_s node;
+  /* all the timers in the process, used for restarting and cleanup */
+  fio_ls_embd_s all;
+  uint64_t due;
   size_t milliseconds;
   size_t repetitions;
   void (*task)(void *);
   void (*on_finish)(void *);
   void *arg;
-} timer_protocol_s;
+  uint8_t level;
+  uint8_t slot;
+  uint8_t state;
+  uint8_t cancelled;
+};
 
-#define prot2timer(protocol) (*((timer_protocol_s *)(protocol)))
+static struct {
+  fio_ls_embd_s slots[FACIL_TIMER_LEVELS][FACIL_TIMER_SLOTS];
+  /* a bitmap of the occupied slots in each level */
+  uint64_t map[FACIL_TIMER_LEVELS];
+  fio_ls_embd_s all;
+  /* the last tick (in milliseconds) reviewed by the wheel */
+  uint64_t now;
+  /* the time at which a blocking reactor will review the wheel (or 0) */
+  uint64_t deadline;
+  /* the number of timers placed in the wheel */
+  size_t count;
+  /* the uuid of the timer used to wake the reactor */
+  intptr_t wake;
+  spn_lock_i lock;
+  uint8_t initialized;
+} facil_timers = {.wake = -1, .lock = SPN_LOCK_INIT};
 
-static void timer_on_data(intptr_t uuid, protocol_s *protocol) {
-  prot2timer(protocol).task(prot2timer(protocol).arg);
-  if (prot2timer(protocol).repetitions == 0)
-    goto reschedule;
-  prot2timer(protocol).repetitions -= 1;
-  if (prot2timer(protocol).repetitions)
-    goto reschedule;
-  sock_force_close(uuid);
-  return;
-reschedule:
-  spn_trylock(&uuid_data(uuid).scheduled);
+static protocol_s facil_timer_wake_protocol;
+
+static void facil_timer_perform(void *t_, void *ignr);
+
+static inline uint64_t facil_timer_clock(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000) + ((uint64_t)t.tv_nsec / 1000000);
+}
+
+static inline uint8_t facil_timer_ctz(uint64_t map) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (uint8_t)__builtin_ctzll(map);
+#else
+  uint8_t i = 0;
+  while (!(map & 1)) {
+    map >>= 1;
+    ++i;
+  }
+  return i;
+#endif
+}
+
+/* initializes the wheel. Call only while the lock is held. */
+static void facil_timer_init_unsafe(void) {
+  if (facil_timers.initialized)
+    return;
+  for (size_t l = 0; l < FACIL_TIMER_LEVELS; ++l) {
+    for (size_t s = 0; s < FACIL_TIMER_SLOTS; ++s) {
+      facil_timers.slots[l][s] =
+          (fio_ls_embd_s)FIO_LS_INIT(facil_timers.slots[l][s]);
+    }
+    facil_timers.map[l] = 0;
+  }
+  facil_timers.all = (fio_ls_embd_s)FIO_LS_INIT(facil_timers.all);
+  facil_timers.now = facil_timer_clock();
+  facil_timers.deadline = 0;
+  facil_timers.count = 0;
+  facil_timers.initialized = 1;
+}
+
+/* places a timer in the wheel according to it's `due` time. Call only while
+ * the lock is held. */
+static void facil_timer_place_unsafe(facil_timer_s *t) {
+  uint64_t pos = t->due;
+  if (pos < facil_timers.now)
+    pos = facil_timers.now;
+  const uint64_t delta = pos - facil_timers.now;
+  uint8_t level = 0;
+  if (delta >= FACIL_TIMER_SPAN) {
+    pos = facil_timers.now + FACIL_TIMER_SPAN - 1;
+    level = FACIL_TIMER_LEVELS - 1;
+  } else {
+    while (delta >> ((level + 1) * FACIL_TIMER_BITS))
+      ++level;
+  }
+  t->level = level;
+  t->slot = (pos >> (level * FACIL_TIMER_BITS)) & FACIL_TIMER_MASK;
+  t->state = FACIL_TIMER_IN_WHEEL;
+  fio_ls_embd_unshift(&facil_timers.slots[level][t->slot], &t->node);
+  facil_timers.map[level] |= (1ULL << t->slot);
+  ++facil_timers.count;
+}
+
+/* removes a timer from the wheel. Call only while the lock is held. */
+static void facil_timer_unplace_unsafe(facil_timer_s *t) {
+  fio_ls_embd_remove(&t->node);
+  if (fio_ls_embd_is_empty(&facil_timers.slots[t->level][t->slot]))
+    facil_timers.map[t->level] &= ~(1ULL << t->slot);
+  --facil_timers.count;
+}
+
+/* moves a slot's timers to the `dest` list. Call only while locked. */
+static void facil_timer_take_slot_unsafe(fio_ls_embd_s *dest, uint8_t level,
+                                         uint8_t slot) {
+  fio_ls_embd_s *src = &facil_timers.slots[level][slot];
+  facil_timers.map[level] &= ~(1ULL << slot);
+  if (fio_ls_embd_is_empty(src)) {
+    *dest = (fio_ls_embd_s)FIO_LS_INIT(*dest);
+    return;
+  }
+  *dest = *src;
+  dest->next->prev = dest;
+  dest->prev->next = dest;
+  *src = (fio_ls_embd_s)FIO_LS_INIT(*src);
+}
+
+/* advances the wheel by a single tick, cascading timers from higher levels
+ * and scheduling any expired timers. Call only while the lock is held. */
+static void facil_timer_tick_unsafe(void) {
+  fio_ls_embd_s list;
+  fio_ls_embd_s *node;
+  const uint64_t now = ++facil_timers.now;
+  for (uint8_t level = 1; level < FACIL_TIMER_LEVELS; ++level) {
+    if (now & ((1ULL << (level * FACIL_TIMER_BITS)) - 1))
+      break;
+    facil_timer_take_slot_unsafe(
+        &list, level, (now >> (level * FACIL_TIMER_BITS)) & FACIL_TIMER_MASK);
+    while ((node = fio_ls_embd_shift(&list))) {
+      --facil_timers.count;
+      facil_timer_place_unsafe(FIO_LS_EMBD_OBJ(facil_timer_s, node, node));
+    }
+  }
+  facil_timer_take_slot_unsafe(&list, 0, now & FACIL_TIMER_MASK);
+  while ((node = fio_ls_embd_shift(&list))) {
+    facil_timer_s *t = FIO_LS_EMBD_OBJ(facil_timer_s, node, node);
+    --facil_timers.count;
+    t->state = FACIL_TIMER_RUNNING;
+    defer(facil_timer_perform, t, NULL);
+  }
+}
+
+/* schedules the timer's next run. Returns the number of milliseconds after
+ * which a blocking reactor should be woken (or 0). Call only while the lock is
+ * held. */
+static uint64_t facil_timer_schedule_unsafe(facil_timer_s *t) {
+  const uint64_t clock = facil_timer_clock();
+  t->due = clock + t->milliseconds;
+  if (t->due <= facil_timers.now)
+    t->due = facil_timers.now + 1;
+  facil_timer_place_unsafe(t);
+  if (t->due >= facil_timers.deadline)
+    return 0;
+  facil_timers.deadline = t->due;
+  return (t->due > clock ? t->due - clock : 1);
+}
+
+/* wakes the reactor after `milliseconds` have passed. The wake-up timer is a
+ * one-shot timer, re-armed whenever an earlier deadline is set (the reactor
+ * bounds it's own timeout by the wheel's next expiry). */
+static void facil_timer_wake(uint64_t milliseconds) {
+  intptr_t uuid = facil_timers.wake;
+  if (!milliseconds || uuid == -1)
+    return;
   evio_set_timer(sock_uuid2fd(uuid), (void *)uuid,
-                 prot2timer(protocol).milliseconds);
+                 (unsigned long)milliseconds);
 }
 
-static void timer_on_close(intptr_t uuid, protocol_s *protocol) {
-  prot2timer(protocol).on_finish(prot2timer(protocol).arg);
-  free(protocol);
-  (void)uuid;
+/* performs a timer's task and reschedules (or finishes) the timer. */
+static void facil_timer_perform(void *t_, void *ignr) {
+  facil_timer_s *t = t_;
+  uint64_t wake;
+  if (t->state != FACIL_TIMER_RUNNING) {
+    /* a stale task (i.e., inherited during a `fork`) */
+    return;
+  }
+  if (!t->cancelled)
+    t->task(t->arg);
+  spn_lock(&facil_timers.lock);
+  if (!t->cancelled && (t->repetitions == 0 || --t->repetitions)) {
+    wake = facil_timer_schedule_unsafe(t);
+    spn_unlock(&facil_timers.lock);
+    facil_timer_wake(wake);
+    return;
+  }
+  fio_ls_embd_remove(&t->all);
+  spn_unlock(&facil_timers.lock);
+  t->on_finish(t->arg);
+  free(t);
+  (void)ignr;
 }
 
-static void timer_ping(intptr_t uuid, protocol_s *protocol) {
-  sock_touch(uuid);
+/* reviews the wheel, scheduling any expired timers. */
+static void facil_timer_review(void) {
+  if (!facil_timers.initialized)
+    return;
+  const uint64_t target = facil_timer_clock();
+  spn_lock(&facil_timers.lock);
+  facil_timers.deadline = 0;
+  while (facil_timers.now < target) {
+    if (!facil_timers.count) {
+      facil_timers.now = target;
+      break;
+    }
+    if (!facil_timers.map[0]) {
+      /* nothing expires before the next cascade, skip ahead */
+      const uint64_t skip = facil_timers.now | FACIL_TIMER_MASK;
+      if (skip >= target) {
+        facil_timers.now = target;
+        break;
+      }
+      facil_timers.now = skip;
+    }
+    facil_timer_tick_unsafe();
+  }
+  spn_unlock(&facil_timers.lock);
+}
+
+/* returns the number of milliseconds the reactor can block for (up to
+ * `limit`), marking the reactor as blocking. */
+static int facil_timer_timeout(int limit) {
+  if (!facil_timers.initialized)
+    return limit;
+  const uint64_t clock = facil_timer_clock();
+  uint64_t next = clock + limit;
+  spn_lock(&facil_timers.lock);
+  if (facil_timers.count) {
+    const uint64_t now = facil_timers.now;
+    if (facil_timers.map[0]) {
+      /* rotate the bitmap so bit 0 marks the slot for the next tick */
+      const uint8_t offset = (now + 1) & FACIL_TIMER_MASK;
+      const uint64_t map =
+          (facil_timers.map[0] >> offset) |
+          (facil_timers.map[0]
+           << ((FACIL_TIMER_SLOTS - offset) & FACIL_TIMER_MASK));
+      if (now + 1 + facil_timer_ctz(map) < next)
+        next = now + 1 + facil_timer_ctz(map);
+    }
+    for (uint8_t level = 1; level < FACIL_TIMER_LEVELS; ++level) {
+      if (facil_timers.map[level]) {
+        /* timers might cascade into the wheel's first level */
+        if ((now | FACIL_TIMER_MASK) + 1 < next)
+          next = (now | FACIL_TIMER_MASK) + 1;
+        break;
+      }
+    }
+  }
+  if (next < clock)
+    next = clock;
+  if (next > clock + limit)
+    next = clock + limit;
+  facil_timers.deadline = next;
+  spn_unlock(&facil_timers.lock);
+  return (int)(next - clock);
+}
+
+/* restarts the timers (in a new process or a new reactor). */
+static void facil_timer_on_start(void) {
+  facil_timers.lock = SPN_LOCK_INIT;
+  facil_timers.wake = -1;
+  if (!facil_timers.initialized)
+    return;
+  spn_lock(&facil_timers.lock);
+  fio_ls_embd_s all = facil_timers.all;
+  if (fio_ls_embd_is_empty(&facil_timers.all)) {
+    all = (fio_ls_embd_s)FIO_LS_INIT(all);
+  } else {
+    all.next->prev = &all;
+    all.prev->next = &all;
+  }
+  facil_timers.initialized = 0;
+  facil_timer_init_unsafe();
+  fio_ls_embd_s *node;
+  while ((node = fio_ls_embd_shift(&all))) {
+    facil_timer_s *t = FIO_LS_EMBD_OBJ(facil_timer_s, all, node);
+    fio_ls_embd_unshift(&facil_timers.all, &t->all);
+    if (t->cancelled && t->state == FACIL_TIMER_RUNNING)
+      continue; /* a pending task will finish the timer */
+    facil_timer_schedule_unsafe(t);
+  }
+  spn_unlock(&facil_timers.lock);
+}
+
+/* stops all the timers, calling the `on_finish` callbacks. */
+static void facil_timer_clear(void) {
+  if (!facil_timers.initialized)
+    return;
+  fio_ls_embd_s done = FIO_LS_INIT(done);
+  fio_ls_embd_s *node;
+  spn_lock(&facil_timers.lock);
+  node = facil_timers.all.next;
+  while (node != &facil_timers.all) {
+    facil_timer_s *t = FIO_LS_EMBD_OBJ(facil_timer_s, all, node);
+    node = node->next;
+    t->cancelled = 1;
+    if (t->state == FACIL_TIMER_RUNNING)
+      continue; /* the pending task will finish the timer */
+    facil_timer_unplace_unsafe(t);
+    fio_ls_embd_remove(&t->all);
+    fio_ls_embd_unshift(&done, &t->node);
+  }
+  spn_unlock(&facil_timers.lock);
+  while ((node = fio_ls_embd_shift(&done))) {
+    facil_timer_s *t = FIO_LS_EMBD_OBJ(facil_timer_s, node, node);
+    t->on_finish(t->arg);
+    free(t);
+  }
+}
+
+/* *******
+Reactor Wake-up Timer
+******* */
+
+static void facil_timer_wake_on_data(intptr_t uuid, protocol_s *protocol) {
+  /* the wheel is reviewed by the reactor, only prevent the fd's rearming */
+  spn_trylock(&uuid_data(uuid).scheduled);
   (void)protocol;
 }
 
-static inline timer_protocol_s *timer_alloc(void (*task)(void *), void *arg,
-                                            size_t milliseconds,
-                                            size_t repetitions,
-                                            void (*on_finish)(void *)) {
-  if (!on_finish)
-    on_finish = (void (*)(void *))mock_on_close;
-  timer_protocol_s *t = malloc(sizeof(*t));
-  if (t)
-    *t = (timer_protocol_s){
-        .protocol.service = TIMER_PROTOCOL_NAME,
-        .protocol.on_data = timer_on_data,
-        .protocol.on_close = timer_on_close,
-        .protocol.on_shutdown = mock_on_shutdown_internal,
-        .protocol.ping = timer_ping,
-        .arg = arg,
-        .task = task,
-        .on_finish = on_finish,
-        .milliseconds = milliseconds,
-        .repetitions = repetitions,
-    };
-  return t;
+static void facil_timer_wake_on_close(intptr_t uuid, protocol_s *protocol) {
+  if (facil_timers.wake == uuid)
+    facil_timers.wake = -1;
+  (void)protocol;
 }
 
-inline static void timer_on_server_start(int fd) {
-  if (evio_set_timer(fd, (void *)sock_fd2uuid(fd),
-                     prot2timer(fd_data(fd).protocol).milliseconds)) {
-    perror("Couldn't register a required timed event.");
-    kill(0, SIGINT);
-    exit(4);
+static void facil_timer_wake_ping(intptr_t uuid, protocol_s *protocol) {
+  sock_touch(uuid);
+  (void)protocol;
+}
+
+/* opens the process's wake-up timer (call after the reactor was created). */
+static void facil_timer_wake_open(void) {
+  int fd = evio_open_timer();
+  if (fd == -1) {
+    perror("WARNING: couldn't create a timer fd");
+    return;
   }
+  intptr_t uuid = sock_open(fd);
+  if (uuid == -1) {
+    close(fd);
+    return;
+  }
+  facil_timer_wake_protocol = (protocol_s){
+      .service = TIMER_PROTOCOL_NAME,
+      .on_data = facil_timer_wake_on_data,
+      .on_close = facil_timer_wake_on_close,
+      .on_shutdown = mock_on_shutdown_internal,
+      .ping = facil_timer_wake_ping,
+  };
+  if (facil_attach(uuid, &facil_timer_wake_protocol))
+    return;
+  facil_timers.wake = uuid;
 }
 
+/* *******
+Timer API
+******* */
+
 /**
- * Creates a system timer (at the cost of 1 file descriptor).
+ * Creates a timer that will run `task` every `milliseconds`.
  *
  * The task will repeat `repetitions` times. If `repetitions` is set to 0, task
  * will repeat forever.
  *
- * Returns -1 on error or the new file descriptor on succeess.
+ * Returns a timer handle that can be passed to `facil_timer_cancel` (valid
+ * until `on_finish` is called) or NULL on error.
  *
  * The `on_finish` handler is always called (even on error).
  */
-int facil_run_every(size_t milliseconds, size_t repetitions,
-                    void (*task)(void *), void *arg,
-                    void (*on_finish)(void *)) {
-  if (task == NULL)
-    goto error_fin;
-  timer_protocol_s *protocol = NULL;
-  intptr_t uuid = -1;
-  int fd = evio_open_timer();
-  if (fd == -1) {
-    perror("ERROR: couldn't create a timer fd");
+facil_timer_s *facil_run_every2(size_t milliseconds, size_t repetitions,
+                                void (*task)(void *), void *arg,
+                                void (*on_finish)(void *)) {
+  facil_timer_s *t = NULL;
+  uint64_t wake;
+  if (task == NULL) {
+    errno = EINVAL;
     goto error;
   }
-  uuid = sock_open(fd);
-  if (uuid == -1)
+  t = malloc(sizeof(*t));
+  if (!t)
     goto error;
-  protocol = timer_alloc(task, arg, milliseconds, repetitions, on_finish);
-  if (protocol == NULL)
-    goto error;
-  facil_attach(uuid, (protocol_s *)protocol);
-  if (evio_isactive() && evio_set_timer(fd, (void *)uuid, milliseconds) == -1) {
-    /* don't goto error because the protocol is attached. */
-    const int old = errno;
-    sock_force_close(uuid);
-    errno = old;
-    return -1;
-  }
-  return 0;
+  *t = (facil_timer_s){
+      .milliseconds = milliseconds,
+      .repetitions = repetitions,
+      .task = task,
+      .on_finish =
+          (on_finish ? on_finish : (void (*)(void *))mock_on_close),
+      .arg = arg,
+  };
+  spn_lock(&facil_timers.lock);
+  facil_timer_init_unsafe();
+  fio_ls_embd_unshift(&facil_timers.all, &t->all);
+  wake = facil_timer_schedule_unsafe(t);
+  spn_unlock(&facil_timers.lock);
+  facil_timer_wake(wake);
+  return t;
 error:
-  if (uuid != -1) {
-    const int old = errno;
-    sock_close(uuid);
-    errno = old;
-  } else if (fd != -1) {
-    const int old = errno;
-    close(fd);
-    errno = old;
-  }
-error_fin:
   if (on_finish) {
     const int old = errno;
     on_finish(arg);
     errno = old;
   }
-  return -1;
+  return NULL;
+}
+
+/**
+ * Cancels a timer. The `on_finish` callback will be called, but the timer's
+ * task will not be performed again.
+ */
+void facil_timer_cancel(facil_timer_s *timer) {
+  if (!timer)
+    return;
+  spn_lock(&facil_timers.lock);
+  if (timer->cancelled) {
+    spn_unlock(&facil_timers.lock);
+    return;
+  }
+  timer->cancelled = 1;
+  if (timer->state == FACIL_TIMER_RUNNING) {
+    /* the pending task will finish the timer */
+    spn_unlock(&facil_timers.lock);
+    return;
+  }
+  facil_timer_unplace_unsafe(timer);
+  fio_ls_embd_remove(&timer->all);
+  spn_unlock(&facil_timers.lock);
+  timer->on_finish(timer->arg);
+  free(timer);
+}
+
+/**
+ * Creates a timer (managed by the reactor's timer wheel).
+ *
+ * The task will repeat `repetitions` times. If `repetitions` is set to 0, task
+ * will repeat forever.
+ *
+ * Returns -1 on error or 0 on succeess.
+ *
+ * The `on_finish` handler is always called (even on error).
+ */
+int facil_run_every(size_t milliseconds, size_t repetitions,
+                    void (*task)(void *), void *arg,
+                    void (*on_finish)(void *)) {
+  return facil_run_every2(milliseconds, repetitions, task, arg, on_finish)
+             ? 0
+             : -1;
 }
 
 /* *****************************************************************************
@@ -1009,38 +1545,49 @@ static void print_pid(void *arg, void *ignr) {
   fprintf(stderr, "* %d is running.\n", getpid());
 }
 
+/* reviews the timeout buckets for the seconds that passed since the last
+ * review, pinging any expired connections. */
 static void facil_review_timeout(void *arg, void *ignr) {
-  (void)ignr;
   protocol_s *tmp;
-  time_t review = facil_data->last_cycle.tv_sec;
-  intptr_t fd = (intptr_t)arg;
-
-  uint16_t timeout = fd_data(fd).timeout;
-  if (!timeout)
-    timeout = 300; /* enforced timout settings */
-
-  if (!fd_data(fd).protocol || (fd_data(fd).active + timeout >= review))
-    goto finish;
-  tmp = protocol_try_lock(fd, FIO_PR_LOCK_STATE);
-  if (!tmp)
-    goto reschedule;
-  if (prt_meta(tmp).locks[FIO_PR_LOCK_TASK] ||
-      prt_meta(tmp).locks[FIO_PR_LOCK_WRITE])
-    goto unlock;
-  defer(deferred_ping, (void *)sock_fd2uuid((int)fd), NULL);
-unlock:
-  protocol_unlock(tmp, FIO_PR_LOCK_STATE);
-finish:
-  do {
-    fd++;
-  } while (!fd_data(fd).protocol && (fd < facil_data->capacity));
-
-  if (facil_data->capacity <= fd) {
-    facil_data->need_review = 1;
-    return;
+  fio_ls_embd_s *node;
+  const time_t review = facil_data->last_cycle.tv_sec;
+
+  spn_lock(&facil_data->timeout_lock);
+  if (review - facil_data->timeout_reviewed > FACIL_TIMEOUT_BUCKETS)
+    facil_data->timeout_reviewed = review - FACIL_TIMEOUT_BUCKETS;
+  while (facil_data->timeout_reviewed < review) {
+    fio_ls_embd_s *bucket =
+        facil_data->timeouts +
+        ((++facil_data->timeout_reviewed) & (FACIL_TIMEOUT_BUCKETS - 1));
+    while ((node = fio_ls_embd_shift(bucket))) {
+      const intptr_t fd =
+          FIO_LS_EMBD_OBJ(struct connection_data_s, timeout_node, node) -
+          facil_data->conn;
+      const intptr_t uuid = sock_fd2uuid((int)fd);
+      *node = (fio_ls_embd_s){.next = NULL};
+      if (!fd_data(fd).protocol || uuid == -1)
+        continue;
+      const time_t due = facil_timeout_due(fd);
+      if (due > review) {
+        /* the connection was active, review it later */
+        facil_timeout_place_unsafe(fd, due);
+        continue;
+      }
+      tmp = protocol_try_lock(fd, FIO_PR_LOCK_STATE);
+      if (tmp) {
+        if (!prt_meta(tmp).locks[FIO_PR_LOCK_TASK] &&
+            !prt_meta(tmp).locks[FIO_PR_LOCK_WRITE])
+          defer(deferred_ping, (void *)uuid, NULL);
+        protocol_unlock(tmp, FIO_PR_LOCK_STATE);
+      }
+      /* review again on the next second (unless the connection is closed) */
+      facil_timeout_place_unsafe(fd, review + 1);
+    }
   }
-reschedule:
-  defer(facil_review_timeout, (void *)fd, NULL);
+  spn_unlock(&facil_data->timeout_lock);
+  facil_data->need_review = 1;
+  (void)arg;
+  (void)ignr;
 }
 
 static void perform_idle(void *arg, void *ignr) {
@@ -1064,7 +1611,7 @@ static void facil_cycle_schedule_events(void) {
       idle = 1;
     }
   } else {
-    events = evio_review(EVIO_TICK);
+    events = evio_review(facil_timer_timeout(EVIO_TICK));
     if (events < 0)
       return;
     if (events > 0) {
@@ -1074,12 +1621,13 @@ static void facil_cycle_schedule_events(void) {
       idle = 0;
     }
   }
+  facil_timer_review();
   static time_t last_to_review = 0;
   if (facil_data->need_review &&
       facil_data->last_cycle.tv_sec != last_to_review) {
     last_to_review = facil_data->last_cycle.tv_sec;
     facil_data->need_review = 0;
-    defer(facil_review_timeout, (void *)0, NULL);
+    defer(facil_review_timeout, NULL, NULL);
   }
 }
 
@@ -1130,6 +1678,32 @@ Behaves like the system's `fork`.
 #pragma weak facil_fork
 int facil_fork(void) { return (int)fork(); }
 
+static inline size_t facil_detect_cpu_cores(void);
+
+/* pins the worker process to a set of CPU cores (one core per thread). */
+static void facil_worker_pin_cpus(void) {
+  facil_data->worker_cpu = -1;
+#if defined(__linux__)
+  if (!facil_data->pin_cpus)
+    return;
+  const size_t cores = facil_detect_cpu_cores();
+  const size_t threads = facil_data->threads;
+  if (!cores || threads >= cores)
+    return;
+  const size_t first = ((size_t)facil_data->worker_id * threads) % cores;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < threads; ++i) {
+    CPU_SET((first + i) % cores, &set);
+  }
+  if (sched_setaffinity(0, sizeof(set), &set)) {
+    perror("WARNING: couldn't set the worker's CPU affinity");
+    return;
+  }
+  facil_data->worker_cpu = (int)first;
+#endif
+}
+
 /** This will be called by child processes, make sure to unlock any existing
  * locks.
  *
@@ -1149,6 +1723,10 @@ static void facil_worker_startup(uint8_t sentinel) {
   evio_create();
   clock_gettime(CLOCK_REALTIME, &facil_data->last_cycle);
   facil_external_init();
+  facil_timer_on_start();
+  facil_timeout_on_start();
+  if (!sentinel)
+    facil_worker_pin_cpus();
   if (facil_data->active == 1) {
     /* single process */
     for (int i = 0; i < facil_data->capacity; i++) {
@@ -1158,8 +1736,6 @@ static void facil_worker_startup(uint8_t sentinel) {
         fd_data(i).protocol->rsv = 0;
         if (fd_data(i).protocol->service == LISTENER_PROTOCOL_NAME)
           listener_on_start(i);
-        else if (fd_data(i).protocol->service == TIMER_PROTOCOL_NAME)
-          timer_on_server_start(i);
         else {
           evio_add(i, (void *)sock_fd2uuid(i));
         }
@@ -1167,6 +1743,15 @@ static void facil_worker_startup(uint8_t sentinel) {
     }
   } else if (sentinel == 0) {
     /* child process */
+#if FACIL_WORKER_REUSEPORT
+    for (int i = 0; i < facil_data->capacity; i++) {
+      if (fd_data(i).protocol &&
+          fd_data(i).protocol->service == LISTENER_PROTOCOL_NAME &&
+          ((struct ListenerProtocol *)fd_data(i).protocol)->reuse_port &&
+          !((struct ListenerProtocol *)fd_data(i).protocol)->reopened)
+        listener_reopen(i);
+    }
+#endif
     for (int i = 0; i < facil_data->capacity; i++) {
       errno = 0;
       fd_data(i).lock = SPN_LOCK_INIT;
@@ -1174,8 +1759,6 @@ static void facil_worker_startup(uint8_t sentinel) {
         fd_data(i).protocol->rsv = 0;
         if (fd_data(i).protocol->service == LISTENER_PROTOCOL_NAME)
           listener_on_start(i);
-        else if (fd_data(i).protocol->service == TIMER_PROTOCOL_NAME)
-          timer_on_server_start(i);
         else {
           /* prevent normal connections from being shared across workers */
           intptr_t uuid = sock_fd2uuid(i);
@@ -1193,9 +1776,7 @@ static void facil_worker_startup(uint8_t sentinel) {
       fd_data(i).lock = SPN_LOCK_INIT;
       if (fd_data(i).protocol) {
         fd_data(i).protocol->rsv = 0;
-        if (fd_data(i).protocol->service == TIMER_PROTOCOL_NAME)
-          timer_on_server_start(i);
-        else if (fd_data(i).protocol->service != LISTENER_PROTOCOL_NAME) {
+        if (fd_data(i).protocol->service != LISTENER_PROTOCOL_NAME) {
           evio_add(i, (void *)sock_fd2uuid(i));
         }
       }
@@ -1210,6 +1791,8 @@ static void facil_worker_startup(uint8_t sentinel) {
     facil_data->active = old_active;
     facil_data->spindown = 0;
   }
+  /* open the timer used to wake the reactor for timers set by other threads */
+  facil_timer_wake_open();
   /* call any external startup callbacks. */
   facil_external_init2();
   /* add cycling to the defer queue to setup the reactor pattern. */
@@ -1262,6 +1845,7 @@ static void facil_worker_cleanup(void) {
       sock_force_close(uuid);
     }
   }
+  facil_timer_clear();
   defer_perform();
 
   if (facil_data->parent == getpid()) {
@@ -1284,6 +1868,8 @@ static spn_lock_i fio_fork_lock = SPN_LOCK_INIT;
 
 static void facil_sentinel_task(void *arg1, void *arg2);
 static void *facil_sentinel_worker_thread(void *arg) {
+  /* the worker's index is passed as the thread's argument */
+  const uint16_t worker_id = (uint16_t)(uintptr_t)arg;
   errno = 0;
   pid_t child = facil_fork();
   /* release fork lock. */
@@ -1327,11 +1913,12 @@ static void *facil_sentinel_worker_thread(void *arg) {
                 "INFO: Child worker (%d) shutdown. Respawning worker.\n",
                 child);
       }
-      defer(facil_sentinel_task, NULL, NULL);
+      defer(facil_sentinel_task, (void *)(uintptr_t)worker_id, NULL);
       spn_unlock(&fio_fork_lock);
     }
 #endif
   } else {
+    facil_data->worker_id = worker_id;
     facil_core_callback_force(FIO_CALL_AFTER_FORK);
     facil_core_callback_force(FIO_CALL_IN_CHILD);
     facil_worker_startup(0);
@@ -1339,7 +1926,6 @@ static void *facil_sentinel_worker_thread(void *arg) {
     exit(0);
   }
   return NULL;
-  (void)arg;
 }
 
 #if FIO_SENTINEL_USE_PTHREAD
@@ -1348,8 +1934,7 @@ static void facil_sentinel_task(void *arg1, void *arg2) {
     return;
   spn_lock(&fio_fork_lock);
   pthread_t sentinel;
-  if (pthread_create(&sentinel, NULL, facil_sentinel_worker_thread,
-                     (void *)&fio_fork_lock)) {
+  if (pthread_create(&sentinel, NULL, facil_sentinel_worker_thread, arg1)) {
     perror("FATAL ERROR: couldn't start sentinel thread");
     exit(errno);
   }
@@ -1357,7 +1942,6 @@ static void facil_sentinel_task(void *arg1, void *arg2) {
   spn_lock(&fio_fork_lock); /* will wait for worker thread to release lock. */
   spn_unlock(&fio_fork_lock);
   facil_core_callback_force(FIO_CALL_AFTER_FORK);
-  (void)arg1;
   (void)arg2;
 }
 #else
@@ -1366,13 +1950,11 @@ static void facil_sentinel_task(void *arg1, void *arg2) {
     return;
   facil_core_callback_force(FIO_CALL_BEFORE_FORK);
   spn_lock(&fio_fork_lock); /* will wait for worker thread to release lock. */
-  void *thrd =
-      defer_new_thread(facil_sentinel_worker_thread, (void *)&fio_fork_lock);
+  void *thrd = defer_new_thread(facil_sentinel_worker_thread, arg1);
   defer_free_thread(thrd);
   spn_lock(&fio_fork_lock); /* will wait for worker thread to release lock. */
   spn_unlock(&fio_fork_lock);
   facil_core_callback_force(FIO_CALL_AFTER_FORK);
-  (void)arg1;
   (void)arg2;
 }
 #endif
@@ -1459,6 +2041,13 @@ pid_t facil_parent_pid(void) {
   return facil_data->parent;
 }
 
+/** returns the calling worker's index (0 in the root process). */
+uint16_t facil_worker_id(void) {
+  if (!facil_data)
+    facil_lib_init();
+  return facil_data->worker_id;
+}
+
 static inline size_t facil_detect_cpu_cores(void) {
   ssize_t cpu_count = 0;
 #ifdef _SC_NPROCESSORS_ONLN
@@ -1564,14 +2153,20 @@ void facil_run(struct facil_run_args args) {
   /* activate facil, fork if needed */
   facil_data->active = (uint16_t)args.processes;
   facil_data->threads = (uint16_t)args.threads;
+  facil_data->pin_cpus = args.pin_cpus;
+  facil_data->worker_id = 0;
 
   /* call any pre-start callbacks*/
   facil_core_callback_force(FIO_CALL_PRE_START);
 
   /* initialize cluster */
   if (args.processes > 1) {
+#if FACIL_WORKER_REUSEPORT
+    /* workers will open their own listening sockets */
+    listener_pause_reuseport();
+#endif
     for (int i = 0; i < args.processes && facil_data->active; ++i) {
-      facil_sentinel_task(NULL, NULL);
+      facil_sentinel_task((void *)(uintptr_t)i, NULL);
     }
     facil_worker_startup(1);
   } else {
@@ -1629,6 +2224,10 @@ static int facil_attach_state(intptr_t uuid, protocol_s *protocol,
   uuid_data(uuid).protocol = protocol;
   uuid_data(uuid).active = facil_data->last_cycle.tv_sec;
   spn_unlock(&uuid_data(uuid).lock);
+  if (protocol)
+    facil_timeout_update(sock_uuid2fd(uuid));
+  else
+    facil_timeout_remove(sock_uuid2fd(uuid));
   if (old_data.protocol) {
     defer(deferred_on_close, (void *)uuid, old_data.protocol);
   } else if (evio_isactive() && protocol) {
@@ -1660,6 +2259,7 @@ void facil_set_timeout(intptr_t uuid, uint8_t timeout) {
   if (sock_isvalid(uuid) && facil_data && facil_data->active) {
     uuid_data(uuid).active = facil_data->last_cycle.tv_sec;
     uuid_data(uuid).timeout = timeout;
+    facil_timeout_update(sock_uuid2fd(uuid));
   }
 }
 /** Gets a timeout for a specific connection. Returns 0 if there's no set
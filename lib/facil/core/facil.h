@@ -250,6 +250,22 @@ struct facil_listen_args {
    *
    * This will be called seperately for every process. */
   void (*on_finish)(intptr_t uuid, void *udata);
+  /**
+   * When set, every worker process opens it's own listening socket (using
+   * `SO_REUSEPORT`), so the kernel balances new connections between the
+   * workers' accept queues instead of all the workers contending over a single
+   * shared socket.
+   *
+   * Linux only (ignored on other systems and for Unix sockets).
+   */
+  uint8_t reuse_port;
+  /**
+   * When set (together with `reuse_port` and the `facil_run` `pin_cpus`
+   * option), every worker's listening socket is associated with the worker's
+   * first CPU core (`SO_INCOMING_CPU`), so connections handled by that core's
+   * network queue are preferably routed to the worker.
+   */
+  uint8_t incoming_cpu;
 };
 
 /**
@@ -350,6 +366,14 @@ struct facil_run_args {
     /** alias to `workers`. See `threads`. */
     int16_t processes;
   };
+  /**
+   * When set, every worker process is pinned to a set of CPU cores (one core
+   * per thread, assigned in a round robin fashion), so the worker's threads
+   * remain on the same cores.
+   *
+   * Linux only (ignored on other systems).
+   */
+  uint8_t pin_cpus;
 };
 
 /**
@@ -392,6 +416,15 @@ int facil_fork(void);
 /** returns facil.io's parent (root) process pid. */
 pid_t facil_parent_pid(void);
 
+/**
+ * Returns the calling worker's index, a number between 0 and the number of
+ * workers (exclusive).
+ *
+ * A respawned worker inherits the index of the worker it replaces. The root
+ * process (and a single process application) returns 0.
+ */
+uint16_t facil_worker_id(void);
+
 /**
  * Attaches (or updates) a protocol object to a socket UUID.
  *
@@ -511,18 +544,46 @@ struct timespec facil_last_tick(void);
 size_t facil_count(void *service);
 
 /**
- * Creates a system timer (at the cost of 1 file descriptor).
+ * Creates a timer (managed by the reactor's timer wheel, no file descriptors
+ * are used).
  *
  * The task will repeat `repetitions` times. If `repetitions` is set to 0, task
  * will repeat forever.
  *
- * Returns -1 on error or the new file descriptor on succeess.
+ * Timers created before `facil_run` is called will run in every worker process
+ * (and restart when a worker is spawned).
+ *
+ * Returns -1 on error or 0 on succeess (NOTE: previous versions returned the
+ * timer's file descriptor, use `facil_run_every2` for a timer handle).
  *
  * The `on_finish` handler is always called (even on error).
  */
 int facil_run_every(size_t milliseconds, size_t repetitions,
                     void (*task)(void *), void *arg, void (*on_finish)(void *));
 
+/** An opaque timer handle, see `facil_run_every2`. */
+typedef struct facil_timer_s facil_timer_s;
+
+/**
+ * Same as `facil_run_every`, but returns a timer handle that can be used to
+ * cancel the timer using `facil_timer_cancel`.
+ *
+ * The handle is valid until the `on_finish` callback is called.
+ *
+ * Returns NULL on error.
+ */
+facil_timer_s *facil_run_every2(size_t milliseconds, size_t repetitions,
+                                void (*task)(void *), void *arg,
+                                void (*on_finish)(void *));
+
+/**
+ * Cancels a timer. The task will not be performed again and the `on_finish`
+ * callback will be called.
+ *
+ * Adding or cancelling a timer is an O(1) operation.
+ */
+void facil_timer_cancel(facil_timer_s *timer);
+
 /**
  * This is used to lock the protocol againste concurrency collisions and
  * concurent memory deallocation.
@@ -984,6 +1045,11 @@ void facil_pubsub_reattach(pubsub_engine_s *eng);
 /** Returns true (1) if the engine is attached to the system. */
 int facil_pubsub_is_attached(pubsub_engine_s *engine);
 
+#if DEBUG
+/** Tests the pub/sub (cluster) internals. */
+void facil_cluster_test(void);
+#endif
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -66,12 +66,16 @@ typedef struct {
   FIOBJ id;
   fio_ls_embd_s subscriptions;
   collection_s *parent;
+  /** the sequence number of the next message published to the channel. */
+  uintptr_t seq;
   spn_lock_i lock;
 } channel_s;
 
 typedef struct {
   channel_s ch;
   facil_match_fn match;
+  /** the pattern's node in the pattern index. */
+  struct pattern_node_s *node;
 } pattern_s;
 
 struct subscription_s {
@@ -83,6 +87,11 @@ struct subscription_s {
   void *udata2;
   /** reference counter. */
   uintptr_t ref;
+  /** the sequence number of the next message to be delivered (ordering). */
+  uintptr_t seq;
+  /** messages waiting for an earlier message's delivery, ordered by `seq`. */
+  struct subscription_parked_s *parked;
+  struct subscription_parked_s *parked_last;
   /** prevents the callback from running concurrently for multiple messages. */
   spn_lock_i lock;
 };
@@ -93,6 +102,20 @@ typedef struct {
   uintptr_t ref;
 } facil_msg_internal_s;
 
+/** A subscription and the message's sequence number in it's channel. */
+typedef struct {
+  subscription_s *s;
+  uintptr_t seq;
+} subscription_target_s;
+
+/** A snapshot of the subscriptions a message should be delivered to. */
+typedef struct {
+  size_t count;
+  size_t capa;
+  subscription_target_s *targets;
+  subscription_target_s stack[32];
+} subscription_snapshot_s;
+
 typedef struct {
   cluster_message_type_e type;
   /** A unique message type. Negative values are reserved, 0 == pub/sub. */
@@ -106,21 +129,216 @@ typedef struct {
 #define COLLECTION_INIT                                                        \
   { .channels = FIO_HASH_INIT, .lock = SPN_LOCK_INIT }
 
+#ifndef FACIL_PUBSUB_SHARDS
+/**
+ * The number of independent (separately locked) shards in the channel and
+ * filter registries. Must be a power of 2 (up to 65536).
+ */
+#define FACIL_PUBSUB_SHARDS 16
+#endif
+
 struct {
-  collection_s filters;
-  collection_s pubsub;
+  collection_s filters[FACIL_PUBSUB_SHARDS];
+  collection_s pubsub[FACIL_PUBSUB_SHARDS];
   collection_s patterns;
   collection_s engines;
   collection_ary_s meta;
 } postoffice = {
-    .filters = COLLECTION_INIT,
-    .pubsub = COLLECTION_INIT,
     .patterns = COLLECTION_INIT,
 };
 
+/**
+ * Returns the registry shard for the channel (or filter) key.
+ *
+ * Numbers (filters) hash to their own (tagged) value, so the hash is mixed
+ * (a Fibonacci hash of both halves) and the result's high bits are used. The
+ * unmixed hash still places the key within the shard's hash map.
+ */
+static inline collection_s *postoffice_shard(collection_s *shards, FIOBJ key) {
+  uint64_t h = fiobj_obj2hash(key);
+  h ^= h >> 32;
+  h *= 0x9E3779B97F4A7C15ULL;
+  return shards + ((h >> 48) & (FACIL_PUBSUB_SHARDS - 1));
+}
+
+/** Loops over the shards of a sharded registry. */
+#define POSTOFFICE_SHARD_FOR(shards, pos)                                      \
+  for (collection_s *pos = (shards); pos < (shards) + FACIL_PUBSUB_SHARDS;     \
+       ++pos)
+
 /** The default engine (settable). */
 pubsub_engine_s *FACIL_PUBSUB_DEFAULT = FACIL_PUBSUB_CLUSTER;
 
+/* *****************************************************************************
+Pattern index
+
+Glob patterns are placed in a trie according to their literal prefix (the
+characters before the first wildcard), so a published channel is only tested
+against patterns that share it's prefix. Patterns using a custom `match`
+function are placed at the root (they are always tested).
+
+The matching patterns are cached per channel name until a pattern is added or
+removed.
+
+All the functions in this section should be called within the
+`postoffice.patterns` lock.
+***************************************************************************** */
+
+#ifndef FACIL_PATTERN_CACHE_LIMIT
+/** The number of channel names for which pattern matches are cached. */
+#define FACIL_PATTERN_CACHE_LIMIT 1024
+#endif
+
+typedef struct pattern_node_s {
+  struct pattern_node_s *parent;
+  struct pattern_node_s *children;
+  struct pattern_node_s *next;
+  /** the patterns whose literal prefix ends at this node. */
+  fio_ary_s patterns;
+  uint8_t key;
+} pattern_node_s;
+
+typedef struct {
+  size_t count;
+  pattern_s *matches[];
+} pattern_matches_s;
+
+static struct {
+  pattern_node_s root;
+  /* maps channel names to `pattern_matches_s` objects */
+  fio_hash_s cache;
+  size_t count;
+} pattern_index = {.root = {.key = 0}, .cache = FIO_HASH_INIT};
+
+static int facil_glob_match(FIOBJ pattern, FIOBJ channel);
+static void subscription_snapshot_add(subscription_snapshot_s *snapshot,
+                                      channel_s *ch);
+
+static void pattern_index_cache_clear(void) {
+  if (!fio_hash_capa(&pattern_index.cache))
+    return;
+  FIO_HASH_FOR_EMPTY(&pattern_index.cache, pos) { fio_free(pos->obj); }
+}
+
+/* adds a new pattern to the index. */
+static void pattern_index_add(pattern_s *p) {
+  pattern_node_s *node = &pattern_index.root;
+  if (p->match == facil_glob_match) {
+    fio_cstr_s str = fiobj_obj2cstr(p->ch.id);
+    for (size_t i = 0; i < str.len; ++i) {
+      const uint8_t c = str.bytes[i];
+      if (c == '*' || c == '?' || c == '[' || c == '\\')
+        break;
+      pattern_node_s *child = node->children;
+      while (child && child->key != c)
+        child = child->next;
+      if (!child) {
+        child = fio_malloc(sizeof(*child));
+        if (!child) {
+          perror("FATAL ERROR: (pubsub) can't allocate memory for pattern "
+                 "index");
+          exit(errno);
+        }
+        *child = (pattern_node_s){
+            .parent = node, .next = node->children, .key = c};
+        node->children = child;
+      }
+      node = child;
+    }
+  }
+  fio_ary_push(&node->patterns, p);
+  p->node = node;
+  ++pattern_index.count;
+  pattern_index_cache_clear();
+}
+
+/* removes a pattern from the index, pruning empty nodes. */
+static void pattern_index_remove(pattern_s *p) {
+  pattern_node_s *node = p->node;
+  if (!node || fio_ary_remove2(&node->patterns, p))
+    return;
+  p->node = NULL;
+  --pattern_index.count;
+  pattern_index_cache_clear();
+  while (node != &pattern_index.root && !node->children &&
+         !fio_ary_count(&node->patterns)) {
+    pattern_node_s **pos = &node->parent->children;
+    while (*pos != node)
+      pos = &(*pos)->next;
+    *pos = node->next;
+    pattern_node_s *parent = node->parent;
+    fio_ary_free(&node->patterns);
+    fio_free(node);
+    node = parent;
+  }
+}
+
+/* collects the patterns matching the channel (walking the trie). */
+static pattern_matches_s *pattern_index_collect(FIOBJ channel) {
+  fio_cstr_s str = fiobj_obj2cstr(channel);
+  fio_ary_s found = FIO_ARY_INIT;
+  pattern_node_s *node = &pattern_index.root;
+  size_t i = 0;
+  while (node) {
+    FIO_ARY_FOR(&node->patterns, pos) {
+      pattern_s *p = pos.obj;
+      if (p->match(p->ch.id, channel))
+        fio_ary_push(&found, p);
+    }
+    if (i == str.len)
+      break;
+    const uint8_t c = str.bytes[i++];
+    node = node->children;
+    while (node && node->key != c)
+      node = node->next;
+  }
+  pattern_matches_s *ret = fio_malloc(sizeof(*ret) + (sizeof(ret->matches[0]) *
+                                                      fio_ary_count(&found)));
+  if (!ret) {
+    perror("FATAL ERROR: (pubsub) can't allocate memory for pattern matches");
+    exit(errno);
+  }
+  ret->count = 0;
+  FIO_ARY_FOR(&found, pos) { ret->matches[ret->count++] = pos.obj; }
+  fio_ary_free(&found);
+  return ret;
+}
+
+/* adds the subscriptions of all the patterns matching the channel. */
+static void pattern_index_snapshot(FIOBJ channel,
+                                   subscription_snapshot_s *snapshot) {
+  if (!pattern_index.count)
+    return;
+  const uint8_t cache = FIOBJ_TYPE_IS(channel, FIOBJ_T_STRING);
+  pattern_matches_s *matches = NULL;
+  if (cache)
+    matches = fio_hash_find(&pattern_index.cache, channel);
+  if (!matches) {
+    matches = pattern_index_collect(channel);
+    if (cache) {
+      if (fio_hash_count(&pattern_index.cache) >= FACIL_PATTERN_CACHE_LIMIT)
+        pattern_index_cache_clear();
+      /* the key is copied, since the channel's String might be edited */
+      fio_cstr_s str = fiobj_obj2cstr(channel);
+      FIOBJ key = fiobj_str_new(str.data, str.len);
+      fiobj_str_freeze(key);
+      fio_hash_insert(&pattern_index.cache, key, matches);
+      fiobj_free(key);
+    }
+  }
+  for (size_t i = 0; i < matches->count; ++i)
+    subscription_snapshot_add(snapshot, &matches->matches[i]->ch);
+  if (!cache)
+    fio_free(matches);
+}
+
+/* frees the index (all patterns should have been removed). */
+static void pattern_index_free(void) {
+  FIO_HASH_FOR_FREE(&pattern_index.cache, pos) { fio_free(pos->obj); }
+  fio_ary_free(&pattern_index.root.patterns);
+  pattern_index.count = 0;
+}
+
 /* *****************************************************************************
 Engine handling and Management
 ***************************************************************************** */
@@ -187,6 +405,9 @@ static inline void channel_destroy(channel_s *c) {
     return;
   }
   fio_hash_insert(&c->parent->channels, c->id, NULL);
+  if (c->parent == &postoffice.patterns) {
+    pattern_index_remove((pattern_s *)c);
+  }
   if ((fio_hash_count(&c->parent->channels) << 1) <=
           fio_hash_capa(&c->parent->channels) &&
       fio_hash_capa(&c->parent->channels) > 512) {
@@ -235,12 +456,12 @@ static inline subscription_s *subscription_create(subscribe_args_s args) {
   if (args.filter) {
     /* either a filter OR a channel can be subscribed to. */
     args.channel = fiobj_num_new((uintptr_t)args.filter);
-    collection = &postoffice.filters;
+    collection = postoffice_shard(postoffice.filters, args.channel);
   } else {
     if (args.match) {
       collection = &postoffice.patterns;
     } else {
-      collection = &postoffice.pubsub;
+      collection = postoffice_shard(postoffice.pubsub, args.channel);
     }
     if (FIOBJ_TYPE_IS(args.channel, FIOBJ_T_STRING)) {
       /* Hash values are cached, so it can be computed outside the lock */
@@ -279,6 +500,7 @@ static inline subscription_s *subscription_create(subscribe_args_s args) {
         exit(errno);
       }
       ((pattern_s *)ch)->match = args.match;
+      ((pattern_s *)ch)->node = NULL;
     } else {
       /* channel subscriptions */
       ch = fio_malloc(sizeof(*ch));
@@ -294,6 +516,9 @@ static inline subscription_s *subscription_create(subscribe_args_s args) {
         .lock = SPN_LOCK_INIT,
     };
     fio_hash_insert(&collection->channels, args.channel, ch);
+    if (args.match) {
+      pattern_index_add((pattern_s *)ch);
+    }
     if (!args.filter) {
       pubsub_on_channel_create(ch, args.match);
     }
@@ -301,6 +526,7 @@ static inline subscription_s *subscription_create(subscribe_args_s args) {
   /* add subscription to filter / channel / pattern */
   s->parent = ch;
   spn_lock(&ch->lock);
+  s->seq = ch->seq;
   fio_ls_embd_push(&ch->subscriptions, &s->node);
   spn_unlock(&ch->lock);
   spn_unlock(&collection->lock);
@@ -350,14 +576,78 @@ void *facil_message_metadata(facil_msg_s *msg, intptr_t type_id) {
   return NULL;
 }
 
-/* performs the actual callback */
-static void perform_subscription_callback(void *s_, void *msg_) {
-  subscription_s *s = s_;
-  if (spn_trylock(&s->lock)) {
-    defer(perform_subscription_callback, s_, msg_);
+#ifndef FACIL_PUBSUB_BATCH
+/**
+ * The maximal number of subscriptions handled by a single delivery task.
+ *
+ * Messages to large channels are split into a number of tasks, so delivery is
+ * performed in parallel by the thread pool.
+ */
+#define FACIL_PUBSUB_BATCH 128
+#endif
+
+/** A delivery task - a message and a chunk of it's subscriptions. */
+typedef struct {
+  facil_msg_internal_s *msg;
+  size_t count;
+  subscription_target_s targets[];
+} subscription_batch_s;
+
+/** A message that arrived before an earlier message was delivered. */
+typedef struct subscription_parked_s {
+  struct subscription_parked_s *next;
+  facil_msg_internal_s *msg;
+  uintptr_t seq;
+} subscription_parked_s;
+
+static void perform_subscription_batch(void *batch_, void *ignr);
+
+/* allocates a delivery task, taking ownership of the targets' references. */
+static subscription_batch_s *
+subscription_batch_new(facil_msg_internal_s *msg,
+                       subscription_target_s *targets, size_t count) {
+  subscription_batch_s *batch =
+      fio_malloc(sizeof(*batch) + (sizeof(batch->targets[0]) * count));
+  if (!batch) {
+    perror("FATAL ERROR: (pubsub) can't allocate memory for delivery");
+    exit(errno);
+  }
+  batch->msg = msg;
+  batch->count = count;
+  memcpy(batch->targets, targets, sizeof(batch->targets[0]) * count);
+  return batch;
+}
+
+/**
+ * Parks a message until the earlier messages were delivered (the message and
+ * subscription references are kept). Call within the subscription's lock.
+ */
+static void subscription_park(subscription_s *s, uintptr_t seq,
+                              facil_msg_internal_s *msg) {
+  subscription_parked_s *p = fio_malloc(sizeof(*p));
+  if (!p) {
+    perror("FATAL ERROR: (pubsub) can't allocate memory for delivery");
+    exit(errno);
+  }
+  *p = (subscription_parked_s){.msg = msg, .seq = seq};
+  if (!s->parked || (intptr_t)(s->parked_last->seq - seq) < 0) {
+    /* the common case - messages are mostly scheduled in order */
+    if (s->parked)
+      s->parked_last->next = p;
+    else
+      s->parked = p;
+    s->parked_last = p;
     return;
   }
-  facil_msg_internal_s *msg = (facil_msg_internal_s *)msg_;
+  subscription_parked_s **pos = &s->parked;
+  while ((intptr_t)((*pos)->seq - seq) < 0)
+    pos = &(*pos)->next;
+  p->next = *pos;
+  *pos = p;
+}
+
+/* calls the subscription's callback, returns -1 if the message was deferred. */
+static int subscription_deliver(subscription_s *s, facil_msg_internal_s *msg) {
   facil_msg_internal_s m = {
       .msg =
           {
@@ -371,33 +661,146 @@ static void perform_subscription_callback(void *s_, void *msg_) {
       .ref = 0,
   };
   s->on_message((facil_msg_s *)&m);
-  spn_unlock(&s->lock);
-  if (m.ref) {
-    defer(perform_subscription_callback, s_, msg_);
-    return;
+  return (m.ref ? -1 : 0);
+}
+
+/**
+ * Performs the actual callback (and delivers any parked messages that were
+ * waiting for it), returning -1 if the message should be retried later (the
+ * subscription is busy or the callback deferred the message).
+ */
+static int perform_subscription_callback(subscription_target_s target,
+                                         facil_msg_internal_s *msg) {
+  subscription_s *s = target.s;
+  if (spn_trylock(&s->lock)) {
+    return -1;
   }
+  if (s->seq != target.seq) {
+    /* preserve the order of messages within the subscription */
+    subscription_park(s, target.seq, msg);
+    spn_unlock(&s->lock);
+    return 0;
+  }
+  if (subscription_deliver(s, msg)) {
+    spn_unlock(&s->lock);
+    return -1;
+  }
+  ++s->seq;
   internal_message_free(msg);
+  while (s->parked && s->parked->seq == s->seq) {
+    subscription_parked_s *p = s->parked;
+    s->parked = p->next;
+    msg = p->msg;
+    fio_free(p);
+    if (subscription_deliver(s, msg)) {
+      /* retry later, the newer messages remain parked */
+      target.seq = s->seq;
+      defer(perform_subscription_batch,
+            subscription_batch_new(msg, &target, 1), NULL);
+      break;
+    }
+    ++s->seq;
+    internal_message_free(msg);
+    subscription_free(s); /* the parked message's reference (never the last) */
+  }
+  spn_unlock(&s->lock);
   subscription_free(s);
+  return 0;
 }
 
-/* publishes a message to a channel, managing the reference counts */
-static void publish2channel(channel_s *ch, facil_msg_internal_s *msg) {
-  if (!ch || !msg) {
+/* delivers a message to a chunk of subscriptions, retrying failures later. */
+static void perform_subscription_batch(void *batch_, void *ignr) {
+  subscription_batch_s *batch = batch_;
+  size_t retry = 0;
+  for (size_t i = 0; i < batch->count; ++i) {
+    if (perform_subscription_callback(batch->targets[i], batch->msg)) {
+      batch->targets[retry++] = batch->targets[i];
+    }
+  }
+  if (retry) {
+    batch->count = retry;
+    defer(perform_subscription_batch, batch, ignr);
+    return;
+  }
+  fio_free(batch);
+}
+
+#define SUBSCRIPTION_SNAPSHOT_INIT(snapshot)                                   \
+  {                                                                            \
+    .capa = sizeof((snapshot).stack) / sizeof((snapshot).stack[0]),           \
+    .targets = (snapshot).stack                                                \
+  }
+
+/**
+ * Copies (and references) the channel's subscriptions, so the message can be
+ * scheduled after all the locks were released.
+ *
+ * Should be called within the channel's registry lock.
+ */
+static void subscription_snapshot_add(subscription_snapshot_s *snapshot,
+                                      channel_s *ch) {
+  if (!ch) {
     return;
   }
   spn_lock(&ch->lock);
+  const uintptr_t seq = ch->seq++;
   FIO_LS_EMBD_FOR(&ch->subscriptions, pos) {
     subscription_s *s = FIO_LS_EMBD_OBJ(subscription_s, node, pos);
     if (!s) {
       continue;
     }
-    subscription_dup(s);
-    spn_add(&msg->ref, 1);
-    defer(perform_subscription_callback, s, msg);
+    if (snapshot->count == snapshot->capa) {
+      subscription_target_s *tmp;
+      snapshot->capa <<= 1;
+      if (snapshot->targets == snapshot->stack) {
+        tmp = fio_malloc(sizeof(*tmp) * snapshot->capa);
+        if (tmp)
+          memcpy(tmp, snapshot->stack, sizeof(snapshot->stack));
+      } else {
+        tmp = fio_realloc(snapshot->targets, sizeof(*tmp) * snapshot->capa);
+      }
+      if (!tmp) {
+        perror("FATAL ERROR: (pubsub) can't allocate memory for subscribers");
+        exit(errno);
+      }
+      snapshot->targets = tmp;
+    }
+    snapshot->targets[snapshot->count++] =
+        (subscription_target_s){.s = subscription_dup(s), .seq = seq};
   }
   spn_unlock(&ch->lock);
 }
 
+/**
+ * Schedules the message for every subscription in the snapshot (no locks), in
+ * chunks of up to FACIL_PUBSUB_BATCH subscriptions per task.
+ */
+static void subscription_snapshot_publish(subscription_snapshot_s *snapshot,
+                                          facil_msg_internal_s *msg) {
+  if (snapshot->count) {
+    spn_add(&msg->ref, snapshot->count);
+  }
+  for (size_t i = 0; i < snapshot->count; i += FACIL_PUBSUB_BATCH) {
+    const size_t count = (snapshot->count - i > FACIL_PUBSUB_BATCH)
+                             ? FACIL_PUBSUB_BATCH
+                             : snapshot->count - i;
+    subscription_batch_s *batch =
+        subscription_batch_new(msg, snapshot->targets + i, count);
+    defer(perform_subscription_batch, batch, NULL);
+  }
+  if (snapshot->targets != snapshot->stack) {
+    fio_free(snapshot->targets);
+  }
+}
+
+/* adds the subscriptions of the channel matching `key` in a registry shard. */
+static inline void subscription_snapshot_find(subscription_snapshot_s *snapshot,
+                                              collection_s *shard, FIOBJ key) {
+  spn_lock(&shard->lock);
+  subscription_snapshot_add(snapshot, fio_hash_find(&shard->channels, key));
+  spn_unlock(&shard->lock);
+}
+
 static inline void call_meta_callbacks(facil_msg_internal_s *m, FIOBJ ch_raw,
                                        FIOBJ msg_raw) {
   if (fio_ary_count(&postoffice.meta.ary) == 0) {
@@ -470,32 +873,21 @@ static void publish2process(int32_t filter, FIOBJ channel, FIOBJ msg,
       call_meta_callbacks(m, m->msg.channel, m->msg.msg);
     }
   }
+  subscription_snapshot_s snapshot = SUBSCRIPTION_SNAPSHOT_INIT(snapshot);
   if (filter) {
     FIOBJ key = fiobj_num_new((uintptr_t)filter);
-    spn_lock(&postoffice.filters.lock);
-    channel_s *ch = fio_hash_find(&postoffice.filters.channels, key);
-    publish2channel(ch, m);
-    spn_unlock(&postoffice.filters.lock);
-    internal_message_free(m);
-    return;
-  }
-  /* exact match */
-  spn_lock(&postoffice.pubsub.lock);
-  channel_s *ch = fio_hash_find(&postoffice.pubsub.channels, channel);
-  publish2channel(ch, m);
-  spn_unlock(&postoffice.pubsub.lock);
-  /* test patterns */
-  spn_lock(&postoffice.patterns.lock);
-  FIO_HASH_FOR_LOOP(&postoffice.patterns.channels, p) {
-    if (!p->obj) {
-      continue;
-    }
-    pattern_s *pattern = p->obj;
-    if (pattern->match(pattern->ch.id, channel)) {
-      publish2channel(&pattern->ch, m);
-    }
+    subscription_snapshot_find(
+        &snapshot, postoffice_shard(postoffice.filters, key), key);
+  } else {
+    /* exact match */
+    subscription_snapshot_find(
+        &snapshot, postoffice_shard(postoffice.pubsub, channel), channel);
+    /* test patterns */
+    spn_lock(&postoffice.patterns.lock);
+    pattern_index_snapshot(channel, &snapshot);
+    spn_unlock(&postoffice.patterns.lock);
   }
-  spn_unlock(&postoffice.patterns.lock);
+  subscription_snapshot_publish(&snapshot, m);
   internal_message_free(m);
 }
 
@@ -869,6 +1261,551 @@ cluster_alloc(intptr_t uuid, void (*handler)(struct cluster_pr_s *pr),
   return &p->protocol;
 }
 
+/* *****************************************************************************
+ * Shared Memory Transport
+ *
+ * Pub/Sub messages (filter and channel messages) can skip the root's relay.
+ *
+ * Before forking, the root maps a single ring buffer for every (publisher,
+ * subscriber) pair of processes. Each ring has a single producer and a single
+ * consumer, so no locks are shared between processes. Publishing copies the
+ * message into the publisher's ring for every other process and rings the
+ * receiving process's `eventfd` doorbell (unless it's already ringing).
+ *
+ * When a ring is full (or a message is larger than the ring), the message is
+ * queued in the publisher's backlog for that peer only, and every later
+ * message to the same peer waits behind it, so each peer receives messages in
+ * the order they were published. Backlogged messages are streamed into the
+ * ring as the consumer makes room (the consumer rings the producer's doorbell
+ * once it reads from a ring marked as `blocked`).
+ *
+ * Control messages (subscriptions, shutdown, root messages) still use the
+ * cluster socket.
+ **************************************************************************** */
+
+#ifndef FACIL_CLUSTER_SHM
+#if defined(__linux__)
+/** Enables the shared memory pub/sub transport (requires `eventfd`). */
+#define FACIL_CLUSTER_SHM 1
+#else
+#define FACIL_CLUSTER_SHM 0
+#endif
+#endif
+
+#ifndef FACIL_CLUSTER_SHM_RING
+/**
+ * The size of each ring buffer in bytes (MUST be a power of 2).
+ *
+ * A ring is mapped for each pair of processes, so the total memory mapped is
+ * `(workers + 1) * workers * FACIL_CLUSTER_SHM_RING` (pages are only allocated
+ * once used).
+ */
+#define FACIL_CLUSTER_SHM_RING (1UL << 16)
+#endif
+
+#ifndef FACIL_CLUSTER_SHM_LIMIT
+/** The shared memory transport is disabled for larger worker counts. */
+#define FACIL_CLUSTER_SHM_LIMIT 64
+#endif
+
+#if FACIL_CLUSTER_SHM
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+typedef struct {
+  /** The producer's position (total bytes written). */
+  volatile size_t head;
+  /** The last consumer `epoch` acknowledged (and reset) by the producer. */
+  volatile size_t acked;
+  /** Incremented whenever a new producer (worker) claims the ring. */
+  volatile size_t reset;
+  uint8_t pad_[64 - (sizeof(size_t) * 3)];
+  /** The consumer's position (total bytes read). */
+  volatile size_t tail;
+  /** Incremented whenever a new consumer (worker) claims the ring. */
+  volatile size_t epoch;
+  /** The last producer `reset` acknowledged (and reset) by the consumer. */
+  volatile size_t reset_ack;
+  uint8_t pad2_[64 - (sizeof(size_t) * 3)];
+  /** Set by a producer waiting for room (cleared by the consumer). */
+  volatile size_t blocked;
+  uint8_t pad3_[64 - sizeof(size_t)];
+  uint8_t data[FACIL_CLUSTER_SHM_RING];
+} cluster_shm_ring_s;
+
+/** The calling process's (unshared) state for each peer. */
+typedef struct {
+  /** Messages to the peer waiting for room in the ring, oldest first. */
+  fio_ls_s backlog;
+  /** The number of bytes of the oldest message already written. */
+  size_t offset;
+  /** A message from the peer that is still being read. */
+  FIOBJ ch;
+  FIOBJ msg;
+  size_t got;
+  uint32_t ch_len;
+  uint32_t msg_len;
+  uint32_t type;
+  int32_t filter;
+  uint8_t reading;
+} cluster_shm_local_s;
+
+typedef struct {
+  /** Set while a doorbell was rung and not yet answered. */
+  spn_lock_i signaled;
+  /** The process's doorbell (an `eventfd`, inherited by all processes). */
+  int doorbell;
+  uint8_t pad_[64 - sizeof(int) - sizeof(spn_lock_i)];
+} cluster_shm_peer_s;
+
+static struct {
+  /** The shared mapping, peer data followed by the rings. */
+  void *map;
+  size_t map_len;
+  cluster_shm_peer_s *peers;
+  cluster_shm_ring_s *rings;
+  /** Number of processes (the root uses the last slot). */
+  size_t count;
+  /** The calling process's slot. */
+  size_t self;
+  /** The calling process's doorbell connection. */
+  intptr_t uuid;
+  /** The calling process's state for each peer (`count` items). */
+  cluster_shm_local_s *local;
+  /** Protects the calling process's outgoing rings (and backlogs). */
+  spn_lock_i lock;
+} cluster_shm = {.uuid = -1};
+
+/** The ring used to send messages from process `from` to process `to`. */
+#define cluster_shm_ring(from, to)                                             \
+  (cluster_shm.rings + ((from)*cluster_shm.count) + (to))
+
+/** Discards a peer's backlog. */
+static void cluster_shm_backlog_clear(cluster_shm_local_s *l) {
+  while (fio_ls_any(&l->backlog))
+    fiobj_free((FIOBJ)fio_ls_shift(&l->backlog));
+  l->offset = 0;
+}
+
+/** Releases the calling process's (unshared) state. */
+static void cluster_shm_local_free(void) {
+  if (!cluster_shm.local)
+    return;
+  for (size_t i = 0; i < cluster_shm.count; ++i) {
+    cluster_shm_backlog_clear(cluster_shm.local + i);
+    fiobj_free(cluster_shm.local[i].ch);
+    fiobj_free(cluster_shm.local[i].msg);
+  }
+  free(cluster_shm.local);
+  cluster_shm.local = NULL;
+}
+
+/** Releases the shared memory (and doorbells). */
+static void cluster_shm_destroy(void) {
+  if (!cluster_shm.map)
+    return;
+  cluster_shm_local_free();
+  for (size_t i = 0; i < cluster_shm.count; ++i) {
+    if (cluster_shm.peers[i].doorbell != -1)
+      close(cluster_shm.peers[i].doorbell);
+  }
+  munmap(cluster_shm.map, cluster_shm.map_len);
+  cluster_shm.map = NULL;
+  cluster_shm.peers = NULL;
+  cluster_shm.rings = NULL;
+  cluster_shm.count = 0;
+}
+
+/** Maps the shared memory, called by the root before any worker is forked. */
+static void cluster_shm_init(void) {
+  cluster_shm_destroy();
+  const size_t workers = (size_t)facil_is_running();
+  if (workers <= 1 || workers > FACIL_CLUSTER_SHM_LIMIT)
+    return;
+  const size_t count = workers + 1;
+  const size_t peers_len = sizeof(cluster_shm_peer_s) * count;
+  const size_t len = peers_len + (sizeof(cluster_shm_ring_s) * count * count);
+  void *map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    perror("WARNING: (facil.io cluster) shared memory unavailable");
+    return;
+  }
+  cluster_shm.map = map;
+  cluster_shm.map_len = len;
+  cluster_shm.peers = map;
+  cluster_shm.rings = (cluster_shm_ring_s *)((uint8_t *)map + peers_len);
+  cluster_shm.count = count;
+  for (size_t i = 0; i < count; ++i) {
+    cluster_shm.peers[i].doorbell = -1;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    cluster_shm.peers[i].doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (cluster_shm.peers[i].doorbell == -1) {
+      perror("WARNING: (facil.io cluster) couldn't create eventfd");
+      cluster_shm_destroy();
+      return;
+    }
+  }
+}
+
+/** Copies data into the ring at the (unmasked) position `pos`. */
+static inline void cluster_shm_write(cluster_shm_ring_s *r, size_t pos,
+                                     const void *src, size_t len) {
+  pos &= (FACIL_CLUSTER_SHM_RING - 1);
+  size_t first = FACIL_CLUSTER_SHM_RING - pos;
+  if (first > len)
+    first = len;
+  memcpy(r->data + pos, src, first);
+  if (len > first)
+    memcpy(r->data, (uint8_t *)src + first, len - first);
+}
+
+/** Copies data out of the ring from the (unmasked) position `pos`. */
+static inline void cluster_shm_read(cluster_shm_ring_s *r, size_t pos,
+                                    void *dest, size_t len) {
+  pos &= (FACIL_CLUSTER_SHM_RING - 1);
+  size_t first = FACIL_CLUSTER_SHM_RING - pos;
+  if (first > len)
+    first = len;
+  memcpy(dest, r->data + pos, first);
+  if (len > first)
+    memcpy((uint8_t *)dest + first, r->data, len - first);
+}
+
+/** Rings a process's doorbell, unless it's already ringing. */
+static inline void cluster_shm_wake(size_t i) {
+  if (spn_trylock(&cluster_shm.peers[i].signaled))
+    return;
+  uint64_t one = 1;
+  if (write(cluster_shm.peers[i].doorbell, &one, sizeof(one)) < 0)
+    one = 0; /* the counter can't overflow, the process is awake anyway. */
+}
+
+/** Returns the number of bytes that can be written to the ring. */
+static inline size_t cluster_shm_room(cluster_shm_ring_s *r) {
+  return FACIL_CLUSTER_SHM_RING - (r->head - spn_add(&r->tail, 0));
+}
+
+/**
+ * Resets the ring to peer `i` (discarding the backlog) if a new worker claimed
+ * the peer's slot. Call only while `cluster_shm.lock` is held.
+ */
+static void cluster_shm_ack_unsafe(size_t i) {
+  cluster_shm_ring_s *r = cluster_shm_ring(cluster_shm.self, i);
+  const size_t epoch = spn_add(&r->epoch, 0);
+  if (r->acked == epoch)
+    return;
+  /* the new consumer ignores the ring until it's acknowledged */
+  cluster_shm_backlog_clear(cluster_shm.local + i);
+  r->tail = r->head;
+  __atomic_store_n(&r->acked, epoch, __ATOMIC_RELEASE);
+}
+
+/**
+ * Tests if the consumer discarded any partial message written by a previous
+ * producer (a worker that used the same slot), so the ring can be written to.
+ */
+static inline int cluster_shm_ready(cluster_shm_ring_s *r) {
+  return __atomic_load_n(&r->reset_ack, __ATOMIC_ACQUIRE) == r->reset;
+}
+
+/**
+ * Streams the backlog to peer `i` into the ring, as room allows. Call only
+ * while `cluster_shm.lock` is held.
+ */
+static void cluster_shm_flush_unsafe(size_t i) {
+  cluster_shm_ring_s *r = cluster_shm_ring(cluster_shm.self, i);
+  cluster_shm_local_s *l = cluster_shm.local + i;
+  uint8_t written = 0;
+  if (!cluster_shm_ready(r)) {
+    /* the consumer wakes the producer once it acknowledged the reset. */
+    cluster_shm_wake(i);
+    return;
+  }
+  while (fio_ls_any(&l->backlog)) {
+    size_t room = cluster_shm_room(r);
+    if (!room) {
+      /* ask for a wakeup, testing again in case room was just made. */
+      __atomic_store_n(&r->blocked, 1, __ATOMIC_SEQ_CST);
+      room = cluster_shm_room(r);
+      if (!room)
+        break;
+    }
+    fio_cstr_s data = fiobj_obj2cstr((FIOBJ)l->backlog.next->obj);
+    size_t len = data.len - l->offset;
+    if (len > room)
+      len = room;
+    cluster_shm_write(r, r->head, data.bytes + l->offset, len);
+    spn_add(&r->head, len);
+    written = 1;
+    l->offset += len;
+    if (l->offset == data.len) {
+      fiobj_free((FIOBJ)fio_ls_shift(&l->backlog));
+      l->offset = 0;
+    }
+  }
+  if (written)
+    cluster_shm_wake(i);
+}
+
+/**
+ * Writes a message to all the other processes.
+ *
+ * A message that doesn't fit in a peer's ring (or that must wait behind that
+ * peer's backlog) is added to the peer's backlog.
+ *
+ * Returns -1 (nothing is written) if the shared memory transport isn't
+ * available, so the message can be sent over the cluster socket instead.
+ */
+static int cluster_shm_send(int32_t filter, fio_cstr_s ch, fio_cstr_s msg,
+                            cluster_message_type_e type) {
+  if (!cluster_shm.map || !cluster_shm.local || cluster_shm.uuid == -1)
+    return -1;
+  const size_t total = 16 + ch.len + msg.len;
+  uint8_t header[16];
+  cluster_uint2str(header, (uint32_t)ch.len);
+  cluster_uint2str(header + 4, (uint32_t)msg.len);
+  cluster_uint2str(header + 8, (uint32_t)type);
+  cluster_uint2str(header + 12, (uint32_t)filter);
+  FIOBJ queued = FIOBJ_INVALID;
+  spn_lock(&cluster_shm.lock);
+  for (size_t i = 0; i < cluster_shm.count; ++i) {
+    if (i == cluster_shm.self)
+      continue;
+    cluster_shm_ack_unsafe(i);
+    cluster_shm_ring_s *r = cluster_shm_ring(cluster_shm.self, i);
+    if (fio_ls_is_empty(&cluster_shm.local[i].backlog) &&
+        cluster_shm_ready(r) && cluster_shm_room(r) >= total) {
+      /* consumers only free space, so a successful test can't be
+       * invalidated. */
+      const size_t pos = r->head;
+      cluster_shm_write(r, pos, header, 16);
+      if (ch.len)
+        cluster_shm_write(r, pos + 16, ch.data, ch.len);
+      if (msg.len)
+        cluster_shm_write(r, pos + 16 + ch.len, msg.data, msg.len);
+      spn_add(&r->head, total);
+      cluster_shm_wake(i);
+      continue;
+    }
+    if (!queued) {
+      queued = fiobj_str_buf(total);
+      fiobj_str_write(queued, (char *)header, 16);
+      fiobj_str_write(queued, ch.data, ch.len);
+      fiobj_str_write(queued, msg.data, msg.len);
+    }
+    fio_ls_unshift(&cluster_shm.local[i].backlog, (void *)fiobj_dup(queued));
+    cluster_shm_flush_unsafe(i);
+  }
+  spn_unlock(&cluster_shm.lock);
+  fiobj_free(queued);
+  return 0;
+}
+
+/**
+ * Reads up to `len` bytes of the message being read from peer `i` (starting at
+ * the ring's position `pos`).
+ */
+static inline void cluster_shm_read_part(cluster_shm_ring_s *r, size_t pos,
+                                         cluster_shm_local_s *l, size_t len) {
+  if (l->got < l->ch_len) {
+    size_t part = l->ch_len - l->got;
+    if (part > len)
+      part = len;
+    cluster_shm_read(r, pos, fiobj_obj2cstr(l->ch).data + l->got, part);
+    pos += part;
+    len -= part;
+    l->got += part;
+  }
+  if (len) {
+    cluster_shm_read(r, pos,
+                     fiobj_obj2cstr(l->msg).data + (l->got - l->ch_len), len);
+    l->got += len;
+  }
+}
+
+/** Allocates a String object for `len` bytes (or FIOBJ_INVALID if empty). */
+static inline FIOBJ cluster_shm_str(size_t len) {
+  if (!len)
+    return FIOBJ_INVALID;
+  FIOBJ str = fiobj_str_buf(len);
+  fiobj_str_resize(str, len);
+  return str;
+}
+
+/**
+ * Publishes all the messages waiting in the calling process's rings and
+ * streams the calling process's backlogs.
+ */
+static void cluster_shm_on_data(intptr_t uuid, protocol_s *pr) {
+  uint64_t count;
+  if (read(sock_uuid2fd(uuid), &count, sizeof(count)) < 0)
+    count = 0; /* a previous review already consumed the messages. */
+  /* clearing the flag first prevents lost wakeups. */
+  spn_unlock(&cluster_shm.peers[cluster_shm.self].signaled);
+  /* a consumer might have made room for a backlog. */
+  spn_lock(&cluster_shm.lock);
+  for (size_t i = 0; i < cluster_shm.count; ++i) {
+    if (i == cluster_shm.self ||
+        fio_ls_is_empty(&cluster_shm.local[i].backlog))
+      continue;
+    cluster_shm_ack_unsafe(i);
+    cluster_shm_flush_unsafe(i);
+  }
+  spn_unlock(&cluster_shm.lock);
+  for (size_t i = 0; i < cluster_shm.count; ++i) {
+    if (i == cluster_shm.self)
+      continue;
+    cluster_shm_ring_s *r = cluster_shm_ring(i, cluster_shm.self);
+    if (__atomic_load_n(&r->acked, __ATOMIC_ACQUIRE) != r->epoch)
+      continue;
+    cluster_shm_local_s *l = cluster_shm.local + i;
+    const size_t reset = spn_add(&r->reset, 0);
+    if (r->reset_ack != reset) {
+      /* a new producer waits (writes nothing) until it's acknowledged. */
+      fiobj_free(l->ch);
+      fiobj_free(l->msg);
+      l->ch = l->msg = FIOBJ_INVALID;
+      l->reading = 0;
+      r->tail = r->head;
+      __atomic_store_n(&r->reset_ack, reset, __ATOMIC_RELEASE);
+      cluster_shm_wake(i);
+      continue;
+    }
+    const size_t head = spn_add(&r->head, 0);
+    size_t pos = r->tail;
+    while (pos != head) {
+      if (!l->reading) {
+        /* a backlogged header might be written in parts. */
+        if (head - pos < 16)
+          break;
+        uint8_t header[16];
+        cluster_shm_read(r, pos, header, 16);
+        l->ch_len = cluster_str2uint32(header);
+        l->msg_len = cluster_str2uint32(header + 4);
+        l->type = cluster_str2uint32(header + 8);
+        l->filter = (int32_t)cluster_str2uint32(header + 12);
+        l->ch = cluster_shm_str(l->ch_len);
+        l->msg = cluster_shm_str(l->msg_len);
+        l->got = 0;
+        l->reading = 1;
+        pos += 16;
+        spn_add(&r->tail, 16);
+      }
+      size_t len = (size_t)l->ch_len + l->msg_len - l->got;
+      if (len > head - pos)
+        len = head - pos;
+      cluster_shm_read_part(r, pos, l, len);
+      pos += len;
+      spn_add(&r->tail, len);
+      if (l->got < (size_t)l->ch_len + l->msg_len)
+        break;
+      l->reading = 0;
+      publish2process(l->filter, l->ch, l->msg,
+                      (cluster_message_type_e)l->type);
+      fiobj_free(l->ch);
+      fiobj_free(l->msg);
+      l->ch = l->msg = FIOBJ_INVALID;
+    }
+    if (r->blocked && __atomic_exchange_n(&r->blocked, 0, __ATOMIC_SEQ_CST))
+      cluster_shm_wake(i);
+  }
+  (void)pr;
+}
+
+static void cluster_shm_on_close(intptr_t uuid, protocol_s *pr) {
+  if (cluster_shm.uuid == uuid)
+    cluster_shm.uuid = -1;
+  free(pr);
+}
+
+static uint8_t cluster_shm_on_shutdown(intptr_t uuid, protocol_s *pr) {
+  return 255;
+  (void)pr;
+  (void)uuid;
+}
+
+static void cluster_shm_ping(intptr_t uuid, protocol_s *pr) {
+  sock_touch(uuid);
+  (void)pr;
+}
+
+/**
+ * Claims the calling process's slot, discarding any stale messages left for a
+ * previous worker in the same slot, and starts listening to the doorbell.
+ */
+static void cluster_shm_on_start(void) {
+  if (!cluster_shm.map)
+    return;
+  cluster_shm.lock = SPN_LOCK_INIT;
+  cluster_shm.uuid = -1;
+  cluster_shm.self = (facil_parent_pid() == getpid())
+                         ? cluster_shm.count - 1
+                         : (size_t)facil_worker_id();
+  /* a worker inherits the root's state, which is discarded. */
+  cluster_shm_local_free();
+  cluster_shm.local = malloc(sizeof(*cluster_shm.local) * cluster_shm.count);
+  if (!cluster_shm.local)
+    return;
+  for (size_t i = 0; i < cluster_shm.count; ++i) {
+    cluster_shm.local[i] = (cluster_shm_local_s){.ch = FIOBJ_INVALID};
+    cluster_shm.local[i].backlog =
+        (fio_ls_s)FIO_LS_INIT(cluster_shm.local[i].backlog);
+  }
+  /* a previous worker might have left partial messages in the rings. The
+   * producers (consumers) reset the incoming (outgoing) rings once they
+   * acknowledge the new epoch (reset), waking them lets them do so sooner. */
+  for (size_t i = 0; i < cluster_shm.count; ++i) {
+    if (i == cluster_shm.self)
+      continue;
+    spn_add(&cluster_shm_ring(i, cluster_shm.self)->epoch, 1);
+    spn_add(&cluster_shm_ring(cluster_shm.self, i)->reset, 1);
+    cluster_shm_wake(i);
+  }
+  /* connections are closed when forking, so the doorbell is duplicated. */
+  int fd = dup(cluster_shm.peers[cluster_shm.self].doorbell);
+  if (fd == -1)
+    return;
+  intptr_t uuid = sock_open(fd);
+  if (uuid == -1) {
+    close(fd);
+    return;
+  }
+  protocol_s *pr = malloc(sizeof(*pr));
+  if (!pr) {
+    sock_close(uuid);
+    return;
+  }
+  *pr = (protocol_s){
+      .service = "_facil.io_cluster_shm_",
+      .on_data = cluster_shm_on_data,
+      .on_close = cluster_shm_on_close,
+      .on_shutdown = cluster_shm_on_shutdown,
+      .ping = cluster_shm_ping,
+  };
+  if (facil_attach(uuid, pr))
+    return;
+  cluster_shm.uuid = uuid;
+  /* messages might have been published before the doorbell was ready. */
+  spn_unlock(&cluster_shm.peers[cluster_shm.self].signaled);
+  cluster_shm_wake(cluster_shm.self);
+}
+
+/** Prevents a new worker from using its parent's slot. */
+static void cluster_shm_on_fork(void) { cluster_shm.uuid = -1; }
+
+#else /* FACIL_CLUSTER_SHM */
+
+#define cluster_shm_init()
+#define cluster_shm_destroy()
+#define cluster_shm_on_start()
+#define cluster_shm_on_fork()
+#define cluster_shm_send(...) (-1)
+
+#endif /* FACIL_CLUSTER_SHM */
+
 /* *****************************************************************************
  * Master (server) IPC Connections
  **************************************************************************** */
@@ -878,10 +1815,11 @@ cluster_alloc(intptr_t uuid, void (*handler)(struct cluster_pr_s *pr),
  */
 static void mock_on_message(facil_msg_s *msg) { (void)msg; }
 
-static void cluster_server_sender(FIOBJ data) {
+/** Sends the data to all the workers, except the `origin` (if any). */
+static void cluster_server_forward(FIOBJ data, intptr_t origin) {
   spn_lock(&cluster_data.lock);
   FIO_LS_FOR(&cluster_data.clients, pos) {
-    if ((intptr_t)pos->obj > 0) {
+    if ((intptr_t)pos->obj > 0 && (intptr_t)pos->obj != origin) {
       fiobj_send_free((intptr_t)pos->obj, fiobj_dup(data));
     }
   }
@@ -889,6 +1827,10 @@ static void cluster_server_sender(FIOBJ data) {
   fiobj_free(data);
 }
 
+static void cluster_server_sender(FIOBJ data) {
+  cluster_server_forward(data, -1);
+}
+
 static void cluster_server_handler(struct cluster_pr_s *pr) {
   /* what to do? */
   switch ((cluster_message_type_e)pr->type) {
@@ -897,8 +1839,9 @@ static void cluster_server_handler(struct cluster_pr_s *pr) {
   case CLUSTER_MESSAGE_JSON: {
     fio_cstr_s cs = fiobj_obj2cstr(pr->channel);
     fio_cstr_s ms = fiobj_obj2cstr(pr->msg);
-    cluster_server_sender(cluster_wrap_message(cs.len, ms.len, pr->type,
-                                               pr->filter, cs.bytes, ms.bytes));
+    cluster_server_forward(cluster_wrap_message(cs.len, ms.len, pr->type,
+                                                pr->filter, cs.bytes, ms.bytes),
+                           pr->uuid);
     publish2process(pr->filter, pr->channel, pr->msg,
                     (cluster_message_type_e)pr->type);
     break;
@@ -1014,6 +1957,7 @@ static void facil_listen2cluster(void *ignore) {
   /* this is called for each `fork`, but we only need this to run once. */
   spn_lock(&cluster_data.lock);
   cluster_init();
+  cluster_shm_init();
   cluster_data.listener = sock_listen(cluster_data.name, NULL);
   spn_unlock(&cluster_data.lock);
   if (cluster_data.listener < 0) {
@@ -1048,6 +1992,7 @@ static void facil_listen2cluster(void *ignore) {
 static void facil_cluster_cleanup(void *ignore) {
   /* cleanup the cluster data */
   cluster_data_cleanup(facil_parent_pid() == getpid());
+  cluster_shm_destroy();
   (void)ignore;
 }
 
@@ -1101,14 +2046,16 @@ void facil_cluster_on_connect(intptr_t uuid, void *udata) {
     exit(errno);
   }
   /* inform root about all existing channels */
-  spn_lock(&postoffice.pubsub.lock);
-  FIO_HASH_FOR_LOOP(&postoffice.pubsub.channels, pos) {
-    if (!pos->obj) {
-      continue;
+  POSTOFFICE_SHARD_FOR(postoffice.pubsub, shard) {
+    spn_lock(&shard->lock);
+    FIO_HASH_FOR_LOOP(&shard->channels, pos) {
+      if (!pos->obj) {
+        continue;
+      }
+      inform_root_about_channel(((channel_s *)pos->obj)->id, NULL, 1);
     }
-    inform_root_about_channel(((channel_s *)pos->obj)->id, NULL, 1);
+    spn_unlock(&shard->lock);
   }
-  spn_unlock(&postoffice.pubsub.lock);
   spn_lock(&postoffice.patterns.lock);
   FIO_HASH_FOR_LOOP(&postoffice.patterns.channels, pos) {
     if (!pos->obj) {
@@ -1137,6 +2084,7 @@ void facil_cluster_on_fail(intptr_t uuid, void *udata) {
 // uint8_t timeout;
 
 static void facil_connect2cluster(void *ignore) {
+  cluster_shm_on_start();
   if (facil_parent_pid() != getpid()) {
     /* this is called for each child. */
     cluster_data.client =
@@ -1164,6 +2112,10 @@ static void facil_send2cluster(int32_t filter, FIOBJ ch, FIOBJ msg,
   }
   fio_cstr_s cs = fiobj_obj2cstr(ch);
   fio_cstr_s ms = fiobj_obj2cstr(msg);
+  if ((type == CLUSTER_MESSAGE_FORWARD || type == CLUSTER_MESSAGE_JSON) &&
+      !cluster_shm_send(filter, cs, ms, type)) {
+    return;
+  }
   if (cluster_data.client > 0) {
     cluster_client_sender(
         cluster_wrap_message(cs.len, ms.len, type, filter, cs.bytes, ms.bytes));
@@ -1215,31 +2167,29 @@ static void facil_connect_after_fork(void *ignore) {
 }
 
 static void facil_cluster_in_child(void *ignore) {
+  cluster_shm_on_fork();
   postoffice.patterns.lock = SPN_LOCK_INIT;
-  postoffice.pubsub.lock = SPN_LOCK_INIT;
-  postoffice.filters.lock = SPN_LOCK_INIT;
   postoffice.engines.lock = SPN_LOCK_INIT;
   postoffice.meta.lock = SPN_LOCK_INIT;
   fio_hash_compact(&postoffice.patterns.channels);
-  fio_hash_compact(&postoffice.pubsub.channels);
-  fio_hash_compact(&postoffice.filters.channels);
   FIO_HASH_FOR_LOOP(&postoffice.patterns.channels, pos) {
     if (!pos->obj) {
       continue;
     }
     ((channel_s *)pos->obj)->lock = SPN_LOCK_INIT;
   }
-  FIO_HASH_FOR_LOOP(&postoffice.pubsub.channels, pos) {
-    if (!pos->obj) {
-      continue;
-    }
-    ((channel_s *)pos->obj)->lock = SPN_LOCK_INIT;
-  }
-  FIO_HASH_FOR_LOOP(&postoffice.filters.channels, pos) {
-    if (!pos->obj) {
-      continue;
+  collection_s *registries[] = {postoffice.pubsub, postoffice.filters};
+  for (size_t i = 0; i < 2; ++i) {
+    POSTOFFICE_SHARD_FOR(registries[i], shard) {
+      shard->lock = SPN_LOCK_INIT;
+      fio_hash_compact(&shard->channels);
+      FIO_HASH_FOR_LOOP(&shard->channels, pos) {
+        if (!pos->obj) {
+          continue;
+        }
+        ((channel_s *)pos->obj)->lock = SPN_LOCK_INIT;
+      }
     }
-    ((channel_s *)pos->obj)->lock = SPN_LOCK_INIT;
   }
   (void)ignore;
 }
@@ -1256,26 +2206,27 @@ static void facil_cluster_at_exit(void *ignore) {
       facil_unsubscribe(sub);
     }
   }
-  while (fio_hash_count(&postoffice.pubsub.channels)) {
-    channel_s *ch = fio_hash_last(&postoffice.pubsub.channels, NULL);
-    while (fio_ls_embd_any(&ch->subscriptions)) {
-      subscription_s *sub =
-          FIO_LS_EMBD_OBJ(subscription_s, node, ch->subscriptions.next);
-      facil_unsubscribe(sub);
-    }
-  }
-  while (fio_hash_count(&postoffice.filters.channels)) {
-    channel_s *ch = fio_hash_last(&postoffice.filters.channels, NULL);
-    while (fio_ls_embd_any(&ch->subscriptions)) {
-      subscription_s *sub =
-          FIO_LS_EMBD_OBJ(subscription_s, node, ch->subscriptions.next);
-      facil_unsubscribe(sub);
+  collection_s *registries[] = {postoffice.pubsub, postoffice.filters};
+  for (size_t i = 0; i < 2; ++i) {
+    POSTOFFICE_SHARD_FOR(registries[i], shard) {
+      while (fio_hash_count(&shard->channels)) {
+        channel_s *ch = fio_hash_last(&shard->channels, NULL);
+        while (fio_ls_embd_any(&ch->subscriptions)) {
+          subscription_s *sub =
+              FIO_LS_EMBD_OBJ(subscription_s, node, ch->subscriptions.next);
+          facil_unsubscribe(sub);
+        }
+      }
     }
   }
 
   FIO_HASH_FOR_FREE(&postoffice.patterns.channels, pos) { (void)pos; }
-  FIO_HASH_FOR_FREE(&postoffice.pubsub.channels, pos) { (void)pos; }
-  FIO_HASH_FOR_FREE(&postoffice.filters.channels, pos) { (void)pos; }
+  pattern_index_free();
+  for (size_t i = 0; i < 2; ++i) {
+    POSTOFFICE_SHARD_FOR(registries[i], shard) {
+      FIO_HASH_FOR_FREE(&shard->channels, pos) { (void)pos; }
+    }
+  }
 
   /* clear engines */
   FACIL_PUBSUB_DEFAULT = FACIL_PUBSUB_CLUSTER;
@@ -1455,15 +2406,17 @@ void facil_pubsub_attach(pubsub_engine_s *engine) {
   fio_hash_insert(&postoffice.engines.channels, key, engine);
   spn_unlock(&postoffice.engines.lock);
   if (engine->subscribe) {
-    spn_lock(&postoffice.pubsub.lock);
-    FIO_HASH_FOR_LOOP(&postoffice.pubsub.channels, i) {
-      if (!i->obj) {
-        continue;
+    POSTOFFICE_SHARD_FOR(postoffice.pubsub, shard) {
+      spn_lock(&shard->lock);
+      FIO_HASH_FOR_LOOP(&shard->channels, i) {
+        if (!i->obj) {
+          continue;
+        }
+        channel_s *ch = i->obj;
+        engine->subscribe(engine, ch->id, NULL);
       }
-      channel_s *ch = i->obj;
-      engine->subscribe(engine, ch->id, NULL);
+      spn_unlock(&shard->lock);
     }
-    spn_unlock(&postoffice.pubsub.lock);
     spn_lock(&postoffice.patterns.lock);
     FIO_HASH_FOR_LOOP(&postoffice.patterns.channels, i) {
       if (!i->obj) {
@@ -1512,15 +2465,17 @@ void facil_pubsub_detach(pubsub_engine_s *engine) {
  */
 void facil_pubsub_reattach(pubsub_engine_s *engine) {
   if (engine->subscribe) {
-    spn_lock(&postoffice.pubsub.lock);
-    FIO_HASH_FOR_LOOP(&postoffice.pubsub.channels, i) {
-      if (!i->obj) {
-        continue;
+    POSTOFFICE_SHARD_FOR(postoffice.pubsub, shard) {
+      spn_lock(&shard->lock);
+      FIO_HASH_FOR_LOOP(&shard->channels, i) {
+        if (!i->obj) {
+          continue;
+        }
+        channel_s *ch = i->obj;
+        engine->subscribe(engine, ch->id, NULL);
       }
-      channel_s *ch = i->obj;
-      engine->subscribe(engine, ch->id, NULL);
+      spn_unlock(&shard->lock);
     }
-    spn_unlock(&postoffice.pubsub.lock);
     spn_lock(&postoffice.patterns.lock);
     FIO_HASH_FOR_LOOP(&postoffice.patterns.channels, i) {
       if (!i->obj) {
@@ -1648,3 +2603,414 @@ static int facil_glob_match(FIOBJ pattern, FIOBJ channel) {
 }
 
 facil_match_fn FACIL_MATCH_GLOB = facil_glob_match;
+
+/* *****************************************************************************
+ * Testing
+ **************************************************************************** */
+
+#if DEBUG
+/* counts the messages delivered to a test subscription. */
+static void cluster_test_count(facil_msg_s *msg) { ++*(size_t *)msg->udata1; }
+
+/* publishes a message to the calling process, performing the deliveries. */
+static void cluster_test_publish(const char *channel) {
+  FIOBJ ch = fiobj_str_new(channel, strlen(channel));
+  publish2process(0, ch, FIOBJ_INVALID, CLUSTER_MESSAGE_FORWARD);
+  fiobj_free(ch);
+  defer_perform();
+}
+
+/* logs the order in which messages are delivered (deferring one message). */
+typedef struct {
+  char log[8];
+  size_t len;
+  /* the (first letter of the) message to be deferred once. */
+  char defer;
+} cluster_test_order_s;
+
+static void cluster_test_order(facil_msg_s *msg) {
+  cluster_test_order_s *t = msg->udata1;
+  const char c = fiobj_obj2cstr(msg->msg).data[0];
+  if (c == t->defer) {
+    t->defer = 0;
+    facil_message_defer(msg);
+    return;
+  }
+  if (t->len < sizeof(t->log) - 1)
+    t->log[t->len++] = c;
+}
+
+#if FACIL_CLUSTER_SHM
+/* two processes sharing a ring, both played by the calling process. */
+typedef struct {
+  cluster_shm_local_s *local[2];
+  intptr_t uuid[2];
+  /* the number of the next message expected by the consumer. */
+  size_t next;
+  size_t errors;
+} cluster_shm_test_s;
+
+static void cluster_shm_test_on_message(facil_msg_s *msg) {
+  cluster_shm_test_s *t = msg->udata1;
+  if (strtoul(fiobj_obj2cstr(msg->msg).data, NULL, 10) == t->next)
+    ++t->next;
+  else
+    ++t->errors;
+}
+
+/* acts as process `self` (0 is the producer, 1 is the consumer). */
+static void cluster_shm_test_as(cluster_shm_test_s *t, size_t self) {
+  cluster_shm.self = self;
+  cluster_shm.local = t->local[self];
+  cluster_shm.uuid = t->uuid[self];
+}
+
+/* the producer publishes message number `i`, padded to `len` bytes. */
+static void cluster_shm_test_send(cluster_shm_test_s *t, size_t i,
+                                  size_t len) {
+  FIOBJ msg = fiobj_str_buf(len + 32);
+  fiobj_str_write2(msg, "%lu", (unsigned long)i);
+  fio_cstr_s str = fiobj_obj2cstr(msg);
+  if (len > str.len) {
+    fiobj_str_resize(msg, len);
+    memset(fiobj_obj2cstr(msg).data + str.len, ' ', len - str.len);
+  }
+  cluster_shm_test_as(t, 0);
+  cluster_shm_send(0, (fio_cstr_s){.data = (char *)"shm_test", .len = 8},
+                   fiobj_obj2cstr(msg), CLUSTER_MESSAGE_FORWARD);
+  fiobj_free(msg);
+}
+
+/* process `self` answers it's doorbell and performs the deliveries. */
+static void cluster_shm_test_wake(cluster_shm_test_s *t, size_t self) {
+  cluster_shm_test_as(t, self);
+  cluster_shm_on_data(t->uuid[self], NULL);
+  defer_perform();
+}
+#endif
+
+void facil_cluster_test(void) {
+#define TEST_ASSERT(cond, ...)                                                 \
+  if (!(cond)) {                                                               \
+    fprintf(stderr, "* " __VA_ARGS__);                                         \
+    fprintf(stderr, "\nTesting failed.\n");                                    \
+    exit(-1);                                                                  \
+  }
+  fprintf(stderr, "=== Testing pub/sub registry shards\n");
+  {
+    /* filters are small numbers, channels are Strings */
+    const size_t total = FACIL_PUBSUB_SHARDS * 256;
+    size_t filters[FACIL_PUBSUB_SHARDS] = {0};
+    size_t channels[FACIL_PUBSUB_SHARDS] = {0};
+    for (size_t i = 0; i < total; ++i) {
+      FIOBJ key = fiobj_num_new((intptr_t)i - (intptr_t)(total / 2));
+      ++filters[postoffice_shard(postoffice.filters, key) -
+                postoffice.filters];
+      fiobj_free(key);
+      key = fiobj_strprintf("channel %lu", (unsigned long)i);
+      ++channels[postoffice_shard(postoffice.pubsub, key) -
+                 postoffice.pubsub];
+      fiobj_free(key);
+    }
+    for (size_t i = 0; i < FACIL_PUBSUB_SHARDS; ++i) {
+      TEST_ASSERT(filters[i] > 128 && filters[i] < 512,
+                  "filters should be spread across shards (shard %lu: %lu)",
+                  (unsigned long)i, (unsigned long)filters[i]);
+      TEST_ASSERT(channels[i] > 128 && channels[i] < 512,
+                  "channels should be spread across shards (shard %lu: %lu)",
+                  (unsigned long)i, (unsigned long)channels[i]);
+    }
+  }
+  fprintf(stderr, "* Pub/Sub shards PASSED\n");
+  fprintf(stderr, "=== Testing the pattern index\n");
+  {
+    struct {
+      const char *pattern;
+      /* the depth of the pattern's node (the literal prefix's length) */
+      size_t depth;
+      subscription_s *sub;
+      size_t count;
+    } p[] = {
+        {.pattern = "news.*", .depth = 5},
+        {.pattern = "news.tech.*", .depth = 10},
+        {.pattern = "*.sport"},
+        {.pattern = "?ews.x"},
+        {.pattern = "[nN]ews.*"},
+        {.pattern = "\\*star"},
+        {.pattern = "exact", .depth = 5},
+    };
+    const size_t p_count = sizeof(p) / sizeof(p[0]);
+    for (size_t i = 0; i < p_count; ++i) {
+      FIOBJ ch = fiobj_str_new(p[i].pattern, strlen(p[i].pattern));
+      p[i].sub = facil_subscribe((subscribe_args_s){
+          .channel = ch,
+          .match = FACIL_MATCH_GLOB,
+          .on_message = cluster_test_count,
+          .udata1 = &p[i].count});
+      fiobj_free(ch);
+      TEST_ASSERT(p[i].sub, "pattern subscription failed (%s)", p[i].pattern);
+      size_t depth = 0;
+      for (pattern_node_s *node = ((pattern_s *)p[i].sub->parent)->node;
+           node != &pattern_index.root; node = node->parent)
+        ++depth;
+      TEST_ASSERT(depth == p[i].depth,
+                  "pattern %s should be indexed by %lu characters (%lu)",
+                  p[i].pattern, (unsigned long)p[i].depth,
+                  (unsigned long)depth);
+    }
+    TEST_ASSERT(pattern_index.count == p_count, "pattern count error");
+#define PATTERN_TEST_EXPECT(channel, ...)                                      \
+  do {                                                                         \
+    const size_t expect[] = {__VA_ARGS__};                                     \
+    for (size_t i = 0; i < p_count; ++i)                                       \
+      p[i].count = 0;                                                          \
+    cluster_test_publish(channel);                                             \
+    for (size_t i = 0; i < p_count; ++i)                                       \
+      TEST_ASSERT(p[i].count == expect[i],                                     \
+                  "pattern %s matched %s %lu times (expected %lu)",            \
+                  p[i].pattern, channel, (unsigned long)p[i].count,            \
+                  (unsigned long)expect[i]);                                   \
+  } while (0)
+    PATTERN_TEST_EXPECT("news.sport", 1, 0, 1, 0, 1, 0, 0);
+    PATTERN_TEST_EXPECT("news.tech.ai", 1, 1, 0, 0, 1, 0, 0);
+    PATTERN_TEST_EXPECT("News.x", 0, 0, 0, 1, 1, 0, 0);
+    PATTERN_TEST_EXPECT("bews.x", 0, 0, 0, 1, 0, 0, 0);
+    PATTERN_TEST_EXPECT("*star", 0, 0, 0, 0, 0, 1, 0);
+    PATTERN_TEST_EXPECT("xstar", 0, 0, 0, 0, 0, 0, 0);
+    PATTERN_TEST_EXPECT("exact", 0, 0, 0, 0, 0, 0, 1);
+    PATTERN_TEST_EXPECT("", 0, 0, 0, 0, 0, 0, 0);
+    /* cached results are invalidated by new and removed patterns */
+    {
+      FIOBJ key = fiobj_str_new("news.sport", 10);
+      pattern_matches_s *m = fio_hash_find(&pattern_index.cache, key);
+      TEST_ASSERT(m && m->count == 3, "channel matches should be cached");
+      size_t count = 0;
+      subscription_s *sub = facil_subscribe((subscribe_args_s){
+          .channel = key,
+          .match = FACIL_MATCH_GLOB,
+          .on_message = cluster_test_count,
+          .udata1 = &count});
+      TEST_ASSERT(!fio_hash_count(&pattern_index.cache),
+                  "a new pattern should clear the cache");
+      PATTERN_TEST_EXPECT("news.sport", 1, 0, 1, 0, 1, 0, 0);
+      TEST_ASSERT(count == 1, "a new pattern should match cached channels");
+      facil_unsubscribe(sub);
+      defer_perform();
+      TEST_ASSERT(!fio_hash_count(&pattern_index.cache),
+                  "a removed pattern should clear the cache");
+      PATTERN_TEST_EXPECT("news.sport", 1, 0, 1, 0, 1, 0, 0);
+      TEST_ASSERT(count == 1, "a removed pattern shouldn't match");
+      facil_unsubscribe(p[0].sub);
+      p[0].sub = NULL;
+      defer_perform();
+      PATTERN_TEST_EXPECT("news.sport", 0, 0, 1, 0, 1, 0, 0);
+      PATTERN_TEST_EXPECT("news.tech.ai", 0, 1, 0, 0, 1, 0, 0);
+      fiobj_free(key);
+    }
+    /* the cache is limited */
+    pattern_index_cache_clear();
+    for (size_t i = 0; i < FACIL_PATTERN_CACHE_LIMIT; ++i) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "news.tech.%lu", (unsigned long)i);
+      cluster_test_publish(buf);
+    }
+    TEST_ASSERT(fio_hash_count(&pattern_index.cache) ==
+                    FACIL_PATTERN_CACHE_LIMIT,
+                "the cache should hold up to FACIL_PATTERN_CACHE_LIMIT items");
+    PATTERN_TEST_EXPECT("news.sport", 0, 0, 1, 0, 1, 0, 0);
+    TEST_ASSERT(fio_hash_count(&pattern_index.cache) == 1,
+                "the cache should be cleared once it's full");
+#undef PATTERN_TEST_EXPECT
+    for (size_t i = 0; i < p_count; ++i) {
+      if (p[i].sub)
+        facil_unsubscribe(p[i].sub);
+    }
+    defer_perform();
+    TEST_ASSERT(!pattern_index.count && !pattern_index.root.children &&
+                    !fio_hash_count(&pattern_index.cache),
+                "the pattern index should be empty (and pruned)");
+  }
+  fprintf(stderr, "* Pattern index PASSED\n");
+  fprintf(stderr, "=== Testing pub/sub delivery order\n");
+  {
+    cluster_test_order_s t = {.len = 0};
+    FIOBJ ch = fiobj_str_new("order_test", 10);
+    subscription_s *s = facil_subscribe((subscribe_args_s){
+        .channel = ch, .on_message = cluster_test_order, .udata1 = &t});
+    TEST_ASSERT(s, "order test subscription failed");
+    /* `order` lists the messages in the order they are scheduled. */
+    struct {
+      const char *order;
+      char defer;
+    } cases[] = {{.order = "bac"}, {.order = "cba"}, {.order = "bca"},
+                 {.order = "bca", .defer = 'b'},
+                 {.order = "cba", .defer = 'c'}};
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+      facil_msg_internal_s *m[3];
+      subscription_target_s targets[3];
+      for (size_t i = 0; i < 3; ++i) {
+        /* published as a, b and c (the sequence numbers are in order) */
+        m[i] = fio_malloc(sizeof(*m[i]));
+        TEST_ASSERT(m[i], "memory allocation failed");
+        *m[i] = (facil_msg_internal_s){
+            .msg = {.channel = fiobj_dup(ch),
+                    .msg = fiobj_str_new((char[]){(char)('a' + i)}, 1)},
+            .ref = 2,
+        };
+        subscription_snapshot_s snapshot = SUBSCRIPTION_SNAPSHOT_INIT(snapshot);
+        subscription_snapshot_add(&snapshot, s->parent);
+        TEST_ASSERT(snapshot.count == 1, "order test snapshot error");
+        targets[i] = snapshot.targets[0];
+      }
+      t = (cluster_test_order_s){.defer = cases[c].defer};
+      for (size_t i = 0; i < 3; ++i) {
+        const size_t pos = cases[c].order[i] - 'a';
+        TEST_ASSERT(!perform_subscription_callback(targets[pos], m[pos]),
+                    "the subscription shouldn't be busy");
+        if (!strchr(cases[c].order + i + 1, 'a'))
+          continue;
+        TEST_ASSERT(!t.len && s->parked, "%s: %c should be parked",
+                    cases[c].order, cases[c].order[i]);
+      }
+      defer_perform();
+      TEST_ASSERT(!strcmp(t.log, "abc"),
+                  "%s (deferring %c): delivered out of order (%s)",
+                  cases[c].order, cases[c].defer ? cases[c].defer : '-',
+                  t.log);
+      TEST_ASSERT(!s->parked && s->ref == 1,
+                  "%s: parked messages should be released (%lu references)",
+                  cases[c].order, (unsigned long)s->ref);
+      for (size_t i = 0; i < 3; ++i) {
+        TEST_ASSERT(m[i]->ref == 1, "%s: message %c wasn't released",
+                    cases[c].order, (char)('a' + i));
+        internal_message_free(m[i]);
+      }
+    }
+    facil_unsubscribe(s);
+    fiobj_free(ch);
+    defer_perform();
+  }
+  fprintf(stderr, "* Pub/Sub delivery order PASSED\n");
+#if FACIL_CLUSTER_SHM
+  fprintf(stderr, "=== Testing the shared memory transport\n");
+  {
+    const size_t ring = FACIL_CLUSTER_SHM_RING;
+    cluster_shm_test_s t = {.next = 0};
+    FIOBJ ch = fiobj_str_new("shm_test", 8);
+    subscription_s *sub = facil_subscribe(
+        (subscribe_args_s){.channel = ch,
+                           .on_message = cluster_shm_test_on_message,
+                           .udata1 = &t});
+    fiobj_free(ch);
+    TEST_ASSERT(sub, "shared memory test subscription failed");
+    const size_t peers_len = sizeof(cluster_shm_peer_s) * 2;
+    cluster_shm.map_len = peers_len + (sizeof(cluster_shm_ring_s) * 4);
+    cluster_shm.map = mmap(NULL, cluster_shm.map_len, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    TEST_ASSERT(cluster_shm.map != MAP_FAILED, "shared memory unavailable");
+    cluster_shm.peers = cluster_shm.map;
+    cluster_shm.rings =
+        (cluster_shm_ring_s *)((uint8_t *)cluster_shm.map + peers_len);
+    cluster_shm.count = 2;
+    cluster_shm.lock = SPN_LOCK_INIT;
+    for (size_t i = 0; i < 2; ++i) {
+      cluster_shm.peers[i].doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      TEST_ASSERT(cluster_shm.peers[i].doorbell != -1, "eventfd failed");
+      t.uuid[i] = sock_open(dup(cluster_shm.peers[i].doorbell));
+      TEST_ASSERT(t.uuid[i] != -1, "doorbell connection failed");
+      t.local[i] = malloc(sizeof(*t.local[i]) * 2);
+      TEST_ASSERT(t.local[i], "memory allocation failed");
+      for (size_t j = 0; j < 2; ++j) {
+        t.local[i][j] = (cluster_shm_local_s){.ch = FIOBJ_INVALID};
+        t.local[i][j].backlog = (fio_ls_s)FIO_LS_INIT(t.local[i][j].backlog);
+      }
+    }
+    cluster_shm_ring_s *r = cluster_shm_ring(0, 1);
+    fio_ls_s *backlog = &t.local[0][1].backlog;
+    size_t sent = 0;
+
+    /* varying message sizes, so messages are split by the ring's edge. */
+    while (r->head < ring * 3) {
+      while (cluster_shm_room(r) > ring / 2) {
+        const size_t len = 1 + ((sent * 131) % (ring / 16));
+        cluster_shm_test_send(&t, sent++, len);
+      }
+      TEST_ASSERT(fio_ls_is_empty(backlog),
+                  "messages that fit the ring shouldn't be backlogged");
+      cluster_shm_test_wake(&t, 1);
+      TEST_ASSERT(!t.errors && t.next == sent,
+                  "shared memory messages lost or out of order (%lu/%lu)",
+                  (unsigned long)t.next, (unsigned long)sent);
+      TEST_ASSERT(r->tail == r->head, "the ring should be consumed");
+    }
+    fprintf(stderr, "* wrap around PASSED\n");
+
+    /* a full ring is backlogged, the consumer wakes the producer. */
+    for (size_t i = 0; i < (ring * 3) / 512; ++i)
+      cluster_shm_test_send(&t, sent++, 500);
+    TEST_ASSERT(fio_ls_any(backlog) && !cluster_shm_room(r) && r->blocked,
+                "a full ring should be backlogged (and marked as blocked)");
+    for (size_t i = 0; i < 16 && t.next != sent; ++i) {
+      cluster_shm_test_wake(&t, 1);
+      cluster_shm_test_wake(&t, 0);
+    }
+    TEST_ASSERT(!t.errors && t.next == sent,
+                "backlogged messages lost or out of order (%lu/%lu)",
+                (unsigned long)t.next, (unsigned long)sent);
+    TEST_ASSERT(fio_ls_is_empty(backlog) && !r->blocked,
+                "the backlog should be streamed once room was made");
+    fprintf(stderr, "* full ring backlog PASSED\n");
+
+    /* a new producer (worker) replaces one that left a partial message. */
+    cluster_shm_test_send(&t, sent + 1000000, ring + (ring / 2));
+    cluster_shm_test_wake(&t, 1);
+    TEST_ASSERT(t.local[1][0].reading && fio_ls_any(backlog),
+                "the large message should be partially read");
+    cluster_shm_test_wake(&t, 0);
+    TEST_ASSERT(r->tail != r->head, "the large message should be streamed");
+    cluster_shm_test_as(&t, 0);
+    cluster_shm_backlog_clear(t.local[0] + 1);
+    spn_add(&r->reset, 1);
+    size_t head = r->head;
+    cluster_shm_test_send(&t, sent++, 100);
+    TEST_ASSERT(r->head == head && fio_ls_any(backlog),
+                "a new producer should wait for the consumer's reset");
+    cluster_shm_test_wake(&t, 1);
+    TEST_ASSERT(!t.local[1][0].reading && r->reset_ack == r->reset,
+                "the consumer should discard the partial message");
+    cluster_shm_test_wake(&t, 0);
+    cluster_shm_test_wake(&t, 1);
+    TEST_ASSERT(!t.errors && t.next == sent,
+                "messages lost after a producer reset (%lu/%lu)",
+                (unsigned long)t.next, (unsigned long)sent);
+
+    /* a new consumer (worker) replaces one that left unread messages. */
+    cluster_shm_test_send(&t, sent + 1000000, 100);
+    spn_add(&r->epoch, 1);
+    cluster_shm_test_wake(&t, 1);
+    TEST_ASSERT(!t.errors && t.next == sent,
+                "a new consumer should wait for the producer's reset");
+    head = r->head;
+    cluster_shm_test_send(&t, sent++, 100);
+    TEST_ASSERT(r->acked == r->epoch && r->head - head == 16 + 8 + 100,
+                "the producer should acknowledge the new consumer");
+    cluster_shm_test_wake(&t, 1);
+    TEST_ASSERT(!t.errors && t.next == sent,
+                "stale messages should be discarded for a new consumer");
+    fprintf(stderr, "* ring reset PASSED\n");
+
+    facil_unsubscribe(sub);
+    defer_perform();
+    for (size_t i = 0; i < 2; ++i)
+      close(sock_hijack(t.uuid[i]));
+    cluster_shm.uuid = -1;
+    cluster_shm.local = t.local[0];
+    cluster_shm_local_free();
+    cluster_shm.local = t.local[1];
+    cluster_shm_destroy();
+    cluster_shm.self = 0;
+  }
+#endif
+#undef TEST_ASSERT
+}
+#endif
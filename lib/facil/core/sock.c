@@ -8,6 +8,7 @@ Feel free to copy, use and enjoy according to the license provided.
 #define _GNU_SOURCE
 #endif
 
+#include "evio.h"
 #include "sock.h"
 #include "spnlock.h"
 /* *****************************************************************************
@@ -28,6 +29,7 @@ Includes and state
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include "fio_mem.h"
@@ -60,6 +62,16 @@ Support an on_close callback.
 #pragma weak sock_on_close
 void __attribute__((weak)) sock_on_close(intptr_t uuid) { (void)(uuid); }
 
+/* *****************************************************************************
+Support the `io_uring` polling engine.
+*/
+
+#ifdef EVIO_ENGINE_URING
+/* io_uring polling requests keep the file open until they are removed. */
+#pragma weak evio_remove
+void __attribute__((weak)) evio_remove(int fd) { (void)(fd); }
+#endif
+
 /* *****************************************************************************
 Support timeout setting.
 */
@@ -116,6 +128,9 @@ static struct {
 
 void SOCK_DEALLOC_NOOP(void *arg) { (void)arg; }
 
+/* the (batched) release of a socket's reference to a shared buffer. */
+static void sock_shared_release(void *shared);
+
 typedef struct func_s {
   void (*task)(void *);
 } func_s;
@@ -141,6 +156,8 @@ static inline void sock_packet_free(packet_s *packet) {
     fio_free(packet->buffer);
   } else if (packet->free_func == free) {
     free(packet->buffer);
+  } else if (packet->free_func == sock_shared_release) {
+    sock_shared_release(packet->buffer);
   } else {
     defer(sock_packet_free_cb, (void *)((uintptr_t)packet->free_func),
           packet->buffer);
@@ -377,7 +394,50 @@ reinitialize:
 Writing - from memory
 ***************************************************************************** */
 
+#ifndef SOCK_MAX_IOVEC
+/**
+ * The maximum number of memory packets gathered into a single `writev` call
+ * when flushing a socket that uses the default Read/Write hooks.
+ *
+ * Setting this to 1 disables vectored writes.
+ */
+#define SOCK_MAX_IOVEC 16
+#endif
+
+static int sock_write_buffer(int fd, struct packet_s *packet);
+
+/* gathers consecutive memory packets into a single `writev` system call. */
+static int sock_write_buffer_vectored(int fd, struct packet_s *packet) {
+  struct iovec iov[SOCK_MAX_IOVEC];
+  int count = 0;
+  for (packet_s *pos = packet;
+       pos && count < SOCK_MAX_IOVEC && pos->write_func == sock_write_buffer;
+       pos = pos->next) {
+    iov[count].iov_base = (uint8_t *)pos->buffer + pos->offset;
+    iov[count].iov_len = pos->length;
+    ++count;
+  }
+  ssize_t written = writev(fd, iov, count);
+  if (written <= 0)
+    return (int)written;
+  const int ret = (written > INT_MAX ? INT_MAX : (int)written);
+  /* rotate the packets that were fully sent, advance the last one (if any) */
+  while (fdinfo(fd).packet && (size_t)written >= fdinfo(fd).packet->length) {
+    written -= fdinfo(fd).packet->length;
+    sock_packet_rotate_unsafe(fd);
+    if (!written)
+      return ret;
+  }
+  fdinfo(fd).packet->length -= written;
+  fdinfo(fd).packet->offset += written;
+  return ret;
+}
+
 static int sock_write_buffer(int fd, struct packet_s *packet) {
+  if (SOCK_MAX_IOVEC > 1 && packet->next &&
+      packet->next->write_func == sock_write_buffer &&
+      fdinfo(fd).rw_hooks == &SOCK_DEFAULT_HOOKS)
+    return sock_write_buffer_vectored(fd, packet);
   int written = fdinfo(fd).rw_hooks->write(
       fd2uuid(fd), fdinfo(fd).rw_udata,
       ((uint8_t *)packet->buffer + packet->offset), packet->length);
@@ -624,24 +684,17 @@ ssize_t sock_max_capacity(void) {
 The main sock API.
 */
 
-/**
-Opens a listening non-blocking socket. Return's the socket's UUID.
-
-Returns -1 on error. Returns a valid socket (non-random) UUID.
-
-UUIDs with values less then -1 are valid values, depending on the system's
-byte-ordering.
-
-Socket UUIDs are predictable and shouldn't be used outside the local system.
-They protect against connection mixups on concurrent systems (i.e. when saving
-client data for "broadcasting" or when an old client task is preparing a
-response in the background while a disconnection and a new connection occur on
-the same `fd`).
-*/
-intptr_t sock_listen(const char *address, const char *port) {
+/* opens a listening socket, optionally setting the SO_REUSEPORT option. */
+static intptr_t sock_listen_internal(const char *address, const char *port,
+                                     uint8_t reuse_port) {
   int srvfd;
   if (!port || *port == 0 || (port[0] == '0' && port[1] == 0)) {
     /* Unix socket */
+    if (reuse_port) {
+      /* binding would unlink the existing socket */
+      errno = EINVAL;
+      return -1;
+    }
     if (!address) {
       errno = EINVAL;
       fprintf(
@@ -711,6 +764,23 @@ intptr_t sock_listen(const char *address, const char *port) {
       int optval = 1;
       setsockopt(srvfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
     }
+    // allow a number of sockets to listen on the same address
+    if (reuse_port) {
+#ifdef SO_REUSEPORT
+      int optval = 1;
+      if (setsockopt(srvfd, SOL_SOCKET, SO_REUSEPORT, &optval,
+                     sizeof(optval)) == -1) {
+        freeaddrinfo(servinfo);
+        close(srvfd);
+        return -1;
+      }
+#else
+      freeaddrinfo(servinfo);
+      close(srvfd);
+      errno = ENOTSUP;
+      return -1;
+#endif
+    }
     // bind the address to the socket
     {
       int bound = 0;
@@ -747,6 +817,35 @@ intptr_t sock_listen(const char *address, const char *port) {
   return fd2uuid(srvfd);
 }
 
+/**
+Opens a listening non-blocking socket. Return's the socket's UUID.
+
+Returns -1 on error. Returns a valid socket (non-random) UUID.
+
+UUIDs with values less then -1 are valid values, depending on the system's
+byte-ordering.
+
+Socket UUIDs are predictable and shouldn't be used outside the local system.
+They protect against connection mixups on concurrent systems (i.e. when saving
+client data for "broadcasting" or when an old client task is preparing a
+response in the background while a disconnection and a new connection occur on
+the same `fd`).
+*/
+intptr_t sock_listen(const char *address, const char *port) {
+  return sock_listen_internal(address, port, 0);
+}
+
+/**
+Same as `sock_listen`, except the `SO_REUSEPORT` socket option is set before
+binding the socket (TCP/IP only).
+
+Returns -1 on error (`errno` is set to `ENOTSUP` if `SO_REUSEPORT` isn't
+supported).
+*/
+intptr_t sock_listen_reuseport(const char *address, const char *port) {
+  return sock_listen_internal(address, port, 1);
+}
+
 /**
 `sock_accept` accepts a new socket connection from the listening socket
 `server_fd`, allowing the use of `sock_` functions with this new file
@@ -952,6 +1051,10 @@ int sock_hijack(intptr_t uuid) {
     return -1;
   }
   fdinfo(fd).open = 0;
+#ifdef EVIO_ENGINE_URING
+  /* `sock_on_close` isn't called, so the polling request is released here */
+  evio_remove(fd);
+#endif
   clear_fd(fd, 0);
   return fd;
 }
@@ -1126,6 +1229,182 @@ error:
 }
 #define sock_write2(...) sock_write2_fn((sock_write_info_s){__VA_ARGS__})
 
+/* *****************************************************************************
+Shared (broadcast) buffers
+***************************************************************************** */
+
+struct sock_shared_s {
+  volatile uintptr_t ref;
+  uintptr_t length;
+  /* the data follows the header */
+};
+
+#ifndef SOCK_SHARED_BATCH_SLOTS
+/* the number of release batches (threads are assigned slots round robin). */
+#define SOCK_SHARED_BATCH_SLOTS 64
+#endif
+
+#ifndef SOCK_SHARED_RESERVE
+/* the number of references a thread takes at once when writing a buffer. */
+#define SOCK_SHARED_RESERVE 64
+#endif
+
+/*
+ * Every thread collects the references it releases in a batch slot, so a
+ * broadcast buffer's reference count is updated once per batch instead of
+ * once per socket. A deferred task releases the batch.
+ *
+ * The same slot holds the references a thread reserved (with a single update)
+ * for the next writes of the same buffer, so a thread sending a buffer to many
+ * sockets updates the reference count once per SOCK_SHARED_RESERVE writes.
+ * The deferred task returns any unused references.
+ */
+static struct sock_shared_batch_s {
+  sock_shared_s *shared;
+  uintptr_t count;
+  sock_shared_s *reserved;
+  uintptr_t available;
+  spn_lock_i lock;
+} __attribute__((aligned(64))) sock_shared_batches[SOCK_SHARED_BATCH_SLOTS];
+
+/* returns the calling thread's batch slot. */
+static inline struct sock_shared_batch_s *sock_shared_batch(void) {
+  static volatile uintptr_t slot_counter;
+  static __thread struct sock_shared_batch_s *batch;
+  if (!batch)
+    batch = sock_shared_batches +
+            (spn_add(&slot_counter, 1) % SOCK_SHARED_BATCH_SLOTS);
+  return batch;
+}
+
+static inline void sock_shared_release_count(sock_shared_s *shared,
+                                             uintptr_t count) {
+  if (spn_sub(&shared->ref, count))
+    return;
+  fio_free(shared);
+}
+
+static void sock_shared_batch_flush(void *batch_, void *shared) {
+  struct sock_shared_batch_s *batch = batch_;
+  uintptr_t count = 0;
+  spn_lock(&batch->lock);
+  if (batch->shared == shared) {
+    count = batch->count;
+    batch->shared = NULL;
+    batch->count = 0;
+  }
+  if (batch->reserved == shared) {
+    count += batch->available;
+    batch->reserved = NULL;
+    batch->available = 0;
+  }
+  spn_unlock(&batch->lock);
+  if (count)
+    sock_shared_release_count(shared, count);
+}
+
+static void sock_shared_release(void *shared_) {
+  struct sock_shared_batch_s *batch = sock_shared_batch();
+  sock_shared_s *shared = shared_;
+  spn_lock(&batch->lock);
+  if (batch->shared == shared) {
+    ++batch->count;
+    spn_unlock(&batch->lock);
+    return;
+  }
+  sock_shared_s *old = batch->shared;
+  uintptr_t old_count = batch->count;
+  batch->shared = shared;
+  batch->count = 1;
+  spn_unlock(&batch->lock);
+  if (old)
+    sock_shared_release_count(old, old_count);
+  defer(sock_shared_batch_flush, batch, shared);
+}
+
+/**
+ * Allocates a shared buffer of `length` bytes, copying `data` into the buffer
+ * (unless `data` is NULL).
+ */
+sock_shared_s *sock_shared_new(const void *data, size_t length) {
+  sock_shared_s *shared = fio_malloc(sizeof(*shared) + length);
+  if (!shared)
+    return NULL;
+  *shared = (sock_shared_s){.ref = 1, .length = length};
+  if (data)
+    memcpy(shared + 1, data, length);
+  return shared;
+}
+
+/** Returns a pointer to the shared buffer's data. */
+void *sock_shared_data(sock_shared_s *shared) { return shared + 1; }
+
+/** Returns the length of the shared buffer's data. */
+size_t sock_shared_length(sock_shared_s *shared) { return shared->length; }
+
+/** Shortens the shared buffer's data (before the buffer is first sent). */
+void sock_shared_truncate(sock_shared_s *shared, size_t length) {
+  if (length < shared->length)
+    shared->length = length;
+}
+
+/** Increases the shared buffer's reference count, returning the buffer. */
+sock_shared_s *sock_shared_dup(sock_shared_s *shared) {
+  spn_add(&shared->ref, 1);
+  return shared;
+}
+
+/**
+ * Increases the shared buffer's reference count by `count` (a single atomic
+ * operation), returning the buffer.
+ */
+sock_shared_s *sock_shared_dup2(sock_shared_s *shared, size_t count) {
+  spn_add(&shared->ref, (uintptr_t)count);
+  return shared;
+}
+
+/* takes a reference for a write, from the thread's reserved references. */
+static sock_shared_s *sock_shared_take(sock_shared_s *shared) {
+  struct sock_shared_batch_s *batch = sock_shared_batch();
+  spn_lock(&batch->lock);
+  if (batch->reserved == shared && batch->available) {
+    --batch->available;
+    spn_unlock(&batch->lock);
+    return shared;
+  }
+  sock_shared_s *old = batch->reserved;
+  uintptr_t old_count = batch->available;
+  batch->reserved = sock_shared_dup2(shared, SOCK_SHARED_RESERVE);
+  batch->available = SOCK_SHARED_RESERVE - 1;
+  spn_unlock(&batch->lock);
+  if (old && old_count)
+    sock_shared_release_count(old, old_count);
+  defer(sock_shared_batch_flush, batch, shared);
+  return shared;
+}
+
+/** Releases a reference, freeing the buffer once no references remain. */
+void sock_shared_free(sock_shared_s *shared) {
+  if (shared)
+    sock_shared_release_count(shared, 1);
+}
+
+/**
+ * Schedules a shared buffer to be sent over the socket, without copying the
+ * data.
+ */
+ssize_t sock_write_shared(intptr_t uuid, sock_shared_s *shared) {
+  if (!shared) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (!shared->length)
+    return 0;
+  return sock_write2(.uuid = uuid, .buffer = sock_shared_take(shared),
+                     .offset = sizeof(*shared), .length = shared->length,
+                     .dealloc = sock_shared_release);
+}
+
 /**
 `sock_close` marks the connection for disconnection once all the data was sent.
 The actual disconnection will be managed by the `sock_flush` function.
@@ -1153,6 +1432,10 @@ void sock_force_close(intptr_t uuid) {
   // perror("errno");
   // We might avoid shutdown, it has side-effects that aren't always clear
   // shutdown(sock_uuid2fd(uuid), SHUT_RDWR);
+#ifdef EVIO_ENGINE_URING
+  /* release the polling request before the fd number could be reused */
+  evio_remove(sock_uuid2fd(uuid));
+#endif
   close(sock_uuid2fd(uuid));
   clear_fd(sock_uuid2fd(uuid), 0);
 }
@@ -1349,6 +1632,9 @@ void sock_libtest(void) {
   sock_max_capacity();
   for (int i = 0; i < 4; ++i) {
     packet_s *packet = sock_packet_new();
+    /* an unset `free_func` would be deferred (and called) later */
+    packet->buffer = NULL;
+    packet->free_func = fio_free;
     sock_packet_free(packet);
   }
   packet_s *head, *pos;
@@ -1361,6 +1647,62 @@ void sock_libtest(void) {
   fprintf(stderr, "Packet pool test %s (%lu =? %lu)\n",
           count == BUFFER_PACKET_POOL ? "PASS" : "FAIL",
           (unsigned long)BUFFER_PACKET_POOL, (unsigned long)count);
+  {
+    /* test vectored flushing of memory packets (using a pipe) */
+    int io[2];
+    char buff[64];
+    if (pipe(io)) {
+      perror("ERROR: (sock) pipe failed during test");
+      exit(-1);
+    }
+    intptr_t uuid = sock_open(io[1]);
+    sock_write(uuid, "Hello", 5);
+    sock_write(uuid, " ", 1);
+    sock_write(uuid, "World", 5);
+    sock_flush(uuid);
+    ssize_t i_read = read(io[0], buff, 64);
+    fprintf(stderr, "Vectored write test %s (%d =? 11, %lu packets left)\n",
+            (i_read == 11 && !memcmp(buff, "Hello World", 11) &&
+             !sock_pending(uuid))
+                ? "PASS"
+                : "FAIL",
+            (int)i_read, (unsigned long)sock_pending(uuid));
+    sock_hijack(uuid);
+    close(io[0]);
+    close(io[1]);
+  }
+  {
+    /* test shared buffers (the references are released in batches) */
+    int io[2];
+    char buff[64];
+    if (pipe(io)) {
+      perror("ERROR: (sock) pipe failed during test");
+      exit(-1);
+    }
+    sock_shared_s *shared = sock_shared_new("Shared Buffer!", 14);
+    sock_shared_truncate(shared, 13);
+    intptr_t uuid = sock_open(io[1]);
+    for (int i = 0; i < 3; ++i)
+      sock_write_shared(uuid, shared);
+    sock_flush(uuid);
+    ssize_t i_read = read(io[0], buff, 64);
+    /* the writes reserved references once (one update, not three) */
+    const uintptr_t ref = shared->ref;
+    for (size_t i = 0; i < SOCK_SHARED_BATCH_SLOTS; ++i)
+      sock_shared_batch_flush(sock_shared_batches + i, shared);
+    const int passed =
+        (i_read == 39 && !memcmp(buff + 26, "Shared Buffer", 13) &&
+         ref == 1 + SOCK_SHARED_RESERVE && shared->ref == 1);
+    fprintf(stderr, "Shared buffer test %s (%d =? 39, %lu references)\n",
+            passed ? "PASS" : "FAIL", (int)i_read,
+            (unsigned long)shared->ref);
+    if (!passed)
+      exit(-1);
+    sock_shared_free(shared);
+    sock_hijack(uuid);
+    close(io[0]);
+    close(io[1]);
+  }
   printf("Allocated sock capacity %lu X %lu\n",
          (unsigned long)sock_data_store.capacity,
          (unsigned long)sizeof(struct fd_data_s));
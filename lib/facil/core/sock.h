@@ -126,6 +126,19 @@ The main sock API.
  */
 intptr_t sock_listen(const char *address, const char *port);
 
+/**
+ * Same as `sock_listen`, except the `SO_REUSEPORT` socket option is set before
+ * binding the socket (TCP/IP only).
+ *
+ * This allows a number of sockets (i.e., one per worker process) to listen on
+ * the same address, so the kernel (on Linux) balances new connections between
+ * their accept queues.
+ *
+ * Returns -1 on error (`errno` is set to `ENOTSUP` if `SO_REUSEPORT` isn't
+ * supported).
+ */
+intptr_t sock_listen_reuseport(const char *address, const char *port);
+
 /**
 * `sock_accept` accepts a new socket connection from the listening socket
 * `server_fd`, allowing the use of `sock_` functions with this new file
@@ -405,6 +418,67 @@ sock_sendfile(intptr_t uuid, intptr_t source_fd, off_t offset, size_t length) {
                      .length = length, .is_fd = 1, .offset = offset);
 }
 
+/* *****************************************************************************
+Shared (broadcast) buffers
+***************************************************************************** */
+
+/**
+ * An immutable, reference counted, buffer that can be sent to any number of
+ * sockets without copying the data (i.e., a pre-wrapped broadcast message).
+ *
+ * The buffer's header and data are placed in a single allocation.
+ */
+typedef struct sock_shared_s sock_shared_s;
+
+/**
+ * Allocates a shared buffer of `length` bytes, copying `data` into the buffer
+ * (unless `data` is NULL).
+ *
+ * The buffer's data should only be edited before the buffer is first sent.
+ *
+ * The buffer's reference count starts at 1 (the caller's reference). Returns
+ * NULL on error.
+ */
+sock_shared_s *sock_shared_new(const void *data, size_t length);
+
+/** Returns a pointer to the shared buffer's data. */
+void *sock_shared_data(sock_shared_s *shared);
+
+/** Returns the length of the shared buffer's data. */
+size_t sock_shared_length(sock_shared_s *shared);
+
+/**
+ * Shortens the shared buffer's data (i.e., when the buffer was allocated for
+ * the worst case). Should only be called before the buffer is first sent.
+ */
+void sock_shared_truncate(sock_shared_s *shared, size_t length);
+
+/** Increases the shared buffer's reference count, returning the buffer. */
+sock_shared_s *sock_shared_dup(sock_shared_s *shared);
+
+/**
+ * Increases the shared buffer's reference count by `count` using a single
+ * atomic operation (i.e., before handing the buffer to `count` owners),
+ * returning the buffer.
+ */
+sock_shared_s *sock_shared_dup2(sock_shared_s *shared, size_t count);
+
+/** Releases a reference, freeing the buffer once no references remain. */
+void sock_shared_free(sock_shared_s *shared);
+
+/**
+ * Schedules a shared buffer to be sent over the socket, without copying the
+ * data.
+ *
+ * The socket holds its own reference until the data was sent (the caller's
+ * reference isn't consumed). These references are taken (reserved using
+ * `sock_shared_dup2`) and released in per-thread batches, so the buffer's
+ * reference count isn't contended when broadcasting.
+ *
+ * Returns the same values as `sock_write2`.
+ */
+ssize_t sock_write_shared(intptr_t uuid, sock_shared_s *shared);
+
 /**
  * `sock_close` marks the connection for disconnection once all the data was
  * sent. The actual disconnection will be managed by the `sock_flush` function.
@@ -39,6 +39,10 @@ void *fio_realloc2(void *ptr, size_t new_size, size_t valid_len) {
 
 void fio_malloc_after_fork(void) {}
 
+void fio_arena_enter(void) {}
+void fio_arena_exit(void) {}
+int fio_arena_rewind(void) { return -1; }
+
 /* *****************************************************************************
 facil.io malloc implementation
 ***************************************************************************** */
@@ -477,6 +481,67 @@ static inline void block_slice_free(void *mem) {
   block_free(blk);
 }
 
+/* *****************************************************************************
+Scoped (per-thread) arenas
+***************************************************************************** */
+
+/* the calling thread's scoped arena (see `fio_arena_enter`) */
+static __thread struct {
+  block_s *block;
+  size_t depth;
+} arena_scoped;
+
+/* releases a thread's arena block when the thread exits */
+static pthread_key_t arena_scoped_key;
+
+static void arena_scoped_release(void *ignr) {
+  if (arena_scoped.block)
+    block_free(arena_scoped.block);
+  arena_scoped.block = NULL;
+  (void)ignr;
+}
+
+static inline void *arena_scoped_slice(uint16_t units) {
+  block_s *blk = arena_scoped.block;
+  if (!blk || blk->pos + units > blk->max) {
+    /* only the arena's reference is released, used memory remains valid */
+    if (blk)
+      block_free(blk);
+    else
+      pthread_setspecific(arena_scoped_key, (void *)1);
+    blk = arena_scoped.block = block_new();
+    if (!blk)
+      return NULL;
+  }
+  /* no locks required, only the owner thread slices the block */
+  const void *mem = (void *)((uintptr_t)blk + ((uintptr_t)blk->pos << 4));
+  spn_add(&blk->ref, 1);
+  blk->pos += units;
+  return (void *)mem;
+}
+
+void fio_arena_enter(void) { ++arena_scoped.depth; }
+
+void fio_arena_exit(void) {
+  if (arena_scoped.depth)
+    --arena_scoped.depth;
+}
+
+int fio_arena_rewind(void) {
+  block_s *blk = arena_scoped.block;
+  if (!blk)
+    return 0;
+  /* other threads can only release slices, so the test is safe */
+  if (__atomic_load_n(&blk->ref, __ATOMIC_ACQUIRE) != 1)
+    return -1;
+  const uint16_t start = (2 + (sizeof(block_s) >> 4));
+  /* memory is expected to be zeroed out, but only the used part is dirty */
+  memset((void *)((uintptr_t)blk + ((uintptr_t)start << 4)), 0,
+         ((uintptr_t)(blk->pos - start) << 4));
+  blk->pos = start;
+  return 0;
+}
+
 /* *****************************************************************************
 Non-Block allocations (direct from the system)
 ***************************************************************************** */
@@ -535,6 +600,7 @@ static void __attribute__((constructor)) fio_mem_init(void) {
       block_free(block);
     }
   }
+  pthread_key_create(&arena_scoped_key, arena_scoped_release);
   pthread_atfork(NULL, NULL, fio_malloc_after_fork);
 }
 
@@ -573,6 +639,8 @@ void *fio_malloc(size_t size) {
   }
   /* ceiling for 16 byte alignement, translated to 16 byte units */
   size = (size >> 4) + (!!(size & 15));
+  if (arena_scoped.depth)
+    return arena_scoped_slice(size);
   arena_enter();
   void *mem = block_slice(size);
   arena_exit();
@@ -777,8 +845,51 @@ void fio_malloc_test(void) {
   fprintf(stderr, "* passed.\n");
 }
 
+/* Tests the scoped arenas (see `fio_arena_enter`). */
+void fio_arena_test(void) {
+  fprintf(stderr, "=== Testing facil.io memory allocator's scoped arenas\n");
+  char *mem, *mem2;
+  fio_arena_enter();
+  mem = fio_malloc(32);
+  TEST_ASSERT(mem && (block_s *)((uintptr_t)mem & (~FIO_MEMORY_BLOCK_MASK)) ==
+                         arena_scoped.block,
+              "scoped arena allocation error!\n");
+  memset(mem, 'a', 32);
+  mem2 = fio_malloc(16);
+  TEST_ASSERT(fio_arena_rewind() == -1,
+              "scoped arena rewound while memory is in use!\n");
+  fio_free(mem2);
+  fio_free(mem);
+  TEST_ASSERT(fio_arena_rewind() == 0, "scoped arena rewind failed!\n");
+  mem2 = fio_malloc(32);
+  TEST_ASSERT(mem2 == mem, "scoped arena memory wasn't reused!\n");
+  for (size_t i = 0; i < 32; ++i) {
+    TEST_ASSERT(mem2[i] == 0, "scoped arena memory wasn't zeroed out!\n");
+  }
+  fio_arena_exit();
+  mem = fio_malloc(16);
+  TEST_ASSERT((block_s *)((uintptr_t)mem & (~FIO_MEMORY_BLOCK_MASK)) !=
+                  arena_scoped.block,
+              "memory allocated from the scoped arena after exiting!\n");
+  fio_free(mem);
+  /* escaped memory remains valid after the arena's block rotates */
+  mem2[0] = 'a';
+  fio_arena_enter();
+  while ((block_s *)((uintptr_t)(mem = fio_malloc(1024)) &
+                     (~FIO_MEMORY_BLOCK_MASK)) ==
+         (block_s *)((uintptr_t)mem2 & (~FIO_MEMORY_BLOCK_MASK)))
+    fio_free(mem);
+  fio_free(mem);
+  fio_arena_exit();
+  TEST_ASSERT(mem2[0] == 'a', "escaped scoped arena memory corrupted!\n");
+  fio_free(mem2);
+
+  fprintf(stderr, "* passed.\n");
+}
+
 #else
 
 void fio_malloc_test(void) {}
+void fio_arena_test(void) {}
 
 #endif
@@ -132,12 +132,41 @@ void *fio_realloc2(void *ptr, size_t new_size, size_t copy_length);
  */
 void *fio_mmap(size_t size);
 
+/**
+ * Enters a scoped arena for the calling thread (scopes can be nested).
+ *
+ * Until `fio_arena_exit` is called, small `fio_malloc` allocations performed by
+ * the calling thread are sliced from a memory block reserved for the thread,
+ * without any locking.
+ *
+ * Memory is still managed per allocation (`fio_free` and `fio_realloc` work as
+ * usual), so memory that outlives the scope remains valid. However, it keeps
+ * the arena's memory block alive - long lived objects should be copied.
+ */
+void fio_arena_enter(void);
+
+/** Exits a scoped arena (see `fio_arena_enter`). */
+void fio_arena_exit(void);
+
+/**
+ * Rewinds the calling thread's arena, allowing it's memory to be reused
+ * immediately (and while still hot in the CPU cache).
+ *
+ * The arena is only rewound if all the memory allocated from the arena's
+ * current block was freed. Returns 0 if the arena was rewound and -1 if some of
+ * the memory is still in use (in which case, nothing happens).
+ */
+int fio_arena_rewind(void);
+
 /** Clears any memory locks, in case of a system call to `fork`. */
 void fio_malloc_after_fork(void);
 
 /** Tests the facil.io memory allocator. */
 void fio_malloc_test(void);
 
+/** Tests the facil.io memory allocator's scoped arenas. */
+void fio_arena_test(void);
+
 /** If defined, `malloc` will be used instead of the fio_malloc functions */
 #if FIO_FORCE_MALLOC
 #define fio_malloc malloc
@@ -147,7 +176,11 @@ void fio_malloc_test(void);
 #define fio_realloc realloc
 #define fio_realloc2(ptr, new_size, old_data_len) realloc((ptr), (new_size))
 #define fio_malloc_test()
+#define fio_arena_test()
 #define fio_malloc_after_fork()
+#define fio_arena_enter()
+#define fio_arena_exit()
+#define fio_arena_rewind() (-1)
 
 /* allows local override as well as global override */
 #elif FIO_OVERRIDE_MALLOC
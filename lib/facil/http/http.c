@@ -9,6 +9,7 @@ Feel free to copy, use and enjoy according to the license provided.
 
 #include "fio_base64.h"
 #include "http1.h"
+#include "http2.h"
 #include "http_internal.h"
 
 #include <ctype.h>
@@ -47,6 +48,39 @@ Small Helpers
 ***************************************************************************** */
 static inline int hex2byte(uint8_t *dest, const uint8_t *source);
 
+/* the static file cache, used by `http_sendfile2` */
+typedef struct http_static_s {
+  /** LRU ordering (most recently used first). */
+  fio_ls_embd_s node;
+  /** The file's name (the cache key). */
+  FIOBJ filename;
+  FIOBJ etag;
+  FIOBJ last_modified;
+  FIOBJ mimetype;
+  /** The file's content (small files only). */
+  FIOBJ body;
+  uintptr_t hash;
+  uintptr_t ref;
+  size_t size;
+  time_t mtime;
+  ino_t ino;
+  /** The last time the file's `stat` was tested. */
+  time_t checked;
+  /** An open file descriptor (files that aren't kept in memory). */
+  int fd;
+  uint8_t is_gz;
+  /** Set once compressing the file was attempted (per encoding). */
+  uint8_t compressed_tried[HTTP_COMPRESS_COUNT];
+  /** The compressed variants of the file (see `http_static_compressed`). */
+  FIOBJ compressed[HTTP_COMPRESS_COUNT];
+  FIOBJ compressed_etag[HTTP_COMPRESS_COUNT];
+} http_static_s;
+
+static http_static_s *http_static_get(FIOBJ filename, uint8_t is_gz);
+static http_static_s *http_static_get_gz(FIOBJ filename);
+static FIOBJ http_static_compressed(http_static_s *f, http_compress_e encoding);
+static void http_static_free(http_static_s *f);
+
 static inline void add_content_length(http_s *r, uintptr_t length) {
   static uint64_t cl_hash = 0;
   if (!cl_hash)
@@ -355,9 +389,7 @@ int http_set_cookie(http_s *h, http_cookie_args_s cookie) {
  *
  * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
  */
-int http_send_body(http_s *r, void *data, uintptr_t length) {
-  if (HTTP_INVALID_HANDLE(r))
-    return -1;
+static int http_send_body_raw(http_s *r, void *data, uintptr_t length) {
   if (!length || !data) {
     http_finish(r);
     return 0;
@@ -368,6 +400,21 @@ int http_send_body(http_s *r, void *data, uintptr_t length) {
   return ((http_vtable_s *)r->private_data.vtbl)
       ->http_send_body(r, data, length);
 }
+
+int http_send_body(http_s *r, void *data, uintptr_t length) {
+  if (HTTP_INVALID_HANDLE(r))
+    return -1;
+  if (data && length) {
+    FIOBJ compressed = http_compress_response(r, data, length);
+    if (compressed) {
+      fio_cstr_s c = fiobj_obj2cstr(compressed);
+      int ret = http_send_body_raw(r, c.data, c.len);
+      fiobj_free(compressed);
+      return ret;
+    }
+  }
+  return http_send_body_raw(r, data, length);
+}
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -386,6 +433,52 @@ int http_sendfile(http_s *r, int fd, uintptr_t length, uintptr_t offset) {
   return ((http_vtable_s *)r->private_data.vtbl)
       ->http_sendfile(r, fd, length, offset);
 }
+
+/**
+ * Parses the first range in a `range` header value (`bytes=N-M`, `bytes=N-`
+ * or `bytes=-N`), setting the `offset` and `length` of the requested bytes.
+ *
+ * Returns -1 if the range should be ignored (the whole file is sent).
+ */
+static int http_range_parse(fio_cstr_s range, int64_t file_size,
+                            int64_t *offset, int64_t *length) {
+  if (!range.data || range.len < 7 || file_size <= 0 ||
+      memcmp("bytes=", range.data, 6))
+    return -1;
+  char *pos = range.data + 6;
+  if (*pos == '-') {
+    /* a suffix range, the last N bytes */
+    ++pos;
+    if (*pos < '0' || *pos > '9')
+      return -1;
+    int64_t suffix = fio_atol(&pos);
+    if (suffix <= 0)
+      return -1;
+    if (suffix > file_size)
+      suffix = file_size;
+    *offset = file_size - suffix;
+    *length = suffix;
+    return 0;
+  }
+  if (*pos < '0' || *pos > '9')
+    return -1;
+  const int64_t start_at = fio_atol(&pos);
+  if (start_at < 0 || start_at >= file_size || *pos != '-')
+    return -1;
+  ++pos;
+  int64_t end_at = file_size - 1;
+  if (*pos >= '0' && *pos <= '9') {
+    end_at = fio_atol(&pos);
+    if (end_at < start_at)
+      return -1;
+    if (end_at >= file_size)
+      end_at = file_size - 1;
+  }
+  *offset = start_at;
+  *length = end_at - start_at + 1;
+  return 0;
+}
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -397,16 +490,14 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
                    const char *encoded, size_t encoded_len) {
   if (HTTP_INVALID_HANDLE(h))
     return -1;
-  struct stat file_data = {.st_size = 0};
-  static uint64_t accept_enc_hash = 0;
-  if (!accept_enc_hash)
-    accept_enc_hash = fio_siphash("accept-encoding", 15);
+  http_static_s *file;
   static uint64_t range_hash = 0;
   if (!range_hash)
     range_hash = fio_siphash("range", 5);
 
-  /* create filename string */
+  /* create filename string (the temporary string isn't cleared) */
   FIOBJ filename = fiobj_str_tmp();
+  fiobj_str_resize(filename, 0);
   if (prefix && prefix_len) {
     if (encoded && prefix[prefix_len - 1] == '/' && encoded[0] == '/')
       --prefix_len;
@@ -440,55 +531,76 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
     if (tmp.data[tmp.len - 1] == '/')
       fiobj_str_write(filename, "index.html", 10);
   }
-  /* test for file existance  */
-
-  int file = -1;
-  uint8_t is_gz = 0;
-
+  /* test for file existance (using the static file cache) */
   fio_cstr_s s = fiobj_obj2cstr(filename);
-  {
-    FIOBJ tmp = fiobj_hash_get2(h->headers, accept_enc_hash);
-    if (!tmp)
-      goto no_gzip_support;
-    fio_cstr_s ac_str = fiobj_obj2cstr(tmp);
-    if (!ac_str.data || !strstr(ac_str.data, "gzip"))
-      goto no_gzip_support;
-    if (s.data[s.len - 3] != '.' || s.data[s.len - 2] != 'g' ||
-        s.data[s.len - 1] != 'z') {
-      fiobj_str_write(filename, ".gz", 3);
-      s = fiobj_obj2cstr(filename);
-      if (!stat(s.data, &file_data) &&
-          (S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode))) {
-        is_gz = 1;
-        goto found_file;
-      }
-      fiobj_str_resize(filename, s.len - 3);
+  /*
+   * negotiate before looking for a pre-compressed ".gz" sibling, so brotli
+   * (when compression is enabled) is preferred.
+   */
+  const uint8_t compress = http2protocol(h)->settings->compress;
+  const http_compress_e enc =
+      compress ? http_compress_negotiate(h) : HTTP_COMPRESS_NONE;
+  uint8_t gz_sibling =
+      (s.len < 3 || s.data[s.len - 3] != '.' || s.data[s.len - 2] != 'g' ||
+       s.data[s.len - 1] != 'z') &&
+      http_compress_negotiate2(h, (1 << HTTP_COMPRESS_GZIP));
+  file = NULL;
+  if (gz_sibling && enc != HTTP_COMPRESS_BROTLI) {
+    file = http_static_get_gz(filename);
+    gz_sibling = 0;
+  }
+  if (!file)
+    file = http_static_get(filename, 0);
+  if (!file && gz_sibling) {
+    file = http_static_get_gz(filename);
+    gz_sibling = 0;
+  }
+  if (!file)
+    return -1;
+  /* the response's body (a compressed variant may replace the file's data) */
+  FIOBJ body = file->body;
+  FIOBJ etag_str = file->etag;
+  FIOBJ encoding = FIOBJ_INVALID;
+  size_t body_size = file->size;
+  const uint8_t compressible =
+      !file->is_gz && compress && file->size >= HTTP_COMPRESS_MIN_SIZE &&
+      file->size <= HTTP_COMPRESS_MAX_FILE &&
+      http_compress_mime(fiobj_obj2cstr(file->mimetype));
+  if (compressible && enc) {
+    FIOBJ compressed = http_static_compressed(file, enc);
+    if (compressed) {
+      body = compressed;
+      body_size = fiobj_obj2cstr(compressed).len;
+      etag_str = file->compressed_etag[enc];
+      encoding = http_compress_name(enc);
+      /* ranges refer to the uncompressed data, send the whole variant */
+      fiobj_hash_delete2(h->headers, range_hash);
     }
   }
-no_gzip_support:
-  if (stat(s.data, &file_data) ||
-      !(S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode)))
-    return -1;
-found_file:
-  /* set last-modified */
-  {
-    FIOBJ tmp = fiobj_str_buf(32);
-    fiobj_str_resize(
-        tmp, http_time2str(fiobj_obj2cstr(tmp).data, file_data.st_mtime));
-    http_set_header(h, HTTP_HEADER_LAST_MODIFIED, tmp);
+  if (!encoding && gz_sibling) {
+    /* brotli wasn't used after all, the ".gz" sibling is the next best */
+    http_static_s *gz = http_static_get_gz(filename);
+    if (gz) {
+      http_static_free(file);
+      file = gz;
+      body = file->body;
+      etag_str = file->etag;
+      body_size = file->size;
+    }
   }
+  if (file->is_gz)
+    encoding = HTTP_HVALUE_GZIP;
+  /* the response depends on the `accept-encoding` header */
+  if (encoding || compressible)
+    http_set_header(h, HTTP_HEADER_VARY,
+                    fiobj_dup(HTTP_HVALUE_ACCEPT_ENCODING));
+  /* set last-modified */
+  http_set_header(h, HTTP_HEADER_LAST_MODIFIED,
+                  fiobj_dup(file->last_modified));
   /* set cache-control */
   http_set_header(h, HTTP_HEADER_CACHE_CONTROL, fiobj_dup(HTTP_HVALUE_MAX_AGE));
   /* set & test etag */
-  uint64_t etag = (uint64_t)file_data.st_size;
-  etag ^= (uint64_t)file_data.st_mtime;
-  etag = fio_siphash(&etag, sizeof(uint64_t));
-  FIOBJ etag_str = fiobj_str_buf(32);
-  fiobj_str_resize(etag_str,
-                   fio_base64_encode(fiobj_obj2cstr(etag_str).data,
-                                     (void *)&etag, sizeof(uint64_t)));
-  /* set */
-  http_set_header(h, HTTP_HEADER_ETAG, etag_str);
+  http_set_header(h, HTTP_HEADER_ETAG, fiobj_dup(etag_str));
   /* test */
   {
     static uint64_t none_match_hash = 0;
@@ -498,12 +610,13 @@ found_file:
     if (tmp2 && fiobj_iseq(tmp2, etag_str)) {
       h->status = 304;
       http_finish(h);
-      return 0;
+      goto finish;
     }
   }
   /* handle range requests */
+  const int64_t file_size = (int64_t)body_size;
   int64_t offset = 0;
-  int64_t length = file_data.st_size;
+  int64_t length = file_size;
   {
     static uint64_t ifrange_hash = 0;
     if (!ifrange_hash)
@@ -517,44 +630,18 @@ found_file:
         /* range ahead... */
         if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
           tmp = fiobj_ary_index(tmp, 0);
-        fio_cstr_s range = fiobj_obj2cstr(tmp);
-        if (!range.data || memcmp("bytes=", range.data, 6))
-          goto open_file;
-        char *pos = range.data + 6;
-        int64_t start_at = 0, end_at = 0;
-        start_at = fio_atol(&pos);
-        if (start_at >= file_data.st_size)
-          goto open_file;
-        if (start_at >= 0) {
-          pos++;
-          end_at = fio_atol(&pos);
-          if (end_at <= 0)
-            goto open_file;
-        }
         /* we ignore multimple ranges, only responding with the first range. */
-        if (start_at < 0) {
-          if (0 - start_at < file_data.st_size) {
-            offset = file_data.st_size - start_at;
-            length = 0 - start_at;
-          }
-        } else if (end_at) {
-          offset = start_at;
-          length = end_at - start_at + 1;
-          if (length + start_at > file_data.st_size || length <= 0)
-            length = length - start_at;
-        } else {
-          offset = start_at;
-          length = length - start_at;
+        if (!http_range_parse(fiobj_obj2cstr(tmp), file_size, &offset,
+                              &length)) {
+          h->status = 206;
+          http_set_header(h, HTTP_HEADER_CONTENT_RANGE,
+                          fiobj_strprintf("bytes %lu-%lu/%lu",
+                                          (unsigned long)offset,
+                                          (unsigned long)(offset + length - 1),
+                                          (unsigned long)file_size));
+          http_set_header(h, HTTP_HEADER_ACCEPT_RANGES,
+                          fiobj_dup(HTTP_HVALUE_BYTES));
         }
-        h->status = 206;
-
-        http_set_header(h, HTTP_HEADER_CONTENT_RANGE,
-                        fiobj_strprintf("bytes %lu-%lu/%lu",
-                                        (unsigned long)start_at,
-                                        (unsigned long)(start_at + length - 1),
-                                        (unsigned long)file_data.st_size));
-        http_set_header(h, HTTP_HEADER_ACCEPT_RANGES,
-                        fiobj_dup(HTTP_HVALUE_BYTES));
       }
     }
   }
@@ -567,7 +654,7 @@ found_file:
                        (fio_cstr_s){.data = "GET, HEAD", .len = 9});
       h->status = 200;
       http_finish(h);
-      return 0;
+      goto finish;
     }
     break;
   case 3:
@@ -576,47 +663,41 @@ found_file:
     break;
   case 4:
     if (!strncasecmp("head", s.data, 4)) {
+      if (encoding)
+        http_set_header(h, HTTP_HEADER_CONTENT_ENCODING, fiobj_dup(encoding));
       http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(length));
       http_finish(h);
-      return 0;
+      goto finish;
     }
     break;
   }
   http_send_error(h, 403);
-  return 0;
+  goto finish;
 open_file:
-  s = fiobj_obj2cstr(filename);
-  file = open(s.data, O_RDONLY);
-  if (file == -1) {
-    fprintf(stderr, "ERROR: Couldn't open file %s!\n", s.data);
-    perror("     ");
-    http_send_error(h, 500);
-    return 0;
+  if (encoding)
+    http_set_header(h, HTTP_HEADER_CONTENT_ENCODING, fiobj_dup(encoding));
+  http_set_header(h, HTTP_HEADER_CONTENT_TYPE,
+                  (file->mimetype ? fiobj_dup(file->mimetype)
+                                  : http_mimetype_find2(h->path)));
+  if (offset + length > file_size)
+    length = file_size - offset;
+  if (body) {
+    /* small files are sent from memory, without touching the file system */
+    http_send_body_raw(h, fiobj_obj2cstr(body).data + offset,
+                       (uintptr_t)length);
+    goto finish;
   }
   {
-    FIOBJ tmp = 0;
-    uintptr_t pos = 0;
-    if (is_gz) {
-      http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
-                      fiobj_dup(HTTP_HVALUE_GZIP));
-
-      pos = s.len - 4;
-      while (pos && s.data[pos] != '.')
-        pos--;
-      pos++; /* assuming, but that's fine. */
-      tmp = http_mimetype_find(s.data + pos, s.len - pos - 3);
-
-    } else {
-      pos = s.len - 1;
-      while (pos && s.data[pos] != '.')
-        pos--;
-      pos++; /* assuming, but that's fine. */
-      tmp = http_mimetype_find(s.data + pos, s.len - pos);
+    int fd = dup(file->fd);
+    if (fd == -1) {
+      perror("ERROR: Couldn't duplicate file descriptor");
+      http_send_error(h, 500);
+      goto finish;
     }
-    if (tmp)
-      http_set_header(h, HTTP_HEADER_CONTENT_TYPE, tmp);
+    http_sendfile(h, fd, length, offset);
   }
-  http_sendfile(h, file, length, offset);
+finish:
+  http_static_free(file);
   return 0;
 }
 
@@ -669,6 +750,46 @@ void http_finish(http_s *r) {
   add_date(r);
   ((http_vtable_s *)r->private_data.vtbl)->http_finish(r);
 }
+
+#undef http_stream_start
+/**
+ * Sends the response headers and starts streaming the response body.
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int http_stream_start(http_s *h, http_stream_args_s args) {
+  if (HTTP_INVALID_HANDLE(h))
+    return -1;
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (!vtbl->http_stream_start)
+    return -1;
+  add_date(h);
+  return vtbl->http_stream_start(h, &args);
+}
+
+/**
+ * Writes a chunk of a streamed response body.
+ *
+ * Returns -1 on error, 0 if more data can be written and 1 if the connection
+ * is busy.
+ */
+int http_stream_write(http_s *h, void *data, uintptr_t length) {
+  if (HTTP_INVALID_HANDLE(h))
+    return -1;
+  return ((http_vtable_s *)h->private_data.vtbl)
+      ->http_stream_write(h, data, length);
+}
+
+/**
+ * Completes a streamed response.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+void http_stream_end(http_s *h) {
+  if (HTTP_INVALID_HANDLE(h))
+    return;
+  ((http_vtable_s *)h->private_data.vtbl)->http_stream_end(h);
+}
 /**
  * Pushes a data response when supported (HTTP/2 only).
  *
@@ -805,6 +926,30 @@ void http_resume(void *http_, void (*task)(http_s *h),
               .fallback = http_resume_fallback_wrapper);
 }
 
+/**
+ * Stops reading a streamed request body until `http_body_resume` is called.
+ */
+void http_body_pause(http_s *h) {
+  if (HTTP_INVALID_HANDLE(h)) {
+    return;
+  }
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (vtbl->http_body_pause)
+    vtbl->http_body_pause(h);
+}
+
+/**
+ * Resumes reading a streamed request body.
+ */
+void http_body_resume(http_s *h) {
+  if (HTTP_INVALID_HANDLE(h)) {
+    return;
+  }
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (vtbl->http_body_resume)
+    vtbl->http_body_resume(h);
+}
+
 /**
  * Hijacks the socket away from the HTTP protocol and away from facil.io.
  */
@@ -925,19 +1070,21 @@ static void http_on_finish(intptr_t uuid, void *set) {
 #undef http_listen
 intptr_t http_listen(const char *port, const char *binding,
                      struct http_settings_s arg_settings) {
-  if (arg_settings.on_request == NULL) {
-    fprintf(stderr, "ERROR: http_listen requires the .on_request parameter "
-                    "to be set\n");
+  if (arg_settings.on_request == NULL && arg_settings.router == NULL) {
+    fprintf(stderr, "ERROR: http_listen requires the .on_request (or .router) "
+                    "parameter to be set\n");
     kill(0, SIGINT);
     exit(11);
   }
 
   http_settings_s *settings = http_settings_new(arg_settings);
   settings->is_client = 0;
+  http_router_compile(settings->router);
 
   return facil_listen(.port = port, .address = binding,
                       .on_finish = http_on_finish, .on_open = http_on_open,
-                      .udata = settings);
+                      .udata = settings, .reuse_port = settings->reuse_port,
+                      .incoming_cpu = settings->incoming_cpu);
 }
 /** Listens to HTTP connections at the specified `port` and `binding`. */
 #define http_listen(port, binding, ...)                                        \
@@ -1942,6 +2089,424 @@ int http_parse_body(http_s *h) {
   return 0;
 }
 
+/* *****************************************************************************
+Streaming multipart/form-data parser
+
+The parser consumes the body in whatever chunks it arrives in. Only a possible
+delimiter at the end of a chunk (up to 74 bytes) and the part's headers are
+copied, so the data is never scanned twice.
+***************************************************************************** */
+
+/* "\r\n--" followed by the boundary (up to 70 bytes, see RFC 2046) */
+#define HTTP_MULTIPART_DELIM_MAX (70 + 4)
+
+typedef enum {
+  HTTP_MULTIPART_PREAMBLE,
+  HTTP_MULTIPART_DELIMITER, /* after a delimiter: CRLF or "--" (the end) */
+  HTTP_MULTIPART_HEADERS,
+  HTTP_MULTIPART_BODY,
+  HTTP_MULTIPART_DONE,
+  HTTP_MULTIPART_ERROR,
+} http_multipart_state_e;
+
+struct http_multipart_s {
+  http_multipart_part_s part;
+  http_multipart_settings_s settings;
+  http_s *h;
+  /* the part's data, for parts added to the `params` */
+  FIOBJ value;
+  size_t delim_len;
+  /* a possible delimiter at the end of the previous chunk */
+  size_t carry_len;
+  size_t head_len;
+  uint8_t state;
+  uint8_t spilled;
+  char delim[HTTP_MULTIPART_DELIM_MAX];
+  char carry[HTTP_MULTIPART_DELIM_MAX];
+  char head[HTTP_MAX_HEADER_LENGTH];
+};
+
+/* finds a header parameter's value (i.e., `name="value"`) */
+static fio_cstr_s http_multipart_param(char *pos, char *end, const char *name,
+                                       size_t name_len) {
+  while (pos < end) {
+    while (pos < end && (*pos == ';' || *pos == ' ' || *pos == '\t'))
+      ++pos;
+    char *key = pos;
+    while (pos < end && *pos != '=' && *pos != ';')
+      ++pos;
+    char *key_end = pos;
+    while (key_end > key && key_end[-1] == ' ')
+      --key_end;
+    if (pos >= end || *pos == ';')
+      continue;
+    ++pos;
+    while (pos < end && *pos == ' ')
+      ++pos;
+    char *value = pos;
+    char *value_end;
+    if (pos < end && *pos == '"') {
+      value = ++pos;
+      while (pos < end && *pos != '"') {
+        if (*pos == '\\' && pos + 1 < end)
+          ++pos;
+        ++pos;
+      }
+      value_end = pos;
+    } else {
+      while (pos < end && *pos != ';')
+        ++pos;
+      value_end = pos;
+      while (value_end > value && value_end[-1] == ' ')
+        --value_end;
+    }
+    if ((size_t)(key_end - key) == name_len &&
+        !strncasecmp(key, name, name_len))
+      return (fio_cstr_s){.data = value, .len = (size_t)(value_end - value)};
+    while (pos < end && *pos != ';')
+      ++pos;
+  }
+  return (fio_cstr_s){.data = NULL, .len = 0};
+}
+
+/* parses the part's headers and calls `on_part`. Returns -1 on error. */
+static int http_multipart_part_start(http_multipart_s *mp) {
+  char *pos = mp->head;
+  char *const stop = mp->head + mp->head_len;
+  mp->part = (http_multipart_part_s){
+      .udata = mp->settings.udata,
+      .fd = -1,
+  };
+  while (pos < stop) {
+    char *end = memchr(pos, '\n', (size_t)(stop - pos));
+    if (!end)
+      end = stop;
+    char *eol = (end > pos && end[-1] == '\r') ? end - 1 : end;
+    if (eol - pos > 20 && !strncasecmp(pos, "content-disposition:", 20)) {
+      mp->part.name = http_multipart_param(pos + 20, eol, "name", 4);
+      mp->part.filename = http_multipart_param(pos + 20, eol, "filename*", 9);
+      if (mp->part.filename.data) {
+        /* RFC 5987 - charset'language'url-encoded-value */
+        char *value = mp->part.filename.data;
+        char *value_end = value + mp->part.filename.len;
+        char *quote = memchr(value, '\'', mp->part.filename.len);
+        if (quote && (quote = memchr(quote + 1, '\'', value_end - quote - 1)))
+          value = quote + 1;
+        ssize_t len =
+            http_decode_url(value, value, (size_t)(value_end - value));
+        mp->part.filename =
+            (fio_cstr_s){.data = value, .len = (len > 0 ? (size_t)len : 0)};
+      } else {
+        mp->part.filename = http_multipart_param(pos + 20, eol, "filename", 8);
+      }
+    } else if (eol - pos > 13 && !strncasecmp(pos, "content-type:", 13)) {
+      char *value = pos + 13;
+      while (value < eol && *value == ' ')
+        ++value;
+      char *value_end = memchr(value, ';', (size_t)(eol - value));
+      if (!value_end)
+        value_end = eol;
+      mp->part.mime =
+          (fio_cstr_s){.data = value, .len = (size_t)(value_end - value)};
+    }
+    pos = end + 1;
+  }
+  if (!mp->part.name.len)
+    return -1; /* RFC 7578: every part must be named */
+  if (mp->settings.on_part)
+    mp->settings.on_part(&mp->part);
+  if (!mp->part.on_data && mp->part.fd == -1) {
+    mp->value = mp->part.filename.data ? fiobj_data_newstr() : fiobj_str_buf(0);
+    mp->spilled = 0;
+  }
+  return 0;
+}
+
+/* adds the part to the `params` (if required) and calls `on_part_end`. */
+static void http_multipart_part_end(http_multipart_s *mp) {
+  if (mp->value) {
+    http_multipart_part_s *part = &mp->part;
+    if (!mp->h->params)
+      mp->h->params = fiobj_hash_new();
+    if (!part->filename.data) {
+      http_add2hash2(mp->h->params, part->name.data, part->name.len, mp->value,
+                     0);
+    } else {
+      /* the same keys used by `http_parse_body` */
+      FIOBJ n = fiobj_str_buf(part->name.len + 6);
+      fiobj_str_write(n, part->name.data, part->name.len);
+      fiobj_str_write(n, "[data]", 6);
+      fio_cstr_s tmp = fiobj_obj2cstr(n);
+      http_add2hash2(mp->h->params, tmp.data, tmp.len, mp->value, 0);
+      fiobj_str_resize(n, part->name.len);
+      fiobj_str_write(n, "[type]", 6);
+      tmp = fiobj_obj2cstr(n);
+      http_add2hash(mp->h->params, tmp.data, tmp.len, part->mime.data,
+                    part->mime.len, 0);
+      fiobj_str_resize(n, part->name.len);
+      fiobj_str_write(n, "[name]", 6);
+      tmp = fiobj_obj2cstr(n);
+      http_add2hash(mp->h->params, tmp.data, tmp.len, part->filename.data,
+                    part->filename.len, 0);
+      fiobj_free(n);
+    }
+    mp->value = FIOBJ_INVALID;
+  }
+  if (mp->settings.on_part_end)
+    mp->settings.on_part_end(&mp->part);
+}
+
+/* routes a part's data to it's destination. Returns -1 on error. */
+static int http_multipart_emit(http_multipart_s *mp, char *data, size_t len) {
+  if (!len || mp->state != HTTP_MULTIPART_BODY)
+    return 0; /* the preamble is ignored */
+  mp->part.length += len;
+  if (mp->part.on_data) {
+    mp->part.on_data(&mp->part, data, len);
+    return 0;
+  }
+  if (mp->part.fd != -1) {
+    while (len) {
+      ssize_t written = write(mp->part.fd, data, len);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      }
+      data += written;
+      len -= written;
+    }
+    return 0;
+  }
+  if (!mp->part.filename.data) {
+    if (mp->part.length > mp->settings.memory_limit)
+      return -1;
+    fiobj_str_write(mp->value, data, len);
+    return 0;
+  }
+  if (!mp->spilled && mp->part.length > mp->settings.memory_limit) {
+    /* the file is too big to be kept in memory */
+    FIOBJ tmp = fiobj_data_newtmpfile();
+    if (!tmp)
+      return -1;
+    fio_cstr_s existing =
+        fiobj_data_pread(mp->value, 0, fiobj_data_len(mp->value));
+    if (existing.len)
+      fiobj_data_write(tmp, existing.data, existing.len);
+    fiobj_free(mp->value);
+    mp->value = tmp;
+    mp->spilled = 1;
+  }
+  if (fiobj_data_write(mp->value, data, len) != (intptr_t)len)
+    return -1;
+  return 0;
+}
+
+/**
+ * Consumes data up to (and including) the next delimiter, emitting the data
+ * that precedes it. Returns the number of bytes consumed (or -1 on error) and
+ * sets `found` if the delimiter was consumed.
+ */
+static ssize_t http_multipart_seek(http_multipart_s *mp, char *data,
+                                   size_t len, uint8_t *found) {
+  *found = 0;
+  /* complete (or drop) a possible delimiter from the previous chunk */
+  while (mp->carry_len) {
+    const size_t need = mp->delim_len - mp->carry_len;
+    const size_t take = (need < len) ? need : len;
+    if (!memcmp(mp->carry, mp->delim, mp->carry_len) &&
+        !memcmp(data, mp->delim + mp->carry_len, take)) {
+      if (take == need) {
+        mp->carry_len = 0;
+        *found = 1;
+        return (ssize_t)take;
+      }
+      memcpy(mp->carry + mp->carry_len, data, take);
+      mp->carry_len += take;
+      return (ssize_t)len;
+    }
+    /* not a delimiter, emit the data up to the next possible delimiter */
+    char *cr = memchr(mp->carry + 1, '\r', mp->carry_len - 1);
+    size_t drop = cr ? (size_t)(cr - mp->carry) : mp->carry_len;
+    if (http_multipart_emit(mp, mp->carry, drop))
+      return -1;
+    memmove(mp->carry, mp->carry + drop, mp->carry_len - drop);
+    mp->carry_len -= drop;
+  }
+  char *const end = data + len;
+  char *pos = data;
+  while ((pos = memchr(pos, '\r', (size_t)(end - pos)))) {
+    const size_t avail = (size_t)(end - pos);
+    if (avail >= mp->delim_len) {
+      if (!memcmp(pos, mp->delim, mp->delim_len)) {
+        if (http_multipart_emit(mp, data, (size_t)(pos - data)))
+          return -1;
+        *found = 1;
+        return (ssize_t)((pos - data) + mp->delim_len);
+      }
+    } else if (!memcmp(pos, mp->delim, avail)) {
+      /* a possible delimiter, wait for more data */
+      if (http_multipart_emit(mp, data, (size_t)(pos - data)))
+        return -1;
+      memcpy(mp->carry, pos, avail);
+      mp->carry_len = avail;
+      return (ssize_t)len;
+    }
+    ++pos;
+  }
+  if (http_multipart_emit(mp, data, len))
+    return -1;
+  return (ssize_t)len;
+}
+
+#undef http_multipart_new
+/**
+ * Creates a streaming `multipart/form-data` parser for the request.
+ */
+http_multipart_s *http_multipart_new(http_s *h,
+                                     http_multipart_settings_s settings) {
+  static uint64_t content_type_hash;
+  if (HTTP_INVALID_HANDLE(h))
+    return NULL;
+  if (!content_type_hash)
+    content_type_hash = fio_siphash("content-type", 12);
+  fio_cstr_s ct =
+      fiobj_obj2cstr(fiobj_hash_get2(h->headers, content_type_hash));
+  http_mime_parser_s boundary;
+  if (!ct.data || http_mime_parser_init(&boundary, ct.data, ct.len))
+    return NULL;
+  if (boundary.boundary_len >= 2 && boundary.boundary[0] == '"') {
+    ++boundary.boundary;
+    boundary.boundary_len -= 2;
+  }
+  if (!boundary.boundary_len ||
+      boundary.boundary_len > HTTP_MULTIPART_DELIM_MAX - 4)
+    return NULL;
+  http_multipart_s *mp = fio_malloc(sizeof(*mp));
+  HTTP_ASSERT(mp, "multipart parser allocation failed");
+  mp->part = (http_multipart_part_s){.fd = -1};
+  mp->settings = settings;
+  if (!mp->settings.memory_limit)
+    mp->settings.memory_limit = HTTP_MAX_HEADER_LENGTH;
+  mp->h = h;
+  mp->value = FIOBJ_INVALID;
+  mp->head_len = 0;
+  mp->state = HTTP_MULTIPART_PREAMBLE;
+  mp->spilled = 0;
+  memcpy(mp->delim, "\r\n--", 4);
+  memcpy(mp->delim + 4, boundary.boundary, boundary.boundary_len);
+  mp->delim_len = boundary.boundary_len + 4;
+  /* the first delimiter might start the body, without the leading CRLF */
+  memcpy(mp->carry, "\r\n", 2);
+  mp->carry_len = 2;
+  return mp;
+}
+
+/**
+ * Parses a chunk of the request's body. Returns -1 on error.
+ */
+int http_multipart_write(http_multipart_s *mp, void *data_, size_t len) {
+  char *data = data_;
+  if (!mp || mp->state == HTTP_MULTIPART_ERROR)
+    return -1;
+  while (len && mp->state != HTTP_MULTIPART_DONE) {
+    switch ((http_multipart_state_e)mp->state) {
+    case HTTP_MULTIPART_PREAMBLE: /* fallthrough */
+    case HTTP_MULTIPART_BODY: {
+      uint8_t found;
+      ssize_t consumed = http_multipart_seek(mp, data, len, &found);
+      if (consumed < 0)
+        goto error;
+      data += consumed;
+      len -= (size_t)consumed;
+      if (found) {
+        if (mp->state == HTTP_MULTIPART_BODY)
+          http_multipart_part_end(mp);
+        mp->state = HTTP_MULTIPART_DELIMITER;
+        mp->head_len = 0;
+      }
+      break;
+    }
+    case HTTP_MULTIPART_DELIMITER:
+      /* (optional) transport padding, followed by CRLF or "--" */
+      if (!mp->head_len && (*data == ' ' || *data == '\t')) {
+        ++data;
+        --len;
+        break;
+      }
+      mp->head[mp->head_len++] = *data;
+      ++data;
+      --len;
+      if (mp->head_len < 2)
+        break;
+      if (mp->head[0] == '-' && mp->head[1] == '-')
+        mp->state = HTTP_MULTIPART_DONE; /* the epilogue is ignored */
+      else if (mp->head[0] == '\r' && mp->head[1] == '\n')
+        mp->state = HTTP_MULTIPART_HEADERS; /* keeps the CRLF */
+      else
+        goto error;
+      break;
+    case HTTP_MULTIPART_HEADERS: {
+      /* collect the headers, up to the empty line (CRLF CRLF) */
+      size_t copy = sizeof(mp->head) - mp->head_len;
+      if (copy > len)
+        copy = len;
+      memcpy(mp->head + mp->head_len, data, copy);
+      size_t i = (mp->head_len > 3) ? mp->head_len - 3 : 0;
+      const size_t old_len = mp->head_len;
+      mp->head_len += copy;
+      char *eoh = NULL;
+      for (char *pos = mp->head + i;
+           (pos = memchr(pos, '\r', mp->head_len - (pos - mp->head)));
+           ++pos) {
+        if ((size_t)(pos - mp->head) + 4 > mp->head_len)
+          break;
+        if (pos[1] == '\n' && pos[2] == '\r' && pos[3] == '\n') {
+          eoh = pos;
+          break;
+        }
+      }
+      if (!eoh) {
+        if (mp->head_len == sizeof(mp->head))
+          goto error; /* header flood */
+        data += copy;
+        len -= copy;
+        break;
+      }
+      const size_t consumed = (size_t)(eoh + 4 - mp->head) - old_len;
+      data += consumed;
+      len -= consumed;
+      mp->head_len = (size_t)(eoh + 2 - mp->head);
+      mp->state = HTTP_MULTIPART_BODY;
+      if (http_multipart_part_start(mp))
+        goto error;
+      break;
+    }
+    case HTTP_MULTIPART_DONE: /* fallthrough */
+    case HTTP_MULTIPART_ERROR:
+      break;
+    }
+  }
+  return 0;
+error:
+  mp->state = HTTP_MULTIPART_ERROR;
+  fiobj_free(mp->value);
+  mp->value = FIOBJ_INVALID;
+  return -1;
+}
+
+/**
+ * Releases the parser, returning -1 if the body was incomplete or invalid.
+ */
+int http_multipart_finish(http_multipart_s *mp) {
+  if (!mp)
+    return -1;
+  const int ret = (mp->state == HTTP_MULTIPART_DONE) ? 0 : -1;
+  fiobj_free(mp->value);
+  fio_free(mp);
+  return ret;
+}
+
 /* *****************************************************************************
 HTTP Helper functions that could be used globally
 ***************************************************************************** */
@@ -1995,73 +2560,6 @@ FIOBJ http_req2str(http_s *h) {
   return w.dest;
 }
 
-void http_write_log(http_s *h) {
-  FIOBJ l = fiobj_str_buf(128);
-
-  intptr_t bytes_sent = fiobj_obj2num(fiobj_hash_get2(
-      h->private_data.out_headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH)));
-
-  struct timespec start, end;
-  clock_gettime(CLOCK_REALTIME, &end);
-  start = facil_last_tick();
-
-  fio_cstr_s buff = fiobj_obj2cstr(l);
-
-  // TODO Guess IP address from headers (forwarded) where possible
-  sock_peer_addr_s addrinfo =
-      sock_peer_addr(((http_protocol_s *)h->private_data.flag)->uuid);
-  if (addrinfo.addrlen) {
-    if (inet_ntop(
-            addrinfo.addr->sa_family,
-            addrinfo.addr->sa_family == AF_INET
-                ? (void *)&((struct sockaddr_in *)addrinfo.addr)->sin_addr
-                : (void *)&((struct sockaddr_in6 *)addrinfo.addr)->sin6_addr,
-            buff.data, 128)) {
-      buff.len = strlen(buff.data);
-    }
-  }
-  if (buff.len == 0) {
-    memcpy(buff.data, "[unknown]", 9);
-    buff.len = 9;
-  }
-  memcpy(buff.data + buff.len, " - - [", 6);
-  buff.len += 6;
-  fiobj_str_resize(l, buff.len);
-  {
-    FIOBJ date;
-    spn_lock(&date_lock);
-    date = fiobj_dup(current_date);
-    spn_unlock(&date_lock);
-    fiobj_str_join(l, current_date);
-    fiobj_free(date);
-  }
-  fiobj_str_write(l, "] \"", 3);
-  fiobj_str_join(l, h->method);
-  fiobj_str_write(l, " ", 1);
-  fiobj_str_join(l, h->path);
-  fiobj_str_write(l, " ", 1);
-  fiobj_str_join(l, h->version);
-  fiobj_str_write(l, "\" ", 2);
-  if (bytes_sent > 0) {
-    fiobj_str_join(l, fiobj_num_tmp(h->status));
-    fiobj_str_write(l, " ", 1);
-    fiobj_str_join(l, fiobj_num_tmp(bytes_sent));
-    fiobj_str_write(l, "b ", 2);
-  } else {
-    fiobj_str_join(l, fiobj_num_tmp(h->status));
-    fiobj_str_write(l, " -- ", 4);
-  }
-
-  bytes_sent = ((end.tv_sec - start.tv_sec) * 1000) +
-               ((end.tv_nsec - start.tv_nsec) / 1000000);
-  fiobj_str_join(l, fiobj_num_tmp(bytes_sent));
-  fiobj_str_write(l, "ms\r\n", 4);
-
-  buff = fiobj_obj2cstr(l);
-  fwrite(buff.data, 1, buff.len, stderr);
-  fiobj_free(l);
-}
-
 /**
 A faster (yet less localized) alternative to `gmtime_r`.
 
@@ -2728,6 +3226,275 @@ void http_mimetype_clear(void) {
   fiobj_free(old_date);
 }
 
+/* *****************************************************************************
+Static File Cache
+***************************************************************************** */
+
+static struct {
+  fio_hash_s files;
+  fio_ls_embd_s lru;
+  size_t memory;
+  spn_lock_i lock;
+} http_static_cache = {
+    .files = FIO_HASH_INIT,
+    .lru = FIO_LS_INIT(http_static_cache.lru),
+    .lock = SPN_LOCK_INIT,
+};
+
+/** The memory accounted for a cache entry. */
+static inline size_t http_static_memory(http_static_s *f) {
+  size_t total = sizeof(*f) + fiobj_obj2cstr(f->filename).len +
+                 (f->body ? f->size : 0);
+  for (size_t i = 0; i < HTTP_COMPRESS_COUNT; ++i) {
+    if (f->compressed[i])
+      total += fiobj_obj2cstr(f->compressed[i]).len;
+  }
+  return total;
+}
+
+static inline http_static_s *http_static_dup(http_static_s *f) {
+  spn_add(&f->ref, 1);
+  return f;
+}
+
+static void http_static_free(http_static_s *f) {
+  if (!f || spn_sub(&f->ref, 1))
+    return;
+  fiobj_free(f->filename);
+  fiobj_free(f->etag);
+  fiobj_free(f->last_modified);
+  fiobj_free(f->mimetype);
+  fiobj_free(f->body);
+  for (size_t i = 0; i < HTTP_COMPRESS_COUNT; ++i) {
+    fiobj_free(f->compressed[i]);
+    fiobj_free(f->compressed_etag[i]);
+  }
+  if (f->fd != -1)
+    close(f->fd);
+  fio_free(f);
+}
+
+/** Removes an entry from the cache (call within the lock). */
+static void http_static_remove_unsafe(http_static_s *f) {
+  if (fio_hash_find(&http_static_cache.files, f->hash) == f)
+    fio_hash_insert(&http_static_cache.files, f->hash, NULL);
+  fio_ls_embd_remove(&f->node);
+  http_static_cache.memory -= http_static_memory(f);
+  http_static_free(f);
+}
+
+/** Evicts the least recently used files, except `keep` (call within lock). */
+static void http_static_evict_unsafe(http_static_s *keep) {
+  while ((http_static_cache.memory > HTTP_STATIC_CACHE_LIMIT ||
+          fio_hash_count(&http_static_cache.files) >
+              HTTP_STATIC_CACHE_FILES) &&
+         http_static_cache.lru.prev != &keep->node) {
+    http_static_remove_unsafe(
+        FIO_LS_EMBD_OBJ(http_static_s, node, http_static_cache.lru.prev));
+  }
+}
+
+/** Opens a file and collects the data needed to send it. */
+static http_static_s *http_static_new(FIOBJ filename, uintptr_t hash,
+                                      uint8_t is_gz) {
+  fio_cstr_s s = fiobj_obj2cstr(filename);
+  struct stat st;
+  int fd = open(s.data, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return NULL;
+  }
+  http_static_s *f = fio_malloc(sizeof(*f));
+  if (!f) {
+    close(fd);
+    return NULL;
+  }
+  *f = (http_static_s){
+      .filename = fiobj_str_copy(filename),
+      .hash = hash,
+      .ref = 1,
+      .size = (size_t)st.st_size,
+      .mtime = st.st_mtime,
+      .ino = st.st_ino,
+      .checked = facil_last_tick().tv_sec,
+      .fd = fd,
+      .is_gz = is_gz,
+  };
+  /* last-modified */
+  f->last_modified = fiobj_str_buf(32);
+  fiobj_str_resize(f->last_modified,
+                   http_time2str(fiobj_obj2cstr(f->last_modified).data,
+                                 st.st_mtime));
+  /* etag */
+  uint64_t etag = (uint64_t)st.st_size;
+  etag ^= (uint64_t)st.st_mtime;
+  etag = fio_siphash(&etag, sizeof(uint64_t));
+  f->etag = fiobj_str_buf(32);
+  fiobj_str_resize(f->etag, fio_base64_encode(fiobj_obj2cstr(f->etag).data,
+                                              (void *)&etag, sizeof(uint64_t)));
+  /* mime-type (ignoring the ".gz" extension of a compressed alternative) */
+  {
+    size_t end = s.len - (is_gz ? 3 : 0);
+    size_t pos = end - 1;
+    while (pos && s.data[pos] != '.')
+      pos--;
+    pos++; /* assuming, but that's fine. */
+    f->mimetype = http_mimetype_find(s.data + pos, end - pos);
+  }
+  /* keep small files in memory */
+  if (f->size <= HTTP_STATIC_CACHE_MAX_FILE) {
+    FIOBJ body = fiobj_str_buf(f->size);
+    fio_cstr_s b = fiobj_obj2cstr(body);
+    if (pread(fd, b.data, f->size, 0) == (ssize_t)f->size) {
+      fiobj_str_resize(body, f->size);
+      f->body = body;
+      close(fd);
+      f->fd = -1;
+    } else {
+      fiobj_free(body);
+    }
+  }
+  return f;
+}
+
+/**
+ * Returns a cache entry for the file's pre-compressed ".gz" sibling (or NULL),
+ * leaving the `filename` String unchanged.
+ */
+static http_static_s *http_static_get_gz(FIOBJ filename) {
+  const size_t len = fiobj_obj2cstr(filename).len;
+  fiobj_str_write(filename, ".gz", 3);
+  http_static_s *f = http_static_get(filename, 1);
+  fiobj_str_resize(filename, len);
+  return f;
+}
+
+/**
+ * Returns a cache entry for the file (call `http_static_free` when done), or
+ * NULL if the file doesn't exist (or isn't a regular file).
+ *
+ * The file is only tested (`stat`) once every HTTP_STATIC_CACHE_REVALIDATE
+ * seconds.
+ */
+static http_static_s *http_static_get(FIOBJ filename, uint8_t is_gz) {
+  fio_cstr_s s = fiobj_obj2cstr(filename);
+  const uintptr_t hash = fio_siphash(s.data, s.len) ^ is_gz;
+  const time_t now = facil_last_tick().tv_sec;
+  http_static_s *f;
+  if (!HTTP_STATIC_CACHE_LIMIT)
+    return http_static_new(filename, hash, is_gz);
+  spn_lock(&http_static_cache.lock);
+  f = fio_hash_find(&http_static_cache.files, hash);
+  if (f && f->is_gz == is_gz && fiobj_iseq(f->filename, filename)) {
+    if (f->checked + HTTP_STATIC_CACHE_REVALIDATE > now)
+      goto found;
+    /* revalidate the cached data */
+    struct stat st;
+    if (!stat(s.data, &st) && S_ISREG(st.st_mode) &&
+        (size_t)st.st_size == f->size && st.st_mtime == f->mtime &&
+        st.st_ino == f->ino) {
+      f->checked = now;
+      goto found;
+    }
+  }
+  if (f)
+    http_static_remove_unsafe(f);
+  spn_unlock(&http_static_cache.lock);
+
+  f = http_static_new(filename, hash, is_gz);
+  if (!f)
+    return NULL;
+  spn_lock(&http_static_cache.lock);
+  {
+    http_static_s *old = fio_hash_insert(&http_static_cache.files, hash, f);
+    if (old) {
+      /* another thread loaded the file */
+      fio_ls_embd_remove(&old->node);
+      http_static_cache.memory -= http_static_memory(old);
+      http_static_free(old);
+    }
+  }
+  fio_ls_embd_push(&http_static_cache.lru, &f->node);
+  http_static_cache.memory += http_static_memory(f);
+  /* evict the least recently used files */
+  http_static_evict_unsafe(f);
+  if (fio_hash_is_fragmented(&http_static_cache.files))
+    fio_hash_compact(&http_static_cache.files);
+  http_static_dup(f);
+  spn_unlock(&http_static_cache.lock);
+  return f;
+
+found:
+  fio_ls_embd_remove(&f->node);
+  fio_ls_embd_push(&http_static_cache.lru, &f->node);
+  http_static_dup(f);
+  spn_unlock(&http_static_cache.lock);
+  return f;
+}
+
+/**
+ * Returns the file's compressed variant (owned by the cache entry), or
+ * FIOBJ_INVALID if compression didn't reduce the file's size.
+ *
+ * The file is compressed once (by the first thread to request the variant),
+ * other threads send the uncompressed data until the variant is available.
+ */
+static FIOBJ http_static_compressed(http_static_s *f,
+                                    http_compress_e encoding) {
+  FIOBJ ret;
+  spn_lock(&http_static_cache.lock);
+  ret = f->compressed[encoding];
+  if (f->compressed_tried[encoding]) {
+    spn_unlock(&http_static_cache.lock);
+    return ret;
+  }
+  f->compressed_tried[encoding] = 1;
+  spn_unlock(&http_static_cache.lock);
+
+  /* compress outside of the lock, reading larger files as needed */
+  FIOBJ data = f->body ? fiobj_dup(f->body) : fiobj_str_buf(f->size);
+  fio_cstr_s d = fiobj_obj2cstr(data);
+  if (!f->body) {
+    if (pread(f->fd, d.data, f->size, 0) != (ssize_t)f->size) {
+      fiobj_free(data);
+      return FIOBJ_INVALID;
+    }
+    fiobj_str_resize(data, f->size);
+  }
+  ret = http_compress(encoding, d.data, f->size, 1);
+  fiobj_free(data);
+  if (!ret)
+    return FIOBJ_INVALID;
+  FIOBJ etag = fiobj_str_copy(f->etag);
+  fiobj_str_write(etag, (encoding == HTTP_COMPRESS_BROTLI ? "-br" : "-gz"), 3);
+
+  spn_lock(&http_static_cache.lock);
+  f->compressed_etag[encoding] = etag;
+  f->compressed[encoding] = ret;
+  if (fio_hash_find(&http_static_cache.files, f->hash) == f) {
+    /* the variant is accounted for while the file is cached */
+    http_static_cache.memory += fiobj_obj2cstr(ret).len;
+    http_static_evict_unsafe(f);
+  }
+  spn_unlock(&http_static_cache.lock);
+  return ret;
+}
+
+/** Clears the static file cache used by `http_sendfile2`. */
+void http_static_cache_clear(void) {
+  spn_lock(&http_static_cache.lock);
+  while (fio_ls_embd_any(&http_static_cache.lru)) {
+    http_static_remove_unsafe(
+        FIO_LS_EMBD_OBJ(http_static_s, node, http_static_cache.lru.next));
+  }
+  fio_hash_free(&http_static_cache.files);
+  http_static_cache.files = (fio_hash_s)FIO_HASH_INIT;
+  http_static_cache.memory = 0;
+  spn_unlock(&http_static_cache.lock);
+}
+
 /**
 * Create with Ruby using:
 
@@ -2859,5 +3626,201 @@ void http_tests(void) {
     fprintf(stderr, "Testing failed.\n");                                      \
     exit(-1);                                                                  \
   }
+  {
+    http_lib_init();
+    FIOBJ name = http_header_name("host", 4);
+    TEST_ASSERT(name == HTTP_HEADER_HOST,
+                "well-known header name should be shared\n");
+    fiobj_free(name);
+    name = http_header_name("x-custom-header", 15);
+    TEST_ASSERT(name != FIOBJ_INVALID && fiobj_obj2cstr(name).len == 15 &&
+                    !memcmp(fiobj_obj2cstr(name).data, "x-custom-header", 15),
+                "unknown header name error\n");
+    fiobj_free(name);
+    name = http_header_name("user-agent", 10);
+    TEST_ASSERT(fiobj_obj2hash(name) == fio_siphash("user-agent", 10),
+                "well-known header name hash error\n");
+    fiobj_free(name);
+    fprintf(stderr, "* header name table passed.\n");
+  }
+  {
+    /* every split of the body must produce the same result */
+    char body[] = "preamble\r\n--xyz\r\n"
+                  "Content-Disposition: form-data; name=\"a\"\r\n\r\n"
+                  "\r\n--xy\r\n-\r\n--xyz \r\n"
+                  "Content-Disposition: form-data; name=\"f\"; "
+                  "filename=\"b.txt\"\r\nContent-Type: text/plain\r\n\r\n"
+                  "file data\r\n--xyz--\r\nepilogue";
+    const size_t body_len = sizeof(body) - 1;
+    for (size_t split = 0; split <= body_len; ++split) {
+      /* `http_s_new` would initialize the facil.io library */
+      http_s h = {.private_data.vtbl = http1_vtable(),
+                  .method = fiobj_str_new("POST", 4),
+                  .headers = fiobj_hash_new(),
+                  .status = 200};
+      fiobj_hash_set(h.headers, HTTP_HEADER_CONTENT_TYPE,
+                     fiobj_str_new("multipart/form-data; boundary=xyz", 33));
+      http_multipart_s *mp =
+          http_multipart_new(&h, (http_multipart_settings_s){.udata = NULL});
+      TEST_ASSERT(mp, "multipart parser creation failed\n");
+      TEST_ASSERT(!http_multipart_write(mp, body, split) &&
+                      !http_multipart_write(mp, body + split,
+                                            body_len - split) &&
+                      !http_multipart_finish(mp),
+                  "multipart parsing failed (split at %zu)\n", split);
+      fio_cstr_s a =
+          fiobj_obj2cstr(fiobj_hash_get2(h.params, fio_siphash("a", 1)));
+      TEST_ASSERT(a.len == 9 && !memcmp(a.data, "\r\n--xy\r\n-", 9),
+                  "multipart field error (split at %zu)\n", split);
+      FIOBJ f = fiobj_hash_get2(h.params, fio_siphash("f", 1));
+      fio_cstr_s data =
+          fiobj_obj2cstr(fiobj_hash_get2(f, fio_siphash("data", 4)));
+      fio_cstr_s name =
+          fiobj_obj2cstr(fiobj_hash_get2(f, fio_siphash("name", 4)));
+      TEST_ASSERT(data.len == 9 && !memcmp(data.data, "file data", 9) &&
+                      name.len == 5 && !memcmp(name.data, "b.txt", 5),
+                  "multipart file error (split at %zu)\n", split);
+      http_s_destroy(&h, 0);
+    }
+    fprintf(stderr, "* streaming multipart parser passed.\n");
+  }
+  {
+    const uint8_t all = (1 << HTTP_COMPRESS_GZIP) | (1 << HTTP_COMPRESS_BROTLI);
+    const uint8_t gzip = (1 << HTTP_COMPRESS_GZIP);
+    static const struct {
+      const char *accept;
+      uint8_t encodings;
+      http_compress_e expected;
+    } cases[] = {
+        {"gzip, deflate, br", all, HTTP_COMPRESS_BROTLI},
+        {"gzip;q=1.0, br;q=0.5", all, HTTP_COMPRESS_GZIP},
+        {"br;q=0.5, gzip;q=0.6", all, HTTP_COMPRESS_GZIP},
+        {"GZIP ; q=0.8 , BR;q=0.80", all, HTTP_COMPRESS_BROTLI},
+        {"deflate, gzip;q=0.001", all, HTTP_COMPRESS_GZIP},
+        {"br;q=0, gzip", all, HTTP_COMPRESS_GZIP},
+        {"gzip;q=0", all, HTTP_COMPRESS_NONE},
+        {"gzip;q=0.000, br;q=0", all, HTTP_COMPRESS_NONE},
+        {"*", all, HTTP_COMPRESS_BROTLI},
+        {"*;q=0.1, br;q=0", all, HTTP_COMPRESS_GZIP},
+        {"gzip;q=0.2, *;q=0.5", all, HTTP_COMPRESS_BROTLI},
+        {"*;q=0", all, HTTP_COMPRESS_NONE},
+        {"identity", all, HTTP_COMPRESS_NONE},
+        {"", all, HTTP_COMPRESS_NONE},
+        {"br, gzip;q=0.5", gzip, HTTP_COMPRESS_GZIP},
+        {"br", gzip, HTTP_COMPRESS_NONE},
+        {"*", 0, HTTP_COMPRESS_NONE},
+        {NULL, 0, HTTP_COMPRESS_NONE},
+    };
+    FIOBJ key = fiobj_str_new("accept-encoding", 15);
+    for (size_t i = 0; cases[i].accept; ++i) {
+      http_s h = {.headers = fiobj_hash_new()};
+      fiobj_hash_set(h.headers, key,
+                     fiobj_str_new(cases[i].accept, strlen(cases[i].accept)));
+      TEST_ASSERT(http_compress_negotiate2(&h, cases[i].encodings) ==
+                      cases[i].expected,
+                  "accept-encoding negotiation error for \"%s\"\n",
+                  cases[i].accept);
+      fiobj_free(h.headers);
+    }
+    {
+      /* no header and the compiled in encodings */
+      http_s h = {.headers = fiobj_hash_new()};
+      TEST_ASSERT(!http_compress_negotiate2(&h, all),
+                  "accept-encoding negotiation error (no header)\n");
+      fiobj_hash_set(h.headers, key, fiobj_str_new("br, gzip", 8));
+#if HAVE_BROTLI
+      const http_compress_e expected = HTTP_COMPRESS_BROTLI;
+#elif HAVE_ZLIB
+      const http_compress_e expected = HTTP_COMPRESS_GZIP;
+#else
+      const http_compress_e expected = HTTP_COMPRESS_NONE;
+#endif
+      TEST_ASSERT(http_compress_negotiate(&h) == expected,
+                  "accept-encoding negotiation error (compiled in)\n");
+      fiobj_free(h.headers);
+    }
+    fiobj_free(key);
+    fprintf(stderr, "* accept-encoding negotiation passed.\n");
+  }
+  {
+    static const struct {
+      const char *mime;
+      int expected;
+    } cases[] = {
+        {"text/html", 1},
+        {"TEXT/plain; charset=utf-8", 1},
+        {"application/json", 1},
+        {"application/javascript", 1},
+        {"image/svg+xml", 1},
+        {"application/wasm", 1},
+        {"image/png", 0},
+        {"application/octet-stream", 0},
+        {"image/png; x=json", 0},
+        {"application/ld+json; charset=utf-8", 1},
+        {"application/xhtml+xml", 1},
+        {"text/xml ", 1},
+        {"application/vnd.openxmlformats-officedocument."
+         "wordprocessingml.document",
+         0},
+        {"application/vnd.ms-excel.sheet.macroEnabled.12", 0},
+        {"application/jsonx", 0},
+        {"application/x-wasm-json-xml", 0},
+        {"text/", 0},
+        {"text", 0},
+        {"", 0},
+        {NULL, 0},
+    };
+    for (size_t i = 0; cases[i].mime; ++i) {
+      fio_cstr_s mime = {.data = (char *)cases[i].mime,
+                         .len = strlen(cases[i].mime)};
+      TEST_ASSERT(http_compress_mime(mime) == cases[i].expected,
+                  "compressible mime type error for \"%s\"\n",
+                  cases[i].mime);
+    }
+    TEST_ASSERT(!http_compress_mime((fio_cstr_s){.data = NULL}),
+                "compressible mime type error (no type)\n");
+    fprintf(stderr, "* compressible mime types passed.\n");
+  }
+  {
+    static const struct {
+      const char *range;
+      int64_t offset; /* -1 == the range is ignored */
+      int64_t length;
+    } cases[] = {
+        {"bytes=-10", 199990, 10},
+        {"bytes=-300000", 0, 200000},
+        {"bytes=100-", 100, 199900},
+        {"bytes=100-199", 100, 100},
+        {"bytes=0-0", 0, 1},
+        {"bytes=199999-", 199999, 1},
+        {"bytes=100-999999", 100, 199900},
+        {"bytes=0-9,20-29", 0, 10},
+        {"bytes=200000-", -1, 0},
+        {"bytes=10-5", -1, 0},
+        {"bytes=-0", -1, 0},
+        {"bytes=-", -1, 0},
+        {"bytes=10", -1, 0},
+        {"bytes=x-10", -1, 0},
+        {"items=0-10", -1, 0},
+        {"", -1, 0},
+        {NULL, 0, 0},
+    };
+    for (size_t i = 0; cases[i].range; ++i) {
+      int64_t offset = -1, length = 0;
+      fio_cstr_s range = {.data = (char *)cases[i].range,
+                          .len = strlen(cases[i].range)};
+      int ret = http_range_parse(range, 200000, &offset, &length);
+      TEST_ASSERT((cases[i].offset == -1 && ret == -1) ||
+                      (!ret && offset == cases[i].offset &&
+                       length == cases[i].length),
+                  "range error for \"%s\" (%lld, %lld)\n", cases[i].range,
+                  (long long)offset, (long long)length);
+    }
+    fprintf(stderr, "* byte ranges passed.\n");
+  }
+  http1_tests();
+  http2_tests();
+  http_router_test();
+  websocket_tests();
 }
 #endif
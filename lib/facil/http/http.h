@@ -40,9 +40,65 @@ Compile Time Settings
 #define HTTP_MAX_HEADER_LENGTH 8192
 #endif
 
+#ifndef HTTP_STREAM_MAX_PENDING
+/**
+ * The number of outgoing packets (see `sock_pending`) after which
+ * `http_stream_write` reports that the connection is busy.
+ */
+#define HTTP_STREAM_MAX_PENDING 8
+#endif
+
+#ifndef HTTP_STATIC_CACHE_LIMIT
+/**
+ * The memory limit (in bytes) for the static file cache used by
+ * `http_sendfile2`. Set to 0 to disable the cache.
+ */
+#define HTTP_STATIC_CACHE_LIMIT (1024 * 1024 * 32)
+#endif
+
+#ifndef HTTP_STATIC_CACHE_FILES
+/** The maximum number of files in the static file cache. */
+#define HTTP_STATIC_CACHE_FILES 1024
+#endif
+
+#ifndef HTTP_STATIC_CACHE_MAX_FILE
+/**
+ * Cached files up to this size (in bytes) are kept in memory. Larger files
+ * are kept open.
+ */
+#define HTTP_STATIC_CACHE_MAX_FILE (1024 * 64)
+#endif
+
+#ifndef HTTP_STATIC_CACHE_REVALIDATE
+/** The number of seconds before a cached file is tested for changes. */
+#define HTTP_STATIC_CACHE_REVALIDATE 1
+#endif
+
+#ifndef HTTP_COMPRESS_MIN_SIZE
+/** Smaller responses (in bytes) aren't compressed (see `compress`). */
+#define HTTP_COMPRESS_MIN_SIZE 512
+#endif
+
+#ifndef HTTP_COMPRESS_MAX_FILE
+/**
+ * Static files up to this size (in bytes) are compressed once and the result
+ * is kept in the static file cache (see `compress`). Larger files are sent as
+ * is, unless a pre-compressed (`.gz`) file exists.
+ */
+#define HTTP_COMPRESS_MAX_FILE (1024 * 1024)
+#endif
+
+#ifndef HTTP_ROUTE_MAX_PARAMS
+/** The maximum number of parameters (and wildcards) captured by a route. */
+#define HTTP_ROUTE_MAX_PARAMS 16
+#endif
+
 /** the `http_listen settings, see detils in the struct definition. */
 typedef struct http_settings_s http_settings_s;
 
+/** A route table, see `http_router_new` and `http_route` for details. */
+typedef struct http_router_s http_router_s;
+
 /* *****************************************************************************
 The Request / Response type and functions
 ***************************************************************************** */
@@ -204,10 +260,21 @@ int http_sendfile(http_s *h, int fd, uintptr_t length, uintptr_t offset);
  * will become invalid).
  *
  * Returns -1 on error (The `http_s` handle should still be used).
+ *
+ * Files are cached (see `HTTP_STATIC_CACHE_LIMIT`), so frequently requested
+ * files are served without accessing the file system.
  */
 int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
                    const char *encoded, size_t encoded_len);
 
+/**
+ * Clears the static file cache used by `http_sendfile2`.
+ *
+ * Cached files are tested for changes every `HTTP_STATIC_CACHE_REVALIDATE`
+ * seconds, so this is rarely required.
+ */
+void http_static_cache_clear(void);
+
 /**
  * Sends an HTTP error response.
  *
@@ -227,6 +294,61 @@ int http_send_error(http_s *h, size_t error_code);
  */
 void http_finish(http_s *h);
 
+/** Named arguments for the {http_stream_start} function. */
+typedef struct {
+  /**
+   * Called whenever the connection's outgoing buffer was flushed and more data
+   * can be written (using `http_stream_write`).
+   *
+   * The callback is performed within the connection's lock, so it's safe to
+   * call `http_stream_write` and `http_stream_end` from within the callback.
+   */
+  void (*on_ready)(http_s *h);
+  /**
+   * Called if the connection was lost (or the HTTP/2 stream was reset) before
+   * `http_stream_end` was called, allowing `h->udata` to be released.
+   *
+   * The `http_s` handle will be invalid once the callback returns.
+   */
+  void (*on_abort)(http_s *h);
+} http_stream_args_s;
+
+/**
+ * Sends the response headers and starts streaming the response body, so long
+ * running responses can start sending data before the whole body is known.
+ *
+ * HTTP/1.1 responses use the `chunked` transfer encoding (unless a
+ * `content-length` header was set), HTTP/1.0 connections are closed once the
+ * response is complete and HTTP/2 responses are sent as DATA frames.
+ *
+ * The `http_s` handle remains valid until `http_stream_end` is called (or
+ * until `on_abort` returns). The `http_stream_write` and `http_stream_end`
+ * functions should be called from within the request's callbacks (i.e., the
+ * `on_request`, `on_ready` or an `http_resume` task).
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int http_stream_start(http_s *h, http_stream_args_s args);
+#define http_stream_start(h, ...)                                              \
+  http_stream_start((h), (http_stream_args_s){__VA_ARGS__})
+
+/**
+ * Writes a chunk of a streamed response body (see `http_stream_start`).
+ *
+ * Returns -1 on error (the connection was lost), 0 if more data can be written
+ * and 1 if the data is waiting for the connection (see
+ * `HTTP_STREAM_MAX_PENDING`). Once 1 is returned, it's best to wait for the
+ * `on_ready` callback before writing more data.
+ */
+int http_stream_write(http_s *h, void *data, uintptr_t length);
+
+/**
+ * Completes a streamed response (see `http_stream_start`).
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+void http_stream_end(http_s *h);
+
 /**
  * Pushes a data response when supported (HTTP/2 only).
  *
@@ -293,6 +415,27 @@ void *http_paused_udata_get(void *http);
  */
 void *http_paused_udata_set(void *http, void *udata);
 
+/**
+ * Stops reading a streamed request body (see `on_body_chunk`) until
+ * `http_body_resume` is called, so the body is consumed no faster than the
+ * application can handle it.
+ *
+ * Should be called within the `on_request` or `on_body_chunk` callbacks.
+ *
+ * On HTTP/1.x, the connection isn't read while the body is paused. On HTTP/2,
+ * the stream's flow control window isn't replenished, so data that was already
+ * sent by the client (up to `HTTP2_WINDOW_SIZE` bytes) might still arrive.
+ */
+void http_body_pause(http_s *h);
+
+/**
+ * Resumes reading a streamed request body that was paused using
+ * `http_body_pause`.
+ *
+ * Safe to call from any thread, for as long as the request wasn't finished.
+ */
+void http_body_resume(http_s *h);
+
 /* *****************************************************************************
 HTTP Connections - Listening / Connecting / Hijacking
 ***************************************************************************** */
@@ -301,6 +444,15 @@ HTTP Connections - Listening / Connecting / Hijacking
 struct http_settings_s {
   /** Callback for normal HTTP requests. */
   void (*on_request)(http_s *request);
+  /**
+   * (optional) A route table (see `http_route`). Requests are dispatched to
+   * the matching route's handler, while `on_request` handles requests that
+   * don't match any route (a 404 error is sent if `on_request` isn't set).
+   *
+   * The table is compiled by `http_listen` and must outlive the listening
+   * socket (free it using `http_router_free` once `facil_run` returns).
+   */
+  http_router_s *router;
   /**
    * Callback for Upgrade and EventSource (SSE) requests.
    *
@@ -309,6 +461,30 @@ struct http_settings_s {
   void (*on_upgrade)(http_s *request, char *requested_protocol, size_t len);
   /** CLIENT REQUIRED: a callback for the HTTP response. */
   void (*on_response)(http_s *response);
+  /**
+   * (optional) Streams request bodies to the application instead of collecting
+   * them (in memory or in a temporary file).
+   *
+   * When set, `on_request` is called once the request's body starts (`h->body`
+   * remains empty) and the body is passed to `on_body_chunk` as it arrives.
+   * Use `http_body_pause` and `http_body_resume` to limit the rate at which the
+   * body is read.
+   *
+   * The request isn't finished when `on_request` returns. Instead, it's
+   * finished once `on_body_end` returns, unless the response was already sent
+   * or `http_pause` was called. Note that `http_pause` can only be called once
+   * the body was received (within or after `on_body_end`).
+   *
+   * The `max_body_size` limit still applies.
+   */
+  void (*on_body_chunk)(http_s *h, char *data, size_t length);
+  /**
+   * (optional) Called once a streamed request body was fully received (see
+   * `on_body_chunk`), including for requests without a body.
+   *
+   * Not called if the response was sent before the body was complete.
+   */
+  void (*on_body_end)(http_s *h);
   /** (optional) the callback to be performed when the HTTP service closes. */
   void (*on_finish)(struct http_settings_s *settings);
   /** Opaque user data. Facil.io will ignore this field, but you can use it. */
@@ -386,6 +562,41 @@ struct http_settings_s {
   uint8_t log;
   /** a read only flag set automatically to indicate the protocol's mode. */
   uint8_t is_client;
+  /**
+   * When set, every worker process opens it's own listening socket
+   * (`SO_REUSEPORT`). See `facil_listen` for details.
+   */
+  uint8_t reuse_port;
+  /**
+   * When set (together with `reuse_port` and the `facil_run` `pin_cpus`
+   * option), every worker's listening socket prefers connections handled by
+   * the worker's CPU core (`SO_INCOMING_CPU`). Defaults to off. See
+   * `facil_listen` for details.
+   */
+  uint8_t incoming_cpu;
+  /**
+   * When set, the objects describing an incoming HTTP/1.x request (method,
+   * path, query, headers, small bodies, etc') are allocated from a thread local
+   * arena that is rewound (reused) once the request is finished.
+   *
+   * Objects retained after the request was finished (i.e., using `fiobj_dup`)
+   * remain valid, but they keep the arena's memory block (32Kb) alive. Copy
+   * any data that should be kept for a long time.
+   */
+  uint8_t request_arena;
+  /**
+   * When set, textual responses (text, JSON, JavaScript, XML, etc') are
+   * compressed using brotli or gzip, according to the client's
+   * `accept-encoding` header.
+   *
+   * Dynamic responses (`http_send_body`) are compressed on the fly. Static
+   * files (`http_sendfile2`) are compressed once and the compressed variant is
+   * kept in the static file cache (see `HTTP_COMPRESS_MAX_FILE`).
+   *
+   * Requires facil.io to be compiled with zlib (`HAVE_ZLIB`) and / or brotli
+   * (`HAVE_BROTLI`). Otherwise, this flag is ignored.
+   */
+  uint8_t compress;
 };
 
 /**
@@ -467,6 +678,95 @@ sock_peer_addr_s http_peer_addr(http_s *h);
  */
 intptr_t http_hijack(http_s *h, fio_cstr_s *leftover);
 
+/* *****************************************************************************
+Routing
+***************************************************************************** */
+
+/** Method flags for the `methods` bitmask (see `http_route`). */
+enum {
+  HTTP_METHOD_GET = 1,
+  HTTP_METHOD_HEAD = 2,
+  HTTP_METHOD_POST = 4,
+  HTTP_METHOD_PUT = 8,
+  HTTP_METHOD_DELETE = 16,
+  HTTP_METHOD_PATCH = 32,
+  HTTP_METHOD_OPTIONS = 64,
+  /** Any other (non-standard) method. */
+  HTTP_METHOD_OTHER = 128,
+  HTTP_METHOD_ANY = 255,
+};
+
+/** Creates a new (empty) route table. See `http_route`. */
+http_router_s *http_router_new(void);
+
+/**
+ * Frees a route table. The table must outlive any listening socket that uses
+ * it (see the `router` setting).
+ */
+void http_router_free(http_router_s *router);
+
+/** Named arguments for the {http_route} function. */
+typedef struct {
+  /**
+   * The route's path. Path segments starting with a colon (`:`) are named
+   * parameters that match a single (non-empty) segment, i.e.:
+   *
+   *      "/users/:id/posts"
+   *
+   * A final segment starting with an asterisk (`*`) is a wildcard that matches
+   * the rest of the path (a wildcard without a name is named `"*"`).
+   */
+  const char *path;
+  /** The path's length, if not NUL terminated. */
+  size_t path_len;
+  /** The function that handles matching requests. */
+  void (*handler)(http_s *h);
+  /** (optional) a value for `h->udata`, set before `handler` is called. */
+  void *udata;
+  /**
+   * The methods handled by the route (a bitmask of `HTTP_METHOD_*` flags),
+   * defaults to `HTTP_METHOD_ANY`. GET routes also handle HEAD requests.
+   */
+  uint16_t methods;
+} http_route_args_s;
+
+/**
+ * Adds a route to the route table.
+ *
+ * Static segments are preferred over parameters and parameters are preferred
+ * over wildcards, regardless of the order in which routes were added. Requests
+ * that match a route's path, but not it's methods, receive a 405 error.
+ *
+ * Routes must be added before the table is used by `http_listen`.
+ *
+ * Returns -1 on error (i.e., the path is invalid or a route with the same path
+ * and method already exists) and 0 on success.
+ */
+int http_route(http_router_s *router, http_route_args_s args);
+#define http_route(router, ...)                                                \
+  http_route((router), (http_route_args_s){__VA_ARGS__})
+
+/**
+ * Returns a route parameter captured for the request (see `http_route`), or a
+ * NULL string if the route has no such parameter.
+ *
+ * The value points into `h->path` (and it's still percent encoded).
+ *
+ * Parameters are only available from within the route's handler (before it
+ * returns). Use `http_route_params` to keep the parameters for later.
+ */
+fio_cstr_s http_route_param(http_s *h, const char *name, size_t name_len);
+
+/**
+ * Adds the route parameters captured for the request to the `h->params` Hash
+ * (decoding the values), so they're available after the route's handler
+ * returns.
+ *
+ * Returns -1 on error (i.e., called outside of a route's handler) and 0 on
+ * success.
+ */
+int http_route_params(http_s *h);
+
 /* *****************************************************************************
 Websocket Upgrade (Server and Client connection establishment)
 ***************************************************************************** */
@@ -527,6 +827,20 @@ typedef struct {
   void (*on_close)(intptr_t uuid, void *udata);
   /** Opaque user data. */
   void *udata;
+  /**
+   * Enables the permessage-deflate extension (RFC 7692) when supported by the
+   * other side. Requires zlib (`HAVE_ZLIB`), otherwise the extension is never
+   * negotiated.
+   *
+   * Set to 1 for the best compression ratio. Unless the other side requests
+   * otherwise, every connection keeps it's own compression contexts (~300Kb).
+   *
+   * Set to 2 to require "no context takeover" in both directions. Every message
+   * is compressed on it's own, so the compression contexts are shared by all
+   * the connections handled by a thread and broadcasts are compressed only once
+   * (see `websocket_optimize4broadcasts`).
+   */
+  uint8_t deflate;
 } websocket_settings_s;
 
 /**
@@ -746,7 +1060,8 @@ HTTP GET and POST parsing helpers
 ***************************************************************************** */
 
 /**
- * Attempts to decode the request's body.
+ * Attempts to decode the request's body (for streamed bodies, see
+ * `http_multipart_new`).
  *
  * Supported Types include:
  * * application/x-www-form-urlencoded
@@ -766,6 +1081,89 @@ HTTP GET and POST parsing helpers
  */
 int http_parse_body(http_s *h);
 
+/** A part (a form field or a file) of a streamed `multipart/form-data` body. */
+typedef struct http_multipart_part_s {
+  /** The part's (form field) name. */
+  fio_cstr_s name;
+  /** The part's file name (`len == 0` if the part isn't a file). */
+  fio_cstr_s filename;
+  /** The part's content type (`len == 0` if missing). */
+  fio_cstr_s mime;
+  /** The opaque user data set for the parser (see `http_multipart_new`). */
+  void *udata;
+  /** The number of bytes received so far. */
+  size_t length;
+  /**
+   * The part's destination, set by `on_part` to write the part's data to a
+   * file descriptor (the file descriptor isn't closed by facil.io).
+   *
+   * Defaults to -1.
+   */
+  int fd;
+  /**
+   * The part's destination, set by `on_part` to receive the part's data as it
+   * arrives.
+   */
+  void (*on_data)(struct http_multipart_part_s *part, char *data, size_t len);
+} http_multipart_part_s;
+
+/** The settings for a streaming `multipart/form-data` parser. */
+typedef struct {
+  /**
+   * (optional) Called when a part starts. The part's `name`, `filename` and
+   * `mime` fields are valid until `on_part_end` returns.
+   *
+   * By default, the part is added to the request's `params`, the same way
+   * `http_parse_body` does. Set the part's `fd` or `on_data` fields to route
+   * the data elsewhere.
+   */
+  void (*on_part)(http_multipart_part_s *part);
+  /** (optional) Called when a part is complete. */
+  void (*on_part_end)(http_multipart_part_s *part);
+  /** Opaque user data, available as `part->udata`. */
+  void *udata;
+  /**
+   * The number of bytes a part may keep in memory when added to `params`.
+   *
+   * Larger files are moved to a temporary file, larger form fields are
+   * errors. Defaults to HTTP_MAX_HEADER_LENGTH.
+   */
+  size_t memory_limit;
+} http_multipart_settings_s;
+
+/** An opaque streaming `multipart/form-data` parser. */
+typedef struct http_multipart_s http_multipart_s;
+
+/**
+ * Creates a streaming `multipart/form-data` parser for the request, to be
+ * used with the `on_body_chunk` setting, so large uploads are written to
+ * their destination as they arrive (instead of collecting the body first).
+ *
+ * Returns NULL if the request's content type isn't `multipart/form-data`.
+ *
+ * The parser MUST be released using `http_multipart_finish`.
+ */
+http_multipart_s *http_multipart_new(http_s *h,
+                                     http_multipart_settings_s settings);
+#define http_multipart_new(h, ...)                                             \
+  http_multipart_new((h), (http_multipart_settings_s){__VA_ARGS__})
+
+/**
+ * Parses a chunk of the request's body (i.e., from within `on_body_chunk`).
+ *
+ * Returns -1 if the body is malformed or a destination failed (further data is
+ * ignored), otherwise returns 0.
+ */
+int http_multipart_write(http_multipart_s *mp, void *data, size_t len);
+
+/**
+ * Releases the parser, returning 0 if the body was complete and valid or -1 if
+ * it wasn't (i.e., the connection was lost mid-upload).
+ *
+ * The `on_part_end` callback is NOT called for incomplete parts.
+ */
+int http_multipart_finish(http_multipart_s *mp);
+
 /**
  * Parses the query part of an HTTP request/response. Uses `http_add2hash`.
  *
@@ -865,6 +1263,7 @@ extern FIOBJ HTTP_HEADER_HOST;
 extern FIOBJ HTTP_HEADER_LAST_MODIFIED;
 extern FIOBJ HTTP_HEADER_ORIGIN;
 extern FIOBJ HTTP_HEADER_SET_COOKIE;
+extern FIOBJ HTTP_HEADER_TRANSFER_ENCODING;
 extern FIOBJ HTTP_HEADER_UPGRADE;
 
 /* *****************************************************************************
@@ -878,11 +1277,36 @@ HTTP General Helper functions that could be used globally
 FIOBJ http_req2str(http_s *h);
 
 /**
- * Writes a log line to `stderr` about the request / response object.
+ * Writes a log line about the request / response object to the access log
+ * (`stderr` unless `http_log_open` was called).
  *
  * This function is called automatically if the `.log` setting is enabled.
+ *
+ * Log records are collected in per-thread buffers. The log lines are formatted
+ * and written (in batches) by a dedicated writer thread.
  */
 void http_write_log(http_s *h);
+
+/**
+ * Sets the access log's destination file.
+ *
+ * If `filename` is NULL, the log is written to `stderr` (the default).
+ *
+ * If `rotate_size` isn't zero, the log file is rotated once it grows beyond
+ * `rotate_size` bytes (the log is renamed to `filename.1`, older logs are
+ * renamed `filename.2` and so on, up to `HTTP_LOG_ROTATE_KEEP`).
+ *
+ * Call this function before `facil_run` so worker processes share the log.
+ *
+ * Returns -1 on error (the destination remains unchanged) and 0 on success.
+ */
+int http_log_open(const char *filename, size_t rotate_size);
+
+/** Reopens the access log file (i.e., after it was moved by `logrotate`). */
+void http_log_reopen(void);
+
+/** Writes any pending access log lines before returning. */
+void http_log_flush(void);
 /* *****************************************************************************
 HTTP Time related helper functions that could be used globally
 ***************************************************************************** */
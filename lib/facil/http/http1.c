@@ -6,6 +6,7 @@ License: MIT
 
 #include "http1.h"
 #include "http1_parser.h"
+#include "http2.h"
 #include "http_internal.h"
 #include "websockets.h"
 
@@ -37,6 +38,17 @@ typedef struct http1pr_s {
   uint8_t close;
   uint8_t is_client;
   uint8_t stop;
+  /* the request's body is streamed (`on_body_chunk`) */
+  uint8_t body_stream;
+  /* reading the streamed body was paused (`http_body_pause`) */
+  volatile uint8_t body_paused;
+  /* the response is streamed (`http_stream_start`) */
+  uint8_t streaming;
+  /* the streamed response uses the chunked transfer encoding */
+  uint8_t stream_chunked;
+  /* the streamed response has no body (i.e., a HEAD request) */
+  uint8_t stream_no_body;
+  http_stream_args_s stream;
   uint8_t buf[];
 } http1pr_s;
 
@@ -63,6 +75,13 @@ static inline void http1_after_finish(http_s *h) {
   if (h != &p->request) {
     http_s_destroy(h, 0);
     fio_free(h);
+  } else if (p->p.settings->request_arena) {
+    /* the next request's objects are allocated from the (rewound) arena */
+    http_s_destroy(h, p->p.settings->log);
+    fio_arena_rewind();
+    fio_arena_enter();
+    http_s_new(h, &p->p, &HTTP1_VTABLE);
+    fio_arena_exit();
   } else {
     http_s_clear(h, p->p.settings->log);
   }
@@ -227,8 +246,14 @@ static int http1_sendfile(http_s *h, int fd, uintptr_t length,
   return 0;
 }
 
+static void http1_stream_end(http_s *h);
+
 /** Should send existing headers or complete streaming */
 static void htt1p_finish(http_s *h) {
+  if (handle2pr(h)->streaming) {
+    http1_stream_end(h);
+    return;
+  }
   FIOBJ packet = headers2str(h, 0);
   if (packet)
     fiobj_send_free((handle2pr(h)->p.uuid), packet);
@@ -237,6 +262,100 @@ static void htt1p_finish(http_s *h) {
   }
   http1_after_finish(h);
 }
+/** Selects the streamed body's framing, setting the headers it requires. */
+static void http1_stream_mode(http1pr_s *p, http_s *h) {
+  static uint64_t cl_hash = 0;
+  if (!cl_hash)
+    cl_hash = fio_siphash("content-length", 14);
+  fio_cstr_s method = fiobj_obj2cstr(h->method);
+  p->stream_no_body = (h->status == 204 || h->status == 304 ||
+                       (method.len == 4 && !memcmp(method.data, "HEAD", 4)));
+  p->stream_chunked = 0;
+  if (!fiobj_hash_get2(h->private_data.out_headers, cl_hash)) {
+    fio_cstr_s version = fiobj_obj2cstr(h->version);
+    if (version.len > 7 && version.data[5] == '1' && version.data[6] == '.' &&
+        version.data[7] == '1') {
+      http_set_header(h, HTTP_HEADER_TRANSFER_ENCODING,
+                      fiobj_dup(HTTP_HVALUE_CHUNKED));
+      p->stream_chunked = 1;
+    } else {
+      /* HTTP/1.0 - the end of the connection marks the end of the body */
+      http_set_header(h, HTTP_HEADER_CONNECTION, fiobj_dup(HTTP_HVALUE_CLOSE));
+    }
+  }
+}
+
+/**
+ * Returns a packet containing the (framed) body data, or FIOBJ_INVALID if
+ * there's nothing to send (i.e., the response to a HEAD request).
+ */
+static FIOBJ http1_stream_packet(http1pr_s *p, void *data, uintptr_t length) {
+  if (!length || p->stream_no_body)
+    return FIOBJ_INVALID;
+  if (!p->stream_chunked)
+    return fiobj_str_new(data, length);
+  FIOBJ packet = fiobj_str_buf(length + 20);
+  fio_cstr_s tmp = fiobj_obj2cstr(packet);
+  size_t pos = fio_ltoa(tmp.data, (int64_t)length, 16);
+  tmp.data[pos++] = '\r';
+  tmp.data[pos++] = '\n';
+  fiobj_str_resize(packet, pos);
+  fiobj_str_write(packet, data, length);
+  fiobj_str_write(packet, "\r\n", 2);
+  return packet;
+}
+
+/** Returns the data that completes the body (or NULL), length is always 5. */
+static inline const char *http1_stream_terminator(http1pr_s *p) {
+  /* the last chunk, followed by an empty trailer */
+  return (p->stream_chunked && !p->stream_no_body) ? "0\r\n\r\n" : NULL;
+}
+
+/** Sends existing headers and prepares for streaming */
+static int http1_stream_start(http_s *h, http_stream_args_s *args) {
+  http1pr_s *p = handle2pr(h);
+  if (p->is_client || p->streaming)
+    return -1;
+  http1_stream_mode(p, h);
+  FIOBJ packet = headers2str(h, 0);
+  if (!packet)
+    return -1;
+  p->streaming = 1;
+  p->stream = *args;
+  fiobj_send_free(p->p.uuid, packet);
+  return 0;
+}
+
+/** Sends a chunk of a streamed response body */
+static int http1_stream_write(http_s *h, void *data, uintptr_t length) {
+  http1pr_s *p = handle2pr(h);
+  if (!p->streaming || sock_isclosed(p->p.uuid))
+    return -1;
+  FIOBJ packet = http1_stream_packet(p, data, length);
+  if (!packet)
+    return 0;
+  if (fiobj_send_free(p->p.uuid, packet))
+    return -1;
+  return (sock_pending(p->p.uuid) > HTTP_STREAM_MAX_PENDING);
+}
+
+/** Completes a streamed response */
+static void http1_stream_end(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  if (!p->streaming)
+    return;
+  const char *terminator = http1_stream_terminator(p);
+  if (terminator)
+    sock_write2(.uuid = p->p.uuid, .buffer = terminator, .length = 5,
+                .dealloc = SOCK_DEALLOC_NOOP);
+  p->streaming = 0;
+  p->stream = (http_stream_args_s){.on_ready = NULL};
+  http1_after_finish(h);
+  /* the next (pipelined) request might be waiting */
+  if (!p->stop)
+    facil_force_event(p->p.uuid, FIO_EVENT_ON_DATA);
+}
+
 /** Push for data - unsupported. */
 static int http1_push_data(http_s *h, void *data, uintptr_t length,
                            FIOBJ mime_type) {
@@ -273,6 +392,24 @@ void http1_on_resume(http_s *h, http_protocol_s *pr) {
   (void)h;
 }
 
+/** Stops reading a streamed request body. */
+static void http1_body_pause(http_s *h) { handle2pr(h)->body_paused = 1; }
+
+/* resumes reading the body within the connection's lock */
+static void http1_body_resume_task(intptr_t uuid, protocol_s *pr, void *ignr) {
+  if (!((http1pr_s *)pr)->body_paused)
+    return;
+  ((http1pr_s *)pr)->body_paused = 0;
+  facil_force_event(uuid, FIO_EVENT_ON_DATA);
+  (void)ignr;
+}
+
+/** Resumes reading a streamed request body. */
+static void http1_body_resume(http_s *h) {
+  facil_defer(.uuid = handle2pr(h)->p.uuid, .type = FIO_PR_LOCK_TASK,
+              .task = http1_body_resume_task);
+}
+
 intptr_t http1_hijack(http_s *h, fio_cstr_s *leftover) {
   if (leftover) {
     intptr_t len =
@@ -302,11 +439,14 @@ static void http1_websocket_client_on_upgrade(http_s *h, char *proto,
   websocket_settings_s *args = h->udata;
   const intptr_t uuid = handle2pr(h)->p.uuid;
   http_settings_s *set = handle2pr(h)->p.settings;
+  FIOBJ extensions = fiobj_dup(fiobj_hash_get2(
+      h->headers, fiobj_obj2hash(HTTP_HEADER_WS_SEC_EXTENSIONS)));
   set->udata = NULL;
   http_finish(h);
   p->stop = 1;
-  websocket_attach(uuid, set, args, p->parser.state.next,
+  websocket_attach(uuid, set, args, extensions, p->parser.state.next,
                    p->buf_len - (intptr_t)(p->parser.state.next - p->buf));
+  fiobj_free(extensions);
   fio_free(args);
   (void)proto;
   (void)len;
@@ -360,14 +500,20 @@ static int http1_http2websocket_server(http_s *h, websocket_settings_s *args) {
   http_set_header(h, HTTP_HEADER_CONNECTION, fiobj_dup(HTTP_HVALUE_WS_UPGRADE));
   http_set_header(h, HTTP_HEADER_UPGRADE, fiobj_dup(HTTP_HVALUE_WEBSOCKET));
   http_set_header(h, HTTP_HEADER_WS_SEC_KEY, tmp);
+  FIOBJ extensions = websocket_extensions_accept(
+      args, fiobj_hash_get2(h->headers,
+                            fiobj_obj2hash(HTTP_HEADER_WS_SEC_EXTENSIONS)));
+  if (extensions)
+    http_set_header(h, HTTP_HEADER_WS_SEC_EXTENSIONS, fiobj_dup(extensions));
   h->status = 101;
   http1pr_s *pr = handle2pr(h);
   const intptr_t uuid = handle2pr(h)->p.uuid;
   http_settings_s *set = handle2pr(h)->p.settings;
   http_finish(h);
   pr->stop = 1;
-  websocket_attach(uuid, set, args, pr->parser.state.next,
+  websocket_attach(uuid, set, args, extensions, pr->parser.state.next,
                    pr->buf_len - (intptr_t)(pr->parser.state.next - pr->buf));
+  fiobj_free(extensions);
   return 0;
 bad_request:
   http_send_error(h, 400);
@@ -394,6 +540,9 @@ static int http1_http2websocket_client(http_s *h, websocket_settings_s *args) {
   http_set_header(h, HTTP_HEADER_UPGRADE, fiobj_dup(HTTP_HVALUE_WEBSOCKET));
   http_set_header(h, HTTP_HVALUE_WS_SEC_VERSION,
                   fiobj_dup(HTTP_HVALUE_WS_VERSION));
+  FIOBJ extensions = websocket_extensions_offer(args);
+  if (extensions)
+    http_set_header(h, HTTP_HEADER_WS_SEC_EXTENSIONS, extensions);
 
   /* we don't set the Origin header since we're not a browser... should we? */
   // http_set_header(
@@ -544,10 +693,15 @@ struct http_vtable_s HTTP1_VTABLE = {
     .http_send_body = http1_send_body,
     .http_sendfile = http1_sendfile,
     .http_finish = htt1p_finish,
+    .http_stream_start = http1_stream_start,
+    .http_stream_write = http1_stream_write,
+    .http_stream_end = http1_stream_end,
     .http_push_data = http1_push_data,
     .http_push_file = http1_push_file,
     .http_on_pause = http1_on_pause,
     .http_on_resume = http1_on_resume,
+    .http_body_pause = http1_body_pause,
+    .http_body_resume = http1_body_resume,
     .http_hijack = http1_hijack,
     .http2websocket = http1_http2websocket,
     .http_upgrade2sse = http1_upgrade2sse,
@@ -561,21 +715,88 @@ void *http1_vtable(void) { return (void *)&HTTP1_VTABLE; }
 Parser Callbacks
 ***************************************************************************** */
 
+/**
+ * Upgrades the connection to HTTP/2 if the request includes an `Upgrade: h2c`
+ * and an `HTTP2-Settings` header. Returns 0 if the connection wasn't upgraded.
+ */
+static int http1_upgrade2h2c(http1pr_s *p) {
+  static uint64_t settings_hash;
+  if (!settings_hash)
+    settings_hash = fio_siphash("http2-settings", 14);
+  FIOBJ tmp =
+      fiobj_hash_get2(p->request.headers, fiobj_obj2hash(HTTP_HEADER_UPGRADE));
+  if (!tmp || !FIOBJ_TYPE_IS(tmp, FIOBJ_T_STRING))
+    return 0;
+  fio_cstr_s val = fiobj_obj2cstr(tmp);
+  if (val.len != 3 || (val.data[0] | 32) != 'h' || val.data[1] != '2' ||
+      (val.data[2] | 32) != 'c')
+    return 0;
+  tmp = fiobj_hash_get2(p->request.headers, settings_hash);
+  if (!tmp || !FIOBJ_TYPE_IS(tmp, FIOBJ_T_STRING))
+    return 0;
+  val = fiobj_obj2cstr(tmp);
+  char settings[192];
+  if (val.len > (sizeof(settings) / 3) * 4 - 4)
+    return 0;
+  int settings_len = fio_base64_decode(settings, val.data, val.len);
+
+  static const char response[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                                 "connection:Upgrade\r\n"
+                                 "upgrade:h2c\r\n\r\n";
+  sock_write2(.uuid = p->p.uuid, .buffer = response,
+              .length = sizeof(response) - 1, .dealloc = SOCK_DEALLOC_NOOP);
+  uint8_t *unread = (uint8_t *)p->parser.state.next;
+  if (!http2_upgrade(p->p.uuid, p->p.settings, &p->request, settings,
+                     settings_len, unread,
+                     p->buf_len - (uintptr_t)(unread - p->buf))) {
+    sock_close(p->p.uuid);
+    http_s_clear(&p->request, 0);
+    p->stop = 1;
+    return 1;
+  }
+  /* the request's data belongs to the HTTP/2 stream now */
+  http_s_new(&p->request, &p->p, &HTTP1_VTABLE);
+  p->stop = 1;
+  return 1;
+}
+
 /** called when a request was received. */
 static int http1_on_request(http1_parser_s *parser) {
   http1pr_s *p = parser2http(parser);
-  http_on_request_handler______internal(&http1_pr2handle(p), p->p.settings);
-  if (p->request.method && !p->stop)
+  const uint8_t streamed = p->body_stream;
+  p->body_stream = 0;
+  p->body_paused = 0; /* the body is complete, the next request is read */
+  if (!streamed && !p->is_client && http1_upgrade2h2c(p)) {
+    h1_reset(p);
+    return 0;
+  }
+  /* the arena is limited to the request's objects (see http1_consume_data) */
+  if (p->p.settings->request_arena)
+    fio_arena_exit();
+  if (!streamed)
+    http_on_request_handler______internal(&http1_pr2handle(p), p->p.settings);
+  if (p->p.settings->on_body_chunk && p->p.settings->on_body_end &&
+      p->request.method && !p->stop)
+    p->p.settings->on_body_end(&p->request);
+  if (p->streaming)
+    p->stop |= 1; /* the next request waits for `http_stream_end` */
+  else if (p->request.method && !p->stop)
     http_finish(&p->request);
+  if (p->p.settings->request_arena)
+    fio_arena_enter();
   h1_reset(p);
   return 0;
 }
 /** called when a response was received. */
 static int http1_on_response(http1_parser_s *parser) {
   http1pr_s *p = parser2http(parser);
+  if (p->p.settings->request_arena)
+    fio_arena_exit();
   http_on_response_handler______internal(&http1_pr2handle(p), p->p.settings);
   if (p->request.status_str && !p->stop)
     http_finish(&p->request);
+  if (p->p.settings->request_arena)
+    fio_arena_enter();
   h1_reset(p);
   return 0;
 }
@@ -645,12 +866,29 @@ static int http1_on_header(http1_parser_s *parser, char *name, size_t name_len,
     http_send_error(&http1_pr2handle(parser2http(parser)), 413);
     return -1;
   }
-  sym = fiobj_str_new(name, name_len);
+  sym = http_header_name(name, name_len);
   obj = fiobj_str_new(data, data_len);
   set_header_add(http1_pr2handle(parser2http(parser)).headers, sym, obj);
   fiobj_free(sym);
   return 0;
 }
+/* passes a body chunk to the `on_body_chunk` callback (streaming mode) */
+static int http1_stream_body_chunk(http1pr_s *p, char *data, size_t data_len) {
+  if (p->p.settings->request_arena)
+    fio_arena_exit();
+  if (!p->body_stream) {
+    /* the body starts, handle the request */
+    p->body_stream = 1;
+    http_on_request_handler______internal(&p->request, p->p.settings);
+  }
+  /* the response might have been sent already, discarding the body */
+  if (p->request.method && !p->stop)
+    p->p.settings->on_body_chunk(&p->request, data, data_len);
+  if (p->p.settings->request_arena)
+    fio_arena_enter();
+  return (p->body_paused != 0);
+}
+
 /** called when a body chunk is parsed. */
 static int http1_on_body_chunk(http1_parser_s *parser, char *data,
                                size_t data_len) {
@@ -658,9 +896,14 @@ static int http1_on_body_chunk(http1_parser_s *parser, char *data,
           (ssize_t)parser2http(parser)->p.settings->max_body_size ||
       parser->state.read >
           (ssize_t)parser2http(parser)->p.settings->max_body_size) {
-    http_send_error(&http1_pr2handle(parser2http(parser)), 413);
+    /* a streamed request might have been answered already */
+    if (!HTTP_INVALID_HANDLE(&http1_pr2handle(parser2http(parser))))
+      http_send_error(&http1_pr2handle(parser2http(parser)), 413);
     return -1; /* test every time, in case of chunked data */
   }
+  if (parser2http(parser)->p.settings->on_body_chunk &&
+      !parser2http(parser)->is_client)
+    return http1_stream_body_chunk(parser2http(parser), data, data_len);
   if (!parser->state.read) {
     if (parser->state.content_length > 0 &&
         parser->state.content_length <= HTTP_MAX_HEADER_LENGTH) {
@@ -696,6 +939,10 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
   ssize_t i = 0;
   size_t org_len = p->buf_len;
   int pipeline_limit = 8;
+  /* the parser's callbacks allocate the request's objects from the arena */
+  const uint8_t arena = p->p.settings->request_arena;
+  if (arena)
+    fio_arena_enter();
   do {
     i = http1_fio_parser(.parser = &p->parser,
                          .buffer = p->buf + (org_len - p->buf_len),
@@ -710,12 +957,17 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
                          .on_error = http1_on_error);
     p->buf_len -= i;
     --pipeline_limit;
-  } while (i && p->buf_len && pipeline_limit && !p->stop);
+  } while (i && p->buf_len && pipeline_limit && !p->stop && !p->body_paused);
+  if (arena)
+    fio_arena_exit();
 
   if (p->buf_len && org_len != p->buf_len) {
     memmove(p->buf, p->buf + (org_len - p->buf_len), p->buf_len);
   }
 
+  if (p->body_paused)
+    return; /* the rest of the data is handled by `http1_body_resume` */
+
   if (p->buf_len == HTTP_MAX_HEADER_LENGTH) {
     /* no room to read... parser not consuming data */
     if (p->request.method)
@@ -734,7 +986,7 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
 /** called when a data is available, but will not run concurrently */
 static void http1_on_data(intptr_t uuid, protocol_s *protocol) {
   http1pr_s *p = (http1pr_s *)protocol;
-  if (p->stop) {
+  if (p->stop || p->body_paused) {
     facil_quite(uuid);
     return;
   }
@@ -754,6 +1006,23 @@ static void http1_on_close(intptr_t uuid, protocol_s *protocol) {
   (void)uuid;
 }
 
+/* calls the streamed response's `on_ready` within the connection's lock */
+static void http1_stream_ready_task(intptr_t uuid, protocol_s *pr,
+                                    void *ignr) {
+  http1pr_s *p = (http1pr_s *)pr;
+  if (p->streaming && p->stream.on_ready)
+    p->stream.on_ready(&p->request);
+  (void)uuid;
+  (void)ignr;
+}
+
+/** called when the socket's outgoing buffer is empty */
+static void http1_on_ready(intptr_t uuid, protocol_s *protocol) {
+  if (((http1pr_s *)protocol)->streaming)
+    facil_defer(.uuid = uuid, .type = FIO_PR_LOCK_TASK,
+                .task = http1_stream_ready_task);
+}
+
 /** called when a data is available for the first time */
 static void http1_on_data_first_time(intptr_t uuid, protocol_s *protocol) {
   http1pr_s *p = (http1pr_s *)protocol;
@@ -767,10 +1036,12 @@ static void http1_on_data_first_time(intptr_t uuid, protocol_s *protocol) {
 
   /* ensure future reads skip this first time HTTP/2.0 test */
   p->p.protocol.on_data = http1_on_data;
-  if (i >= 24 && !memcmp(p->buf, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24)) {
-    fprintf(stderr,
-            "ERROR: unsupported HTTP/2 attempeted using prior knowledge.\n");
-    sock_close(uuid);
+  if (p->buf_len >= 24 && !p->is_client &&
+      !memcmp(p->buf, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24)) {
+    /* HTTP/2 using prior knowledge, hand the connection to HTTP/2 */
+    p->stop = 1;
+    if (!http2_new(uuid, p->p.settings, p->buf, p->buf_len))
+      sock_close(uuid);
     return;
   }
 
@@ -796,6 +1067,7 @@ protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
           {
               .service = HTTP1_SERVICE_STR,
               .on_data = http1_on_data_first_time,
+              .on_ready = http1_on_ready,
               .on_close = http1_on_close,
           },
       .p.uuid = uuid,
@@ -816,6 +1088,10 @@ protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
 /** Manually destroys the HTTP1 protocol object. */
 void http1_destroy(protocol_s *pr) {
   http1pr_s *p = (http1pr_s *)pr;
+  if (p->streaming && p->stream.on_abort) {
+    p->streaming = 0;
+    p->stream.on_abort(&p->request);
+  }
   http1_pr2handle(p).status = 0;
   http_s_destroy(&http1_pr2handle(p), 0);
   free(p);
@@ -907,3 +1183,273 @@ static fio_cstr_s http1pr_status2str(uintptr_t status) {
   return ret;
 }
 #undef HTTP_SET_STATUS_STR
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+
+#if DEBUG
+#define TEST_ASSERT(cond, ...)                                                 \
+  if (!(cond)) {                                                               \
+    fprintf(stderr, "* " __VA_ARGS__);                                         \
+    fprintf(stderr, "Testing failed.\n");                                      \
+    exit(-1);                                                                  \
+  }
+
+typedef struct {
+  char body[64];
+  size_t body_len;
+  size_t chunks;
+  size_t requests;
+  size_t errors;
+  int pause;
+} http1_test_parser_s;
+
+static int http1_test_on_request(http1_parser_s *parser) {
+  ++((http1_test_parser_s *)parser->udata)->requests;
+  return 0;
+}
+static int http1_test_on_status(http1_parser_s *parser, size_t status,
+                                char *status_str, size_t len) {
+  return 0;
+  (void)parser;
+  (void)status;
+  (void)status_str;
+  (void)len;
+}
+static int http1_test_on_str(http1_parser_s *parser, char *str, size_t len) {
+  return 0;
+  (void)parser;
+  (void)str;
+  (void)len;
+}
+static int http1_test_on_header(http1_parser_s *parser, char *name,
+                                size_t name_len, char *data, size_t data_len) {
+  return 0;
+  (void)parser;
+  (void)name;
+  (void)name_len;
+  (void)data;
+  (void)data_len;
+}
+static int http1_test_on_body_chunk(http1_parser_s *parser, char *data,
+                                    size_t len) {
+  http1_test_parser_s *t = parser->udata;
+  if (t->body_len + len > sizeof(t->body))
+    return -1;
+  memcpy(t->body + t->body_len, data, len);
+  t->body_len += len;
+  ++t->chunks;
+  return t->pause;
+}
+static int http1_test_on_error(http1_parser_s *parser) {
+  ++((http1_test_parser_s *)parser->udata)->errors;
+  return 0;
+}
+
+/*
+ * Parses a single request, making only the first `split` bytes available at
+ * first (the rest "arrive" once the parser asks for more data). Data the
+ * parser didn't consume is resubmitted, as `http1_consume_data` does.
+ *
+ * Returns the number of bytes consumed.
+ */
+static size_t http1_test_parse(http1_test_parser_s *t, const char *request,
+                               size_t split) {
+  char buf[256];
+  const size_t len = strlen(request);
+  memcpy(buf, request, len + 1);
+  http1_parser_s parser = {.udata = t};
+  size_t pos = 0;
+  size_t available = split;
+  for (size_t rounds = 0; rounds < 256 && !t->requests && !t->errors;
+       ++rounds) {
+    size_t consumed = http1_fio_parser(
+        .parser = &parser, .buffer = buf + pos, .length = available - pos,
+        .on_request = http1_test_on_request,
+        .on_response = http1_test_on_request, .on_method = http1_test_on_str,
+        .on_status = http1_test_on_status, .on_path = http1_test_on_str,
+        .on_query = http1_test_on_str,
+        .on_http_version = http1_test_on_str,
+        .on_header = http1_test_on_header,
+        .on_body_chunk = http1_test_on_body_chunk,
+        .on_error = http1_test_on_error);
+    pos += consumed;
+    if (!consumed) {
+      if (available == len)
+        break;
+      available = len;
+    }
+  }
+  return pos;
+}
+
+void http1_tests(void) {
+  static const char *chunked = "POST /upload HTTP/1.1\r\n"
+                               "Host: localhost\r\n"
+                               "Transfer-Encoding: chunked\r\n"
+                               "\r\n"
+                               "5\r\nhello\r\n"
+                               "1\r\n \r\n"
+                               "7\r\nworld!!\r\n"
+                               "0\r\n\r\n";
+  static const char *sized = "POST /upload HTTP/1.1\r\n"
+                             "Host: localhost\r\n"
+                             "Content-Length: 13\r\n"
+                             "\r\n"
+                             "hello world!!";
+  const char *requests[] = {chunked, sized};
+  for (size_t r = 0; r < 2; ++r) {
+    const size_t len = strlen(requests[r]);
+    for (int pause = 0; pause < 2; ++pause) {
+      for (size_t split = 0; split <= len; ++split) {
+        http1_test_parser_s t = {.pause = pause};
+        size_t consumed = http1_test_parse(&t, requests[r], split);
+        /* a trailing EOL that didn't arrive yet is skipped by the next
+         * request */
+        TEST_ASSERT(t.requests == 1 && !t.errors && consumed <= len &&
+                        strspn(requests[r] + consumed, "\r\n") ==
+                            len - consumed,
+                    "HTTP/1.1 parser failed (%s, pause %d, split %zu)\n",
+                    (r ? "content-length" : "chunked"), pause, split);
+        TEST_ASSERT(t.body_len == 13 && !memcmp(t.body, "hello world!!", 13),
+                    "HTTP/1.1 body error (%s, pause %d, split %zu): %.*s\n",
+                    (r ? "content-length" : "chunked"), pause, split,
+                    (int)t.body_len, t.body);
+      }
+    }
+  }
+  {
+    /* a positive `on_body_chunk` return value stops after every chunk */
+    http1_test_parser_s t = {.pause = 1};
+    char buf[256];
+    const size_t len = strlen(chunked);
+    memcpy(buf, chunked, len + 1);
+    http1_parser_s parser = {.udata = &t};
+    size_t pos = 0;
+    size_t calls = 0;
+    while (pos < len && !t.requests && calls < 16) {
+      const size_t chunks = t.chunks;
+      pos += http1_fio_parser(
+          .parser = &parser, .buffer = buf + pos, .length = len - pos,
+          .on_request = http1_test_on_request,
+          .on_response = http1_test_on_request,
+          .on_method = http1_test_on_str, .on_status = http1_test_on_status,
+          .on_path = http1_test_on_str, .on_query = http1_test_on_str,
+          .on_http_version = http1_test_on_str,
+          .on_header = http1_test_on_header,
+          .on_body_chunk = http1_test_on_body_chunk,
+          .on_error = http1_test_on_error);
+      ++calls;
+      TEST_ASSERT(t.chunks <= chunks + 1,
+                  "HTTP/1.1 parser didn't pause after a body chunk\n");
+    }
+    TEST_ASSERT(t.chunks == 3 && t.requests == 1 && pos == len &&
+                    t.body_len == 13 && !memcmp(t.body, "hello world!!", 13),
+                "HTTP/1.1 paused parsing error (%zu calls)\n", calls);
+  }
+  fprintf(stderr, "* HTTP/1.1 parser body streaming passed.\n");
+  {
+    /* streamed responses (`http_stream_write`) */
+    static const struct {
+      const char *method;
+      const char *version;
+      size_t status;
+      uint8_t length; /* content-length set by the application */
+      uint8_t chunked;
+      uint8_t no_body;
+      uint8_t close;
+    } cases[] = {
+        {"GET", "HTTP/1.1", 200, 0, 1, 0, 0},
+        {"HEAD", "HTTP/1.1", 200, 0, 1, 1, 0},
+        {"GET", "HTTP/1.1", 204, 0, 1, 1, 0},
+        {"GET", "HTTP/1.1", 304, 0, 1, 1, 0},
+        {"GET", "HTTP/1.0", 200, 0, 0, 0, 1},
+        {"GET", "HTTP/1.1", 200, 1, 0, 0, 0},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+      http1pr_s *p = calloc(1, sizeof(*p));
+      TEST_ASSERT(p, "allocation failed\n");
+      /* `http_s_new` would initialize the facil.io library */
+      http_s h = {.private_data.vtbl = http1_vtable(),
+                  .private_data.flag = (uintptr_t)p,
+                  .private_data.out_headers = fiobj_hash_new(),
+                  .headers = fiobj_hash_new(),
+                  .method = fiobj_str_new(cases[i].method,
+                                          strlen(cases[i].method)),
+                  .version = fiobj_str_new(cases[i].version, 8),
+                  .status = cases[i].status};
+      if (cases[i].length)
+        http_set_header(&h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(13));
+      http1_stream_mode(p, &h);
+      TEST_ASSERT(p->stream_chunked == cases[i].chunked &&
+                      p->stream_no_body == cases[i].no_body,
+                  "HTTP/1.1 stream mode error (case %zu)\n", i);
+      FIOBJ head = headers2str(&h, 0);
+      fio_cstr_s head_str = fiobj_obj2cstr(head);
+      TEST_ASSERT(!strstr(head_str.data, "transfer-encoding:chunked\r\n") ==
+                          !cases[i].chunked &&
+                      p->close == cases[i].close &&
+                      !strstr(head_str.data, "connection:close\r\n") ==
+                          !cases[i].close,
+                  "HTTP/1.1 stream headers error (case %zu):\n%s\n", i,
+                  head_str.data);
+      fiobj_free(head);
+      /* the framed body should be parsed back to the original body */
+      char *body[] = {"hello", " ", "world!!"};
+      FIOBJ request = fiobj_str_buf(256);
+      fiobj_str_write(request, "POST / HTTP/1.1\r\n", 17);
+      if (p->stream_chunked)
+        fiobj_str_write(request, "transfer-encoding: chunked\r\n\r\n", 30);
+      else
+        fiobj_str_write(request, "content-length: 13\r\n\r\n", 22);
+      for (size_t j = 0; j < 3; ++j) {
+        FIOBJ packet = http1_stream_packet(p, body[j], strlen(body[j]));
+        TEST_ASSERT((!packet) == p->stream_no_body,
+                    "HTTP/1.1 stream body drop error (case %zu)\n", i);
+        fiobj_str_join(request, packet);
+        fiobj_free(packet);
+      }
+      TEST_ASSERT(!http1_stream_packet(p, "", 0),
+                  "HTTP/1.1 stream shouldn't frame empty data\n");
+      const char *terminator = http1_stream_terminator(p);
+      TEST_ASSERT(!terminator == !(p->stream_chunked && !p->stream_no_body),
+                  "HTTP/1.1 stream terminator error (case %zu)\n", i);
+      if (terminator) {
+        TEST_ASSERT(!memcmp(terminator, "0\r\n\r\n", 5),
+                    "HTTP/1.1 stream terminator error\n");
+        fiobj_str_write(request, terminator, 5);
+      }
+      if (!p->stream_no_body) {
+        fio_cstr_s req = fiobj_obj2cstr(request);
+        http1_test_parser_s t = {.pause = 0};
+        TEST_ASSERT(http1_test_parse(&t, req.data, req.len) == req.len &&
+                        t.requests == 1 && t.body_len == 13 &&
+                        !memcmp(t.body, "hello world!!", 13),
+                    "HTTP/1.1 stream framing error (case %zu):\n%s\n", i,
+                    req.data);
+      }
+      fiobj_free(request);
+      fiobj_free(h.private_data.out_headers);
+      fiobj_free(h.headers);
+      fiobj_free(h.method);
+      fiobj_free(h.version);
+      free(p);
+    }
+    {
+      /* chunk sizes are hex encoded (`fio_ltoa` pads to whole bytes) */
+      char data[300];
+      memset(data, 'x', sizeof(data));
+      http1pr_s p = {.stream_chunked = 1};
+      FIOBJ packet = http1_stream_packet(&p, data, sizeof(data));
+      fio_cstr_s s = fiobj_obj2cstr(packet);
+      TEST_ASSERT(s.len == 308 && !memcmp(s.data, "012C\r\nxx", 8) &&
+                      !memcmp(s.data + 306, "\r\n", 2),
+                  "HTTP/1.1 chunk framing error\n");
+      fiobj_free(packet);
+    }
+    fprintf(stderr, "* HTTP/1.1 streamed responses passed.\n");
+  }
+}
+#undef TEST_ASSERT
+#endif
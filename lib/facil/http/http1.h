@@ -26,4 +26,9 @@ void http1_destroy(protocol_s *);
 /** returns the HTTP/1.1 protocol's VTable. */
 void * http1_vtable(void);
 
+#if DEBUG
+/** Tests the HTTP/1.1 parser's body handling. */
+void http1_tests(void);
+#endif
+
 #endif
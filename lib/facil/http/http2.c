@@ -0,0 +1,1461 @@
+/*
+Copyright: Boaz Segev, 2018
+License: MIT
+*/
+#include "spnlock.h"
+
+#include "hpack.h"
+#include "http2.h"
+#include "http_internal.h"
+
+#include "fio_base64.h"
+#include "fio_hashmap.h"
+#include "fiobj.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+/* Don't use `#define FIO_OVERRIDE_MALLOC 1`
+ * because protocol objects can have long life spans and fio_malloc is optimized
+ * for short life spans.
+ */
+#include "fio_mem.h"
+
+/* *****************************************************************************
+Protocol Constants (RFC 7540)
+***************************************************************************** */
+
+/* frame types */
+#define H2_DATA 0
+#define H2_HEADERS 1
+#define H2_PRIORITY 2
+#define H2_RST_STREAM 3
+#define H2_SETTINGS 4
+#define H2_PUSH_PROMISE 5
+#define H2_PING 6
+#define H2_GOAWAY 7
+#define H2_WINDOW_UPDATE 8
+#define H2_CONTINUATION 9
+
+/* frame flags */
+#define H2_FLAG_END_STREAM 1
+#define H2_FLAG_ACK 1
+#define H2_FLAG_END_HEADERS 4
+#define H2_FLAG_PADDED 8
+#define H2_FLAG_PRIORITY 32
+
+/* error codes */
+#define H2_NO_ERROR 0
+#define H2_PROTOCOL_ERROR 1
+#define H2_INTERNAL_ERROR 2
+#define H2_FLOW_CONTROL_ERROR 3
+#define H2_STREAM_CLOSED 5
+#define H2_FRAME_SIZE_ERROR 6
+#define H2_REFUSED_STREAM 7
+#define H2_COMPRESSION_ERROR 9
+#define H2_ENHANCE_YOUR_CALM 11
+
+/* settings */
+#define H2_SETTINGS_HEADER_TABLE_SIZE 1
+#define H2_SETTINGS_ENABLE_PUSH 2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 4
+#define H2_SETTINGS_MAX_FRAME_SIZE 5
+#define H2_SETTINGS_MAX_HEADER_LIST_SIZE 6
+
+/* the largest frame we accept (we never change the default) */
+#define H2_MAX_FRAME 16384
+/* the largest frame we send, regardless of the peer's settings */
+#define H2_MAX_FRAME_SEND (64 * 1024)
+/* the default flow control window */
+#define H2_DEFAULT_WINDOW 65535
+/* the maximal flow control window */
+#define H2_MAX_WINDOW 0x7FFFFFFFL
+/* the number of DATA frames read from a file before waiting for `on_ready` */
+#define H2_FILE_BURST 16
+
+#if HTTP2_READ_BUFFER < (H2_MAX_FRAME + 9)
+#error HTTP2_READ_BUFFER must hold at least a single HTTP/2 frame.
+#endif
+
+static const char H2_PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+/* *****************************************************************************
+The HTTP/2 Protocol and Stream Objects
+***************************************************************************** */
+
+typedef struct http2pr_s {
+  http_protocol_s p;
+  /* header decompression state */
+  hpack_table_s decoder;
+  /* open streams, by stream id */
+  fio_hash_s streams;
+  /* streams with pending response data (waiting for the flow control window or
+   * the socket) */
+  fio_ls_embd_s sending;
+  /* an upgraded HTTP/1.1 request that should be handled (stream 1) */
+  void *upgraded;
+  /* a header block waiting for CONTINUATION frames */
+  FIOBJ headers;
+  uint32_t headers_id;
+  uint8_t headers_flags;
+  /* the connection's flow control windows */
+  int64_t window;
+  uint32_t recv_unacked;
+  /* the peer's settings */
+  int64_t peer_initial_window;
+  uint32_t peer_max_frame;
+  /* the highest stream id opened by the client */
+  uint32_t last_id;
+  /* the client's preface is expected */
+  uint8_t preface;
+  /* a GOAWAY frame was sent or received */
+  uint8_t goaway;
+  /* file data is waiting for the socket's buffer to drain */
+  volatile uint8_t wait_ready;
+  /* the number of streamed responses (`http_stream_start`) */
+  size_t streaming;
+  size_t buf_len;
+  uint8_t buf[];
+} http2pr_s;
+
+/* stream state flags */
+#define H2S_REMOTE_CLOSED 1 /* the client sent END_STREAM */
+#define H2S_DISPATCHED 2    /* the request was handed to the `on_request` */
+#define H2S_FINISHED 4      /* the response was sent (the handle is invalid) */
+#define H2S_RESET 8         /* RST_STREAM was sent or received */
+#define H2S_BUSY 16         /* the `on_request` callback is running */
+#define H2S_HEAD 32         /* a HEAD request (no body should be sent) */
+#define H2S_MALFORMED 64    /* the request headers were malformed */
+#define H2S_HEADERS 128     /* regular (not pseudo) headers were received */
+
+/* streamed request body flags (`on_body_chunk`) */
+#define H2S_BODY_STREAMING 1 /* the body is passed to `on_body_chunk` */
+#define H2S_BODY_PAUSED 2    /* the stream's window isn't replenished */
+
+typedef struct {
+  /* the request / response handle - MUST be the first member */
+  http_s h;
+  /* a node in the connection's `sending` list */
+  fio_ls_embd_s node;
+  /* pending response body (memory) */
+  FIOBJ out;
+  size_t out_pos;
+  /* pending response body (file) */
+  int fd;
+  uintptr_t fd_offset;
+  uintptr_t fd_len;
+  /* the stream's flow control windows */
+  int64_t window;
+  uint32_t recv_unacked;
+  /* the number of streamed request body bytes */
+  size_t body_len;
+  /* the streamed response's callbacks (`http_stream_start`) */
+  http_stream_args_s stream;
+  /* the stream's identifier */
+  uint32_t id;
+  /* the number of incoming header bytes */
+  uint32_t header_size;
+  /* an HTTP error response code, for requests that can't be handled */
+  uint16_t error;
+  /* the number of `http_pause` calls that weren't resumed */
+  uint8_t paused;
+  uint8_t flags;
+  uint8_t body;
+  /* the response is streamed (`http_stream_start`) */
+  uint8_t streaming;
+} h2stream_s;
+
+struct http_vtable_s HTTP2_VTABLE; /* initialized later on */
+
+/* *****************************************************************************
+Internal Helpers
+***************************************************************************** */
+
+#define handle2pr(h) ((http2pr_s *)(h)->private_data.flag)
+#define handle2stream(h) ((h2stream_s *)(h))
+
+static inline uint32_t h2_read32(const uint8_t *b) {
+  return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+         ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+}
+
+static inline void h2_write32(uint8_t *b, uint32_t i) {
+  b[0] = (uint8_t)(i >> 24);
+  b[1] = (uint8_t)(i >> 16);
+  b[2] = (uint8_t)(i >> 8);
+  b[3] = (uint8_t)i;
+}
+
+/* writes a frame header (9 bytes) to the target buffer */
+static inline void h2_frame_header(uint8_t *dest, size_t len, uint8_t type,
+                                   uint8_t flags, uint32_t id) {
+  dest[0] = (uint8_t)(len >> 16);
+  dest[1] = (uint8_t)(len >> 8);
+  dest[2] = (uint8_t)len;
+  dest[3] = type;
+  dest[4] = flags;
+  h2_write32(dest + 5, id & 0x7FFFFFFF);
+}
+
+/* appends a frame to a packet (a String object) */
+static void h2_frame_write(FIOBJ packet, uint8_t type, uint8_t flags,
+                           uint32_t id, const void *payload, size_t len) {
+  uint8_t head[9];
+  h2_frame_header(head, len, type, flags, id);
+  fiobj_str_write(packet, (char *)head, 9);
+  if (len)
+    fiobj_str_write(packet, payload, len);
+}
+
+/* sends a single frame */
+static void h2_frame_send(http2pr_s *p, uint8_t type, uint8_t flags,
+                          uint32_t id, const void *payload, size_t len) {
+  FIOBJ packet = fiobj_str_buf(9 + len);
+  h2_frame_write(packet, type, flags, id, payload, len);
+  fiobj_send_free(p->p.uuid, packet);
+}
+
+static void h2_send_rst(http2pr_s *p, uint32_t id, uint32_t error) {
+  uint8_t payload[4];
+  h2_write32(payload, error);
+  h2_frame_send(p, H2_RST_STREAM, 0, id, payload, 4);
+}
+
+static void h2_send_window_update(http2pr_s *p, uint32_t id, uint32_t inc) {
+  uint8_t payload[4];
+  h2_write32(payload, inc);
+  h2_frame_send(p, H2_WINDOW_UPDATE, 0, id, payload, 4);
+}
+
+/* sends a GOAWAY frame and closes the connection. Always returns -1. */
+static int h2_goaway(http2pr_s *p, uint32_t error) {
+  uint8_t payload[8];
+  h2_write32(payload, p->last_id);
+  h2_write32(payload + 4, error);
+  h2_frame_send(p, H2_GOAWAY, 0, 0, payload, 8);
+  p->goaway = 2;
+  sock_close(p->p.uuid);
+  return -1;
+}
+
+/* *****************************************************************************
+Stream Management
+***************************************************************************** */
+
+static h2stream_s *h2_stream_find(http2pr_s *p, uint32_t id) {
+  return fio_hash_find(&p->streams, id);
+}
+
+static h2stream_s *h2_stream_new(http2pr_s *p, uint32_t id) {
+  h2stream_s *s = fio_malloc(sizeof(*s));
+  HTTP_ASSERT(s, "HTTP/2 stream allocation failed");
+  *s = (h2stream_s){
+      .fd = -1,
+      .window = p->peer_initial_window,
+      .id = id,
+  };
+  s->node.next = s->node.prev = &s->node;
+  http_s_new(&s->h, &p->p, &HTTP2_VTABLE);
+  s->h.version = fiobj_str_new("HTTP/2.0", 8);
+  fio_hash_insert(&p->streams, id, s);
+  if (id > p->last_id)
+    p->last_id = id;
+  return s;
+}
+
+static inline int h2_stream_pending(h2stream_s *s) {
+  return s->fd_len || s->out;
+}
+
+/* drops any pending response data */
+static void h2_stream_drop_output(h2stream_s *s) {
+  fiobj_free(s->out);
+  s->out = FIOBJ_INVALID;
+  if (s->fd != -1)
+    close(s->fd);
+  s->fd = -1;
+  s->fd_len = 0;
+  fio_ls_embd_remove(&s->node);
+  s->node.next = s->node.prev = &s->node;
+}
+
+/* the streamed response can't be completed, calls `on_abort` */
+static void h2_stream_abort(http2pr_s *p, h2stream_s *s) {
+  s->streaming = 0;
+  --p->streaming;
+  if (s->stream.on_abort)
+    s->stream.on_abort(&s->h);
+}
+
+static void h2_stream_destroy(http2pr_s *p, h2stream_s *s) {
+  if (s->streaming)
+    h2_stream_abort(p, s);
+  h2_stream_drop_output(s);
+  http_s_destroy(&s->h, 0);
+  fio_free(s);
+}
+
+static void h2_stream_free(http2pr_s *p, h2stream_s *s) {
+  fio_hash_insert(&p->streams, s->id, NULL);
+  if (fio_hash_is_fragmented(&p->streams))
+    fio_hash_compact(&p->streams);
+  h2_stream_destroy(p, s);
+}
+
+/* frees the stream if the response is complete and nobody references it */
+static void h2_stream_review(http2pr_s *p, h2stream_s *s) {
+  if (!(s->flags & H2S_FINISHED) || s->paused || (s->flags & H2S_BUSY))
+    return;
+  if (!(s->flags & H2S_RESET) && h2_stream_pending(s))
+    return;
+  if (!(s->flags & (H2S_REMOTE_CLOSED | H2S_RESET))) {
+    /* the response is complete, the client shouldn't send any more data */
+    h2_send_rst(p, s->id, H2_NO_ERROR);
+  }
+  h2_stream_free(p, s);
+}
+
+/* resets a stream, sending a RST_STREAM frame if `error` isn't negative */
+static void h2_stream_reset(http2pr_s *p, h2stream_s *s, int error) {
+  if (s->flags & H2S_RESET)
+    return;
+  if (error >= 0)
+    h2_send_rst(p, s->id, (uint32_t)error);
+  s->flags |= H2S_RESET;
+  h2_stream_drop_output(s);
+  if (s->streaming) {
+    h2_stream_abort(p, s);
+    http_s_destroy(&s->h, 0);
+    s->flags |= H2S_FINISHED;
+  }
+  if (!(s->flags & H2S_DISPATCHED))
+    s->flags |= H2S_FINISHED; /* nobody is handling the request */
+  h2_stream_review(p, s);
+}
+
+/* sends as much of the response body as the flow control windows allow */
+static void h2_stream_flush(http2pr_s *p, h2stream_s *s) {
+  FIOBJ packet = FIOBJ_INVALID;
+  size_t file_frames = 0;
+  if (s->flags & H2S_RESET)
+    goto finish;
+  while (h2_stream_pending(s) && p->window > 0 && s->window > 0) {
+    size_t pending;
+    fio_cstr_s body = {.data = NULL};
+    if (s->out) {
+      body = fiobj_obj2cstr(s->out);
+      pending = body.len - s->out_pos;
+    } else {
+      if (file_frames >= H2_FILE_BURST) {
+        /* wait for the socket to drain before reading more file data */
+        p->wait_ready = 1;
+        break;
+      }
+      ++file_frames;
+      pending = s->fd_len;
+    }
+    size_t chunk = pending;
+    if (chunk > p->peer_max_frame)
+      chunk = p->peer_max_frame;
+    if ((int64_t)chunk > p->window)
+      chunk = (size_t)p->window;
+    if ((int64_t)chunk > s->window)
+      chunk = (size_t)s->window;
+    if (!packet)
+      packet = fiobj_str_buf(chunk + 9);
+    if (s->out) {
+      h2_frame_write(
+          packet, H2_DATA,
+          ((chunk == pending && !s->streaming) ? H2_FLAG_END_STREAM : 0),
+          s->id, body.data + s->out_pos, chunk);
+      s->out_pos += chunk;
+      if (chunk == pending) {
+        fiobj_free(s->out);
+        s->out = FIOBJ_INVALID;
+      }
+    } else {
+      /* read the file data directly into the packet */
+      fio_cstr_s buf = fiobj_obj2cstr(packet);
+      fiobj_str_capa_assert(packet, buf.len + chunk + 9);
+      buf = fiobj_obj2cstr(packet);
+      ssize_t r = pread(s->fd, buf.data + buf.len + 9, chunk, s->fd_offset);
+      if (r <= 0) {
+        h2_stream_reset(p, s, H2_INTERNAL_ERROR);
+        goto finish;
+      }
+      chunk = (size_t)r;
+      h2_frame_header((uint8_t *)buf.data + buf.len, chunk, H2_DATA,
+                      (chunk == pending ? H2_FLAG_END_STREAM : 0), s->id);
+      fiobj_str_resize(packet, buf.len + chunk + 9);
+      s->fd_offset += chunk;
+      s->fd_len -= chunk;
+      if (!s->fd_len) {
+        close(s->fd);
+        s->fd = -1;
+      }
+    }
+    p->window -= chunk;
+    s->window -= chunk;
+  }
+  if (h2_stream_pending(s)) {
+    if (s->node.next == &s->node)
+      fio_ls_embd_unshift(&p->sending, &s->node);
+  } else {
+    fio_ls_embd_remove(&s->node);
+    s->node.next = s->node.prev = &s->node;
+  }
+finish:
+  if (packet)
+    fiobj_send_free(p->p.uuid, packet);
+  h2_stream_review(p, s);
+}
+
+/* sends pending response data for all the streams (i.e. after the connection
+ * window grew) */
+static void h2_flush_all(http2pr_s *p) {
+  fio_ls_embd_s *node = p->sending.next;
+  while (node != &p->sending && p->window > 0) {
+    fio_ls_embd_s *next = node->next;
+    h2_stream_flush(p, FIO_LS_EMBD_OBJ(h2stream_s, node, node));
+    node = next;
+  }
+}
+
+/* *****************************************************************************
+Sending Headers
+***************************************************************************** */
+
+struct h2_header_writer_s {
+  FIOBJ dest;
+  FIOBJ name;
+};
+
+/* tests for connection specific headers, which are forbidden in HTTP/2 */
+static int h2_is_connection_header(fio_cstr_s name) {
+  switch (name.len) {
+  case 7:
+    return !memcmp(name.data, "upgrade", 7);
+  case 10:
+    return !memcmp(name.data, "connection", 10) ||
+           !memcmp(name.data, "keep-alive", 10);
+  case 16:
+    return !memcmp(name.data, "proxy-connection", 16);
+  case 17:
+    return !memcmp(name.data, "transfer-encoding", 17);
+  }
+  return 0;
+}
+
+static int h2_write_header(FIOBJ o, void *w_) {
+  struct h2_header_writer_s *w = w_;
+  if (!o)
+    return 0;
+  if (fiobj_hash_key_in_loop()) {
+    w->name = fiobj_hash_key_in_loop();
+  }
+  if (FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY)) {
+    fiobj_each1(o, 0, h2_write_header, w);
+    return 0;
+  }
+  fio_cstr_s name = fiobj_obj2cstr(w->name);
+  fio_cstr_s str = fiobj_obj2cstr(o);
+  if (!str.data || !name.len || h2_is_connection_header(name))
+    return 0;
+  fio_cstr_s dest = fiobj_obj2cstr(w->dest);
+  fiobj_str_capa_assert(w->dest,
+                        dest.len + HPACK_ENCODED_MAX(name.len, str.len));
+  dest = fiobj_obj2cstr(w->dest);
+  /* HTTP/2 header names MUST be lower case */
+  char lower[64];
+  if (name.len <= sizeof(lower)) {
+    uint8_t upper = 0;
+    for (size_t i = 0; i < name.len; ++i) {
+      lower[i] = name.data[i];
+      if (lower[i] >= 'A' && lower[i] <= 'Z') {
+        lower[i] |= 32;
+        upper = 1;
+      }
+    }
+    if (upper)
+      name.data = lower;
+  }
+  fiobj_str_resize(w->dest, dest.len + hpack_encode_header(
+                                           (uint8_t *)dest.data + dest.len,
+                                           name.data, name.len, str.data,
+                                           str.len));
+  return 0;
+}
+
+/* sends the response headers (HEADERS + CONTINUATION frames) */
+static void h2_send_headers(http2pr_s *p, h2stream_s *s) {
+  if (s->flags & H2S_RESET)
+    return;
+  http_s *h = &s->h;
+  struct h2_header_writer_s w;
+  w.dest = fiobj_str_buf(fiobj_hash_count(h->private_data.out_headers) * 48 +
+                         16);
+  fiobj_str_resize(
+      w.dest, hpack_encode_status((uint8_t *)fiobj_obj2cstr(w.dest).data,
+                                  h->status));
+  fiobj_each1(h->private_data.out_headers, 0, h2_write_header, &w);
+
+  fio_cstr_s block = fiobj_obj2cstr(w.dest);
+  FIOBJ packet =
+      fiobj_str_buf(block.len + 9 * (1 + block.len / p->peer_max_frame));
+  uint8_t type = H2_HEADERS;
+  uint8_t flags = (h2_stream_pending(s) ||
+                   (s->streaming && !(s->flags & H2S_HEAD)))
+                      ? 0
+                      : H2_FLAG_END_STREAM;
+  size_t pos = 0;
+  do {
+    size_t len = block.len - pos;
+    if (len > p->peer_max_frame)
+      len = p->peer_max_frame;
+    if (pos + len == block.len)
+      flags |= H2_FLAG_END_HEADERS;
+    h2_frame_write(packet, type, flags, s->id, block.data + pos, len);
+    pos += len;
+    type = H2_CONTINUATION;
+    flags = 0;
+  } while (pos < block.len);
+  fiobj_free(w.dest);
+  fiobj_send_free(p->p.uuid, packet);
+}
+
+/* invalidates the handle and starts sending the response body */
+static void h2_stream_finish(http2pr_s *p, h2stream_s *s) {
+  http_s_destroy(&s->h, (p->p.settings->log && !(s->flags & H2S_RESET)));
+  s->flags |= H2S_FINISHED;
+  h2_stream_flush(p, s);
+}
+
+/* *****************************************************************************
+HTTP Request / Response (Virtual) Functions
+***************************************************************************** */
+
+/** Should send existing headers and data */
+static int http2_send_body(http_s *h, void *data, uintptr_t length) {
+  h2stream_s *s = handle2stream(h);
+  if (s->flags & H2S_FINISHED)
+    return -1;
+  if (length && !(s->flags & (H2S_RESET | H2S_HEAD)))
+    s->out = fiobj_str_new(data, length);
+  h2_send_headers(handle2pr(h), s);
+  h2_stream_finish(handle2pr(h), s);
+  return 0;
+}
+
+/** Should send existing headers and file */
+static int http2_sendfile(http_s *h, int fd, uintptr_t length,
+                          uintptr_t offset) {
+  h2stream_s *s = handle2stream(h);
+  if (s->flags & H2S_FINISHED) {
+    close(fd);
+    return -1;
+  }
+  if (!length || (s->flags & (H2S_RESET | H2S_HEAD))) {
+    close(fd);
+  } else if (length < HTTP_MAX_HEADER_LENGTH) {
+    /* optimize away small files */
+    s->out = fiobj_str_buf(length);
+    ssize_t i = pread(fd, fiobj_obj2cstr(s->out).data, length, offset);
+    close(fd);
+    if (i <= 0) {
+      fiobj_free(s->out);
+      s->out = FIOBJ_INVALID;
+      h2_stream_reset(handle2pr(h), s, H2_INTERNAL_ERROR);
+      h2_stream_finish(handle2pr(h), s);
+      return -1;
+    }
+    fiobj_str_resize(s->out, (size_t)i);
+  } else {
+    s->fd = fd;
+    s->fd_offset = offset;
+    s->fd_len = length;
+  }
+  h2_send_headers(handle2pr(h), s);
+  h2_stream_finish(handle2pr(h), s);
+  return 0;
+}
+
+static void http2_stream_end(http_s *h);
+
+/** Should send existing headers or complete streaming */
+static void http2_finish(http_s *h) {
+  h2stream_s *s = handle2stream(h);
+  if (s->flags & H2S_FINISHED)
+    return;
+  if (s->streaming) {
+    http2_stream_end(h);
+    return;
+  }
+  h2_send_headers(handle2pr(h), s);
+  h2_stream_finish(handle2pr(h), s);
+}
+
+/** Sends existing headers and prepares for streaming */
+static int http2_stream_start(http_s *h, http_stream_args_s *args) {
+  h2stream_s *s = handle2stream(h);
+  if ((s->flags & (H2S_FINISHED | H2S_RESET)) || s->streaming)
+    return -1;
+  s->streaming = 1;
+  s->stream = *args;
+  ++handle2pr(h)->streaming;
+  h2_send_headers(handle2pr(h), s);
+  return 0;
+}
+
+/** Sends a chunk of a streamed response body (as flow control allows) */
+static int http2_stream_write(http_s *h, void *data, uintptr_t length) {
+  h2stream_s *s = handle2stream(h);
+  if (!s->streaming || (s->flags & H2S_RESET))
+    return -1;
+  if (!length || (s->flags & H2S_HEAD))
+    return 0;
+  if (s->out)
+    fiobj_str_write(s->out, data, length);
+  else {
+    s->out = fiobj_str_new(data, length);
+    s->out_pos = 0;
+  }
+  h2_stream_flush(handle2pr(h), s);
+  return (h2_stream_pending(s) ||
+          sock_pending(handle2pr(h)->p.uuid) > HTTP_STREAM_MAX_PENDING);
+}
+
+/** Completes a streamed response */
+static void http2_stream_end(http_s *h) {
+  h2stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  if (!s->streaming)
+    return;
+  s->streaming = 0;
+  --p->streaming;
+  if (!h2_stream_pending(s) && !(s->flags & (H2S_HEAD | H2S_RESET)))
+    h2_frame_send(p, H2_DATA, H2_FLAG_END_STREAM, s->id, NULL, 0);
+  /* pending data is sent with the END_STREAM flag (see `h2_stream_flush`) */
+  h2_stream_finish(p, s);
+}
+
+/** Push for data - unsupported (server push isn't implemented). */
+static int http2_push_data(http_s *h, void *data, uintptr_t length,
+                           FIOBJ mime_type) {
+  return -1;
+  (void)h;
+  (void)data;
+  (void)length;
+  (void)mime_type;
+}
+
+/** Push for files - unsupported (server push isn't implemented). */
+static int http2_push_file(http_s *h, FIOBJ filename, FIOBJ mime_type) {
+  return -1;
+  (void)h;
+  (void)filename;
+  (void)mime_type;
+}
+
+/**
+ * Called befor a pause task,
+ */
+static void http2_on_pause(http_s *h, http_protocol_s *pr) {
+  ++handle2stream(h)->paused;
+  (void)pr;
+}
+
+/**
+ * called after the resume task had completed.
+ */
+static void http2_on_resume(http_s *h, http_protocol_s *pr) {
+  h2stream_s *s = handle2stream(h);
+  if (s->paused)
+    --s->paused;
+  h2_stream_review((http2pr_s *)pr, s);
+}
+
+/** Stops replenishing the stream's window (streamed request bodies). */
+static void http2_body_pause(http_s *h) {
+  handle2stream(h)->body |= H2S_BODY_PAUSED;
+}
+
+/* replenishes the stream's window within the connection's lock */
+static void http2_body_resume_task(intptr_t uuid, protocol_s *pr, void *id) {
+  http2pr_s *p = (http2pr_s *)pr;
+  h2stream_s *s = h2_stream_find(p, (uint32_t)(uintptr_t)id);
+  if (!s || !(s->body & H2S_BODY_PAUSED))
+    return;
+  s->body &= ~H2S_BODY_PAUSED;
+  if (s->recv_unacked && !(s->flags & (H2S_REMOTE_CLOSED | H2S_RESET))) {
+    h2_send_window_update(p, s->id, s->recv_unacked);
+    s->recv_unacked = 0;
+  }
+  (void)uuid;
+}
+
+/** Resumes replenishing the stream's window (thread safe). */
+static void http2_body_resume(http_s *h) {
+  facil_defer(.uuid = handle2pr(h)->p.uuid, .type = FIO_PR_LOCK_TASK,
+              .task = http2_body_resume_task,
+              .arg = (void *)(uintptr_t)handle2stream(h)->id);
+}
+
+/** Hijacking the socket is impossible while other streams are using it. */
+static intptr_t http2_hijack(http_s *h, fio_cstr_s *leftover) {
+  if (leftover)
+    *leftover = (fio_cstr_s){.len = 0, .data = NULL};
+  return -1;
+  (void)h;
+}
+
+/** Websockets over HTTP/2 (RFC 8441) aren't supported. */
+static int http2_http2websocket(http_s *h, websocket_settings_s *args) {
+  http_send_error(h, 400);
+  if (args->on_close)
+    args->on_close(0, args->udata);
+  return -1;
+}
+
+/** EventSource over HTTP/2 isn't supported. */
+static int http2_upgrade2sse(http_s *h, http_sse_s *sse) {
+  http_send_error(h, 400);
+  if (sse->on_close)
+    sse->on_close(sse);
+  return -1;
+}
+
+static int http2_sse_write(http_sse_s *sse, FIOBJ str) {
+  fiobj_free(str);
+  return -1;
+  (void)sse;
+}
+
+static int http2_sse_close(http_sse_s *sse) {
+  return -1;
+  (void)sse;
+}
+
+/* *****************************************************************************
+Virtual Table Decleration
+***************************************************************************** */
+
+struct http_vtable_s HTTP2_VTABLE = {
+    .http_send_body = http2_send_body,
+    .http_sendfile = http2_sendfile,
+    .http_finish = http2_finish,
+    .http_stream_start = http2_stream_start,
+    .http_stream_write = http2_stream_write,
+    .http_stream_end = http2_stream_end,
+    .http_push_data = http2_push_data,
+    .http_push_file = http2_push_file,
+    .http_on_pause = http2_on_pause,
+    .http_on_resume = http2_on_resume,
+    .http_body_pause = http2_body_pause,
+    .http_body_resume = http2_body_resume,
+    .http_hijack = http2_hijack,
+    .http2websocket = http2_http2websocket,
+    .http_upgrade2sse = http2_upgrade2sse,
+    .http_sse_write = http2_sse_write,
+    .http_sse_close = http2_sse_close,
+};
+
+void *http2_vtable(void) { return (void *)&HTTP2_VTABLE; }
+
+/* *****************************************************************************
+Request Handling
+***************************************************************************** */
+
+/* calls the `on_request` callback and finishes the response if required */
+static void h2_dispatch(http2pr_s *p, h2stream_s *s) {
+  s->flags |= H2S_DISPATCHED;
+  if ((s->flags & H2S_MALFORMED) || !s->h.method || !s->h.path) {
+    h2_stream_reset(p, s, H2_PROTOCOL_ERROR);
+    return;
+  }
+  if (s->error) {
+    http_send_error(&s->h, s->error);
+    return;
+  }
+  fio_cstr_s method = fiobj_obj2cstr(s->h.method);
+  if (method.len == 4 && !memcmp(method.data, "HEAD", 4))
+    s->flags |= H2S_HEAD;
+  s->flags |= H2S_BUSY;
+  http_on_request_handler______internal(&s->h, p->p.settings);
+  if (p->p.settings->on_body_chunk) {
+    if (!(s->flags & H2S_REMOTE_CLOSED)) {
+      /* the body is streamed, the request is finished by `h2_body_end` */
+      s->body |= H2S_BODY_STREAMING;
+      s->flags &= ~H2S_BUSY;
+      h2_stream_review(p, s);
+      return;
+    }
+    if (p->p.settings->on_body_end && !(s->flags & H2S_FINISHED) &&
+        !s->paused)
+      p->p.settings->on_body_end(&s->h);
+  }
+  s->flags &= ~H2S_BUSY;
+  if (!(s->flags & H2S_FINISHED) && !s->paused && !s->streaming)
+    http_finish(&s->h);
+  else
+    h2_stream_review(p, s);
+}
+
+/* a streamed body was received, calls `on_body_end` and finishes the request */
+static void h2_body_end(http2pr_s *p, h2stream_s *s) {
+  s->body = 0;
+  if (!(s->flags & H2S_FINISHED) && !s->paused) {
+    s->flags |= H2S_BUSY;
+    if (p->p.settings->on_body_end)
+      p->p.settings->on_body_end(&s->h);
+    s->flags &= ~H2S_BUSY;
+  }
+  if (!(s->flags & H2S_FINISHED) && !s->paused && !s->streaming)
+    http_finish(&s->h);
+  else
+    h2_stream_review(p, s);
+}
+
+/* collects incoming header data (HPACK callback) */
+static int h2_on_header(void *udata, char *name, size_t name_len, char *value,
+                        size_t value_len) {
+  h2stream_s *s = udata;
+  if (!s || s->error)
+    return 0; /* decoding is required to keep the HPACK state in sync */
+  http_s *h = &s->h;
+  s->header_size += name_len + value_len;
+  if (s->header_size >= handle2pr(h)->p.settings->max_header_size ||
+      fiobj_hash_count(h->headers) > HTTP_MAX_HEADER_COUNT) {
+    if (handle2pr(h)->p.settings->log) {
+      fprintf(stderr,
+              "WARNING: (http security alert) header flood detected.\n");
+    }
+    s->error = 413;
+    return 0;
+  }
+  if (name_len && name[0] == ':') {
+    if (s->flags & H2S_HEADERS)
+      goto malformed; /* pseudo headers must come first */
+    switch (name_len) {
+    case 5:
+      if (memcmp(name, ":path", 5) || h->path)
+        goto malformed;
+      {
+        char *query = memchr(value, '?', value_len);
+        if (query) {
+          h->query = fiobj_str_new(query + 1, value_len - (query + 1 - value));
+          value_len = query - value;
+        }
+        h->path = fiobj_str_new(value, value_len);
+      }
+      return 0;
+    case 7:
+      if (!memcmp(name, ":method", 7)) {
+        if (h->method)
+          goto malformed;
+        h->method = fiobj_str_new(value, value_len);
+        return 0;
+      }
+      if (!memcmp(name, ":scheme", 7))
+        return 0;
+      goto malformed;
+    case 10:
+      if (memcmp(name, ":authority", 10))
+        goto malformed;
+      set_header_add(h->headers, HTTP_HEADER_HOST,
+                     fiobj_str_new(value, value_len));
+      return 0;
+    }
+    goto malformed;
+  }
+  s->flags |= H2S_HEADERS;
+  FIOBJ sym = http_header_name(name, name_len);
+  if (name_len == 6 && !memcmp(name, "cookie", 6)) {
+    /* HTTP/2 splits cookies, HTTP/1.1 expects a single header (RFC 7540,
+     * section 8.1.2.5) */
+    FIOBJ old = fiobj_hash_get(h->headers, sym);
+    if (old && FIOBJ_TYPE_IS(old, FIOBJ_T_STRING)) {
+      fiobj_str_write(old, "; ", 2);
+      fiobj_str_write(old, value, value_len);
+      fiobj_free(sym);
+      return 0;
+    }
+  }
+  set_header_add(h->headers, sym, fiobj_str_new(value, value_len));
+  fiobj_free(sym);
+  return 0;
+malformed:
+  s->flags |= H2S_MALFORMED;
+  return 0;
+}
+
+/* handles a complete header block. Returns -1 on a connection error. */
+static int h2_on_header_block(http2pr_s *p, uint32_t id, uint8_t flags,
+                              uint8_t *data, size_t len) {
+  h2stream_s *s = h2_stream_find(p, id);
+  if (s || id <= p->last_id) {
+    /* trailers (ignored) or a closed stream */
+    if (hpack_decode(&p->decoder, data, len, h2_on_header, NULL))
+      return h2_goaway(p, H2_COMPRESSION_ERROR);
+    if (!s) {
+      h2_send_rst(p, id, H2_STREAM_CLOSED);
+      return 0;
+    }
+    if (s->flags & H2S_REMOTE_CLOSED) {
+      h2_stream_reset(p, s, H2_STREAM_CLOSED);
+      return 0;
+    }
+    if (!(flags & H2_FLAG_END_STREAM)) {
+      h2_stream_reset(p, s, H2_PROTOCOL_ERROR);
+      return 0;
+    }
+    s->flags |= H2S_REMOTE_CLOSED;
+    if (!(s->flags & (H2S_DISPATCHED | H2S_FINISHED)))
+      h2_dispatch(p, s);
+    else if (s->body & H2S_BODY_STREAMING)
+      h2_body_end(p, s);
+    else
+      h2_stream_review(p, s);
+    return 0;
+  }
+  if (p->goaway ||
+      fio_hash_count(&p->streams) >= HTTP2_MAX_CONCURRENT_STREAMS) {
+    p->last_id = id;
+    if (hpack_decode(&p->decoder, data, len, h2_on_header, NULL))
+      return h2_goaway(p, H2_COMPRESSION_ERROR);
+    h2_send_rst(p, id, H2_REFUSED_STREAM);
+    return 0;
+  }
+  s = h2_stream_new(p, id);
+  if (hpack_decode(&p->decoder, data, len, h2_on_header, s))
+    return h2_goaway(p, H2_COMPRESSION_ERROR);
+  if (flags & H2_FLAG_END_STREAM) {
+    s->flags |= H2S_REMOTE_CLOSED;
+    h2_dispatch(p, s);
+    return 0;
+  }
+  if (s->error || (s->flags & H2S_MALFORMED) || !s->h.method) {
+    h2_dispatch(p, s); /* sends the error response */
+    return 0;
+  }
+  static uint64_t content_length_hash;
+  if (!content_length_hash)
+    content_length_hash = fio_siphash("content-length", 14);
+  FIOBJ tmp = fiobj_hash_get2(s->h.headers, content_length_hash);
+  if (tmp) {
+    int64_t content_length = fiobj_obj2num(tmp);
+    if (content_length > (int64_t)p->p.settings->max_body_size) {
+      s->error = 413;
+      h2_dispatch(p, s);
+      return 0;
+    }
+    if (content_length > 0 && content_length <= HTTP_MAX_HEADER_LENGTH &&
+        !p->p.settings->on_body_chunk)
+      s->h.body = fiobj_data_newstr();
+  }
+  if (p->p.settings->on_body_chunk)
+    h2_dispatch(p, s); /* the request is handled before the body arrives */
+  return 0;
+}
+
+/* handles incoming request body data */
+static void h2_on_body(http2pr_s *p, h2stream_s *s, uint8_t *data,
+                       size_t len) {
+  if (!len || (s->flags & (H2S_FINISHED | H2S_RESET)))
+    return;
+  if (s->body & H2S_BODY_STREAMING) {
+    s->body_len += len;
+    s->flags |= H2S_BUSY;
+    if (s->body_len > p->p.settings->max_body_size)
+      http_send_error(&s->h, 413);
+    else
+      p->p.settings->on_body_chunk(&s->h, (char *)data, len);
+    s->flags &= ~H2S_BUSY;
+    return;
+  }
+  if (s->flags & H2S_DISPATCHED)
+    return;
+  if (!s->h.body)
+    s->h.body = fiobj_data_newtmpfile();
+  if (fiobj_data_len(s->h.body) + len > p->p.settings->max_body_size) {
+    s->error = 413;
+    h2_dispatch(p, s);
+    return;
+  }
+  fiobj_data_write(s->h.body, data, len);
+}
+
+/* *****************************************************************************
+Frame Handling
+***************************************************************************** */
+
+/* applies the peer's SETTINGS, returns an error code (0 == no error) */
+static uint32_t h2_apply_settings(http2pr_s *p, uint8_t *data, size_t len) {
+  if (len % 6)
+    return H2_FRAME_SIZE_ERROR;
+  for (size_t pos = 0; pos < len; pos += 6) {
+    uint16_t id = ((uint16_t)data[pos] << 8) | data[pos + 1];
+    uint32_t value = h2_read32(data + pos + 2);
+    switch (id) {
+    case H2_SETTINGS_ENABLE_PUSH:
+      if (value > 1)
+        return H2_PROTOCOL_ERROR;
+      break;
+    case H2_SETTINGS_INITIAL_WINDOW_SIZE: {
+      if (value > H2_MAX_WINDOW)
+        return H2_FLOW_CONTROL_ERROR;
+      /* the change applies to all the open streams (RFC 7540, 6.9.2) */
+      int64_t delta = (int64_t)value - p->peer_initial_window;
+      p->peer_initial_window = value;
+      FIO_HASH_FOR_LOOP(&p->streams, i) {
+        h2stream_s *s = i->obj;
+        if (s)
+          s->window += delta;
+      }
+      break;
+    }
+    case H2_SETTINGS_MAX_FRAME_SIZE:
+      if (value < H2_MAX_FRAME || value > 16777215)
+        return H2_PROTOCOL_ERROR;
+      p->peer_max_frame =
+          (value > H2_MAX_FRAME_SEND) ? H2_MAX_FRAME_SEND : value;
+      break;
+    default:
+      /* the encoder doesn't use a dynamic table and the stream / header list
+       * limits are a client concern */
+      break;
+    }
+  }
+  return 0;
+}
+
+/* handles a single frame. Returns -1 on a connection error. */
+static int h2_on_frame(http2pr_s *p, uint8_t type, uint8_t flags, uint32_t id,
+                       uint8_t *data, size_t len) {
+  if (p->headers_id && type != H2_CONTINUATION)
+    return h2_goaway(p, H2_PROTOCOL_ERROR);
+  switch (type) {
+  case H2_DATA: {
+    if (!id || id > p->last_id)
+      return h2_goaway(p, H2_PROTOCOL_ERROR);
+    /* flow control includes the padding */
+    p->recv_unacked += len;
+    if (p->recv_unacked >= (HTTP2_WINDOW_SIZE >> 1)) {
+      h2_send_window_update(p, 0, p->recv_unacked);
+      p->recv_unacked = 0;
+    }
+    h2stream_s *s = h2_stream_find(p, id);
+    if (!s)
+      return 0; /* a stream we closed, ignore */
+    if (s->flags & H2S_REMOTE_CLOSED) {
+      h2_stream_reset(p, s, H2_STREAM_CLOSED);
+      return 0;
+    }
+    s->recv_unacked += len;
+    if (flags & H2_FLAG_PADDED) {
+      if (!len || data[0] >= len)
+        return h2_goaway(p, H2_PROTOCOL_ERROR);
+      len -= 1 + data[0];
+      ++data;
+    }
+    h2_on_body(p, s, data, len);
+    if (flags & H2_FLAG_END_STREAM) {
+      s->flags |= H2S_REMOTE_CLOSED;
+      if (!(s->flags & (H2S_DISPATCHED | H2S_FINISHED)))
+        h2_dispatch(p, s);
+      else if (s->body & H2S_BODY_STREAMING)
+        h2_body_end(p, s);
+      else
+        h2_stream_review(p, s);
+      return 0;
+    }
+    if (!(s->body & H2S_BODY_PAUSED) &&
+        s->recv_unacked >= (HTTP2_WINDOW_SIZE >> 1)) {
+      h2_send_window_update(p, id, s->recv_unacked);
+      s->recv_unacked = 0;
+    }
+    if (s->body & H2S_BODY_STREAMING)
+      h2_stream_review(p, s); /* the response might have been sent already */
+    return 0;
+  }
+  case H2_HEADERS: {
+    if (!id || !(id & 1))
+      return h2_goaway(p, H2_PROTOCOL_ERROR);
+    if (flags & H2_FLAG_PADDED) {
+      if (!len || data[0] >= len)
+        return h2_goaway(p, H2_PROTOCOL_ERROR);
+      len -= 1 + data[0];
+      ++data;
+    }
+    if (flags & H2_FLAG_PRIORITY) {
+      if (len < 5)
+        return h2_goaway(p, H2_PROTOCOL_ERROR);
+      len -= 5;
+      data += 5;
+    }
+    if (flags & H2_FLAG_END_HEADERS)
+      return h2_on_header_block(p, id, flags, data, len);
+    p->headers_id = id;
+    p->headers_flags = flags;
+    p->headers = fiobj_str_buf(len + H2_MAX_FRAME);
+    fiobj_str_write(p->headers, (char *)data, len);
+    return 0;
+  }
+  case H2_CONTINUATION: {
+    if (!p->headers_id || id != p->headers_id)
+      return h2_goaway(p, H2_PROTOCOL_ERROR);
+    fiobj_str_write(p->headers, (char *)data, len);
+    fio_cstr_s block = fiobj_obj2cstr(p->headers);
+    if (block.len > (p->p.settings->max_header_size << 1))
+      return h2_goaway(p, H2_ENHANCE_YOUR_CALM);
+    if (!(flags & H2_FLAG_END_HEADERS))
+      return 0;
+    FIOBJ tmp = p->headers;
+    p->headers = FIOBJ_INVALID;
+    p->headers_id = 0;
+    int ret = h2_on_header_block(p, id, p->headers_flags, block.bytes,
+                                 block.len);
+    fiobj_free(tmp);
+    return ret;
+  }
+  case H2_PRIORITY:
+    if (!id)
+      return h2_goaway(p, H2_PROTOCOL_ERROR);
+    return 0; /* prioritization isn't supported, streams are handled in order */
+  case H2_RST_STREAM: {
+    if (!id || id > p->last_id)
+      return h2_goaway(p, H2_PROTOCOL_ERROR);
+    if (len != 4)
+      return h2_goaway(p, H2_FRAME_SIZE_ERROR);
+    h2stream_s *s = h2_stream_find(p, id);
+    if (s)
+      h2_stream_reset(p, s, -1);
+    return 0;
+  }
+  case H2_SETTINGS: {
+    if (id)
+      return h2_goaway(p, H2_PROTOCOL_ERROR);
+    if (flags & H2_FLAG_ACK) {
+      if (len)
+        return h2_goaway(p, H2_FRAME_SIZE_ERROR);
+      return 0;
+    }
+    uint32_t error = h2_apply_settings(p, data, len);
+    if (error)
+      return h2_goaway(p, error);
+    h2_frame_send(p, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+    h2_flush_all(p);
+    return 0;
+  }
+  case H2_PUSH_PROMISE:
+    /* clients can't push */
+    return h2_goaway(p, H2_PROTOCOL_ERROR);
+  case H2_PING:
+    if (id)
+      return h2_goaway(p, H2_PROTOCOL_ERROR);
+    if (len != 8)
+      return h2_goaway(p, H2_FRAME_SIZE_ERROR);
+    if (!(flags & H2_FLAG_ACK))
+      h2_frame_send(p, H2_PING, H2_FLAG_ACK, 0, data, 8);
+    return 0;
+  case H2_GOAWAY:
+    if (id)
+      return h2_goaway(p, H2_PROTOCOL_ERROR);
+    /* the client won't open new streams, existing streams are completed */
+    if (!p->goaway)
+      p->goaway = 1;
+    return 0;
+  case H2_WINDOW_UPDATE: {
+    if (len != 4)
+      return h2_goaway(p, H2_FRAME_SIZE_ERROR);
+    const uint32_t inc = h2_read32(data) & 0x7FFFFFFF;
+    if (!id) {
+      if (!inc)
+        return h2_goaway(p, H2_PROTOCOL_ERROR);
+      p->window += inc;
+      if (p->window > H2_MAX_WINDOW)
+        return h2_goaway(p, H2_FLOW_CONTROL_ERROR);
+      h2_flush_all(p);
+      return 0;
+    }
+    h2stream_s *s = h2_stream_find(p, id);
+    if (!s)
+      return 0;
+    if (!inc) {
+      h2_stream_reset(p, s, H2_PROTOCOL_ERROR);
+      return 0;
+    }
+    s->window += inc;
+    if (s->window > H2_MAX_WINDOW) {
+      h2_stream_reset(p, s, H2_FLOW_CONTROL_ERROR);
+      return 0;
+    }
+    if (h2_stream_pending(s))
+      h2_stream_flush(p, s);
+    return 0;
+  }
+  }
+  /* unknown frame types are ignored */
+  return 0;
+}
+
+/* parses the frames in the buffer */
+static void http2_consume_data(http2pr_s *p) {
+  size_t pos = 0;
+  if (p->preface) {
+    size_t len = p->buf_len < 24 ? p->buf_len : 24;
+    if (memcmp(p->buf, H2_PREFACE, len)) {
+      sock_close(p->p.uuid);
+      p->buf_len = 0;
+      return;
+    }
+    if (len < 24)
+      return;
+    pos = 24;
+    p->preface = 0;
+  }
+  while (p->buf_len - pos >= 9 && p->goaway < 2) {
+    uint8_t *frame = p->buf + pos;
+    size_t len = ((size_t)frame[0] << 16) | ((size_t)frame[1] << 8) | frame[2];
+    if (len > H2_MAX_FRAME) {
+      h2_goaway(p, H2_FRAME_SIZE_ERROR);
+      break;
+    }
+    if (p->buf_len - pos < len + 9)
+      break;
+    pos += len + 9;
+    if (h2_on_frame(p, frame[3], frame[4], h2_read32(frame + 5) & 0x7FFFFFFF,
+                    frame + 9, len))
+      break;
+  }
+  if (p->goaway >= 2) {
+    p->buf_len = 0;
+    return;
+  }
+  p->buf_len -= pos;
+  if (p->buf_len && pos)
+    memmove(p->buf, p->buf + pos, p->buf_len);
+}
+
+/* *****************************************************************************
+Connection Callbacks
+***************************************************************************** */
+
+/**
+ * A string to identify the protocol's service (i.e. "http").
+ *
+ * The string should be a global constant, only a pointer comparison will be
+ * used (not `strcmp`).
+ */
+static const char *HTTP2_SERVICE_STR = "http2_protocol_facil_io";
+
+/** called when a data is available, but will not run concurrently */
+static void http2_on_data(intptr_t uuid, protocol_s *protocol) {
+  http2pr_s *p = (http2pr_s *)protocol;
+  if (p->wait_ready) {
+    p->wait_ready = 0;
+    h2_flush_all(p);
+  }
+  ssize_t i = 0;
+  if (HTTP2_READ_BUFFER - p->buf_len)
+    i = sock_read(uuid, p->buf + p->buf_len, HTTP2_READ_BUFFER - p->buf_len);
+  if (i > 0) {
+    p->buf_len += i;
+  }
+  http2_consume_data(p);
+  if (p->upgraded && !p->preface) {
+    /* handle the HTTP/1.1 request that requested the upgrade, once the client
+     * is ready (the preface and SETTINGS were received) */
+    h2stream_s *s = p->upgraded;
+    p->upgraded = NULL;
+    h2_dispatch(p, s);
+  }
+}
+
+/* calls the streamed responses' `on_ready` within the connection's lock */
+static void http2_stream_ready_task(intptr_t uuid, protocol_s *pr, void *ignr) {
+  http2pr_s *p = (http2pr_s *)pr;
+  if (!p->streaming)
+    return;
+  /* `on_ready` might complete the response (freeing the stream) */
+  size_t count = 0;
+  uint32_t *ids = fio_malloc(sizeof(*ids) * p->streaming);
+  FIO_HASH_FOR_LOOP(&p->streams, i) {
+    h2stream_s *s = i->obj;
+    if (s && s->streaming && s->stream.on_ready && !h2_stream_pending(s) &&
+        count < p->streaming)
+      ids[count++] = s->id;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    h2stream_s *s = h2_stream_find(p, ids[i]);
+    if (s && s->streaming)
+      s->stream.on_ready(&s->h);
+  }
+  fio_free(ids);
+  (void)uuid;
+  (void)ignr;
+}
+
+/** called when the socket's outgoing buffer is empty */
+static void http2_on_ready(intptr_t uuid, protocol_s *protocol) {
+  if (((http2pr_s *)protocol)->wait_ready)
+    facil_force_event(uuid, FIO_EVENT_ON_DATA);
+  if (((http2pr_s *)protocol)->streaming)
+    facil_defer(.uuid = uuid, .type = FIO_PR_LOCK_TASK,
+                .task = http2_stream_ready_task);
+}
+
+/** called when the server is shutting down */
+static uint8_t http2_on_shutdown(intptr_t uuid, protocol_s *protocol) {
+  http2pr_s *p = (http2pr_s *)protocol;
+  uint8_t payload[8];
+  h2_write32(payload, p->last_id);
+  h2_write32(payload + 4, H2_NO_ERROR);
+  h2_frame_send(p, H2_GOAWAY, 0, 0, payload, 8);
+  return 0;
+  (void)uuid;
+}
+
+/** called when the connection timed out */
+static void http2_ping(intptr_t uuid, protocol_s *protocol) {
+  http2pr_s *p = (http2pr_s *)protocol;
+  if (!fio_hash_count(&p->streams)) {
+    /* idle connection */
+    sock_close(uuid);
+    return;
+  }
+  /* requests are still being handled, keep the connection alive */
+  h2_frame_send(p, H2_PING, 0, 0, "facil.io", 8);
+}
+
+/** called when the connection was closed, but will not run concurrently */
+static void http2_on_close(intptr_t uuid, protocol_s *protocol) {
+  http2_destroy(protocol);
+  (void)uuid;
+}
+
+/* *****************************************************************************
+Public API
+***************************************************************************** */
+
+static http2pr_s *http2_new_internal(uintptr_t uuid, http_settings_s *settings,
+                                     void *unread_data, size_t unread_length) {
+  if (unread_data && unread_length > HTTP2_READ_BUFFER)
+    return NULL;
+  http2pr_s *p = malloc(sizeof(*p) + HTTP2_READ_BUFFER);
+  HTTP_ASSERT(p, "HTTP/2 protocol allocation failed");
+  *p = (http2pr_s){
+      .p.protocol =
+          {
+              .service = HTTP2_SERVICE_STR,
+              .on_data = http2_on_data,
+              .on_ready = http2_on_ready,
+              .on_shutdown = http2_on_shutdown,
+              .ping = http2_ping,
+              .on_close = http2_on_close,
+          },
+      .p.uuid = uuid,
+      .p.settings = settings,
+      .streams = FIO_HASH_INIT,
+      .window = H2_DEFAULT_WINDOW,
+      .peer_initial_window = H2_DEFAULT_WINDOW,
+      .peer_max_frame = H2_MAX_FRAME,
+      .preface = 1,
+  };
+  p->sending = (fio_ls_embd_s){.next = &p->sending, .prev = &p->sending};
+  hpack_table_init(&p->decoder);
+  if (unread_data && unread_length) {
+    memcpy(p->buf, unread_data, unread_length);
+    p->buf_len = unread_length;
+  }
+  /* send the server's preface (SETTINGS) and grow the connection window */
+  uint8_t payload[24];
+  size_t len = 0;
+  const uint32_t settings_list[][2] = {
+      {H2_SETTINGS_MAX_CONCURRENT_STREAMS, HTTP2_MAX_CONCURRENT_STREAMS},
+      {H2_SETTINGS_INITIAL_WINDOW_SIZE, HTTP2_WINDOW_SIZE},
+      {H2_SETTINGS_HEADER_TABLE_SIZE, HPACK_TABLE_SIZE},
+      {H2_SETTINGS_MAX_HEADER_LIST_SIZE, settings->max_header_size},
+  };
+  for (size_t i = 0; i < sizeof(settings_list) / sizeof(settings_list[0]);
+       ++i) {
+    payload[len] = (uint8_t)(settings_list[i][0] >> 8);
+    payload[len + 1] = (uint8_t)settings_list[i][0];
+    h2_write32(payload + len + 2, settings_list[i][1]);
+    len += 6;
+  }
+  FIOBJ packet = fiobj_str_buf(9 + len + 13);
+  h2_frame_write(packet, H2_SETTINGS, 0, 0, payload, len);
+  if (HTTP2_WINDOW_SIZE > H2_DEFAULT_WINDOW) {
+    h2_write32(payload, HTTP2_WINDOW_SIZE - H2_DEFAULT_WINDOW);
+    h2_frame_write(packet, H2_WINDOW_UPDATE, 0, 0, payload, 4);
+  }
+  fiobj_send_free(uuid, packet);
+  return p;
+}
+
+/** Creates an HTTP/2 protocol object and handles any unread data in the buffer
+ * (if any). The unread data should start with the client's preface. */
+protocol_s *http2_new(uintptr_t uuid, http_settings_s *settings,
+                      void *unread_data, size_t unread_length) {
+  http2pr_s *p =
+      http2_new_internal(uuid, settings, unread_data, unread_length);
+  if (!p)
+    return NULL;
+  facil_attach(uuid, &p->p.protocol);
+  if (p->buf_len)
+    facil_force_event(uuid, FIO_EVENT_ON_DATA);
+  return &p->p.protocol;
+}
+
+/**
+ * Upgrades an HTTP/1.1 connection to HTTP/2 (`Upgrade: h2c`).
+ */
+protocol_s *http2_upgrade(uintptr_t uuid, http_settings_s *settings,
+                          http_s *h, void *h2settings, size_t h2settings_len,
+                          void *unread_data, size_t unread_length) {
+  http2pr_s *p =
+      http2_new_internal(uuid, settings, unread_data, unread_length);
+  if (!p)
+    return NULL;
+  if (h2_apply_settings(p, h2settings, h2settings_len)) {
+    http2_destroy(&p->p.protocol);
+    return NULL;
+  }
+  /* the request becomes stream 1, half closed (remote) */
+  h2stream_s *s = h2_stream_new(p, 1);
+  http_s_destroy(&s->h, 0);
+  s->h = *h;
+  s->h.private_data.vtbl = &HTTP2_VTABLE;
+  s->h.private_data.flag = (uintptr_t)&p->p;
+  fiobj_free(s->h.version);
+  s->h.version = fiobj_str_new("HTTP/2.0", 8);
+  fiobj_hash_delete2(s->h.headers, fiobj_obj2hash(HTTP_HEADER_UPGRADE));
+  fiobj_hash_delete2(s->h.headers, fiobj_obj2hash(HTTP_HEADER_CONNECTION));
+  fiobj_hash_delete2(s->h.headers, fio_siphash("http2-settings", 14));
+  s->flags |= H2S_REMOTE_CLOSED;
+  p->upgraded = s;
+  facil_attach(uuid, &p->p.protocol);
+  facil_force_event(uuid, FIO_EVENT_ON_DATA);
+  return &p->p.protocol;
+}
+
+/** Manually destroys the HTTP/2 protocol object. */
+void http2_destroy(protocol_s *pr) {
+  http2pr_s *p = (http2pr_s *)pr;
+  FIO_HASH_FOR_FREE(&p->streams, pos) {
+    if (pos->obj)
+      h2_stream_destroy(p, pos->obj);
+  }
+  hpack_table_destroy(&p->decoder);
+  fiobj_free(p->headers);
+  free(p);
+}
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+
+#if DEBUG
+void http2_tests(void) { hpack_test(); }
+#endif
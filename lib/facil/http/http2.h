@@ -0,0 +1,71 @@
+/*
+Copyright: Boaz Segev, 2018
+License: MIT
+*/
+#ifndef H_HTTP2_H
+#define H_HTTP2_H
+
+#include "http.h"
+
+#ifndef HTTP2_MAX_CONCURRENT_STREAMS
+/**
+ * The maximum number of concurrent streams (requests) a single HTTP/2
+ * connection is allowed to open (advertised using SETTINGS).
+ */
+#define HTTP2_MAX_CONCURRENT_STREAMS 128
+#endif
+
+#ifndef HTTP2_WINDOW_SIZE
+/**
+ * The flow control window (per stream and per connection) used for incoming
+ * data.
+ *
+ * Request bodies are buffered in full (up to `max_body_size`), so a larger
+ * window only means faster uploads. Streamed request bodies (`on_body_chunk`)
+ * might receive up to a window's worth of data after calling
+ * `http_body_pause`.
+ */
+#define HTTP2_WINDOW_SIZE (1UL << 20) /* ~1Mb */
+#endif
+
+#ifndef HTTP2_READ_BUFFER
+/**
+ * The size of the HTTP/2 read buffer. Must hold at least a single frame
+ * (16,393 bytes, since facil.io doesn't allow larger frames).
+ */
+#define HTTP2_READ_BUFFER (32 * 1024) /* ~32kb */
+#endif
+
+/** Creates an HTTP/2 protocol object and handles any unread data in the buffer
+ * (if any). The unread data should start with the client's preface. */
+protocol_s *http2_new(uintptr_t uuid, http_settings_s *settings,
+                      void *unread_data, size_t unread_length);
+
+/**
+ * Upgrades an HTTP/1.1 connection to HTTP/2 (`Upgrade: h2c`).
+ *
+ * The HTTP/1.1 request `h` becomes the first HTTP/2 stream. Its data is moved
+ * to the new protocol, so `h` should be reinitialized rather than destroyed.
+ *
+ * `h2settings` contains the decoded `HTTP2-Settings` header value and the
+ * unread data should contain the client's preface (if already received).
+ *
+ * The `101 Switching Protocols` response should be sent before calling this
+ * function.
+ */
+protocol_s *http2_upgrade(uintptr_t uuid, http_settings_s *settings,
+                          http_s *h, void *h2settings, size_t h2settings_len,
+                          void *unread_data, size_t unread_length);
+
+/** Manually destroys the HTTP/2 protocol object. */
+void http2_destroy(protocol_s *);
+
+/** returns the HTTP/2 protocol's VTable. */
+void *http2_vtable(void);
+
+#if DEBUG
+/** Tests the HTTP/2 helpers (HPACK). */
+void http2_tests(void);
+#endif
+
+#endif
@@ -0,0 +1,339 @@
+/*
+Copyright: Boaz Segev, 2016-2018
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include "http_internal.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+#if HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include "fio_mem.h"
+
+/* *****************************************************************************
+Response compression
+
+Dynamic responses (`http_send_body`) are compressed using a fast setting, while
+static files are compressed once, using a stronger setting, and the result is
+kept in the static file cache (see `http_sendfile2`).
+***************************************************************************** */
+
+#ifndef HTTP_COMPRESS_GZIP_LEVEL
+/** The gzip compression level for dynamic responses. */
+#define HTTP_COMPRESS_GZIP_LEVEL 6
+#endif
+
+#ifndef HTTP_COMPRESS_BROTLI_QUALITY
+/** The brotli compression quality for dynamic responses. */
+#define HTTP_COMPRESS_BROTLI_QUALITY 4
+#endif
+
+#ifndef HTTP_COMPRESS_BROTLI_STATIC_QUALITY
+/**
+ * The brotli compression quality for (cached) static files. Qualities 10 and
+ * 11 are much slower, which might stall a worker thread for large files.
+ */
+#define HTTP_COMPRESS_BROTLI_STATIC_QUALITY 9
+#endif
+
+/* *****************************************************************************
+Per-thread compression contexts
+***************************************************************************** */
+#if HAVE_ZLIB
+
+typedef struct {
+  /* a dynamic response context and a static file context */
+  z_stream gzip[2];
+  uint8_t gzip_ready[2];
+} http_compress_ctx_s;
+
+static __thread http_compress_ctx_s *http_compress_ctx;
+static pthread_key_t http_compress_ctx_key;
+
+static void http_compress_ctx_free(void *ctx_) {
+  http_compress_ctx_s *ctx = ctx_;
+  for (size_t i = 0; i < 2; ++i) {
+    if (ctx->gzip_ready[i])
+      deflateEnd(&ctx->gzip[i]);
+  }
+  free(ctx);
+}
+
+static void __attribute__((constructor)) http_compress_initialize(void) {
+  pthread_key_create(&http_compress_ctx_key, http_compress_ctx_free);
+}
+
+/** Returns the thread's (reset) gzip stream (or NULL). */
+static z_stream *http_compress_gzip_stream(uint8_t best) {
+  if (!http_compress_ctx) {
+    http_compress_ctx = calloc(1, sizeof(*http_compress_ctx));
+    HTTP_ASSERT(http_compress_ctx, "HTTP compression allocation failed");
+    pthread_setspecific(http_compress_ctx_key, http_compress_ctx);
+  }
+  z_stream *z = http_compress_ctx->gzip + best;
+  if (!http_compress_ctx->gzip_ready[best]) {
+    /* 16 + 15 bits == a gzip wrapper with the maximal window */
+    if (deflateInit2(z, (best ? Z_BEST_COMPRESSION : HTTP_COMPRESS_GZIP_LEVEL),
+                     Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      return NULL;
+    http_compress_ctx->gzip_ready[best] = 1;
+    return z;
+  }
+  deflateReset(z);
+  return z;
+}
+
+static FIOBJ http_compress_gzip(const void *data, size_t len, uint8_t best) {
+  z_stream *z = http_compress_gzip_stream(best);
+  if (!z)
+    return FIOBJ_INVALID;
+  const size_t capa = deflateBound(z, len);
+  FIOBJ out = fiobj_str_buf(capa);
+  z->next_in = (Bytef *)data;
+  z->avail_in = len;
+  z->next_out = (Bytef *)fiobj_obj2cstr(out).data;
+  z->avail_out = capa;
+  if (deflate(z, Z_FINISH) != Z_STREAM_END) {
+    fiobj_free(out);
+    return FIOBJ_INVALID;
+  }
+  fiobj_str_resize(out, capa - z->avail_out);
+  return out;
+}
+#endif
+
+#if HAVE_BROTLI
+static FIOBJ http_compress_brotli(const void *data, size_t len, uint8_t best) {
+  size_t capa = BrotliEncoderMaxCompressedSize(len);
+  if (!capa)
+    return FIOBJ_INVALID;
+  FIOBJ out = fiobj_str_buf(capa);
+  if (!BrotliEncoderCompress((best ? HTTP_COMPRESS_BROTLI_STATIC_QUALITY
+                                   : HTTP_COMPRESS_BROTLI_QUALITY),
+                             BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len,
+                             data, &capa,
+                             (uint8_t *)fiobj_obj2cstr(out).data)) {
+    fiobj_free(out);
+    return FIOBJ_INVALID;
+  }
+  fiobj_str_resize(out, capa);
+  return out;
+}
+#endif
+
+/* *****************************************************************************
+Compression API
+***************************************************************************** */
+
+/**
+ * Compresses the data, returning a new String, or FIOBJ_INVALID if the data
+ * couldn't be compressed (or the result wasn't any smaller).
+ */
+FIOBJ http_compress(http_compress_e encoding, const void *data, size_t len,
+                    uint8_t best) {
+  FIOBJ out = FIOBJ_INVALID;
+  switch (encoding) {
+  case HTTP_COMPRESS_GZIP:
+#if HAVE_ZLIB
+    out = http_compress_gzip(data, len, best);
+#endif
+    break;
+  case HTTP_COMPRESS_BROTLI:
+#if HAVE_BROTLI
+    out = http_compress_brotli(data, len, best);
+#endif
+    break;
+  case HTTP_COMPRESS_NONE: /* fallthrough */
+  case HTTP_COMPRESS_COUNT:
+    break;
+  }
+  if (out && fiobj_obj2cstr(out).len >= len) {
+    fiobj_free(out);
+    out = FIOBJ_INVALID;
+  }
+  (void)data;
+  (void)best;
+  return out;
+}
+
+/** Returns the `content-encoding` header value for the encoding. */
+FIOBJ http_compress_name(http_compress_e encoding) {
+  return (encoding == HTTP_COMPRESS_BROTLI) ? HTTP_HVALUE_BROTLI
+                                            : HTTP_HVALUE_GZIP;
+}
+
+/** Tests if a response with the `mime` type is worth compressing. */
+int http_compress_mime(fio_cstr_s mime) {
+  if (!mime.data || mime.len < 5)
+    return 0;
+  char *end = memchr(mime.data, ';', mime.len);
+  if (end)
+    mime.len = (size_t)(end - mime.data);
+  while (mime.len && (mime.data[mime.len - 1] == ' ' ||
+                      mime.data[mime.len - 1] == '\t'))
+    --mime.len;
+  if (mime.len > 5 && !strncasecmp(mime.data, "text/", 5))
+    return 1;
+  char *subtype = memchr(mime.data, '/', mime.len);
+  if (!subtype)
+    return 0;
+  ++subtype;
+  const size_t len = mime.len - (size_t)(subtype - mime.data);
+  /* i.e. "application/json", "image/svg+xml", "application/wasm" */
+  static const struct {
+    const char *str;
+    size_t len;
+  } types[] = {
+      {"json", 4}, {"javascript", 10}, {"xml", 3}, {"wasm", 4}, {NULL, 0},
+  };
+  for (size_t i = 0; types[i].str; ++i) {
+    if (len == types[i].len &&
+        !strncasecmp(subtype, types[i].str, types[i].len))
+      return 1;
+  }
+  /* structured syntax suffixes, i.e. "application/ld+json" */
+  if ((len > 4 && !strncasecmp(subtype + len - 4, "+xml", 4)) ||
+      (len > 5 && !strncasecmp(subtype + len - 5, "+json", 5)))
+    return 1;
+  return 0;
+}
+
+/* returns the value of a `q` parameter, in thousandths (0-1000). */
+static size_t http_compress_qvalue(char *pos, char *end) {
+  while (pos < end) {
+    while (pos < end && (*pos == ';' || *pos == ' ' || *pos == '\t'))
+      ++pos;
+    if (end - pos >= 2 && (pos[0] | 32) == 'q' && pos[1] == '=') {
+      pos += 2;
+      if (pos < end && *pos == '1')
+        return 1000;
+      size_t q = 0, scale = 100;
+      if (pos < end && *pos == '0')
+        ++pos;
+      if (pos < end && *pos == '.') {
+        ++pos;
+        while (pos < end && *pos >= '0' && *pos <= '9' && scale) {
+          q += (size_t)(*pos - '0') * scale;
+          scale /= 10;
+          ++pos;
+        }
+      }
+      return q;
+    }
+    while (pos < end && *pos != ';')
+      ++pos;
+  }
+  return 1000;
+}
+
+/**
+ * Selects the best encoding the client accepts (see `accept-encoding`) out of
+ * the `encodings` bit mask (`1 << encoding`), preferring brotli.
+ */
+http_compress_e http_compress_negotiate2(http_s *h, uint8_t encodings) {
+  static uint64_t accept_enc_hash = 0;
+  if (!accept_enc_hash)
+    accept_enc_hash = fio_siphash("accept-encoding", 15);
+  FIOBJ tmp = fiobj_hash_get2(h->headers, accept_enc_hash);
+  if (!tmp || !FIOBJ_TYPE_IS(tmp, FIOBJ_T_STRING))
+    return HTTP_COMPRESS_NONE;
+  fio_cstr_s s = fiobj_obj2cstr(tmp);
+  /* -1 == not listed */
+  ssize_t q[HTTP_COMPRESS_COUNT] = {-1, -1, -1};
+  ssize_t q_any = -1;
+  char *pos = s.data;
+  char *const stop = s.data + s.len;
+  while (pos < stop) {
+    while (pos < stop && (*pos == ' ' || *pos == '\t' || *pos == ','))
+      ++pos;
+    char *name = pos;
+    while (pos < stop && *pos != ',' && *pos != ';' && *pos != ' ')
+      ++pos;
+    const size_t name_len = (size_t)(pos - name);
+    char *end = memchr(pos, ',', (size_t)(stop - pos));
+    if (!end)
+      end = stop;
+    const ssize_t value = (ssize_t)http_compress_qvalue(pos, end);
+    if (name_len == 2 && !strncasecmp(name, "br", 2))
+      q[HTTP_COMPRESS_BROTLI] = value;
+    else if (name_len == 4 && !strncasecmp(name, "gzip", 4))
+      q[HTTP_COMPRESS_GZIP] = value;
+    else if (name_len == 1 && name[0] == '*')
+      q_any = value;
+    pos = end;
+  }
+  for (size_t i = 1; i < HTTP_COMPRESS_COUNT; ++i) {
+    if (q[i] == -1)
+      q[i] = q_any;
+    if (!(encodings & (1 << i)))
+      q[i] = 0;
+  }
+  if (q[HTTP_COMPRESS_BROTLI] > 0 &&
+      q[HTTP_COMPRESS_BROTLI] >= q[HTTP_COMPRESS_GZIP])
+    return HTTP_COMPRESS_BROTLI;
+  if (q[HTTP_COMPRESS_GZIP] > 0)
+    return HTTP_COMPRESS_GZIP;
+  return HTTP_COMPRESS_NONE;
+}
+
+/**
+ * Selects the best encoding the client accepts (see `accept-encoding`),
+ * preferring brotli. Only the encodings compiled in are considered.
+ */
+http_compress_e http_compress_negotiate(http_s *h) {
+  static const uint8_t encodings = 0
+#if HAVE_ZLIB
+                                   | (1 << HTTP_COMPRESS_GZIP)
+#endif
+#if HAVE_BROTLI
+                                   | (1 << HTTP_COMPRESS_BROTLI)
+#endif
+      ;
+  return http_compress_negotiate2(h, encodings);
+}
+
+/**
+ * Compresses a dynamic response body if the settings, the client and the
+ * response allow it, setting the `content-encoding` and `vary` headers.
+ *
+ * Returns the compressed body (or FIOBJ_INVALID).
+ */
+FIOBJ http_compress_response(http_s *h, const void *data, size_t len) {
+  static uint64_t ce_hash = 0, cl_hash = 0, ct_hash = 0;
+  if (!ce_hash) {
+    ce_hash = fio_siphash("content-encoding", 16);
+    cl_hash = fio_siphash("content-length", 14);
+    ct_hash = fio_siphash("content-type", 12);
+  }
+  if (len < HTTP_COMPRESS_MIN_SIZE || h->status_str || h->status < 200 ||
+      h->status == 204 || h->status == 206 || h->status == 304 ||
+      !http2protocol(h)->settings->compress ||
+      http2protocol(h)->settings->is_client)
+    return FIOBJ_INVALID;
+  /* the application might have encoded the data (or set it's length) */
+  if (fiobj_hash_get2(h->private_data.out_headers, ce_hash) ||
+      fiobj_hash_get2(h->private_data.out_headers, cl_hash) ||
+      !http_compress_mime(fiobj_obj2cstr(
+          fiobj_hash_get2(h->private_data.out_headers, ct_hash))))
+    return FIOBJ_INVALID;
+  /* the response depends on the `accept-encoding` header */
+  http_set_header(h, HTTP_HEADER_VARY, fiobj_dup(HTTP_HVALUE_ACCEPT_ENCODING));
+  http_compress_e encoding = http_compress_negotiate(h);
+  if (!encoding)
+    return FIOBJ_INVALID;
+  FIOBJ out = http_compress(encoding, data, len, 0);
+  if (out)
+    http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
+                    fiobj_dup(http_compress_name(encoding)));
+  return out;
+}
@@ -52,6 +52,8 @@ void http_on_request_handler______internal(http_s *h,
       return;
     }
   }
+  if (settings->router && !http_router_dispatch(settings->router, h))
+    return;
   settings->on_request(h);
   return;
 
@@ -103,6 +105,129 @@ int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings) {
   return ret;
 }
 
+/* *****************************************************************************
+Well-known header names
+***************************************************************************** */
+
+#ifndef HTTP_HEADER_NAMES_INDEX
+/** The size of the well-known header name index (must be a power of 2). */
+#define HTTP_HEADER_NAMES_INDEX 256
+#endif
+
+/* well-known request header names, reusing the library's constants if any */
+static struct {
+  const char *name;
+  size_t len;
+  FIOBJ *constant;
+  FIOBJ str;
+} http_header_names[] = {
+#define HTTP_HNAME(n, c) {.name = n, .len = sizeof(n) - 1, .constant = c}
+    HTTP_HNAME("accept", &HTTP_HEADER_ACCEPT),
+    HTTP_HNAME("accept-charset", NULL),
+    HTTP_HNAME("accept-encoding", NULL),
+    HTTP_HNAME("accept-language", NULL),
+    HTTP_HNAME("authorization", NULL),
+    HTTP_HNAME("cache-control", &HTTP_HEADER_CACHE_CONTROL),
+    HTTP_HNAME("connection", &HTTP_HEADER_CONNECTION),
+    HTTP_HNAME("content-encoding", &HTTP_HEADER_CONTENT_ENCODING),
+    HTTP_HNAME("content-length", &HTTP_HEADER_CONTENT_LENGTH),
+    HTTP_HNAME("content-type", &HTTP_HEADER_CONTENT_TYPE),
+    HTTP_HNAME("cookie", &HTTP_HEADER_COOKIE),
+    HTTP_HNAME("dnt", NULL),
+    HTTP_HNAME("expect", NULL),
+    HTTP_HNAME("forwarded", NULL),
+    HTTP_HNAME("host", &HTTP_HEADER_HOST),
+    HTTP_HNAME("if-match", NULL),
+    HTTP_HNAME("if-modified-since", NULL),
+    HTTP_HNAME("if-none-match", NULL),
+    HTTP_HNAME("if-range", NULL),
+    HTTP_HNAME("if-unmodified-since", NULL),
+    HTTP_HNAME("keep-alive", NULL),
+    HTTP_HNAME("origin", &HTTP_HEADER_ORIGIN),
+    HTTP_HNAME("pragma", NULL),
+    HTTP_HNAME("range", NULL),
+    HTTP_HNAME("referer", NULL),
+    HTTP_HNAME("sec-fetch-dest", NULL),
+    HTTP_HNAME("sec-fetch-mode", NULL),
+    HTTP_HNAME("sec-fetch-site", NULL),
+    HTTP_HNAME("sec-fetch-user", NULL),
+    HTTP_HNAME("sec-websocket-extensions", &HTTP_HEADER_WS_SEC_EXTENSIONS),
+    HTTP_HNAME("sec-websocket-key", &HTTP_HEADER_WS_SEC_CLIENT_KEY),
+    HTTP_HNAME("sec-websocket-protocol", NULL),
+    HTTP_HNAME("sec-websocket-version", &HTTP_HVALUE_WS_SEC_VERSION),
+    HTTP_HNAME("te", NULL),
+    HTTP_HNAME("transfer-encoding", &HTTP_HEADER_TRANSFER_ENCODING),
+    HTTP_HNAME("upgrade", &HTTP_HEADER_UPGRADE),
+    HTTP_HNAME("upgrade-insecure-requests", NULL),
+    HTTP_HNAME("user-agent", NULL),
+    HTTP_HNAME("via", NULL),
+    HTTP_HNAME("x-forwarded-for", NULL),
+    HTTP_HNAME("x-forwarded-host", NULL),
+    HTTP_HNAME("x-forwarded-proto", NULL),
+    HTTP_HNAME("x-real-ip", NULL),
+    HTTP_HNAME("x-requested-with", NULL),
+#undef HTTP_HNAME
+};
+
+/* open addressing index, each slot holds an `http_header_names` offset + 1 */
+static uint8_t http_header_names_index[HTTP_HEADER_NAMES_INDEX];
+
+static inline size_t http_header_names_bucket(const char *name, size_t len) {
+  return ((len * 31) ^ ((uint8_t)name[0] << 3) ^ (uint8_t)name[len >> 1] ^
+          ((uint8_t)name[len - 1] << 1));
+}
+
+static void http_header_names_init(void) {
+  for (size_t i = 0;
+       i < sizeof(http_header_names) / sizeof(http_header_names[0]); ++i) {
+    if (http_header_names[i].constant)
+      http_header_names[i].str = fiobj_dup(*http_header_names[i].constant);
+    else
+      http_header_names[i].str =
+          fiobj_str_new(http_header_names[i].name, http_header_names[i].len);
+    /* pre-compute the hash and freeze the shared String */
+    fiobj_obj2hash(http_header_names[i].str);
+    fiobj_str_freeze(http_header_names[i].str);
+    size_t pos = http_header_names_bucket(http_header_names[i].name,
+                                          http_header_names[i].len);
+    while (http_header_names_index[pos & (HTTP_HEADER_NAMES_INDEX - 1)])
+      ++pos;
+    http_header_names_index[pos & (HTTP_HEADER_NAMES_INDEX - 1)] = i + 1;
+  }
+}
+
+static void http_header_names_clear(void) {
+  memset(http_header_names_index, 0, sizeof(http_header_names_index));
+  for (size_t i = 0;
+       i < sizeof(http_header_names) / sizeof(http_header_names[0]); ++i) {
+    fiobj_free(http_header_names[i].str);
+    http_header_names[i].str = FIOBJ_INVALID;
+  }
+}
+
+/**
+ * Returns a String for the (lower case) header `name`.
+ *
+ * Well-known header names share a single frozen String with a pre-computed
+ * hash value, avoiding both the allocation and the hashing.
+ *
+ * Remember to `fiobj_free`.
+ */
+FIOBJ http_header_name(const char *name, size_t len) {
+  if (len) {
+    size_t pos = http_header_names_bucket(name, len);
+    uint8_t i;
+    while ((i = http_header_names_index[pos & (HTTP_HEADER_NAMES_INDEX - 1)])) {
+      --i;
+      if (http_header_names[i].len == len &&
+          !memcmp(http_header_names[i].name, name, len))
+        return fiobj_dup(http_header_names[i].str);
+      ++pos;
+    }
+  }
+  return fiobj_str_new(name, len);
+}
+
 /* *****************************************************************************
 Library initialization
 ***************************************************************************** */
@@ -122,10 +247,16 @@ FIOBJ HTTP_HEADER_HOST;
 FIOBJ HTTP_HEADER_LAST_MODIFIED;
 FIOBJ HTTP_HEADER_ORIGIN;
 FIOBJ HTTP_HEADER_SET_COOKIE;
+FIOBJ HTTP_HEADER_TRANSFER_ENCODING;
 FIOBJ HTTP_HEADER_UPGRADE;
+FIOBJ HTTP_HEADER_VARY;
 FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 FIOBJ HTTP_HEADER_WS_SEC_KEY;
+FIOBJ HTTP_HEADER_WS_SEC_EXTENSIONS;
+FIOBJ HTTP_HVALUE_ACCEPT_ENCODING;
+FIOBJ HTTP_HVALUE_BROTLI;
 FIOBJ HTTP_HVALUE_BYTES;
+FIOBJ HTTP_HVALUE_CHUNKED;
 FIOBJ HTTP_HVALUE_CLOSE;
 FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
 FIOBJ HTTP_HVALUE_GZIP;
@@ -139,6 +270,9 @@ FIOBJ HTTP_HVALUE_WS_VERSION;
 FIOBJ HTTP_HVALUE_SSE_MIME;
 
 void http_lib_cleanup(void) {
+  http_log_cleanup();
+  http_static_cache_clear();
+  http_header_names_clear();
   http_mimetype_clear();
 #define HTTPLIB_RESET(x)                                                       \
   fiobj_free(x);                                                               \
@@ -159,10 +293,16 @@ void http_lib_cleanup(void) {
   HTTPLIB_RESET(HTTP_HEADER_LAST_MODIFIED);
   HTTPLIB_RESET(HTTP_HEADER_ORIGIN);
   HTTPLIB_RESET(HTTP_HEADER_SET_COOKIE);
+  HTTPLIB_RESET(HTTP_HEADER_TRANSFER_ENCODING);
   HTTPLIB_RESET(HTTP_HEADER_UPGRADE);
+  HTTPLIB_RESET(HTTP_HEADER_VARY);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_KEY);
+  HTTPLIB_RESET(HTTP_HEADER_WS_SEC_EXTENSIONS);
+  HTTPLIB_RESET(HTTP_HVALUE_ACCEPT_ENCODING);
+  HTTPLIB_RESET(HTTP_HVALUE_BROTLI);
   HTTPLIB_RESET(HTTP_HVALUE_BYTES);
+  HTTPLIB_RESET(HTTP_HVALUE_CHUNKED);
   HTTPLIB_RESET(HTTP_HVALUE_CLOSE);
   HTTPLIB_RESET(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
   HTTPLIB_RESET(HTTP_HVALUE_GZIP);
@@ -195,10 +335,16 @@ void http_lib_init(void) {
   HTTP_HEADER_LAST_MODIFIED = fiobj_str_new("last-modified", 13);
   HTTP_HEADER_ORIGIN = fiobj_str_new("origin", 6);
   HTTP_HEADER_SET_COOKIE = fiobj_str_new("set-cookie", 10);
+  HTTP_HEADER_TRANSFER_ENCODING = fiobj_str_new("transfer-encoding", 17);
   HTTP_HEADER_UPGRADE = fiobj_str_new("upgrade", 7);
+  HTTP_HEADER_VARY = fiobj_str_new("vary", 4);
   HTTP_HEADER_WS_SEC_CLIENT_KEY = fiobj_str_new("sec-websocket-key", 17);
   HTTP_HEADER_WS_SEC_KEY = fiobj_str_new("sec-websocket-accept", 20);
+  HTTP_HEADER_WS_SEC_EXTENSIONS = fiobj_str_new("sec-websocket-extensions", 24);
+  HTTP_HVALUE_ACCEPT_ENCODING = fiobj_str_new("accept-encoding", 15);
+  HTTP_HVALUE_BROTLI = fiobj_str_new("br", 2);
   HTTP_HVALUE_BYTES = fiobj_str_new("bytes", 5);
+  HTTP_HVALUE_CHUNKED = fiobj_str_new("chunked", 7);
   HTTP_HVALUE_CLOSE = fiobj_str_new("close", 5);
   HTTP_HVALUE_CONTENT_TYPE_DEFAULT =
       fiobj_str_new("application/octet-stream", 24);
@@ -226,10 +372,16 @@ void http_lib_init(void) {
   fiobj_obj2hash(HTTP_HEADER_LAST_MODIFIED);
   fiobj_obj2hash(HTTP_HEADER_ORIGIN);
   fiobj_obj2hash(HTTP_HEADER_SET_COOKIE);
+  fiobj_obj2hash(HTTP_HEADER_TRANSFER_ENCODING);
   fiobj_obj2hash(HTTP_HEADER_UPGRADE);
+  fiobj_obj2hash(HTTP_HEADER_VARY);
   fiobj_obj2hash(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   fiobj_obj2hash(HTTP_HEADER_WS_SEC_KEY);
+  fiobj_obj2hash(HTTP_HEADER_WS_SEC_EXTENSIONS);
+  fiobj_obj2hash(HTTP_HVALUE_ACCEPT_ENCODING);
+  fiobj_obj2hash(HTTP_HVALUE_BROTLI);
   fiobj_obj2hash(HTTP_HVALUE_BYTES);
+  fiobj_obj2hash(HTTP_HVALUE_CHUNKED);
   fiobj_obj2hash(HTTP_HVALUE_CLOSE);
   fiobj_obj2hash(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
   fiobj_obj2hash(HTTP_HVALUE_GZIP);
@@ -242,6 +394,8 @@ void http_lib_init(void) {
   fiobj_obj2hash(HTTP_HVALUE_WS_UPGRADE);
   fiobj_obj2hash(HTTP_HVALUE_WS_VERSION);
 
+  http_header_names_init();
+
 #define REGISTER_MIME(ext, type)                                               \
   http_mimetype_register(ext, sizeof(ext) - 1,                                 \
                          fiobj_str_new(type, sizeof(type) - 1))
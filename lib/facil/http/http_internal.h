@@ -30,8 +30,12 @@ struct http_vtable_s {
   /** Should send existing headers and file */
   int (*const http_sendfile)(http_s *h, int fd, uintptr_t length,
                              uintptr_t offset);
-  /** Should send existing headers and data and prepare for streaming */
-  int (*const http_stream)(http_s *h, void *data, uintptr_t length);
+  /** Should send existing headers and prepare for streaming */
+  int (*const http_stream_start)(http_s *h, http_stream_args_s *args);
+  /** Should send a chunk of a streamed response body */
+  int (*const http_stream_write)(http_s *h, void *data, uintptr_t length);
+  /** Should complete a streamed response */
+  void (*const http_stream_end)(http_s *h);
   /** Should send existing headers or complete streaming */
   void (*const http_finish)(http_s *h);
   /** Push for data. */
@@ -46,6 +50,10 @@ struct http_vtable_s {
 
   /** Resumes a request / response handling. */
   void (*http_on_resume)(http_s *, http_protocol_s *);
+  /** Stops reading a streamed request body. */
+  void (*http_body_pause)(http_s *h);
+  /** Resumes reading a streamed request body (thread safe). */
+  void (*http_body_resume)(http_s *h);
   /** hijacks the socket aaway from the protocol. */
   intptr_t (*http_hijack)(http_s *h, fio_cstr_s *leftover);
 
@@ -72,7 +80,12 @@ Constants that shouldn't be accessed by the users (`fiobj_dup` required).
 extern FIOBJ HTTP_HEADER_ACCEPT_RANGES;
 extern FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 extern FIOBJ HTTP_HEADER_WS_SEC_KEY;
+extern FIOBJ HTTP_HEADER_WS_SEC_EXTENSIONS;
+extern FIOBJ HTTP_HEADER_VARY;
+extern FIOBJ HTTP_HVALUE_ACCEPT_ENCODING;
+extern FIOBJ HTTP_HVALUE_BROTLI;
 extern FIOBJ HTTP_HVALUE_BYTES;
+extern FIOBJ HTTP_HVALUE_CHUNKED;
 extern FIOBJ HTTP_HVALUE_CLOSE;
 extern FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
 extern FIOBJ HTTP_HVALUE_GZIP;
@@ -146,6 +159,79 @@ void http_on_response_handler______internal(http_s *h,
                                             http_settings_s *settings);
 int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings);
 
+/** Stops the access log's writer thread, writing any pending log lines. */
+void http_log_cleanup(void);
+
+/* *****************************************************************************
+Routing (see `http_router.c`)
+***************************************************************************** */
+
+/**
+ * Compiles the route table into a trie (called by `http_listen`). Routes can't
+ * be added once the table was compiled.
+ */
+void http_router_compile(http_router_s *router);
+
+/**
+ * Routes the request to the matching route's handler.
+ *
+ * Returns -1 if no route matched the request's path (the request wasn't
+ * handled) and 0 otherwise (a 405 error is sent when only the method didn't
+ * match).
+ */
+int http_router_dispatch(http_router_s *router, http_s *h);
+
+#if DEBUG
+void http_router_test(void);
+void websocket_tests(void);
+#endif
+
+/* *****************************************************************************
+Response compression (see `http_compress.c`)
+***************************************************************************** */
+
+typedef enum {
+  HTTP_COMPRESS_NONE = 0,
+  HTTP_COMPRESS_GZIP,
+  HTTP_COMPRESS_BROTLI,
+  HTTP_COMPRESS_COUNT,
+} http_compress_e;
+
+/**
+ * Selects the best encoding the client accepts (see `accept-encoding`),
+ * preferring brotli. Only the encodings compiled in are considered.
+ */
+http_compress_e http_compress_negotiate(http_s *h);
+
+/**
+ * Selects the best encoding the client accepts out of the `encodings` bit mask
+ * (`1 << encoding`), i.e., when a pre-compressed file is available.
+ */
+http_compress_e http_compress_negotiate2(http_s *h, uint8_t encodings);
+
+/** Tests if a response with the `mime` type is worth compressing. */
+int http_compress_mime(fio_cstr_s mime);
+
+/** Returns the `content-encoding` header value for the encoding. */
+FIOBJ http_compress_name(http_compress_e encoding);
+
+/**
+ * Compresses the data, returning a new String, or FIOBJ_INVALID if the data
+ * couldn't be compressed (or the result wasn't any smaller).
+ *
+ * Set `best` for data that will be cached (a slower, stronger setting).
+ */
+FIOBJ http_compress(http_compress_e encoding, const void *data, size_t len,
+                    uint8_t best);
+
+/**
+ * Compresses a dynamic response body if the settings, the client and the
+ * response allow it, setting the `content-encoding` and `vary` headers.
+ *
+ * Returns the compressed body (or FIOBJ_INVALID).
+ */
+FIOBJ http_compress_response(http_s *h, const void *data, size_t len);
+
 /* *****************************************************************************
 EventSource Support (SSE)
 ***************************************************************************** */
@@ -194,6 +280,12 @@ Helpers
   if (!x)                                                                      \
     perror("FATAL ERROR: (http)" m), exit(errno);
 
+/**
+ * Returns a String for the (lower case) header `name`, reusing a shared String
+ * for well-known header names. Remember to `fiobj_free`.
+ */
+FIOBJ http_header_name(const char *name, size_t len);
+
 /** sets an outgoing header only if it doesn't exist */
 static inline void set_header_if_missing(FIOBJ hash, FIOBJ name, FIOBJ value) {
   FIOBJ old = fiobj_hash_replace(hash, name, value);
@@ -0,0 +1,499 @@
+/*
+Copyright: Boaz Segev, 2016-2018
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "http_internal.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* *****************************************************************************
+The access log pipeline
+
+Every worker thread writes compact binary log records to it's own (single
+producer, single consumer) ring buffer. A dedicated writer thread collects the
+records, formats them and writes them in large batches.
+
+The hot path (`http_write_log`) performs no formatting, no allocations and no
+locking (unless the thread's ring buffer is full).
+***************************************************************************** */
+
+#ifndef HTTP_LOG_RING_SIZE
+/** Each thread's ring buffer size, in bytes (must be a power of 2). */
+#define HTTP_LOG_RING_SIZE ((size_t)1 << 18)
+#endif
+
+#ifndef HTTP_LOG_MAX_STRING
+/** Longer method / path / version strings are truncated in the log. */
+#define HTTP_LOG_MAX_STRING 2048
+#endif
+
+#ifndef HTTP_LOG_BUFFER_SIZE
+/** The writer's output buffer size (the largest batch written at once). */
+#define HTTP_LOG_BUFFER_SIZE ((size_t)1 << 16)
+#endif
+
+#ifndef HTTP_LOG_IDLE_SLEEP
+/** The writer's polling interval (in milliseconds) when there's nothing new. */
+#define HTTP_LOG_IDLE_SLEEP 10
+#endif
+
+#ifndef HTTP_LOG_ROTATE_KEEP
+/** The number of rotated log files kept (`name.1` ... `name.N`). */
+#define HTTP_LOG_ROTATE_KEEP 5
+#endif
+
+/* the longest possible formatted log line */
+#define HTTP_LOG_MAX_LINE ((HTTP_LOG_MAX_STRING * 3) + 256)
+
+/* a log record, followed by the method, path and version strings */
+typedef struct {
+  uint32_t len; /* the record's length (0 == skip to the ring's end) */
+  uint16_t status;
+  uint16_t family; /* AF_INET, AF_INET6 or 0 (unknown) */
+  uint16_t method_len;
+  uint16_t path_len;
+  uint16_t version_len;
+  uint16_t reserved;
+  intptr_t bytes_sent;
+  struct timespec start;
+  struct timespec end;
+  uint8_t addr[16];
+} http_log_record_s;
+
+typedef struct http_log_ring_s {
+  struct http_log_ring_s *next;
+  /* the owner thread exited, the ring is freed once drained */
+  volatile uint8_t orphan;
+  /* the producer's position (next write) */
+  size_t head __attribute__((aligned(64)));
+  /* the consumer's position (next read) */
+  size_t tail __attribute__((aligned(64)));
+  uint8_t buf[HTTP_LOG_RING_SIZE] __attribute__((aligned(64)));
+} http_log_ring_s;
+
+static struct {
+  /* protects the ring list, the output and the consumer side of the rings */
+  pthread_mutex_t lock;
+  http_log_ring_s *rings;
+  /* incremented after a `fork`, so threads register new rings */
+  size_t generation;
+  pthread_t writer;
+  char *filename;
+  size_t rotate_size;
+  int fd; /* -1 == stderr */
+  volatile uint8_t running;
+  volatile uint8_t stop;
+  volatile uint8_t reopen;
+  /* the date cache, used by the consumer */
+  time_t date_sec;
+  size_t date_len;
+  char date[48];
+} http_log = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+    .date_sec = -1,
+};
+
+static __thread http_log_ring_s *http_log_ring;
+static __thread size_t http_log_ring_generation;
+static pthread_key_t http_log_ring_key;
+
+/* *****************************************************************************
+Output (called with the lock held)
+***************************************************************************** */
+
+static void http_log_open_unsafe(void) {
+  int fd = open(http_log.filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                0644);
+  if (fd == -1) {
+    perror("ERROR: (http log) couldn't open the log file, using stderr");
+  } else if (http_log.fd != -1) {
+    /* the descriptor is reused, so worker processes share the new file */
+    dup2(fd, http_log.fd);
+    close(fd);
+  } else {
+    http_log.fd = fd;
+  }
+}
+
+static void http_log_rotate_unsafe(void) {
+  struct stat file, opened;
+  if (fstat(http_log.fd, &opened) ||
+      (size_t)opened.st_size < http_log.rotate_size)
+    return;
+  if (!stat(http_log.filename, &file) && file.st_ino == opened.st_ino &&
+      file.st_dev == opened.st_dev) {
+    /* rotate, unless another process already rotated the file */
+    const size_t len = strlen(http_log.filename);
+    char from[len + 24];
+    char to[len + 24];
+    for (size_t i = HTTP_LOG_ROTATE_KEEP; i > 1; --i) {
+      snprintf(from, sizeof(from), "%s.%zu", http_log.filename, i - 1);
+      snprintf(to, sizeof(to), "%s.%zu", http_log.filename, i);
+      rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", http_log.filename);
+    rename(http_log.filename, to);
+  }
+  http_log_open_unsafe();
+}
+
+static void http_log_output_unsafe(const char *data, size_t len) {
+  const int fd = (http_log.fd == -1 ? STDERR_FILENO : http_log.fd);
+  while (len) {
+    ssize_t written = write(fd, data, len);
+    if (written <= 0)
+      return; /* nowhere to log */
+    data += written;
+    len -= written;
+  }
+  if (http_log.rotate_size && http_log.fd != -1)
+    http_log_rotate_unsafe();
+}
+
+/* *****************************************************************************
+Formatting (called with the lock held)
+***************************************************************************** */
+
+static size_t http_log_format(char *dest, http_log_record_s *r) {
+  size_t len = 0;
+  if (r->family &&
+      inet_ntop(r->family, r->addr, dest, INET6_ADDRSTRLEN)) {
+    len = strlen(dest);
+  } else {
+    memcpy(dest, "[unknown]", 9);
+    len = 9;
+  }
+  memcpy(dest + len, " - - [", 6);
+  len += 6;
+  if (r->end.tv_sec != http_log.date_sec) {
+    http_log.date_sec = r->end.tv_sec;
+    http_log.date_len = http_time2str(http_log.date, r->end.tv_sec);
+  }
+  memcpy(dest + len, http_log.date, http_log.date_len);
+  len += http_log.date_len;
+  memcpy(dest + len, "] \"", 3);
+  len += 3;
+  const char *str = (char *)(r + 1);
+  memcpy(dest + len, str, r->method_len);
+  len += r->method_len;
+  str += r->method_len;
+  dest[len++] = ' ';
+  memcpy(dest + len, str, r->path_len);
+  len += r->path_len;
+  str += r->path_len;
+  dest[len++] = ' ';
+  memcpy(dest + len, str, r->version_len);
+  len += r->version_len;
+  memcpy(dest + len, "\" ", 2);
+  len += 2;
+  len += fio_ltoa(dest + len, r->status, 10);
+  if (r->bytes_sent > 0) {
+    dest[len++] = ' ';
+    len += fio_ltoa(dest + len, r->bytes_sent, 10);
+    memcpy(dest + len, "b ", 2);
+    len += 2;
+  } else {
+    memcpy(dest + len, " -- ", 4);
+    len += 4;
+  }
+  len += fio_ltoa(dest + len,
+                  ((r->end.tv_sec - r->start.tv_sec) * 1000) +
+                      ((r->end.tv_nsec - r->start.tv_nsec) / 1000000),
+                  10);
+  memcpy(dest + len, "ms\r\n", 4);
+  len += 4;
+  return len;
+}
+
+/* formats and writes all the pending records, returns the number of records. */
+static size_t http_log_drain_unsafe(char *out) {
+  size_t count = 0;
+  size_t len = 0;
+  if (http_log.reopen) {
+    http_log.reopen = 0;
+    if (http_log.filename)
+      http_log_open_unsafe();
+  }
+  http_log_ring_s **pos = &http_log.rings;
+  while (*pos) {
+    http_log_ring_s *ring = *pos;
+    const uint8_t orphan = ring->orphan;
+    const size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t tail = ring->tail;
+    while (tail != head) {
+      http_log_record_s *r =
+          (http_log_record_s *)(ring->buf + (tail & (HTTP_LOG_RING_SIZE - 1)));
+      if (!r->len) {
+        tail += HTTP_LOG_RING_SIZE - (tail & (HTTP_LOG_RING_SIZE - 1));
+        continue;
+      }
+      if (len + HTTP_LOG_MAX_LINE > HTTP_LOG_BUFFER_SIZE) {
+        http_log_output_unsafe(out, len);
+        len = 0;
+      }
+      len += http_log_format(out + len, r);
+      tail += r->len;
+      ++count;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    if (orphan) {
+      *pos = ring->next;
+      free(ring);
+      continue;
+    }
+    pos = &ring->next;
+  }
+  if (len)
+    http_log_output_unsafe(out, len);
+  return count;
+}
+
+/* *****************************************************************************
+The writer thread
+***************************************************************************** */
+
+static void *http_log_writer(void *ignr) {
+  char *out = malloc(HTTP_LOG_BUFFER_SIZE);
+  HTTP_ASSERT(out, "access log buffer allocation failed");
+  const struct timespec idle = {.tv_nsec = HTTP_LOG_IDLE_SLEEP * 1000000};
+  for (;;) {
+    pthread_mutex_lock(&http_log.lock);
+    size_t count = http_log_drain_unsafe(out);
+    pthread_mutex_unlock(&http_log.lock);
+    if (!count) {
+      if (http_log.stop)
+        break;
+      nanosleep(&idle, NULL);
+    }
+  }
+  free(out);
+  return ignr;
+}
+
+/* stops the writer thread, writing any pending records. */
+static void http_log_stop(void *ignr) {
+  if (http_log.running) {
+    http_log.stop = 1;
+    pthread_join(http_log.writer, NULL);
+    http_log.stop = 0;
+    http_log.running = 0;
+  }
+  (void)ignr;
+}
+
+/* *****************************************************************************
+Thread rings
+***************************************************************************** */
+
+/* called when a thread exits (the ring is freed by the consumer) */
+static void http_log_ring_release(void *ring) {
+  ((http_log_ring_s *)ring)->orphan = 1;
+}
+
+static http_log_ring_s *http_log_ring_new(void) {
+  http_log_ring_s *ring;
+  if (posix_memalign((void **)&ring, 64, sizeof(*ring)))
+    return NULL;
+  ring->orphan = 0;
+  ring->head = 0;
+  ring->tail = 0;
+  pthread_mutex_lock(&http_log.lock);
+  ring->next = http_log.rings;
+  http_log.rings = ring;
+  http_log_ring = ring;
+  http_log_ring_generation = http_log.generation;
+  if (!http_log.running &&
+      !pthread_create(&http_log.writer, NULL, http_log_writer, NULL))
+    http_log.running = 1;
+  pthread_mutex_unlock(&http_log.lock);
+  pthread_setspecific(http_log_ring_key, ring);
+  return ring;
+}
+
+static inline http_log_ring_s *http_log_ring_get(void) {
+  if (http_log_ring && http_log_ring_generation == http_log.generation &&
+      http_log.running)
+    return http_log_ring;
+  if (http_log_ring && http_log_ring_generation == http_log.generation) {
+    /* the writer was stopped, restart it */
+    pthread_mutex_lock(&http_log.lock);
+    if (!http_log.running &&
+        !pthread_create(&http_log.writer, NULL, http_log_writer, NULL))
+      http_log.running = 1;
+    pthread_mutex_unlock(&http_log.lock);
+    return http_log_ring;
+  }
+  return http_log_ring_new();
+}
+
+/* reserves room for a record, returns NULL if the ring is full. */
+static inline http_log_record_s *http_log_reserve(http_log_ring_s *ring,
+                                                  size_t len) {
+  size_t head = ring->head;
+  const size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  const size_t offset = head & (HTTP_LOG_RING_SIZE - 1);
+  const size_t skip =
+      (offset + len > HTTP_LOG_RING_SIZE) ? (HTTP_LOG_RING_SIZE - offset) : 0;
+  if (head + skip + len - tail > HTTP_LOG_RING_SIZE)
+    return NULL;
+  if (skip) {
+    ((http_log_record_s *)(ring->buf + offset))->len = 0;
+    head += skip;
+    /* publish the skip marker, the record itself is published later */
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+  }
+  return (http_log_record_s *)(ring->buf + (head & (HTTP_LOG_RING_SIZE - 1)));
+}
+
+/* *****************************************************************************
+Library management
+***************************************************************************** */
+
+static void http_log_fork_prepare(void) { pthread_mutex_lock(&http_log.lock); }
+static void http_log_fork_parent(void) { pthread_mutex_unlock(&http_log.lock); }
+static void http_log_fork_child(void) {
+  /* the writer thread and the other threads don't exist in the child */
+  pthread_mutex_init(&http_log.lock, NULL);
+  while (http_log.rings) {
+    http_log_ring_s *ring = http_log.rings;
+    http_log.rings = ring->next;
+    free(ring);
+  }
+  http_log_ring = NULL;
+  pthread_setspecific(http_log_ring_key, NULL);
+  ++http_log.generation;
+  http_log.running = 0;
+  http_log.stop = 0;
+}
+
+static void __attribute__((constructor)) http_log_initialize(void) {
+  pthread_key_create(&http_log_ring_key, http_log_ring_release);
+  pthread_atfork(http_log_fork_prepare, http_log_fork_parent,
+                 http_log_fork_child);
+  facil_core_callback_add(FIO_CALL_ON_FINISH, http_log_stop, NULL);
+}
+
+/** Stops the writer thread (called by `http_lib_cleanup`). */
+void http_log_cleanup(void) {
+  http_log_stop(NULL);
+  pthread_mutex_lock(&http_log.lock);
+  free(http_log.filename);
+  http_log.filename = NULL;
+  if (http_log.fd != -1)
+    close(http_log.fd);
+  http_log.fd = -1;
+  pthread_mutex_unlock(&http_log.lock);
+}
+
+/* *****************************************************************************
+Public API
+***************************************************************************** */
+
+/**
+ * Sets the access log's destination (see `http_write_log`).
+ */
+int http_log_open(const char *filename, size_t rotate_size) {
+  int fd = -1;
+  char *name = NULL;
+  if (filename) {
+    fd = open(filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+      return -1;
+    name = strdup(filename);
+    HTTP_ASSERT(name, "access log allocation failed");
+  }
+  pthread_mutex_lock(&http_log.lock);
+  if (http_log.fd != -1)
+    close(http_log.fd);
+  free(http_log.filename);
+  http_log.fd = fd;
+  http_log.filename = name;
+  http_log.rotate_size = rotate_size;
+  pthread_mutex_unlock(&http_log.lock);
+  return 0;
+}
+
+/** Reopens the access log file (i.e., after it was moved by `logrotate`). */
+void http_log_reopen(void) { http_log.reopen = 1; }
+
+/** Writes any pending access log lines before returning. */
+void http_log_flush(void) {
+  char *out = malloc(HTTP_LOG_BUFFER_SIZE);
+  HTTP_ASSERT(out, "access log buffer allocation failed");
+  pthread_mutex_lock(&http_log.lock);
+  http_log_drain_unsafe(out);
+  pthread_mutex_unlock(&http_log.lock);
+  free(out);
+}
+
+/**
+ * Logs the request / response object.
+ *
+ * The log record is written to a thread local buffer, to be formatted and
+ * written by the access log's writer thread.
+ */
+void http_write_log(http_s *h) {
+  http_log_record_s rec = {
+      .status = h->status,
+      .start = h->received_at,
+      .bytes_sent = fiobj_obj2num(
+          fiobj_hash_get2(h->private_data.out_headers,
+                          fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH))),
+  };
+  clock_gettime(CLOCK_REALTIME, &rec.end);
+
+  // TODO Guess IP address from headers (forwarded) where possible
+  sock_peer_addr_s addrinfo =
+      sock_peer_addr(((http_protocol_s *)h->private_data.flag)->uuid);
+  if (addrinfo.addrlen && addrinfo.addr->sa_family == AF_INET) {
+    rec.family = AF_INET;
+    memcpy(rec.addr, &((struct sockaddr_in *)addrinfo.addr)->sin_addr, 4);
+  } else if (addrinfo.addrlen && addrinfo.addr->sa_family == AF_INET6) {
+    rec.family = AF_INET6;
+    memcpy(rec.addr, &((struct sockaddr_in6 *)addrinfo.addr)->sin6_addr, 16);
+  }
+
+  fio_cstr_s method = fiobj_obj2cstr(h->method);
+  fio_cstr_s path = fiobj_obj2cstr(h->path);
+  fio_cstr_s version = fiobj_obj2cstr(h->version);
+  if (method.len > HTTP_LOG_MAX_STRING)
+    method.len = HTTP_LOG_MAX_STRING;
+  if (path.len > HTTP_LOG_MAX_STRING)
+    path.len = HTTP_LOG_MAX_STRING;
+  if (version.len > HTTP_LOG_MAX_STRING)
+    version.len = HTTP_LOG_MAX_STRING;
+  rec.method_len = method.len;
+  rec.path_len = path.len;
+  rec.version_len = version.len;
+  rec.len = (sizeof(rec) + method.len + path.len + version.len + 7) & (~7UL);
+
+  http_log_ring_s *ring = http_log_ring_get();
+  if (!ring)
+    return;
+  http_log_record_s *r;
+  while (!(r = http_log_reserve(ring, rec.len))) {
+    /* the ring is full, drain it ourselves */
+    http_log_flush();
+  }
+  *r = rec;
+  char *str = (char *)(r + 1);
+  memcpy(str, method.data, method.len);
+  str += method.len;
+  memcpy(str, path.data, path.len);
+  str += path.len;
+  memcpy(str, version.data, version.len);
+  __atomic_store_n(&ring->head, ring->head + rec.len, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,637 @@
+/*
+Copyright: Boaz Segev, 2016-2018
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include "http_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* *****************************************************************************
+The route table
+
+Routes are collected by `http_route` and compiled into a radix trie (a single
+array of nodes) once the server starts listening (see `http_router_compile`).
+
+Route paths are normalized into keys, where every `:param` segment is replaced
+by the HTTP_ROUTE_PARAM byte and a wildcard is replaced by the
+HTTP_ROUTE_WILDCARD byte. The parameter names are kept aside, since different
+routes might use different names for the same trie node.
+
+All the strings (paths, keys and names) are kept in a single byte pool and
+referenced by offset, so the pool can grow while routes are added.
+***************************************************************************** */
+
+#define HTTP_ROUTE_PARAM ((char)1)
+#define HTTP_ROUTE_WILDCARD ((char)2)
+
+typedef struct {
+  uint32_t pos; /* offset in the byte pool */
+  uint32_t len;
+} http_route_str_s;
+
+typedef struct {
+  void (*handler)(http_s *h);
+  void *udata;
+  http_route_str_s key;
+  /* the index of the route's first parameter name (in the `names` array) */
+  uint32_t names;
+  uint16_t name_count;
+  uint16_t methods;
+} http_route_s;
+
+typedef struct {
+  /* the static bytes matched by the node */
+  http_route_str_s prefix;
+  /* static children are stored together, sorted by their first byte */
+  uint32_t children;
+  uint32_t child_count;
+  /* a `:param` child (0 == none, the root is never a child) */
+  uint32_t param;
+  /* the routes (one per method mask) ending at this node */
+  uint32_t routes;
+  uint32_t route_count;
+  /* the wildcard routes starting at this node */
+  uint32_t wildcard;
+  uint32_t wildcard_count;
+} http_route_node_s;
+
+struct http_router_s {
+  char *pool;
+  http_route_s *routes;
+  http_route_str_s *names;
+  http_route_node_s *nodes;
+  size_t pool_len, pool_capa;
+  size_t count, capa;
+  size_t name_count, name_capa;
+  size_t node_count, node_capa;
+  uint8_t compiled;
+};
+
+/** The result of a route lookup. */
+typedef struct {
+  http_route_s *route;
+  /* the methods allowed for the path (when the method didn't match) */
+  uint16_t allowed;
+  uint16_t count;
+  fio_cstr_s values[HTTP_ROUTE_MAX_PARAMS];
+} http_route_match_s;
+
+/* grows an array so it can hold `count` members. */
+static void *http_router_reserve(void *ptr, size_t *capa, size_t count,
+                                 size_t size) {
+  if (count <= *capa)
+    return ptr;
+  while (*capa < count)
+    *capa = (*capa ? (*capa << 1) : 16);
+  ptr = realloc(ptr, *capa * size);
+  HTTP_ASSERT(ptr, "route table allocation failed");
+  return ptr;
+}
+
+static inline const char *http_route_key(http_router_s *r, size_t i) {
+  return r->pool + r->routes[i].key.pos;
+}
+
+/* *****************************************************************************
+Adding routes
+***************************************************************************** */
+
+/** Creates a new (empty) route table. */
+http_router_s *http_router_new(void) {
+  http_router_s *r = calloc(1, sizeof(*r));
+  HTTP_ASSERT(r, "route table allocation failed");
+  return r;
+}
+
+/** Frees the route table. */
+void http_router_free(http_router_s *r) {
+  if (!r)
+    return;
+  free(r->pool);
+  free(r->routes);
+  free(r->names);
+  free(r->nodes);
+  free(r);
+}
+
+#undef http_route
+/** Adds a route to the route table. */
+int http_route(http_router_s *r, http_route_args_s args) {
+  if (!r || r->compiled || !args.path || !args.handler)
+    return -1;
+  const size_t len = args.path_len ? args.path_len : strlen(args.path);
+  if (!len || args.path[0] != '/' || len > (UINT32_MAX >> 2))
+    return -1;
+  uint16_t methods = args.methods ? args.methods : HTTP_METHOD_ANY;
+  if (methods & HTTP_METHOD_GET)
+    methods |= HTTP_METHOD_HEAD;
+  /* copy the path (the names refer to it) and write the key after it */
+  const size_t path_pos = r->pool_len;
+  const size_t first_name = r->name_count;
+  r->pool =
+      http_router_reserve(r->pool, &r->pool_capa, path_pos + (len * 2), 1);
+  memcpy(r->pool + path_pos, args.path, len);
+  const char *path = r->pool + path_pos;
+  const size_t key_pos = path_pos + len;
+  size_t key_len = 0;
+  for (size_t i = 0; i < len;) {
+    const char c = path[i];
+    if ((uint8_t)c < 32 || c == 127)
+      goto error;
+    if ((c == ':' || c == '*') && path[i - 1] == '/') {
+      size_t end = i + 1;
+      while (end < len && path[end] != '/')
+        ++end;
+      if ((c == ':' && end == i + 1) || (c == '*' && end != len) ||
+          r->name_count - first_name >= HTTP_ROUTE_MAX_PARAMS)
+        goto error;
+      r->names = http_router_reserve(r->names, &r->name_capa,
+                                     r->name_count + 1, sizeof(*r->names));
+      /* an unnamed wildcard is named "*" */
+      r->names[r->name_count++] =
+          (end == i + 1) ? (http_route_str_s){(uint32_t)(path_pos + i), 1}
+                         : (http_route_str_s){(uint32_t)(path_pos + i + 1),
+                                              (uint32_t)(end - i - 1)};
+      r->pool[key_pos + key_len++] =
+          (c == ':') ? HTTP_ROUTE_PARAM : HTTP_ROUTE_WILDCARD;
+      i = end;
+      continue;
+    }
+    r->pool[key_pos + key_len++] = c;
+    ++i;
+  }
+  /* routes can't overlap (same path and method) */
+  for (size_t i = 0; i < r->count; ++i) {
+    if (r->routes[i].key.len == key_len && (r->routes[i].methods & methods) &&
+        !memcmp(http_route_key(r, i), r->pool + key_pos, key_len))
+      goto error;
+  }
+  r->routes = http_router_reserve(r->routes, &r->capa, r->count + 1,
+                                  sizeof(*r->routes));
+  r->routes[r->count++] = (http_route_s){
+      .handler = args.handler,
+      .udata = args.udata,
+      .key = {.pos = (uint32_t)key_pos, .len = (uint32_t)key_len},
+      .names = (uint32_t)first_name,
+      .name_count = (uint16_t)(r->name_count - first_name),
+      .methods = methods,
+  };
+  r->pool_len = key_pos + key_len;
+  return 0;
+error:
+  r->name_count = first_name;
+  return -1;
+}
+
+/* *****************************************************************************
+Compiling the route table
+***************************************************************************** */
+
+static int http_route_cmp(http_router_s *r, http_route_s *a, http_route_s *b) {
+  const size_t len = a->key.len < b->key.len ? a->key.len : b->key.len;
+  int ret = memcmp(r->pool + a->key.pos, r->pool + b->key.pos, len);
+  if (ret)
+    return ret;
+  return (a->key.len > b->key.len) - (a->key.len < b->key.len);
+}
+
+/* allocates `count` (zeroed) nodes, returning the first node's index. */
+static uint32_t http_router_node_new(http_router_s *r, size_t count) {
+  r->nodes = http_router_reserve(r->nodes, &r->node_capa,
+                                 r->node_count + count, sizeof(*r->nodes));
+  memset(r->nodes + r->node_count, 0, count * sizeof(*r->nodes));
+  r->node_count += count;
+  return (uint32_t)(r->node_count - count);
+}
+
+/*
+ * Builds the node for the (sorted) routes `lo` to `hi`, where the first
+ * `depth` bytes of every route's key were already matched.
+ *
+ * Nodes are referenced by index, since the array might grow.
+ */
+static void http_router_build(http_router_s *r, uint32_t node, uint32_t lo,
+                              uint32_t hi, size_t depth) {
+  uint32_t i = lo;
+  /* shorter keys are sorted first */
+  while (i < hi && r->routes[i].key.len == depth)
+    ++i;
+  r->nodes[node].routes = lo;
+  r->nodes[node].route_count = i - lo;
+  /* static children are allocated together */
+  uint32_t count = 0;
+  for (uint32_t j = i; j < hi;) {
+    const char c = http_route_key(r, j)[depth];
+    if (c != HTTP_ROUTE_PARAM && c != HTTP_ROUTE_WILDCARD)
+      ++count;
+    while (j < hi && http_route_key(r, j)[depth] == c)
+      ++j;
+  }
+  uint32_t child = http_router_node_new(r, count);
+  r->nodes[node].children = child;
+  r->nodes[node].child_count = count;
+  while (i < hi) {
+    const char c = http_route_key(r, i)[depth];
+    uint32_t end = i + 1;
+    while (end < hi && http_route_key(r, end)[depth] == c)
+      ++end;
+    if (c == HTTP_ROUTE_WILDCARD) {
+      /* wildcards are always last, so these keys end here */
+      r->nodes[node].wildcard = i;
+      r->nodes[node].wildcard_count = end - i;
+    } else if (c == HTTP_ROUTE_PARAM) {
+      const uint32_t param = http_router_node_new(r, 1);
+      r->nodes[node].param = param;
+      http_router_build(r, param, i, end, depth + 1);
+    } else {
+      /* the group is sorted, so the first and last keys share the prefix */
+      const char *a = http_route_key(r, i);
+      const char *b = http_route_key(r, end - 1);
+      const size_t limit = r->routes[i].key.len < r->routes[end - 1].key.len
+                               ? r->routes[i].key.len
+                               : r->routes[end - 1].key.len;
+      size_t stop = depth + 1;
+      while (stop < limit && a[stop] == b[stop] &&
+             a[stop] != HTTP_ROUTE_PARAM && a[stop] != HTTP_ROUTE_WILDCARD)
+        ++stop;
+      r->nodes[child].prefix =
+          (http_route_str_s){.pos = (uint32_t)(r->routes[i].key.pos + depth),
+                             .len = (uint32_t)(stop - depth)};
+      http_router_build(r, child, i, end, stop);
+      ++child;
+    }
+    i = end;
+  }
+}
+
+/**
+ * Compiles the route table (called by `http_listen`). Routes can't be added
+ * once the table was compiled.
+ */
+void http_router_compile(http_router_s *r) {
+  if (!r || r->compiled)
+    return;
+  /* a stable sort, so the first route added wins (performed once) */
+  for (size_t i = 1; i < r->count; ++i) {
+    http_route_s tmp = r->routes[i];
+    size_t j = i;
+    while (j && http_route_cmp(r, r->routes + j - 1, &tmp) > 0) {
+      r->routes[j] = r->routes[j - 1];
+      --j;
+    }
+    r->routes[j] = tmp;
+  }
+  http_router_node_new(r, 1);
+  http_router_build(r, 0, 0, (uint32_t)r->count, 0);
+  r->compiled = 1;
+}
+
+/* *****************************************************************************
+Matching requests
+***************************************************************************** */
+
+/* selects a route by method, collecting the allowed methods otherwise. */
+static inline http_route_s *http_router_pick(http_router_s *r, uint32_t first,
+                                             uint32_t count, uint16_t method,
+                                             http_route_match_s *m) {
+  for (uint32_t i = first; i < first + count; ++i) {
+    if (r->routes[i].methods & method)
+      return r->routes + i;
+    m->allowed |= r->routes[i].methods;
+  }
+  return NULL;
+}
+
+/*
+ * Matches the path from `pos` onward. Static segments are preferred over
+ * parameters, which are preferred over wildcards.
+ *
+ * Returns 1 if a route was found (`m->route`).
+ */
+static int http_router_find(http_router_s *r, uint32_t node, const char *path,
+                            size_t len, size_t pos, uint16_t method,
+                            http_route_match_s *m) {
+  http_route_node_s *n = r->nodes + node;
+  if (pos == len) {
+    m->route = http_router_pick(r, n->routes, n->route_count, method, m);
+    if (m->route)
+      return 1;
+  } else {
+    const uint8_t c = (uint8_t)path[pos];
+    for (uint32_t i = n->children; i < n->children + n->child_count; ++i) {
+      const http_route_node_s *child = r->nodes + i;
+      const uint8_t first = (uint8_t)r->pool[child->prefix.pos];
+      if (first < c)
+        continue;
+      if (first == c && child->prefix.len <= len - pos &&
+          !memcmp(r->pool + child->prefix.pos, path + pos,
+                  child->prefix.len) &&
+          http_router_find(r, i, path, len, pos + child->prefix.len, method,
+                           m))
+        return 1;
+      break;
+    }
+    if (n->param && m->count < HTTP_ROUTE_MAX_PARAMS) {
+      const char *end = memchr(path + pos, '/', len - pos);
+      const size_t value_len = end ? (size_t)(end - (path + pos)) : len - pos;
+      if (value_len) {
+        m->values[m->count++] =
+            (fio_cstr_s){.data = (char *)path + pos, .len = value_len};
+        if (http_router_find(r, n->param, path, len, pos + value_len, method,
+                             m))
+          return 1;
+        --m->count;
+      }
+    }
+  }
+  if (n->wildcard_count && m->count < HTTP_ROUTE_MAX_PARAMS) {
+    m->route = http_router_pick(r, n->wildcard, n->wildcard_count, method, m);
+    if (m->route) {
+      m->values[m->count++] =
+          (fio_cstr_s){.data = (char *)path + pos, .len = len - pos};
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static uint16_t http_router_method(FIOBJ method) {
+  fio_cstr_s s = fiobj_obj2cstr(method);
+  switch (s.len) {
+  case 3:
+    if (!strncasecmp("get", s.data, 3))
+      return HTTP_METHOD_GET;
+    if (!strncasecmp("put", s.data, 3))
+      return HTTP_METHOD_PUT;
+    break;
+  case 4:
+    if (!strncasecmp("head", s.data, 4))
+      return HTTP_METHOD_HEAD;
+    if (!strncasecmp("post", s.data, 4))
+      return HTTP_METHOD_POST;
+    break;
+  case 5:
+    if (!strncasecmp("patch", s.data, 5))
+      return HTTP_METHOD_PATCH;
+    break;
+  case 6:
+    if (!strncasecmp("delete", s.data, 6))
+      return HTTP_METHOD_DELETE;
+    break;
+  case 7:
+    if (!strncasecmp("options", s.data, 7))
+      return HTTP_METHOD_OPTIONS;
+    break;
+  }
+  return HTTP_METHOD_OTHER;
+}
+
+/* the route being handled by the current thread (see `http_route_param`) */
+static __thread struct {
+  http_s *h;
+  http_router_s *router;
+  http_route_match_s match;
+} http_route_current;
+
+/* sends a 405 response, listing the allowed methods. */
+static void http_router_not_allowed(http_s *h, uint16_t allowed) {
+  static const struct {
+    uint16_t flag;
+    const char *name;
+  } methods[] = {
+      {HTTP_METHOD_GET, "GET"},     {HTTP_METHOD_HEAD, "HEAD"},
+      {HTTP_METHOD_POST, "POST"},   {HTTP_METHOD_PUT, "PUT"},
+      {HTTP_METHOD_DELETE, "DELETE"}, {HTTP_METHOD_PATCH, "PATCH"},
+      {HTTP_METHOD_OPTIONS, "OPTIONS"}, {0, NULL},
+  };
+  FIOBJ allow = fiobj_str_buf(48);
+  for (size_t i = 0; methods[i].name; ++i) {
+    if (!(allowed & methods[i].flag))
+      continue;
+    if (fiobj_obj2cstr(allow).len)
+      fiobj_str_write(allow, ", ", 2);
+    fiobj_str_write(allow, methods[i].name, strlen(methods[i].name));
+  }
+  http_set_header2(h, (fio_cstr_s){.data = "allow", .len = 5},
+                   fiobj_obj2cstr(allow));
+  fiobj_free(allow);
+  http_send_error(h, 405);
+}
+
+/**
+ * Routes the request to the matching route's handler.
+ *
+ * Returns -1 if no route matched the request's path (the request wasn't
+ * handled) and 0 otherwise (a 405 error is sent when only the method didn't
+ * match).
+ */
+int http_router_dispatch(http_router_s *r, http_s *h) {
+  if (!r->compiled)
+    return -1;
+  fio_cstr_s path = fiobj_obj2cstr(h->path);
+  http_route_match_s *m = &http_route_current.match;
+  m->route = NULL;
+  m->allowed = 0;
+  m->count = 0;
+  if (!path.len || !http_router_find(r, 0, path.data, path.len, 0,
+                                     http_router_method(h->method), m)) {
+    if (!m->allowed)
+      return -1;
+    http_router_not_allowed(h, m->allowed);
+    return 0;
+  }
+  http_s *const old_h = http_route_current.h;
+  http_router_s *const old_router = http_route_current.router;
+  http_route_current.h = h;
+  http_route_current.router = r;
+  if (m->route->udata)
+    h->udata = m->route->udata;
+  m->route->handler(h);
+  http_route_current.h = old_h;
+  http_route_current.router = old_router;
+  return 0;
+}
+
+/* *****************************************************************************
+Captured parameters
+***************************************************************************** */
+
+/** Returns a captured route parameter by name (see `http_route`). */
+fio_cstr_s http_route_param(http_s *h, const char *name, size_t name_len) {
+  if (!h || http_route_current.h != h || !name)
+    return (fio_cstr_s){.data = NULL};
+  http_router_s *r = http_route_current.router;
+  http_route_s *route = http_route_current.match.route;
+  for (size_t i = 0; i < route->name_count; ++i) {
+    http_route_str_s n = r->names[route->names + i];
+    if (n.len == name_len && !memcmp(r->pool + n.pos, name, name_len))
+      return http_route_current.match.values[i];
+  }
+  return (fio_cstr_s){.data = NULL};
+}
+
+/** Adds the captured route parameters to the `h->params` Hash. */
+int http_route_params(http_s *h) {
+  if (!h || http_route_current.h != h)
+    return -1;
+  http_router_s *r = http_route_current.router;
+  http_route_s *route = http_route_current.match.route;
+  if (!route->name_count)
+    return 0;
+  if (!h->params)
+    h->params = fiobj_hash_new();
+  for (size_t i = 0; i < route->name_count; ++i) {
+    http_route_str_s n = r->names[route->names + i];
+    fio_cstr_s v = http_route_current.match.values[i];
+    http_add2hash(h->params, r->pool + n.pos, n.len, v.data, v.len, 1);
+  }
+  return 0;
+}
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+#if DEBUG
+
+#define http_route(router, ...)                                                \
+  http_route((router), (http_route_args_s){__VA_ARGS__})
+
+static void http_router_test_handler(http_s *h) { (void)h; }
+static void http_router_test_handler2(http_s *h) { (void)h; }
+
+/* matches a path, returning the route's key (or NULL) */
+static http_route_s *http_router_test_find(http_router_s *r, uint16_t method,
+                                           const char *path,
+                                           http_route_match_s *m) {
+  *m = (http_route_match_s){.route = NULL};
+  if (!http_router_find(r, 0, path, strlen(path), 0, method, m))
+    return NULL;
+  return m->route;
+}
+
+void http_router_test(void) {
+#define TEST_ASSERT(cond, ...)                                                 \
+  if (!(cond)) {                                                               \
+    fprintf(stderr, "* " __VA_ARGS__);                                         \
+    fprintf(stderr, "Testing failed.\n");                                      \
+    exit(-1);                                                                  \
+  }
+  fprintf(stderr, "=== Testing HTTP route table\n");
+  http_router_s *r = http_router_new();
+  static const char *paths[] = {
+      "/",
+      "/users",
+      "/users/:id",
+      "/users/:id/posts",
+      "/users/:uid/posts/:post",
+      "/users/me",
+      "/user",
+      "/static/*",
+      "/files/*path",
+      "/about",
+      "/abc",
+      NULL,
+  };
+  for (size_t i = 0; paths[i]; ++i) {
+    TEST_ASSERT(!http_route(r, .path = paths[i],
+                            .handler = http_router_test_handler,
+                            .methods = HTTP_METHOD_GET),
+                "route %s couldn't be added\n", paths[i]);
+  }
+  TEST_ASSERT(!http_route(r, .path = "/users", .methods = HTTP_METHOD_POST,
+                          .handler = http_router_test_handler2),
+              "a route for a different method should be added\n");
+  TEST_ASSERT(http_route(r, .path = "/users/:name",
+                         .handler = http_router_test_handler2) == -1,
+              "overlapping routes should fail\n");
+  TEST_ASSERT(http_route(r, .path = "users",
+                         .handler = http_router_test_handler) == -1 &&
+                  http_route(r, .path = "/a/*/b",
+                             .handler = http_router_test_handler) == -1 &&
+                  http_route(r, .path = "/a/:/b",
+                             .handler = http_router_test_handler) == -1 &&
+                  http_route(r, .path = "/a",
+                             .handler = NULL) == -1,
+              "invalid routes should fail\n");
+  http_router_compile(r);
+  TEST_ASSERT(http_route(r, .path = "/late",
+                         .handler = http_router_test_handler) == -1,
+              "routes can't be added to a compiled table\n");
+
+  http_route_match_s m;
+  http_route_s *route;
+  struct {
+    const char *path;
+    const char *route;
+    const char *values[3];
+  } expected[] = {
+      {"/", "/", {NULL}},
+      {"/users", "/users", {NULL}},
+      {"/users/me", "/users/me", {NULL}},
+      {"/users/42", "/users/\x01", {"42"}},
+      {"/users/me/posts", "/users/\x01/posts", {"me"}},
+      {"/users/7/posts/9", "/users/\x01/posts/\x01", {"7", "9"}},
+      {"/user", "/user", {NULL}},
+      {"/static/", "/static/\x02", {""}},
+      {"/static/a/b.css", "/static/\x02", {"a/b.css"}},
+      {"/files/x", "/files/\x02", {"x"}},
+      {"/about", "/about", {NULL}},
+      {"/abc", "/abc", {NULL}},
+      {"/ab", NULL, {NULL}},
+      {"/users/", NULL, {NULL}},
+      {"/users/1/post", NULL, {NULL}},
+      {"/static", NULL, {NULL}},
+      {NULL, NULL, {NULL}},
+  };
+  for (size_t i = 0; expected[i].path; ++i) {
+    route = http_router_test_find(r, HTTP_METHOD_GET, expected[i].path, &m);
+    if (!expected[i].route) {
+      TEST_ASSERT(!route, "%s shouldn't match\n", expected[i].path);
+      continue;
+    }
+    TEST_ASSERT(route && route->key.len == strlen(expected[i].route) &&
+                    !memcmp(r->pool + route->key.pos, expected[i].route,
+                            route->key.len),
+                "%s matched the wrong route\n", expected[i].path);
+    for (size_t j = 0; j < 3; ++j) {
+      if (!expected[i].values[j]) {
+        TEST_ASSERT(m.count == j, "%s capture count error (%u != %zu)\n",
+                    expected[i].path, m.count, j);
+        break;
+      }
+      TEST_ASSERT(m.values[j].len == strlen(expected[i].values[j]) &&
+                      !memcmp(m.values[j].data, expected[i].values[j],
+                              m.values[j].len),
+                  "%s capture %zu error\n", expected[i].path, j);
+    }
+  }
+  /* parameter names belong to the matched route */
+  route = http_router_test_find(r, HTTP_METHOD_GET, "/users/7/posts/9", &m);
+  TEST_ASSERT(route->name_count == 2 &&
+                  r->names[route->names].len == 3 &&
+                  !memcmp(r->pool + r->names[route->names].pos, "uid", 3),
+              "parameter name error\n");
+  route = http_router_test_find(r, HTTP_METHOD_GET, "/static/x", &m);
+  TEST_ASSERT(route->name_count == 1 && r->names[route->names].len == 1 &&
+                  r->pool[r->names[route->names].pos] == '*',
+              "unnamed wildcards should be named \"*\"\n");
+  /* methods */
+  route = http_router_test_find(r, HTTP_METHOD_HEAD, "/users", &m);
+  TEST_ASSERT(route && route->handler == http_router_test_handler,
+              "GET routes should handle HEAD requests\n");
+  route = http_router_test_find(r, HTTP_METHOD_POST, "/users", &m);
+  TEST_ASSERT(route && route->handler == http_router_test_handler2,
+              "method routing error\n");
+  route = http_router_test_find(r, HTTP_METHOD_DELETE, "/users/1", &m);
+  TEST_ASSERT(!route && m.allowed == (HTTP_METHOD_GET | HTTP_METHOD_HEAD),
+              "allowed methods error (%u)\n", m.allowed);
+  http_router_free(r);
+  fprintf(stderr, "* route table passed.\n");
+#undef TEST_ASSERT
+}
+
+#endif
@@ -0,0 +1,807 @@
+/*
+copyright: Boaz Segev, 2018
+license: MIT
+
+Feel free to copy, use and enjoy according to the license specified.
+*/
+#ifndef H_HPACK_H
+/**\file
+
+A single file HPACK (RFC 7541) header compression implementation, decoupled
+from any IO layer.
+
+The decoder supports the full HPACK specification (static and dynamic tables,
+Huffman encoded strings and table size updates).
+
+The encoder is stateless - it never adds entries to the peer's dynamic table.
+Headers are encoded as literals without indexing, using the static table for
+header names whenever possible and Huffman encoding when it's shorter.
+*/
+#define H_HPACK_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if DEBUG
+#include <stdio.h>
+#endif
+
+#ifndef HPACK_TABLE_SIZE
+/**
+ * The maximum size of the decoder's dynamic table (in HPACK terms, where each
+ * entry costs its name and value lengths + 32 bytes).
+ *
+ * This is also the value the HTTP/2 layer should advertise using the
+ * SETTINGS_HEADER_TABLE_SIZE setting (the default is 4096).
+ */
+#define HPACK_TABLE_SIZE 4096
+#endif
+
+/* *****************************************************************************
+API
+***************************************************************************** */
+
+/** An HPACK dynamic table entry (the name and value are NUL terminated). */
+typedef struct {
+  size_t name_len;
+  size_t value_len;
+  char data[];
+} hpack_entry_s;
+
+/** The HPACK decoder's state (the dynamic table). */
+typedef struct {
+  hpack_entry_s *entries[(HPACK_TABLE_SIZE >> 5) + 1];
+  /** the position of the newest entry. */
+  size_t head;
+  /** the number of entries in the table. */
+  size_t count;
+  /** the current size of the table (in HPACK terms). */
+  size_t size;
+  /** the maximum table size, as set by the peer's table size updates. */
+  size_t max;
+} hpack_table_s;
+
+/** Initializes the decoder's dynamic table. */
+inline static __attribute__((unused)) void hpack_table_init(hpack_table_s *t);
+
+/** Frees any resources used by the decoder's dynamic table. */
+inline static __attribute__((unused)) void
+hpack_table_destroy(hpack_table_s *t);
+
+/**
+ * Decodes a complete HPACK header block, calling `on_header` for each header.
+ *
+ * The `name` and `value` pointers are only valid during the callback.
+ *
+ * If `on_header` returns a non-zero value, decoding stops and -1 is returned.
+ *
+ * Returns 0 on success and -1 on error (an HTTP/2 COMPRESSION_ERROR, unless
+ * the callback aborted the decoding).
+ */
+static __attribute__((unused)) int
+hpack_decode(hpack_table_s *t, const uint8_t *data, size_t len,
+             int (*on_header)(void *udata, char *name, size_t name_len,
+                              char *value, size_t value_len),
+             void *udata);
+
+/** The maximum number of bytes `hpack_encode_header` might write. */
+#define HPACK_ENCODED_MAX(name_len, value_len) ((name_len) + (value_len) + 12)
+
+/**
+ * Encodes a header (literal without indexing) into `dest`, which must be able
+ * to hold `HPACK_ENCODED_MAX(name_len, value_len)` bytes.
+ *
+ * Header names are expected to be lower case (as required by HTTP/2).
+ *
+ * Returns the number of bytes written.
+ */
+static __attribute__((unused)) size_t
+hpack_encode_header(uint8_t *dest, const char *name, size_t name_len,
+                    const char *value, size_t value_len);
+
+/**
+ * Encodes the `:status` pseudo header into `dest`, which must be able to hold
+ * at least 5 bytes.
+ *
+ * Returns the number of bytes written.
+ */
+static __attribute__((unused)) size_t hpack_encode_status(uint8_t *dest,
+                                                          size_t status);
+
+#if DEBUG
+/** Tests the HPACK implementation using the RFC 7541 examples. */
+static __attribute__((unused)) void hpack_test(void);
+#endif
+
+/* *****************************************************************************
+Static Table (RFC 7541, Appendix A)
+***************************************************************************** */
+
+typedef struct {
+  const char *name;
+  const char *value;
+  uint8_t name_len;
+  uint8_t value_len;
+} hpack_static_s;
+
+#define HPACK_STATIC(n, v) {n, v, sizeof(n) - 1, sizeof(v) - 1}
+static const hpack_static_s hpack_static_table[62] = {
+    {NULL, NULL, 0, 0},
+    HPACK_STATIC(":authority", ""),
+    HPACK_STATIC(":method", "GET"),
+    HPACK_STATIC(":method", "POST"),
+    HPACK_STATIC(":path", "/"),
+    HPACK_STATIC(":path", "/index.html"),
+    HPACK_STATIC(":scheme", "http"),
+    HPACK_STATIC(":scheme", "https"),
+    HPACK_STATIC(":status", "200"),
+    HPACK_STATIC(":status", "204"),
+    HPACK_STATIC(":status", "206"),
+    HPACK_STATIC(":status", "304"),
+    HPACK_STATIC(":status", "400"),
+    HPACK_STATIC(":status", "404"),
+    HPACK_STATIC(":status", "500"),
+    HPACK_STATIC("accept-charset", ""),
+    HPACK_STATIC("accept-encoding", "gzip, deflate"),
+    HPACK_STATIC("accept-language", ""),
+    HPACK_STATIC("accept-ranges", ""),
+    HPACK_STATIC("accept", ""),
+    HPACK_STATIC("access-control-allow-origin", ""),
+    HPACK_STATIC("age", ""),
+    HPACK_STATIC("allow", ""),
+    HPACK_STATIC("authorization", ""),
+    HPACK_STATIC("cache-control", ""),
+    HPACK_STATIC("content-disposition", ""),
+    HPACK_STATIC("content-encoding", ""),
+    HPACK_STATIC("content-language", ""),
+    HPACK_STATIC("content-length", ""),
+    HPACK_STATIC("content-location", ""),
+    HPACK_STATIC("content-range", ""),
+    HPACK_STATIC("content-type", ""),
+    HPACK_STATIC("cookie", ""),
+    HPACK_STATIC("date", ""),
+    HPACK_STATIC("etag", ""),
+    HPACK_STATIC("expect", ""),
+    HPACK_STATIC("expires", ""),
+    HPACK_STATIC("from", ""),
+    HPACK_STATIC("host", ""),
+    HPACK_STATIC("if-match", ""),
+    HPACK_STATIC("if-modified-since", ""),
+    HPACK_STATIC("if-none-match", ""),
+    HPACK_STATIC("if-range", ""),
+    HPACK_STATIC("if-unmodified-since", ""),
+    HPACK_STATIC("last-modified", ""),
+    HPACK_STATIC("link", ""),
+    HPACK_STATIC("location", ""),
+    HPACK_STATIC("max-forwards", ""),
+    HPACK_STATIC("proxy-authenticate", ""),
+    HPACK_STATIC("proxy-authorization", ""),
+    HPACK_STATIC("range", ""),
+    HPACK_STATIC("referer", ""),
+    HPACK_STATIC("refresh", ""),
+    HPACK_STATIC("retry-after", ""),
+    HPACK_STATIC("server", ""),
+    HPACK_STATIC("set-cookie", ""),
+    HPACK_STATIC("strict-transport-security", ""),
+    HPACK_STATIC("transfer-encoding", ""),
+    HPACK_STATIC("user-agent", ""),
+    HPACK_STATIC("vary", ""),
+    HPACK_STATIC("via", ""),
+    HPACK_STATIC("www-authenticate", ""),
+};
+#undef HPACK_STATIC
+
+/* *****************************************************************************
+Huffman Code (RFC 7541, Appendix B)
+
+The code is canonical, so decoding only requires the symbols sorted by code
+length and, per code length, the first code that's too long (the limit) and
+the offset of the symbols (the base).
+***************************************************************************** */
+
+static const uint32_t hpack_huffman_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5,
+    0xfffffe6, 0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9,
+    0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee,
+    0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9,
+    0xffffffa, 0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa,
+    0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa, 0x3fb,
+    0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b,
+    0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb,
+    0x7ffc, 0x20, 0xffb, 0x3fc, 0x1ffa, 0x21,
+    0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e,
+    0x6f, 0x70, 0x71, 0x72, 0xfc, 0x73,
+    0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5,
+    0x25, 0x26, 0x27, 0x6, 0x74, 0x75,
+    0x28, 0x29, 0x2a, 0x7, 0x2b, 0x76,
+    0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd,
+    0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8,
+    0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda,
+    0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1,
+    0x7fffe2, 0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5,
+    0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd,
+    0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf,
+    0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2,
+    0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2,
+    0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2,
+    0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde,
+    0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3,
+    0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3,
+    0x7ffffe4, 0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6,
+    0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb,
+    0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8,
+    0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed,
+    0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee, 0x3fffffff,
+};
+static const uint8_t hpack_huffman_bits[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+static const uint32_t hpack_huffman_limit[31] = {
+    0x0, 0x0, 0x0, 0x0, 0x0, 0xa,
+    0x2e, 0x7c, 0xfe, 0x1fc, 0x3fd, 0x7fd,
+    0xffc, 0x1ffe, 0x3ffe, 0x7fff, 0xfffe, 0x1fffc,
+    0x3fff8, 0x7fff3, 0xfffee, 0x1fffe9, 0x3fffec, 0x7ffff5,
+    0xfffff6, 0x1fffff0, 0x3ffffef, 0x7fffff1, 0xfffffff, 0x1ffffffe,
+    0x40000000,
+};
+static const int32_t hpack_huffman_base[31] = {
+    0, 0, 0, 0, 0, 0,
+    -10, -56, -180, 0, -942, -1963,
+    -4008, -8100, -16290, -32672, 0, 0,
+    0, -524177, -1048452, -2097010, -4194139, -8388423,
+    -16777020, -33554226, -67108642, -134217489, -268435202, 0,
+    -1073741567,
+};
+static const uint16_t hpack_huffman_syms[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46,
+    47, 51, 52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102,
+    103, 104, 108, 109, 110, 112, 114, 117, 58, 66, 67, 68, 69, 70,
+    71, 72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82, 83, 84,
+    85, 86, 87, 89, 106, 107, 113, 118, 119, 120, 121, 122, 38, 42,
+    44, 59, 88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+    0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92, 195, 208,
+    128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+    179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154,
+    156, 160, 163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190,
+    196, 198, 228, 232, 233, 1, 135, 137, 138, 139, 140, 141, 143, 147,
+    149, 150, 151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+    183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159, 171, 206,
+    215, 225, 236, 237, 199, 207, 234, 235, 192, 193, 200, 201, 202, 205,
+    210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211, 212, 214,
+    221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18,
+    19, 20, 21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+    249, 10, 13, 22, 256,
+};
+
+/* *****************************************************************************
+Integer and String Primitives (RFC 7541, section 5)
+***************************************************************************** */
+
+/* decodes an integer with an N bit prefix, returns -1 on error. */
+inline static int hpack_int_decode(const uint8_t **pos, const uint8_t *end,
+                                   uint8_t prefix, size_t *result) {
+  const size_t mask = ((size_t)1 << prefix) - 1;
+  if (*pos >= end)
+    return -1;
+  size_t i = (**pos) & mask;
+  ++(*pos);
+  if (i < mask) {
+    *result = i;
+    return 0;
+  }
+  uint8_t shift = 0;
+  uint8_t byte;
+  do {
+    if (*pos >= end || shift > 28)
+      return -1;
+    byte = **pos;
+    ++(*pos);
+    i += (size_t)(byte & 127) << shift;
+    shift += 7;
+  } while (byte & 128);
+  *result = i;
+  return 0;
+}
+
+/* encodes an integer with an N bit prefix, returns the number of bytes. */
+inline static size_t hpack_int_encode(uint8_t *dest, uint8_t flags,
+                                      uint8_t prefix, size_t i) {
+  const size_t mask = ((size_t)1 << prefix) - 1;
+  if (i < mask) {
+    dest[0] = flags | (uint8_t)i;
+    return 1;
+  }
+  dest[0] = flags | (uint8_t)mask;
+  i -= mask;
+  size_t pos = 1;
+  while (i >= 128) {
+    dest[pos++] = (uint8_t)((i & 127) | 128);
+    i >>= 7;
+  }
+  dest[pos++] = (uint8_t)i;
+  return pos;
+}
+
+/* returns the Huffman encoded length of a string. */
+inline static size_t hpack_huffman_len(const uint8_t *str, size_t len) {
+  size_t bits = 0;
+  for (size_t i = 0; i < len; ++i)
+    bits += hpack_huffman_bits[str[i]];
+  return (bits + 7) >> 3;
+}
+
+/* Huffman encodes a string (`dest` must hold `hpack_huffman_len` bytes). */
+inline static void hpack_huffman_encode(uint8_t *dest, const uint8_t *str,
+                                        size_t len) {
+  uint64_t acc = 0;
+  uint8_t bits = 0;
+  for (size_t i = 0; i < len; ++i) {
+    acc = (acc << hpack_huffman_bits[str[i]]) | hpack_huffman_codes[str[i]];
+    bits += hpack_huffman_bits[str[i]];
+    while (bits >= 8) {
+      bits -= 8;
+      *(dest++) = (uint8_t)(acc >> bits);
+    }
+  }
+  if (bits) /* pad using the EOS prefix (all ones) */
+    *dest = (uint8_t)((acc << (8 - bits)) | (0xFF >> bits));
+}
+
+/* Huffman decodes a string, returns the decoded length or -1 on error. */
+static int64_t hpack_huffman_decode(uint8_t *dest, size_t limit,
+                                    const uint8_t *str, size_t len) {
+  uint64_t acc = 0;
+  uint8_t bits = 0;
+  size_t pos = 0;
+  size_t written = 0;
+  for (;;) {
+    while (bits <= 56 && pos < len) {
+      acc |= (uint64_t)str[pos++] << (56 - bits);
+      bits += 8;
+    }
+    if (!bits)
+      break;
+    uint8_t code_len = 5;
+    uint32_t code = (uint32_t)(acc >> (64 - code_len));
+    while (code >= hpack_huffman_limit[code_len]) {
+      if (++code_len > 30)
+        return -1;
+      code = (uint32_t)(acc >> (64 - code_len));
+    }
+    if (code_len > bits) {
+      /* padding: less than 8 bits, all set (the EOS prefix) */
+      if (bits >= 8 || (acc >> (64 - bits)) != ((1ULL << bits) - 1))
+        return -1;
+      break;
+    }
+    const uint16_t sym =
+        hpack_huffman_syms[hpack_huffman_base[code_len] + (int32_t)code];
+    if (sym == 256 || written >= limit)
+      return -1; /* EOS is a decoding error */
+    dest[written++] = (uint8_t)sym;
+    acc <<= code_len;
+    bits -= code_len;
+  }
+  return (int64_t)written;
+}
+
+/* decodes a string literal, Huffman strings are decoded to `scratch`. */
+inline static int hpack_string_decode(const uint8_t **pos, const uint8_t *end,
+                                      uint8_t **scratch, uint8_t *scratch_end,
+                                      char **str, size_t *len) {
+  if (*pos >= end)
+    return -1;
+  const uint8_t huffman = (**pos) & 128;
+  size_t l;
+  if (hpack_int_decode(pos, end, 7, &l) || l > (size_t)(end - *pos))
+    return -1;
+  if (!huffman) {
+    *str = (char *)*pos;
+    *len = l;
+    *pos += l;
+    return 0;
+  }
+  int64_t decoded =
+      hpack_huffman_decode(*scratch, scratch_end - *scratch, *pos, l);
+  if (decoded < 0)
+    return -1;
+  *str = (char *)*scratch;
+  *len = (size_t)decoded;
+  *scratch += decoded;
+  *pos += l;
+  return 0;
+}
+
+/* encodes a string literal, using Huffman encoding when it's shorter. */
+inline static size_t hpack_string_encode(uint8_t *dest, const char *str,
+                                         size_t len) {
+  size_t huffman = hpack_huffman_len((const uint8_t *)str, len);
+  if (huffman < len) {
+    size_t pos = hpack_int_encode(dest, 128, 7, huffman);
+    hpack_huffman_encode(dest + pos, (const uint8_t *)str, len);
+    return pos + huffman;
+  }
+  size_t pos = hpack_int_encode(dest, 0, 7, len);
+  memcpy(dest + pos, str, len);
+  return pos + len;
+}
+
+/* *****************************************************************************
+Dynamic Table
+***************************************************************************** */
+
+#define HPACK_TABLE_CAPA                                                       \
+  (sizeof(((hpack_table_s *)0)->entries) / sizeof(void *))
+
+inline static void hpack_table_init(hpack_table_s *t) {
+  *t = (hpack_table_s){.max = HPACK_TABLE_SIZE};
+}
+
+/* removes the oldest entry */
+inline static void hpack_table_evict(hpack_table_s *t) {
+  const size_t oldest = (t->head + HPACK_TABLE_CAPA + 1 - t->count) %
+                        HPACK_TABLE_CAPA;
+  t->size -= t->entries[oldest]->name_len + t->entries[oldest]->value_len + 32;
+  free(t->entries[oldest]);
+  t->entries[oldest] = NULL;
+  --t->count;
+}
+
+inline static void hpack_table_destroy(hpack_table_s *t) {
+  while (t->count)
+    hpack_table_evict(t);
+}
+
+/* sets the maximum table size (evicting entries as required) */
+inline static void hpack_table_resize(hpack_table_s *t, size_t max) {
+  t->max = max;
+  while (t->count && t->size > t->max)
+    hpack_table_evict(t);
+}
+
+/* adds an entry to the table, returns -1 on allocation failure. */
+static int hpack_table_add(hpack_table_s *t, const char *name, size_t name_len,
+                           const char *value, size_t value_len) {
+  const size_t size = name_len + value_len + 32;
+  if (size > t->max) {
+    /* an entry larger than the table empties the table (not an error) */
+    while (t->count)
+      hpack_table_evict(t);
+    return 0;
+  }
+  /* copy first, the name might reference an entry we're about to evict */
+  hpack_entry_s *e = malloc(sizeof(*e) + name_len + value_len + 2);
+  if (!e)
+    return -1;
+  e->name_len = name_len;
+  e->value_len = value_len;
+  memcpy(e->data, name, name_len);
+  e->data[name_len] = 0;
+  memcpy(e->data + name_len + 1, value, value_len);
+  e->data[name_len + value_len + 1] = 0;
+  while (t->count && t->size + size > t->max)
+    hpack_table_evict(t);
+  t->head = (t->head + 1) % HPACK_TABLE_CAPA;
+  t->entries[t->head] = e;
+  ++t->count;
+  t->size += size;
+  return 0;
+}
+
+/* finds an entry (static or dynamic) by index, returns -1 on error. */
+inline static int hpack_table_get(hpack_table_s *t, size_t index, char **name,
+                                  size_t *name_len, char **value,
+                                  size_t *value_len) {
+  if (!index)
+    return -1;
+  if (index < 62) {
+    *name = (char *)hpack_static_table[index].name;
+    *name_len = hpack_static_table[index].name_len;
+    *value = (char *)hpack_static_table[index].value;
+    *value_len = hpack_static_table[index].value_len;
+    return 0;
+  }
+  index -= 62;
+  if (index >= t->count)
+    return -1;
+  hpack_entry_s *e =
+      t->entries[(t->head + HPACK_TABLE_CAPA - index) % HPACK_TABLE_CAPA];
+  *name = e->data;
+  *name_len = e->name_len;
+  *value = e->data + e->name_len + 1;
+  *value_len = e->value_len;
+  return 0;
+}
+
+/* *****************************************************************************
+Decoding
+***************************************************************************** */
+
+static int
+hpack_decode(hpack_table_s *t, const uint8_t *data, size_t len,
+             int (*on_header)(void *udata, char *name, size_t name_len,
+                              char *value, size_t value_len),
+             void *udata) {
+  const uint8_t *pos = data;
+  const uint8_t *end = data + len;
+  /* Huffman decoding can't expand a string by more than 8/5 */
+  const size_t scratch_len = len * 2 + 1;
+  uint8_t *const scratch_start = malloc(scratch_len);
+  if (!scratch_start)
+    return -1;
+  uint8_t *const scratch_end = scratch_start + scratch_len;
+  uint8_t allow_resize = 1;
+  while (pos < end) {
+    uint8_t *scratch = scratch_start;
+    char *name, *value;
+    size_t name_len, value_len, index;
+    const uint8_t type = *pos;
+    if ((type & 224) == 32) {
+      /* dynamic table size update - only allowed at the block's beginning */
+      if (!allow_resize || hpack_int_decode(&pos, end, 5, &index) ||
+          index > HPACK_TABLE_SIZE)
+        goto error;
+      hpack_table_resize(t, index);
+      continue;
+    }
+    allow_resize = 0;
+    if (type & 128) {
+      /* indexed header field */
+      if (hpack_int_decode(&pos, end, 7, &index) ||
+          hpack_table_get(t, index, &name, &name_len, &value, &value_len))
+        goto error;
+    } else {
+      /* literal header field (incremental indexing or without indexing) */
+      if (hpack_int_decode(&pos, end, ((type & 64) ? 6 : 4), &index))
+        goto error;
+      if (index) {
+        if (hpack_table_get(t, index, &name, &name_len, &value, &value_len))
+          goto error;
+      } else if (hpack_string_decode(&pos, end, &scratch, scratch_end, &name,
+                                     &name_len)) {
+        goto error;
+      }
+      if (hpack_string_decode(&pos, end, &scratch, scratch_end, &value,
+                              &value_len))
+        goto error;
+      if ((type & 64) &&
+          hpack_table_add(t, name, name_len, value, value_len))
+        goto error;
+    }
+    if (on_header(udata, name, name_len, value, value_len))
+      goto error;
+  }
+  free(scratch_start);
+  return 0;
+error:
+  free(scratch_start);
+  return -1;
+}
+
+/* *****************************************************************************
+Encoding
+***************************************************************************** */
+
+static size_t hpack_encode_header(uint8_t *dest, const char *name,
+                                  size_t name_len, const char *value,
+                                  size_t value_len) {
+  size_t pos;
+  size_t index = 15; /* regular header names start after the pseudo headers */
+  while (index < 62 && (hpack_static_table[index].name_len != name_len ||
+                        memcmp(hpack_static_table[index].name, name, name_len)))
+    ++index;
+  if (index < 62) {
+    pos = hpack_int_encode(dest, 0, 4, index);
+  } else {
+    dest[0] = 0;
+    pos = 1 + hpack_string_encode(dest + 1, name, name_len);
+  }
+  return pos + hpack_string_encode(dest + pos, value, value_len);
+}
+
+static size_t hpack_encode_status(uint8_t *dest, size_t status) {
+  switch (status) {
+  case 200:
+    dest[0] = 128 | 8;
+    return 1;
+  case 204:
+    dest[0] = 128 | 9;
+    return 1;
+  case 206:
+    dest[0] = 128 | 10;
+    return 1;
+  case 304:
+    dest[0] = 128 | 11;
+    return 1;
+  case 400:
+    dest[0] = 128 | 12;
+    return 1;
+  case 404:
+    dest[0] = 128 | 13;
+    return 1;
+  case 500:
+    dest[0] = 128 | 14;
+    return 1;
+  }
+  if (status < 100 || status > 999)
+    status = 500;
+  dest[0] = 8; /* literal without indexing, name index 8 (:status) */
+  dest[1] = 3;
+  dest[2] = '0' + (uint8_t)(status / 100);
+  dest[3] = '0' + (uint8_t)((status / 10) % 10);
+  dest[4] = '0' + (uint8_t)(status % 10);
+  return 5;
+}
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+
+#if DEBUG
+typedef struct {
+  char buf[512];
+  size_t len;
+} hpack_test_s;
+
+static int hpack_test_on_header(void *udata, char *name, size_t name_len,
+                                char *value, size_t value_len) {
+  hpack_test_s *t = udata;
+  if (t->len + name_len + value_len + 3 > sizeof(t->buf))
+    return -1;
+  memcpy(t->buf + t->len, name, name_len);
+  t->len += name_len;
+  t->buf[t->len++] = ':';
+  memcpy(t->buf + t->len, value, value_len);
+  t->len += value_len;
+  t->buf[t->len++] = '\n';
+  t->buf[t->len] = 0;
+  return 0;
+}
+
+static void hpack_test(void) {
+#define HPACK_TEST_ASSERT(cond, ...)                                           \
+  if (!(cond)) {                                                               \
+    fprintf(stderr, "* " __VA_ARGS__);                                         \
+    fprintf(stderr, "\n!!! Testing failed !!!\n");                             \
+    exit(-1);                                                                  \
+  }
+  struct {
+    const char *block;
+    size_t len;
+    const char *expected;
+    size_t table_size;
+  } examples[] = {
+      /* RFC 7541, C.4 - requests with Huffman coding */
+      {"\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a\x6b\xa0\xab\x90\xf4\xff",
+       17, ":method:GET\n:scheme:http\n:path:/\n:authority:www.example.com\n",
+       57},
+      {"\x82\x86\x84\xbe\x58\x86\xa8\xeb\x10\x64\x9c\xbf", 12,
+       ":method:GET\n:scheme:http\n:path:/\n:authority:www.example.com\n"
+       "cache-control:no-cache\n",
+       110},
+      {"\x82\x87\x85\xbf\x40\x88\x25\xa8\x49\xe9\x5b\xa9\x7d\x7f\x89\x25\xa8"
+       "\x49\xe9\x5b\xb8\xe8\xb4\xbf",
+       24,
+       ":method:GET\n:scheme:https\n:path:/index.html\n"
+       ":authority:www.example.com\ncustom-key:custom-value\n",
+       164},
+      /* RFC 7541, C.6 - responses with Huffman coding and a 256 byte table */
+      {"\x48\x82\x64\x02\x58\x85\xae\xc3\x77\x1a\x4b\x61\x96\xd0\x7a\xbe\x94"
+       "\x10\x54\xd4\x44\xa8\x20\x05\x95\x04\x0b\x81\x66\xe0\x82\xa6\x2d\x1b"
+       "\xff\x6e\x91\x9d\x29\xad\x17\x18\x63\xc7\x8f\x0b\x97\xc8\xe9\xae\x82"
+       "\xae\x43\xd3",
+       54,
+       ":status:302\ncache-control:private\n"
+       "date:Mon, 21 Oct 2013 20:13:21 GMT\n"
+       "location:https://www.example.com\n",
+       222},
+      {"\x48\x83\x64\x0e\xff\xc1\xc0\xbf", 8,
+       ":status:307\ncache-control:private\n"
+       "date:Mon, 21 Oct 2013 20:13:21 GMT\n"
+       "location:https://www.example.com\n",
+       222},
+      {"\x88\xc1\x61\x96\xd0\x7a\xbe\x94\x10\x54\xd4\x44\xa8\x20\x05\x95\x04"
+       "\x0b\x81\x66\xe0\x84\xa6\x2d\x1b\xff\xc0\x5a\x83\x9b\xd9\xab\x77\xad"
+       "\x94\xe7\x82\x1d\xd7\xf2\xe6\xc7\xb3\x35\xdf\xdf\xcd\x5b\x39\x60\xd5"
+       "\xaf\x27\x08\x7f\x36\x72\xc1\xab\x27\x0f\xb5\x29\x1f\x95\x87\x31\x60"
+       "\x65\xc0\x03\xed\x4e\xe5\xb1\x06\x3d\x50\x07",
+       79,
+       ":status:200\ncache-control:private\n"
+       "date:Mon, 21 Oct 2013 20:13:22 GMT\n"
+       "location:https://www.example.com\ncontent-encoding:gzip\n"
+       "set-cookie:foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n",
+       215},
+  };
+  fprintf(stderr, "=== Testing HPACK\n");
+  hpack_table_s table;
+  hpack_table_init(&table);
+  for (size_t i = 0; i < sizeof(examples) / sizeof(examples[0]); ++i) {
+    if (i == 3) {
+      hpack_table_destroy(&table);
+      hpack_table_init(&table);
+      table.max = 256;
+    }
+    hpack_test_s result = {.len = 0};
+    HPACK_TEST_ASSERT(!hpack_decode(&table, (uint8_t *)examples[i].block,
+                                    examples[i].len, hpack_test_on_header,
+                                    &result),
+                      "HPACK decoding error for example %zu", i);
+    HPACK_TEST_ASSERT(!strcmp(result.buf, examples[i].expected),
+                      "HPACK decoding mismatch for example %zu:\n%s", i,
+                      result.buf);
+    HPACK_TEST_ASSERT(table.size == examples[i].table_size,
+                      "HPACK table size error for example %zu (%zu != %zu)", i,
+                      table.size, examples[i].table_size);
+  }
+  hpack_table_destroy(&table);
+
+  /* round trip (stateless encoder) */
+  {
+    uint8_t buf[256];
+    size_t len = hpack_encode_status(buf, 200);
+    len += hpack_encode_status(buf + len, 418);
+    len += hpack_encode_header(buf + len, "content-type", 12,
+                               "text/html; charset=utf-8", 24);
+    len += hpack_encode_header(buf + len, "x-custom", 8, "\x01\xff", 2);
+    len += hpack_encode_header(buf + len, "content-length", 14, "1234567", 7);
+    hpack_test_s result = {.len = 0};
+    hpack_table_init(&table);
+    HPACK_TEST_ASSERT(
+        !hpack_decode(&table, buf, len, hpack_test_on_header, &result),
+        "HPACK round trip decoding error");
+    HPACK_TEST_ASSERT(!strcmp(result.buf,
+                              ":status:200\n:status:418\n"
+                              "content-type:text/html; charset=utf-8\n"
+                              "x-custom:\x01\xff\ncontent-length:1234567\n"),
+                      "HPACK round trip mismatch:\n%s", result.buf);
+    HPACK_TEST_ASSERT(!table.count,
+                      "HPACK encoder shouldn't update the dynamic table");
+    /* invalid input */
+    HPACK_TEST_ASSERT(
+        hpack_decode(&table, (uint8_t *)"\x80", 1, hpack_test_on_header,
+                     &result) == -1,
+        "HPACK index 0 should be an error");
+    HPACK_TEST_ASSERT(
+        hpack_decode(&table, (uint8_t *)"\xbf\x01", 2, hpack_test_on_header,
+                     &result) == -1,
+        "HPACK missing dynamic index should be an error");
+    HPACK_TEST_ASSERT(
+        hpack_decode(&table, (uint8_t *)"\x00\x81\x00\x00", 4,
+                     hpack_test_on_header, &result) == -1,
+        "HPACK invalid Huffman padding should be an error");
+    hpack_table_destroy(&table);
+  }
+  fprintf(stderr, "* HPACK tests passed.\n");
+#undef HPACK_TEST_ASSERT
+}
+#endif
+
+#undef HPACK_TABLE_CAPA
+#endif
@@ -122,6 +122,228 @@ inline static uint8_t seek2eol(uint8_t **pos, uint8_t *const limit) {
   return 1;
 }
 
+/* *****************************************************************************
+Scanning a header block for delimiters
+***************************************************************************** */
+
+/*
+ * The header block is scanned for line ends ('\n') and the first ':' of each
+ * line in a single pass, filling an index of up to HTTP1_PARSER_SCAN_LINES
+ * lines at a time. The index is then consumed by the header parsing loop.
+ *
+ * On x86_64 the scanner is selected at runtime (AVX2, SSE4.2 or the portable
+ * SWAR fallback, see `http1_parser_scanner_set`).
+ */
+
+#ifndef HTTP1_PARSER_SCAN_LINES
+/** The number of header lines indexed in each scanning pass. */
+#define HTTP1_PARSER_SCAN_LINES 64
+#endif
+
+#if !defined(HTTP1_PARSER_SIMD) && defined(__x86_64__) &&                      \
+    (defined(__GNUC__) || defined(__clang__))
+/** Set to 0 to disable the SSE4.2 / AVX2 scanners. */
+#define HTTP1_PARSER_SIMD 1
+#elif !defined(HTTP1_PARSER_SIMD)
+#define HTTP1_PARSER_SIMD 0
+#endif
+
+#if HTTP1_PARSER_SIMD
+#include <immintrin.h>
+#endif
+
+typedef struct {
+  uint8_t *colon; /* the first ':' in the line, or NULL */
+  uint8_t *eol;   /* the line's '\n' */
+} http1_line_s;
+
+typedef struct {
+  http1_line_s *lines;
+  uint8_t *line;  /* the start of the current line */
+  uint8_t *colon; /* the first ':' in the current line, or NULL */
+  size_t count;
+  size_t max;
+} http1_scan_s;
+
+/* marks a line's end, returns -1 when scanning should stop. */
+static inline int http1_scan_eol(http1_scan_s *s, uint8_t *pos) {
+  s->lines[s->count].colon = s->colon;
+  s->lines[s->count].eol = pos;
+  ++s->count;
+  /* stop after the empty line (end of headers) or when the index is full */
+  if (pos == s->line || (pos == s->line + 1 && *s->line == '\r') ||
+      s->count == s->max)
+    return -1;
+  s->line = pos + 1;
+  s->colon = NULL;
+  return 0;
+}
+
+/*
+ * marks the delimiters found in a block, `shift` converts the bitmaps' lowest
+ * set bit to a byte offset.
+ */
+static inline int http1_scan_maps(http1_scan_s *s, uint8_t *base, uint64_t eol,
+                                  uint64_t colon, const uint8_t shift) {
+  while (eol) {
+    const uint64_t bit = eol & (0 - eol);
+    if (!s->colon && (colon & (bit - 1)))
+      s->colon = base + (__builtin_ctzll(colon) >> shift);
+    if (http1_scan_eol(s, base + (__builtin_ctzll(eol) >> shift)))
+      return -1;
+    colon &= ~(bit | (bit - 1));
+    eol ^= bit;
+  }
+  if (!s->colon && colon)
+    s->colon = base + (__builtin_ctzll(colon) >> shift);
+  return 0;
+}
+
+/* scans the remaining bytes one by one. */
+static inline size_t http1_scan_tail(http1_scan_s *s, uint8_t *pos,
+                                     uint8_t *const stop) {
+  for (; pos < stop; ++pos) {
+    if (*pos == '\n') {
+      if (http1_scan_eol(s, pos))
+        break;
+    } else if (*pos == ':' && !s->colon) {
+      s->colon = pos;
+    }
+  }
+  return s->count;
+}
+
+/* the portable scanner, testing 8 bytes at a time when possible. */
+static size_t http1_scan_swar(uint8_t *pos, uint8_t *const stop,
+                              http1_line_s *lines, size_t max) {
+  http1_scan_s s = {.lines = lines, .line = pos, .max = max};
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const uint64_t wanted_eol = 0x0101010101010101ULL * '\n';
+  const uint64_t wanted_colon = 0x0101010101010101ULL * ':';
+  for (; pos + 8 <= stop; pos += 8) {
+    uint64_t tmp;
+    memcpy(&tmp, pos, 8);
+    const uint64_t eq1 = ~(tmp ^ wanted_eol);
+    const uint64_t eq2 = ~(tmp ^ wanted_colon);
+    const uint64_t eol =
+        ((eq1 & 0x7f7f7f7f7f7f7f7fULL) + 0x0101010101010101ULL) & eq1 &
+        0x8080808080808080ULL;
+    const uint64_t colon =
+        ((eq2 & 0x7f7f7f7f7f7f7f7fULL) + 0x0101010101010101ULL) & eq2 &
+        0x8080808080808080ULL;
+    if ((eol | colon) && http1_scan_maps(&s, pos, eol, colon, 3))
+      return s.count;
+  }
+#endif
+  return http1_scan_tail(&s, pos, stop);
+}
+
+#if HTTP1_PARSER_SIMD
+
+/* the SSE4.2 scanner, testing 16 bytes at a time. */
+__attribute__((target("sse4.2"))) static size_t
+http1_scan_sse42(uint8_t *pos, uint8_t *const stop, http1_line_s *lines,
+                 size_t max) {
+  http1_scan_s s = {.lines = lines, .line = pos, .max = max};
+  const __m128i wanted_eol = _mm_set1_epi8('\n');
+  const __m128i wanted_colon = _mm_set1_epi8(':');
+  for (; pos + 16 <= stop; pos += 16) {
+    const __m128i data = _mm_loadu_si128((const __m128i *)pos);
+    const uint64_t eol =
+        (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(data, wanted_eol));
+    const uint64_t colon =
+        (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(data, wanted_colon));
+    if ((eol | colon) && http1_scan_maps(&s, pos, eol, colon, 0))
+      return s.count;
+  }
+  return http1_scan_tail(&s, pos, stop);
+}
+
+/* the AVX2 scanner, testing 64 bytes at a time. */
+__attribute__((target("avx2"))) static size_t
+http1_scan_avx2(uint8_t *pos, uint8_t *const stop, http1_line_s *lines,
+                size_t max) {
+  http1_scan_s s = {.lines = lines, .line = pos, .max = max};
+  const __m256i wanted_eol = _mm256_set1_epi8('\n');
+  const __m256i wanted_colon = _mm256_set1_epi8(':');
+  for (; pos + 64 <= stop; pos += 64) {
+    const __m256i lo = _mm256_loadu_si256((const __m256i *)pos);
+    const __m256i hi = _mm256_loadu_si256((const __m256i *)(pos + 32));
+    const uint64_t eol =
+        (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, wanted_eol)) |
+        ((uint64_t)(uint32_t)_mm256_movemask_epi8(
+             _mm256_cmpeq_epi8(hi, wanted_eol))
+         << 32);
+    const uint64_t colon =
+        (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, wanted_colon)) |
+        ((uint64_t)(uint32_t)_mm256_movemask_epi8(
+             _mm256_cmpeq_epi8(hi, wanted_colon))
+         << 32);
+    if ((eol | colon) && http1_scan_maps(&s, pos, eol, colon, 0))
+      return s.count;
+  }
+  return http1_scan_tail(&s, pos, stop);
+}
+
+#endif
+
+static size_t http1_scan_auto(uint8_t *pos, uint8_t *const stop,
+                              http1_line_s *lines, size_t max);
+
+/* the active scanner (selected on first use). */
+static size_t (*http1_scan)(uint8_t *pos, uint8_t *const stop,
+                            http1_line_s *lines,
+                            size_t max) = http1_scan_auto;
+static http1_parser_scanner_e http1_scan_mode = HTTP1_SCANNER_AUTO;
+
+/**
+ * Selects the header block scanner, returning -1 if the scanner isn't
+ * supported by the CPU (or the build).
+ */
+int http1_parser_scanner_set(http1_parser_scanner_e scanner) {
+  switch (scanner) {
+  case HTTP1_SCANNER_AUTO:
+#if HTTP1_PARSER_SIMD
+    if (!http1_parser_scanner_set(HTTP1_SCANNER_AVX2) ||
+        !http1_parser_scanner_set(HTTP1_SCANNER_SSE42))
+      return 0;
+#endif
+    return http1_parser_scanner_set(HTTP1_SCANNER_SWAR);
+  case HTTP1_SCANNER_SWAR:
+    http1_scan = http1_scan_swar;
+    break;
+#if HTTP1_PARSER_SIMD
+  case HTTP1_SCANNER_SSE42:
+    if (!__builtin_cpu_supports("sse4.2"))
+      return -1;
+    http1_scan = http1_scan_sse42;
+    break;
+  case HTTP1_SCANNER_AVX2:
+    if (!__builtin_cpu_supports("avx2"))
+      return -1;
+    http1_scan = http1_scan_avx2;
+    break;
+#endif
+  default:
+    return -1;
+  }
+  http1_scan_mode = scanner;
+  return 0;
+}
+
+/** Returns the header block scanner in use. */
+http1_parser_scanner_e http1_parser_scanner_get(void) {
+  if (http1_scan_mode == HTTP1_SCANNER_AUTO)
+    http1_parser_scanner_set(HTTP1_SCANNER_AUTO);
+  return http1_scan_mode;
+}
+
+static size_t http1_scan_auto(uint8_t *pos, uint8_t *const stop,
+                              http1_line_s *lines, size_t max) {
+  http1_parser_scanner_set(HTTP1_SCANNER_AUTO);
+  return http1_scan(pos, stop, lines, max);
+}
+
 /* *****************************************************************************
 HTTP/1.1 parsre stages
 ***************************************************************************** */
@@ -206,16 +428,37 @@ start_version:
   return 0;
 }
 
-inline static int consume_header(struct http1_fio_parser_args_s *args,
-                                 uint8_t *start, uint8_t *end) {
-  uint8_t *end_name = start;
-  /* divide header name from data */
-  if (!seek2ch(&end_name, end, ':'))
-    return -1;
 #if HTTP_HEADERS_LOWERCASE
-  for (uint8_t *t = start; t < end_name; t++) {
-    *t = tolower(*t);
+/* converts ASCII to lowercase, 8 bytes at a time, writing only when required */
+inline static void http1_tolower(uint8_t *pos, uint8_t *const end) {
+  for (; pos + 8 <= end; pos += 8) {
+    uint64_t word;
+    memcpy(&word, pos, 8);
+    const uint64_t heptets = word & 0x7f7f7f7f7f7f7f7fULL;
+    const uint64_t above_z = heptets + 0x2525252525252525ULL; /* > 'Z' */
+    const uint64_t from_a = heptets + 0x3f3f3f3f3f3f3f3fULL;  /* >= 'A' */
+    const uint64_t upper =
+        (from_a ^ above_z) & ~word & 0x8080808080808080ULL;
+    if (upper) {
+      word |= upper >> 2;
+      memcpy(pos, &word, 8);
+    }
   }
+  for (; pos < end; ++pos) {
+    if ((uint8_t)(*pos - 'A') < 26)
+      *pos |= 32;
+  }
+}
+#endif
+
+inline static int consume_header(struct http1_fio_parser_args_s *args,
+                                 uint8_t *start, uint8_t *end_name,
+                                 uint8_t *end) {
+#if HTTP1_PARSER_CONVERT_EOL2NUL
+  *end_name = 0;
+#endif
+#if HTTP_HEADERS_LOWERCASE
+  http1_tolower(start, end_name);
 #endif
   uint8_t *start_value = end_name + 1;
   if (start_value[0] == ' ') {
@@ -248,7 +491,7 @@ inline static int consume_header(struct http1_fio_parser_args_s *args,
     args->parser->state.content_length = atol((char *)start_value);
   } else if ((end_name - start) == 17 &&
              HEADER_NAME_IS_EQ((char *)start, "transfer-encoding", 17) &&
-             memcmp(start_value, "chunked", 7)) {
+             !memcmp(start_value, "chunked", 7)) {
     /* handle the special `transfer-encoding: chunked` header */
     args->parser->state.reserved |= 64;
   } else if ((end_name - start) == 7 &&
@@ -274,16 +517,20 @@ inline static int consume_body_streamed(struct http1_fio_parser_args_s *args,
   uint8_t *end =
       *start + args->parser->state.content_length - args->parser->state.read;
   uint8_t *const stop = ((uint8_t *)args->buffer) + args->length;
+  int ret = 0;
   if (end > stop)
     end = stop;
   if (end > *start &&
-      args->on_body_chunk(args->parser, (char *)(*start), end - *start))
+      (ret = args->on_body_chunk(args->parser, (char *)(*start),
+                                 end - *start)) < 0)
     return -1;
   args->parser->state.read += (end - *start);
   *start = end;
-  if (args->parser->state.content_length <= args->parser->state.read)
+  if (args->parser->state.content_length <= args->parser->state.read) {
     args->parser->state.reserved |= 4;
-  return 0;
+    return 0;
+  }
+  return (ret > 0);
 }
 
 inline static int consume_body_chunked(struct http1_fio_parser_args_s *args,
@@ -323,16 +570,20 @@ inline static int consume_body_chunked(struct http1_fio_parser_args_s *args,
         return 0;
       }
     }
+    int ret = 0;
     end = *start + (0 - args->parser->state.content_length);
     if (end > stop)
       end = stop;
     if (end > *start &&
-        args->on_body_chunk(args->parser, (char *)(*start), end - *start)) {
+        (ret = args->on_body_chunk(args->parser, (char *)(*start),
+                                   end - *start)) < 0) {
       return -1;
     }
     args->parser->state.read += (end - *start);
     args->parser->state.content_length += (end - *start);
     *start = end;
+    if (ret > 0)
+      return 1;
   }
   return 0;
 }
@@ -406,16 +657,34 @@ re_eval:
   /* headers */
   case 1:
     do {
+      http1_line_s lines[HTTP1_PARSER_SCAN_LINES];
+      size_t count;
       if (start + 1 >= stop)
         return CONSUMED; /* buffer ended on header line */
       if (*start == '\r' || *start == '\n') {
         goto finished_headers; /* empty line, end of headers */
       }
-      if (!(eol_len = seek2eol(&end, stop)))
+      /* index the header block (or as much of it as possible) */
+      if (!(count = http1_scan(start, stop, lines, HTTP1_PARSER_SCAN_LINES)))
         return CONSUMED;
-      if (consume_header(args, start, end - eol_len + 1))
-        goto error;
-      end = start = end + 1;
+      for (size_t i = 0; i < count; ++i) {
+        if (i) {
+          if (start + 1 >= stop)
+            return CONSUMED;
+          if (*start == '\r' || *start == '\n')
+            goto finished_headers;
+        }
+        end = lines[i].eol;
+        eol_len = (end > start && end[-1] == '\r') ? 2 : 1;
+#if HTTP1_PARSER_CONVERT_EOL2NUL
+        end[0] = 0;
+        end[1 - eol_len] = 0;
+#endif
+        if (!lines[i].colon || lines[i].colon == start ||
+            consume_header(args, start, lines[i].colon, end - eol_len + 1))
+          goto error;
+        end = start = end + 1;
+      }
     } while ((args->parser->state.reserved & 2) == 0);
   finished_headers:
     ++start;
@@ -432,6 +701,8 @@ re_eval:
       goto error;
     case -2:
       goto re_eval;
+    case 1:
+      return CONSUMED; /* the body's consumer asked to stop */
     }
     break;
   }
@@ -87,7 +87,12 @@ struct http1_fio_parser_args_s {
   /** called when a header is parsed. */
   int (*const on_header)(http1_parser_s *parser, char *name, size_t name_len,
                          char *data, size_t data_len);
-  /** called when a body chunk is parsed. */
+  /**
+   * called when a body chunk is parsed.
+   *
+   * A positive return value stops the parsing once the chunk was consumed, so
+   * the rest of the data can be resubmitted later on (flow control).
+   */
   int (*const on_body_chunk)(http1_parser_s *parser, char *data,
                              size_t data_len);
   /** called when a protocol error occured. */
@@ -111,6 +116,31 @@ struct http1_fio_parser_args_s {
  */
 size_t http1_fio_parser_fn(struct http1_fio_parser_args_s *args);
 
+/**
+ * The header block scanners available to the parser.
+ *
+ * The parser indexes header lines (and their ':' separators) in a single pass.
+ * By default, the fastest scanner supported by the CPU is selected at runtime
+ * (AVX2, SSE4.2 or the portable SWAR fallback).
+ */
+typedef enum {
+  HTTP1_SCANNER_AUTO = 0,
+  HTTP1_SCANNER_SWAR,
+  HTTP1_SCANNER_SSE42,
+  HTTP1_SCANNER_AVX2,
+} http1_parser_scanner_e;
+
+/**
+ * Selects the header block scanner used by all parsers (mostly for testing and
+ * benchmarking).
+ *
+ * Returns -1 if the scanner isn't supported by the CPU (or the build).
+ */
+int http1_parser_scanner_set(http1_parser_scanner_e scanner);
+
+/** Returns the header block scanner in use. */
+http1_parser_scanner_e http1_parser_scanner_get(void);
+
 static inline __attribute__((unused)) size_t
 http1_fio_parser(struct http1_fio_parser_args_s args) {
   if (!args.length)
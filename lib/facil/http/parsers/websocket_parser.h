@@ -21,6 +21,18 @@ must be implemented by the including file (the callbacks).
 #if DEBUG
 #include <stdio.h>
 #endif
+
+#if !defined(WEBSOCKET_PARSER_SIMD) && defined(__x86_64__) &&                  \
+    (defined(__GNUC__) || defined(__clang__))
+/** Set to 0 to disable the SSE2 / AVX2 kernels. */
+#define WEBSOCKET_PARSER_SIMD 1
+#elif !defined(WEBSOCKET_PARSER_SIMD)
+#define WEBSOCKET_PARSER_SIMD 0
+#endif
+
+#if WEBSOCKET_PARSER_SIMD
+#include <immintrin.h>
+#endif
 /* *****************************************************************************
 API - Message Wrapping
 ***************************************************************************** */
@@ -127,6 +139,41 @@ inline static __attribute__((unused)) uint64_t
 websocket_consume(void *buffer, uint64_t len, void *udata,
                   uint8_t require_masking);
 
+/* *****************************************************************************
+API - Unmasking and UTF-8 validation kernels
+***************************************************************************** */
+
+/**
+ * The kernels available for masking / unmasking messages and for UTF-8
+ * validation.
+ *
+ * By default, the fastest kernels supported by the CPU are selected at runtime
+ * (AVX2, SSE2 or the portable 64 bit fallback).
+ */
+typedef enum {
+  WEBSOCKET_KERNEL_AUTO = 0,
+  WEBSOCKET_KERNEL_SWAR,
+  WEBSOCKET_KERNEL_SSE2,
+  WEBSOCKET_KERNEL_AVX2,
+} websocket_kernel_e;
+
+/**
+ * Selects the kernels used by `websocket_xmask` and `websocket_utf8_valid`
+ * (mostly for testing and benchmarking).
+ *
+ * Returns -1 if the kernel isn't supported by the CPU (or the build).
+ */
+inline static __attribute__((unused)) int
+websocket_kernel_set(websocket_kernel_e kernel);
+
+/** Returns the kernel in use. */
+inline static __attribute__((unused)) websocket_kernel_e
+websocket_kernel_get(void);
+
+/** Returns 1 if the data is valid UTF-8 and 0 if it isn't. */
+inline static __attribute__((unused)) int websocket_utf8_valid(void *data,
+                                                               uint64_t len);
+
 /* *****************************************************************************
 API - Internal Helpers
 ***************************************************************************** */
@@ -143,8 +190,9 @@ inline static void websocket_xmask(void *msg, uint64_t len, uint32_t mask);
 /* *****************************************************************************
 Message masking
 ***************************************************************************** */
-/** used internally to mask and unmask client messages. */
-void websocket_xmask(void *msg, uint64_t len, uint32_t mask) {
+
+/* the portable kernel, 8 bytes at a time (after aligning the memory). */
+static void websocket_xmask_swar(void *msg, uint64_t len, uint32_t mask) {
   if (len > 7) {
     { /* XOR any unaligned memory (4 byte alignment) */
       const uintptr_t offset = 4 - ((uintptr_t)msg & 3);
@@ -217,6 +265,398 @@ void websocket_xmask(void *msg, uint64_t len, uint32_t mask) {
   }
 }
 
+#if WEBSOCKET_PARSER_SIMD
+
+/* the SSE2 kernel, 16 bytes at a time. */
+__attribute__((target("sse2"))) static void
+websocket_xmask_sse2(void *msg, uint64_t len, uint32_t mask) {
+  const __m128i xmask = _mm_set1_epi32((int)mask);
+  uint8_t *pos = msg;
+  for (; len >= 16; len -= 16, pos += 16) {
+    const __m128i data = _mm_loadu_si128((const __m128i *)pos);
+    _mm_storeu_si128((__m128i *)pos, _mm_xor_si128(data, xmask));
+  }
+  /* we moved a multiple of 4 bytes, the mask's alignment didn't change */
+  websocket_xmask_swar(pos, len, mask);
+}
+
+/* the AVX2 kernel, 64 bytes at a time. */
+__attribute__((target("avx2"))) static void
+websocket_xmask_avx2(void *msg, uint64_t len, uint32_t mask) {
+  const __m256i xmask = _mm256_set1_epi32((int)mask);
+  uint8_t *pos = msg;
+  for (; len >= 64; len -= 64, pos += 64) {
+    const __m256i lo = _mm256_loadu_si256((const __m256i *)pos);
+    const __m256i hi = _mm256_loadu_si256((const __m256i *)(pos + 32));
+    _mm256_storeu_si256((__m256i *)pos, _mm256_xor_si256(lo, xmask));
+    _mm256_storeu_si256((__m256i *)(pos + 32), _mm256_xor_si256(hi, xmask));
+  }
+  if (len >= 32) {
+    const __m256i data = _mm256_loadu_si256((const __m256i *)pos);
+    _mm256_storeu_si256((__m256i *)pos, _mm256_xor_si256(data, xmask));
+    len -= 32;
+    pos += 32;
+  }
+  if (len >= 16) {
+    const __m128i data = _mm_loadu_si128((const __m128i *)pos);
+    _mm_storeu_si128((__m128i *)pos,
+                     _mm_xor_si128(data, _mm256_castsi256_si128(xmask)));
+    len -= 16;
+    pos += 16;
+  }
+  websocket_xmask_swar(pos, len, mask);
+}
+
+#endif
+
+/* *****************************************************************************
+UTF-8 validation
+
+The portable and SSE2 kernels skip ASCII data and validate any other data using
+a DFA. This part was practically copied from:
+https://stackoverflow.com/a/22135005/4025095
+and
+http://bjoern.hoehrmann.de/utf-8/decoder/dfa
+
+The AVX2 kernel validates all the data using the "lookup" algorithm described
+by John Keiser and Daniel Lemire in "Validating UTF-8 In Less Than One
+Instruction Per Byte" (2021).
+***************************************************************************** */
+/* Copyright (c) 2008-2009 Bjoern Hoehrmann <bjoern@hoehrmann.de> */
+/* See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details. */
+
+#define WEBSOCKET_UTF8_ACCEPT 0
+#define WEBSOCKET_UTF8_REJECT 1
+
+static const uint8_t websocket_utf8d[] = {
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0, // 00..1f
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0, // 20..3f
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0, // 40..5f
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0, // 60..7f
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+    1,   1,   1,   1,   1,   9,   9,   9,   9,   9,   9,
+    9,   9,   9,   9,   9,   9,   9,   9,   9,   9, // 80..9f
+    7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,
+    7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,
+    7,   7,   7,   7,   7,   7,   7,   7,   7,   7, // a0..bf
+    8,   8,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+    2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+    2,   2,   2,   2,   2,   2,   2,   2,   2,   2, // c0..df
+    0xa, 0x3, 0x3, 0x3, 0x3, 0x3, 0x3, 0x3, 0x3, 0x3, 0x3,
+    0x3, 0x3, 0x4, 0x3, 0x3, // e0..ef
+    0xb, 0x6, 0x6, 0x6, 0x5, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8,
+    0x8, 0x8, 0x8, 0x8, 0x8, // f0..ff
+    0x0, 0x1, 0x2, 0x3, 0x5, 0x8, 0x7, 0x1, 0x1, 0x1, 0x4,
+    0x6, 0x1, 0x1, 0x1, 0x1, // s0..s0
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+    1,   1,   1,   1,   1,   1,   0,   1,   1,   1,   1,
+    1,   0,   1,   0,   1,   1,   1,   1,   1,   1, // s1..s2
+    1,   2,   1,   1,   1,   1,   1,   2,   1,   2,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+    1,   2,   1,   1,   1,   1,   1,   1,   1,   1, // s3..s4
+    1,   2,   1,   1,   1,   1,   1,   1,   1,   2,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+    1,   3,   1,   3,   1,   1,   1,   1,   1,   1, // s5..s6
+    1,   3,   1,   1,   1,   1,   1,   3,   1,   3,   1,
+    1,   1,   1,   1,   1,   1,   3,   1,   1,   1,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   1, // s7..s8
+};
+
+/* advances the DFA by a single byte. */
+#define websocket_utf8_dfa(state, byte)                                        \
+  websocket_utf8d[256 + (state)*16 + websocket_utf8d[(byte)]]
+
+/* the portable kernel, skipping ASCII data 8 bytes at a time. */
+static int websocket_utf8_swar(uint8_t *str, uint64_t len) {
+  uint32_t state = WEBSOCKET_UTF8_ACCEPT;
+  for (uint64_t tmp; len >= 8; len -= 8, str += 8) {
+    memcpy(&tmp, str, 8);
+    if (state == WEBSOCKET_UTF8_ACCEPT && !(tmp & 0x8080808080808080ULL))
+      continue;
+    for (size_t i = 0; i < 8; ++i)
+      state = websocket_utf8_dfa(state, str[i]);
+    if (state == WEBSOCKET_UTF8_REJECT) /* the REJECT state is final */
+      return 0;
+  }
+  while (len--)
+    state = websocket_utf8_dfa(state, *(str++));
+  return state == WEBSOCKET_UTF8_ACCEPT;
+}
+
+#if WEBSOCKET_PARSER_SIMD
+
+/* the SSE2 kernel, skipping ASCII data 16 bytes at a time. */
+__attribute__((target("sse2"))) static int websocket_utf8_sse2(uint8_t *str,
+                                                               uint64_t len) {
+  uint32_t state = WEBSOCKET_UTF8_ACCEPT;
+  for (; len >= 16; len -= 16, str += 16) {
+    if (state == WEBSOCKET_UTF8_ACCEPT &&
+        !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)str)))
+      continue;
+    for (size_t i = 0; i < 16; ++i)
+      state = websocket_utf8_dfa(state, str[i]);
+    if (state == WEBSOCKET_UTF8_REJECT)
+      return 0;
+  }
+  while (len--)
+    state = websocket_utf8_dfa(state, *(str++));
+  return state == WEBSOCKET_UTF8_ACCEPT;
+}
+
+/* the AVX2 lookup tables (the error bits for each nibble). */
+#define WEBSOCKET_UTF8_TOO_SHORT 1
+#define WEBSOCKET_UTF8_TOO_LONG 2
+#define WEBSOCKET_UTF8_OVERLONG_3 4
+#define WEBSOCKET_UTF8_TOO_LARGE 8
+#define WEBSOCKET_UTF8_SURROGATE 16
+#define WEBSOCKET_UTF8_OVERLONG_2 32
+#define WEBSOCKET_UTF8_TOO_LARGE_1000 64
+#define WEBSOCKET_UTF8_OVERLONG_4 64
+#define WEBSOCKET_UTF8_TWO_CONTS 128
+#define WEBSOCKET_UTF8_CARRY                                                   \
+  (WEBSOCKET_UTF8_TOO_SHORT | WEBSOCKET_UTF8_TOO_LONG | WEBSOCKET_UTF8_TWO_CONTS)
+
+/* sets both 128 bit lanes to the same 16 byte table. */
+#define WEBSOCKET_UTF8_TABLE(...)                                              \
+  _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+/* tests a 32 byte block, accumulating errors. */
+__attribute__((target("avx2"))) static inline void
+websocket_utf8_avx2_block(__m256i input, __m256i *prev_input, __m256i *error,
+                          __m256i *prev_incomplete) {
+  if (!_mm256_movemask_epi8(input)) {
+    /* ASCII, but the previous block might have ended mid-character */
+    *error = _mm256_or_si256(*error, *prev_incomplete);
+    *prev_input = input;
+    return;
+  }
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i byte_1_high_table = WEBSOCKET_UTF8_TABLE(
+      /* 0_______ ________ (ASCII in byte 1) */
+      WEBSOCKET_UTF8_TOO_LONG, WEBSOCKET_UTF8_TOO_LONG, WEBSOCKET_UTF8_TOO_LONG,
+      WEBSOCKET_UTF8_TOO_LONG, WEBSOCKET_UTF8_TOO_LONG, WEBSOCKET_UTF8_TOO_LONG,
+      WEBSOCKET_UTF8_TOO_LONG, WEBSOCKET_UTF8_TOO_LONG,
+      /* 10______ ________ (continuation in byte 1) */
+      (char)WEBSOCKET_UTF8_TWO_CONTS, (char)WEBSOCKET_UTF8_TWO_CONTS,
+      (char)WEBSOCKET_UTF8_TWO_CONTS, (char)WEBSOCKET_UTF8_TWO_CONTS,
+      /* 1100____ ________ (two byte lead in byte 1) */
+      WEBSOCKET_UTF8_TOO_SHORT | WEBSOCKET_UTF8_OVERLONG_2,
+      /* 1101____ ________ (two byte lead in byte 1) */
+      WEBSOCKET_UTF8_TOO_SHORT,
+      /* 1110____ ________ (three byte lead in byte 1) */
+      WEBSOCKET_UTF8_TOO_SHORT | WEBSOCKET_UTF8_OVERLONG_3 |
+          WEBSOCKET_UTF8_SURROGATE,
+      /* 1111____ ________ (four+ byte lead in byte 1) */
+      WEBSOCKET_UTF8_TOO_SHORT | WEBSOCKET_UTF8_TOO_LARGE |
+          WEBSOCKET_UTF8_TOO_LARGE_1000 | WEBSOCKET_UTF8_OVERLONG_4);
+  const __m256i byte_1_low_table = WEBSOCKET_UTF8_TABLE(
+      /* ____0000 ________ */
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_OVERLONG_3 |
+             WEBSOCKET_UTF8_OVERLONG_2 | WEBSOCKET_UTF8_OVERLONG_4),
+      /* ____0001 ________ */
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_OVERLONG_2),
+      /* ____001_ ________ */
+      (char)WEBSOCKET_UTF8_CARRY, (char)WEBSOCKET_UTF8_CARRY,
+      /* ____0100 ________ */
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE),
+      /* ____0101 ________ */
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE |
+             WEBSOCKET_UTF8_TOO_LARGE_1000),
+      /* ____011_ ________ */
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE |
+             WEBSOCKET_UTF8_TOO_LARGE_1000),
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE |
+             WEBSOCKET_UTF8_TOO_LARGE_1000),
+      /* ____1___ ________ */
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE |
+             WEBSOCKET_UTF8_TOO_LARGE_1000),
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE |
+             WEBSOCKET_UTF8_TOO_LARGE_1000),
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE |
+             WEBSOCKET_UTF8_TOO_LARGE_1000),
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE |
+             WEBSOCKET_UTF8_TOO_LARGE_1000),
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE |
+             WEBSOCKET_UTF8_TOO_LARGE_1000),
+      /* ____1101 ________ */
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE |
+             WEBSOCKET_UTF8_TOO_LARGE_1000 | WEBSOCKET_UTF8_SURROGATE),
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE |
+             WEBSOCKET_UTF8_TOO_LARGE_1000),
+      (char)(WEBSOCKET_UTF8_CARRY | WEBSOCKET_UTF8_TOO_LARGE |
+             WEBSOCKET_UTF8_TOO_LARGE_1000));
+  const __m256i byte_2_high_table = WEBSOCKET_UTF8_TABLE(
+      /* ________ 0_______ (ASCII in byte 2) */
+      WEBSOCKET_UTF8_TOO_SHORT, WEBSOCKET_UTF8_TOO_SHORT,
+      WEBSOCKET_UTF8_TOO_SHORT, WEBSOCKET_UTF8_TOO_SHORT,
+      WEBSOCKET_UTF8_TOO_SHORT, WEBSOCKET_UTF8_TOO_SHORT,
+      WEBSOCKET_UTF8_TOO_SHORT, WEBSOCKET_UTF8_TOO_SHORT,
+      /* ________ 1000____ */
+      (char)(WEBSOCKET_UTF8_TOO_LONG | WEBSOCKET_UTF8_OVERLONG_2 |
+             WEBSOCKET_UTF8_TWO_CONTS | WEBSOCKET_UTF8_OVERLONG_3 |
+             WEBSOCKET_UTF8_TOO_LARGE_1000 | WEBSOCKET_UTF8_OVERLONG_4),
+      /* ________ 1001____ */
+      (char)(WEBSOCKET_UTF8_TOO_LONG | WEBSOCKET_UTF8_OVERLONG_2 |
+             WEBSOCKET_UTF8_TWO_CONTS | WEBSOCKET_UTF8_OVERLONG_3 |
+             WEBSOCKET_UTF8_TOO_LARGE),
+      /* ________ 101_____ */
+      (char)(WEBSOCKET_UTF8_TOO_LONG | WEBSOCKET_UTF8_OVERLONG_2 |
+             WEBSOCKET_UTF8_TWO_CONTS | WEBSOCKET_UTF8_SURROGATE |
+             WEBSOCKET_UTF8_TOO_LARGE),
+      (char)(WEBSOCKET_UTF8_TOO_LONG | WEBSOCKET_UTF8_OVERLONG_2 |
+             WEBSOCKET_UTF8_TWO_CONTS | WEBSOCKET_UTF8_SURROGATE |
+             WEBSOCKET_UTF8_TOO_LARGE),
+      /* ________ 11______ */
+      WEBSOCKET_UTF8_TOO_SHORT, WEBSOCKET_UTF8_TOO_SHORT,
+      WEBSOCKET_UTF8_TOO_SHORT, WEBSOCKET_UTF8_TOO_SHORT);
+  /* the previous 1, 2 and 3 bytes for every byte in the block */
+  const __m256i shifted = _mm256_permute2x128_si256(*prev_input, input, 0x21);
+  const __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+  const __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+  const __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+  /* test two byte sequences */
+  const __m256i byte_1_high = _mm256_shuffle_epi8(
+      byte_1_high_table,
+      _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+  const __m256i byte_1_low =
+      _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(prev1, nibble));
+  const __m256i byte_2_high = _mm256_shuffle_epi8(
+      byte_2_high_table,
+      _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+  const __m256i special_cases = _mm256_and_si256(
+      _mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+  /* the third and fourth bytes must be continuations (and only these) */
+  const __m256i must_be_continuation = _mm256_and_si256(
+      _mm256_or_si256(
+          _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+          _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)))),
+      _mm256_set1_epi8((char)0x80));
+  *error = _mm256_or_si256(
+      *error, _mm256_xor_si256(must_be_continuation, special_cases));
+  /* a lead byte in the last 3 bytes must be continued by the next block */
+  *prev_incomplete = _mm256_subs_epu8(
+      input,
+      _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                       -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                       -1, (char)(0xF0 - 1), (char)(0xE0 - 1),
+                       (char)(0xC0 - 1)));
+  *prev_input = input;
+}
+
+/* the AVX2 kernel, validating 32 bytes at a time. */
+__attribute__((target("avx2"))) static int websocket_utf8_avx2(uint8_t *str,
+                                                               uint64_t len) {
+  if (len < 32) /* padding a single block costs more than it's worth */
+    return websocket_utf8_sse2(str, len);
+  __m256i prev_input = _mm256_setzero_si256();
+  __m256i error = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+  for (; len >= 32; len -= 32, str += 32) {
+    websocket_utf8_avx2_block(_mm256_loadu_si256((const __m256i *)str),
+                              &prev_input, &error, &prev_incomplete);
+  }
+  if (len) {
+    /* pad the last block with zeros (ASCII) */
+    uint8_t tail[32] = {0};
+    memcpy(tail, str, len);
+    websocket_utf8_avx2_block(_mm256_loadu_si256((const __m256i *)tail),
+                              &prev_input, &error, &prev_incomplete);
+  }
+  error = _mm256_or_si256(error, prev_incomplete);
+  return _mm256_testz_si256(error, error);
+}
+
+#undef WEBSOCKET_UTF8_TABLE
+
+#endif
+
+/* *****************************************************************************
+Kernel selection
+***************************************************************************** */
+
+static void websocket_xmask_auto(void *msg, uint64_t len, uint32_t mask);
+static int websocket_utf8_auto(uint8_t *str, uint64_t len);
+
+/* the active kernels (selected on first use). */
+static void (*websocket_xmask_kernel)(void *msg, uint64_t len,
+                                      uint32_t mask) = websocket_xmask_auto;
+static int (*websocket_utf8_kernel)(uint8_t *str,
+                                    uint64_t len) = websocket_utf8_auto;
+static websocket_kernel_e websocket_kernel_mode = WEBSOCKET_KERNEL_AUTO;
+
+/**
+ * Selects the kernels used by `websocket_xmask` and `websocket_utf8_valid`,
+ * returning -1 if the kernel isn't supported by the CPU (or the build).
+ */
+static int websocket_kernel_set(websocket_kernel_e kernel) {
+  switch (kernel) {
+  case WEBSOCKET_KERNEL_AUTO:
+#if WEBSOCKET_PARSER_SIMD
+    if (!websocket_kernel_set(WEBSOCKET_KERNEL_AVX2) ||
+        !websocket_kernel_set(WEBSOCKET_KERNEL_SSE2))
+      return 0;
+#endif
+    return websocket_kernel_set(WEBSOCKET_KERNEL_SWAR);
+  case WEBSOCKET_KERNEL_SWAR:
+    websocket_xmask_kernel = websocket_xmask_swar;
+    websocket_utf8_kernel = websocket_utf8_swar;
+    break;
+#if WEBSOCKET_PARSER_SIMD
+  case WEBSOCKET_KERNEL_SSE2:
+    if (!__builtin_cpu_supports("sse2"))
+      return -1;
+    websocket_xmask_kernel = websocket_xmask_sse2;
+    websocket_utf8_kernel = websocket_utf8_sse2;
+    break;
+  case WEBSOCKET_KERNEL_AVX2:
+    if (!__builtin_cpu_supports("avx2"))
+      return -1;
+    websocket_xmask_kernel = websocket_xmask_avx2;
+    websocket_utf8_kernel = websocket_utf8_avx2;
+    break;
+#endif
+  default:
+    return -1;
+  }
+  websocket_kernel_mode = kernel;
+  return 0;
+}
+
+/** Returns the kernel in use. */
+static websocket_kernel_e websocket_kernel_get(void) {
+  if (websocket_kernel_mode == WEBSOCKET_KERNEL_AUTO)
+    websocket_kernel_set(WEBSOCKET_KERNEL_AUTO);
+  return websocket_kernel_mode;
+}
+
+static void websocket_xmask_auto(void *msg, uint64_t len, uint32_t mask) {
+  websocket_kernel_set(WEBSOCKET_KERNEL_AUTO);
+  websocket_xmask_kernel(msg, len, mask);
+}
+
+static int websocket_utf8_auto(uint8_t *str, uint64_t len) {
+  websocket_kernel_set(WEBSOCKET_KERNEL_AUTO);
+  return websocket_utf8_kernel(str, len);
+}
+
+/** used internally to mask and unmask client messages. */
+static void websocket_xmask(void *msg, uint64_t len, uint32_t mask) {
+  websocket_xmask_kernel(msg, len, mask);
+}
+
+/** Returns 1 if the data is valid UTF-8 and 0 if it isn't. */
+static int websocket_utf8_valid(void *data, uint64_t len) {
+  return websocket_utf8_kernel((uint8_t *)data, len);
+}
+
 /* *****************************************************************************
 Message wrapping
 ***************************************************************************** */
@@ -22,6 +22,11 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <string.h>
 #include <strings.h>
 
+#if HAVE_ZLIB
+#include <pthread.h>
+#include <zlib.h>
+#endif
+
 #include "fio_mem.h"
 
 #include "websocket_parser.h"
@@ -128,8 +133,14 @@ struct ws_s {
   FIOBJ msg;
   /** latest text state. */
   uint8_t is_text;
+  /** latest compression state (the message's RSV1 bit). */
+  uint8_t is_compressed;
   /** websocket connection type. */
   uint8_t is_client;
+#if HAVE_ZLIB
+  /** permessage-deflate state (NULL unless negotiated). */
+  struct ws_deflate_s *deflate;
+#endif
 };
 
 /**
@@ -147,6 +158,437 @@ static inline void clear_subscriptions(ws_s *ws) {
   }
 }
 
+/* *****************************************************************************
+permessage-deflate (RFC 7692)
+***************************************************************************** */
+#if HAVE_ZLIB
+
+/** Messages shorter than this are sent uncompressed. */
+#ifndef WEBSOCKET_DEFLATE_MIN_SIZE
+#define WEBSOCKET_DEFLATE_MIN_SIZE 64
+#endif
+
+/** The permessage-deflate extension parameters (an offer or a response). */
+typedef struct {
+  uint8_t server_no_context_takeover;
+  uint8_t client_no_context_takeover;
+  /* 0 == not set, otherwise 8-15 */
+  uint8_t server_max_window_bits;
+  /* 0 == not set, 1 == set without a value, otherwise 8-15 */
+  uint8_t client_max_window_bits;
+} ws_deflate_params_s;
+
+/** The permessage-deflate state for a connection. */
+typedef struct ws_deflate_s {
+  /** compression stream (unless a shared stream is used). */
+  z_stream tx;
+  /** decompression stream (unless a shared stream is used). */
+  z_stream rx;
+  /** the decompressed message. */
+  FIOBJ msg;
+  /** protects `tx`, messages might be written by more than one thread. */
+  spn_lock_i lock;
+  /** the compression window size. */
+  uint8_t tx_bits;
+  /** set when the compression context is reset for every message. */
+  uint8_t tx_reset;
+  /** set when the decompression context is reset for every message. */
+  uint8_t rx_reset;
+  /** `tx` / `rx` were initialized. */
+  uint8_t tx_ready;
+  uint8_t rx_ready;
+} ws_deflate_s;
+
+/* a context that's reset for every message can be shared by the thread. */
+#define ws_deflate_tx_shared(d) ((d)->tx_reset && (d)->tx_bits == 15)
+
+/* *****************************************************************************
+permessage-deflate - negotiation
+***************************************************************************** */
+
+/* reads a token (or a quoted string), returning the position after it. */
+static const char *ws_deflate_token(const char *pos, const char *end,
+                                    const char **token, size_t *len) {
+  while (pos < end && (*pos == ' ' || *pos == '\t'))
+    ++pos;
+  *token = pos;
+  if (pos < end && *pos == '"') {
+    *token = ++pos;
+    while (pos < end && *pos != '"')
+      ++pos;
+    *len = pos - *token;
+    if (pos < end)
+      ++pos;
+  } else {
+    while (pos < end && *pos != ';' && *pos != '=' && *pos != ' ' &&
+           *pos != '\t')
+      ++pos;
+    *len = pos - *token;
+  }
+  while (pos < end && (*pos == ' ' || *pos == '\t'))
+    ++pos;
+  return pos;
+}
+
+/* parses a window size value (8-15), returns 0 if the value is invalid. */
+static uint8_t ws_deflate_bits(const char *value, size_t len) {
+  if (len == 1 && value[0] >= '8' && value[0] <= '9')
+    return value[0] - '0';
+  if (len == 2 && value[0] == '1' && value[1] >= '0' && value[1] <= '5')
+    return 10 + (value[1] - '0');
+  return 0;
+}
+
+/**
+ * Parses a single extension (an offer or a response, no commas).
+ *
+ * Returns -1 if the extension isn't a valid permessage-deflate extension.
+ */
+static int ws_deflate_params_parse(ws_deflate_params_s *p, const char *pos,
+                                   const char *end) {
+  const char *name, *value;
+  size_t name_len, value_len;
+  *p = (ws_deflate_params_s){.server_no_context_takeover = 0};
+  pos = ws_deflate_token(pos, end, &name, &name_len);
+  if (name_len != 18 || strncasecmp(name, "permessage-deflate", 18))
+    return -1;
+  while (pos < end) {
+    if (*pos != ';')
+      return -1;
+    pos = ws_deflate_token(pos + 1, end, &name, &name_len);
+    value = NULL;
+    value_len = 0;
+    if (pos < end && *pos == '=')
+      pos = ws_deflate_token(pos + 1, end, &value, &value_len);
+    if (name_len == 26 &&
+        !strncasecmp(name, "server_no_context_takeover", 26)) {
+      if (value || p->server_no_context_takeover)
+        return -1;
+      p->server_no_context_takeover = 1;
+    } else if (name_len == 26 &&
+               !strncasecmp(name, "client_no_context_takeover", 26)) {
+      if (value || p->client_no_context_takeover)
+        return -1;
+      p->client_no_context_takeover = 1;
+    } else if (name_len == 22 &&
+               !strncasecmp(name, "server_max_window_bits", 22)) {
+      if (p->server_max_window_bits ||
+          !(p->server_max_window_bits = ws_deflate_bits(value, value_len)))
+        return -1;
+    } else if (name_len == 22 &&
+               !strncasecmp(name, "client_max_window_bits", 22)) {
+      if (p->client_max_window_bits)
+        return -1;
+      p->client_max_window_bits = 1;
+      if (value && !(p->client_max_window_bits =
+                         ws_deflate_bits(value, value_len)))
+        return -1;
+    } else {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/** used internally: returns the extension offer for a client's handshake. */
+FIOBJ websocket_extensions_offer(websocket_settings_s *args) {
+  if (!args->deflate)
+    return FIOBJ_INVALID;
+  if (args->deflate == 1)
+    return fiobj_str_new("permessage-deflate; client_max_window_bits", 42);
+  return fiobj_str_new("permessage-deflate; server_no_context_takeover; "
+                       "client_no_context_takeover; client_max_window_bits",
+                       98);
+}
+
+/* selects the first supported offer in a (comma separated) list of offers. */
+static FIOBJ ws_deflate_accept(websocket_settings_s *args, fio_cstr_s offers) {
+  const char *pos = offers.data;
+  const char *end = offers.data + offers.len;
+  ws_deflate_params_s p;
+  while (pos < end) {
+    const char *next = memchr(pos, ',', end - pos);
+    if (!next)
+      next = end;
+    /* zlib doesn't support an 8 bit window (256 bytes) for compression */
+    if (!ws_deflate_params_parse(&p, pos, next) &&
+        p.server_max_window_bits != 8) {
+      FIOBJ ret = fiobj_str_buf(128);
+      fiobj_str_write(ret, "permessage-deflate", 18);
+      if (p.server_no_context_takeover || args->deflate > 1)
+        fiobj_str_write(ret, "; server_no_context_takeover", 28);
+      if (p.client_no_context_takeover || args->deflate > 1)
+        fiobj_str_write(ret, "; client_no_context_takeover", 28);
+      if (p.server_max_window_bits)
+        fiobj_str_write2(ret, "; server_max_window_bits=%u",
+                          (unsigned int)p.server_max_window_bits);
+      return ret;
+    }
+    pos = next + 1;
+  }
+  return FIOBJ_INVALID;
+}
+
+/**
+ * used internally: selects a supported extension offer (server side), returning
+ * the `sec-websocket-extensions` response value (or FIOBJ_INVALID).
+ */
+FIOBJ websocket_extensions_accept(websocket_settings_s *args, FIOBJ offers) {
+  if (!args->deflate || !offers)
+    return FIOBJ_INVALID;
+  if (!FIOBJ_TYPE_IS(offers, FIOBJ_T_ARRAY))
+    return ws_deflate_accept(args, fiobj_obj2cstr(offers));
+  /* the header was sent more than once */
+  FIOBJ ret = FIOBJ_INVALID;
+  for (size_t i = 0; !ret && i < fiobj_ary_count(offers); ++i) {
+    ret = ws_deflate_accept(args, fiobj_obj2cstr(fiobj_ary_index(offers, i)));
+  }
+  return ret;
+}
+
+/* *****************************************************************************
+permessage-deflate - shared (per thread) compression contexts
+***************************************************************************** */
+
+typedef struct {
+  z_stream tx;
+  z_stream rx;
+  uint8_t tx_ready;
+  uint8_t rx_ready;
+} ws_deflate_shared_s;
+
+static __thread ws_deflate_shared_s *ws_deflate_shared;
+static pthread_key_t ws_deflate_shared_key;
+
+static void ws_deflate_shared_free(void *shared_) {
+  ws_deflate_shared_s *shared = shared_;
+  if (shared->tx_ready)
+    deflateEnd(&shared->tx);
+  if (shared->rx_ready)
+    inflateEnd(&shared->rx);
+  free(shared);
+}
+
+static void __attribute__((constructor)) ws_deflate_initialize(void) {
+  pthread_key_create(&ws_deflate_shared_key, ws_deflate_shared_free);
+}
+
+static inline ws_deflate_shared_s *ws_deflate_shared_get(void) {
+  if (!ws_deflate_shared) {
+    ws_deflate_shared = calloc(1, sizeof(*ws_deflate_shared));
+    HTTP_ASSERT(ws_deflate_shared, "WebSocket deflate allocation failed");
+    pthread_setspecific(ws_deflate_shared_key, ws_deflate_shared);
+  }
+  return ws_deflate_shared;
+}
+
+/* *****************************************************************************
+permessage-deflate - compression state
+***************************************************************************** */
+
+/**
+ * Initializes the connection's permessage-deflate state, using the negotiated
+ * response (`extensions`).
+ *
+ * Returns -1 if the response isn't supported.
+ */
+static int ws_deflate_init(ws_s *ws, FIOBJ extensions) {
+  ws_deflate_params_s p;
+  if (!FIOBJ_TYPE_IS(extensions, FIOBJ_T_STRING))
+    return -1;
+  fio_cstr_s s = fiobj_obj2cstr(extensions);
+  if (ws_deflate_params_parse(&p, s.data, s.data + s.len))
+    return -1;
+  const uint8_t tx_bits =
+      (ws->is_client ? p.client_max_window_bits : p.server_max_window_bits);
+  if (tx_bits == 8 || (!ws->is_client && p.client_max_window_bits == 1) ||
+      (ws->is_client && tx_bits == 1))
+    return -1;
+  ws->deflate = malloc(sizeof(*ws->deflate));
+  HTTP_ASSERT(ws->deflate, "WebSocket deflate allocation failed");
+  *ws->deflate = (ws_deflate_s){
+      .tx_bits = (tx_bits ? tx_bits : 15),
+      .tx_reset = (ws->is_client ? p.client_no_context_takeover
+                                 : p.server_no_context_takeover),
+      .rx_reset = (ws->is_client ? p.server_no_context_takeover
+                                 : p.client_no_context_takeover),
+      .lock = SPN_LOCK_INIT,
+  };
+  return 0;
+}
+
+static void ws_deflate_destroy(ws_s *ws) {
+  if (!ws->deflate)
+    return;
+  if (ws->deflate->tx_ready)
+    deflateEnd(&ws->deflate->tx);
+  if (ws->deflate->rx_ready)
+    inflateEnd(&ws->deflate->rx);
+  fiobj_free(ws->deflate->msg);
+  free(ws->deflate);
+  ws->deflate = NULL;
+}
+
+/** Returns the thread's (reset) compression stream (or NULL). */
+static z_stream *ws_deflate_shared_tx(void) {
+  ws_deflate_shared_s *shared = ws_deflate_shared_get();
+  if (!shared->tx_ready) {
+    if (deflateInit2(&shared->tx, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      return NULL;
+    shared->tx_ready = 1;
+    return &shared->tx;
+  }
+  deflateReset(&shared->tx);
+  return &shared->tx;
+}
+
+/** Returns a compression stream, ready for the next message (or NULL). */
+static z_stream *ws_deflate_tx(ws_deflate_s *d) {
+  if (ws_deflate_tx_shared(d))
+    return ws_deflate_shared_tx();
+  if (!d->tx_ready) {
+    if (deflateInit2(&d->tx, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     -(int)d->tx_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      return NULL;
+    d->tx_ready = 1;
+  } else if (d->tx_reset) {
+    deflateReset(&d->tx);
+  }
+  return &d->tx;
+}
+
+/** Returns a decompression stream, ready for the next message (or NULL). */
+static z_stream *ws_deflate_rx(ws_deflate_s *d) {
+  z_stream *zs = &d->rx;
+  uint8_t *ready = &d->rx_ready;
+  if (d->rx_reset) {
+    ws_deflate_shared_s *shared = ws_deflate_shared_get();
+    zs = &shared->rx;
+    ready = &shared->rx_ready;
+  }
+  if (!*ready) {
+    if (inflateInit2(zs, -15) != Z_OK)
+      return NULL;
+    *ready = 1;
+  } else if (d->rx_reset) {
+    inflateReset(zs);
+  }
+  return zs;
+}
+
+/**
+ * Compresses a message using `zs`, returning a `fio_malloc` allocated buffer
+ * (or NULL on error). `len` is updated to the compressed data's length.
+ */
+static void *ws_deflate_compress(z_stream *zs, void *data, size_t *len) {
+  size_t capa = deflateBound(zs, *len) + 16;
+  size_t pos = 0;
+  uint8_t *out = fio_malloc(capa);
+  zs->next_in = data;
+  zs->avail_in = *len;
+  while (out) {
+    zs->next_out = out + pos;
+    zs->avail_out = capa - pos;
+    if (deflate(zs, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+      break;
+    pos = capa - zs->avail_out;
+    if (zs->avail_out) {
+      /* remove the empty block's tail (0x00 0x00 0xFF 0xFF) */
+      *len = pos - 4;
+      return out;
+    }
+    void *tmp = fio_realloc2(out, capa << 1, pos);
+    if (!tmp)
+      break;
+    out = tmp;
+    capa <<= 1;
+  }
+  fio_free(out);
+  return NULL;
+}
+
+/**
+ * Decompresses a message into `d->msg`.
+ *
+ * Returns -1 on error or if the decompressed message exceeds `limit` bytes.
+ */
+static int ws_deflate_decompress(ws_deflate_s *d, void *data, size_t len,
+                                 size_t limit) {
+  static uint8_t tail[4] = {0x00, 0x00, 0xFF, 0xFF};
+  z_stream *zs = ws_deflate_rx(d);
+  if (!zs)
+    return -1;
+  if (!d->msg)
+    d->msg = fiobj_str_buf(len << 2);
+  fiobj_str_resize(d->msg, 0);
+  size_t used = 0;
+  zs->next_in = data;
+  zs->avail_in = len;
+  for (int i = 0; i < 2; ++i) {
+    if (i) {
+      /* restore the empty block's tail, removed by the sender */
+      zs->next_in = tail;
+      zs->avail_in = 4;
+    }
+    do {
+      const size_t capa = fiobj_str_capa_assert(
+          d->msg, used + (zs->avail_in << 1) + 1024);
+      zs->next_out = (Bytef *)fiobj_obj2cstr(d->msg).data + used;
+      zs->avail_out = capa - used;
+      const int r = inflate(zs, Z_SYNC_FLUSH);
+      used = capa - zs->avail_out;
+      fiobj_str_resize(d->msg, used);
+      if (used > limit)
+        return -1;
+      if (r == Z_STREAM_END) {
+        /* the message ended with a final block, the context can't be reused */
+        inflateReset(zs);
+        return 0;
+      }
+      if (r != Z_OK && r != Z_BUF_ERROR)
+        return -1;
+      if (r == Z_BUF_ERROR && zs->avail_out)
+        break;
+    } while (zs->avail_in || !zs->avail_out);
+  }
+  return 0;
+}
+
+/* decompresses a message before calling the `on_message` callback. */
+static void ws_deflate_on_message(ws_s *ws, void *msg, uint64_t len,
+                                  uint8_t is_text) {
+  if (ws_deflate_decompress(ws->deflate, msg, len, ws->max_msg_size)) {
+    /* corrupted data or message too big */
+    websocket_close(ws);
+    return;
+  }
+  fio_cstr_s s = fiobj_obj2cstr(ws->deflate->msg);
+  ws->on_message(ws, s.data, s.len, is_text);
+}
+
+#define ws_deflate_enabled(ws) ((ws)->deflate != NULL)
+
+#else
+/** used internally: returns the extension offer for a client's handshake. */
+FIOBJ websocket_extensions_offer(websocket_settings_s *args) {
+  (void)args;
+  return FIOBJ_INVALID;
+}
+/**
+ * used internally: selects a supported extension offer (server side), returning
+ * the `sec-websocket-extensions` response value (or FIOBJ_INVALID).
+ */
+FIOBJ websocket_extensions_accept(websocket_settings_s *args, FIOBJ offers) {
+  (void)args;
+  (void)offers;
+  return FIOBJ_INVALID;
+}
+
+#define ws_deflate_enabled(ws) 0
+#define ws_deflate_on_message(ws, msg, len, is_text) websocket_close((ws))
+#endif
+
 /* *****************************************************************************
 Callbacks - Required functions for websocket_parser.h
 ***************************************************************************** */
@@ -155,12 +597,21 @@ static void websocket_on_unwrapped(void *ws_p, void *msg, uint64_t len,
                                    char first, char last, char text,
                                    unsigned char rsv) {
   ws_s *ws = ws_p;
+  /* RSV1 marks the first frame of a compressed message (permessage-deflate) */
+  if (rsv && (rsv != 4 || !first || !ws_deflate_enabled(ws))) {
+    websocket_on_protocol_error(ws);
+    return;
+  }
   if (last && first) {
-    ws->on_message(ws, msg, len, (uint8_t)text);
+    if (rsv)
+      ws_deflate_on_message(ws, msg, len, (uint8_t)text);
+    else
+      ws->on_message(ws, msg, len, (uint8_t)text);
     return;
   }
   if (first) {
     ws->is_text = (uint8_t)text;
+    ws->is_compressed = (rsv != 0);
     if (ws->msg == FIOBJ_INVALID)
       ws->msg = fiobj_str_buf(len);
     fiobj_str_resize(ws->msg, 0);
@@ -168,10 +619,11 @@ static void websocket_on_unwrapped(void *ws_p, void *msg, uint64_t len,
   fiobj_str_write(ws->msg, msg, len);
   if (last) {
     fio_cstr_s s = fiobj_obj2cstr(ws->msg);
-    ws->on_message(ws, (char *)s.data, s.len, ws->is_text);
+    if (ws->is_compressed)
+      ws_deflate_on_message(ws, s.data, s.len, ws->is_text);
+    else
+      ws->on_message(ws, (char *)s.data, s.len, ws->is_text);
   }
-
-  (void)rsv;
 }
 static void websocket_on_protocol_ping(void *ws_p, void *msg_, uint64_t len) {
   ws_s *ws = ws_p;
@@ -300,7 +752,8 @@ static void on_data_first(intptr_t sockfd, protocol_s *ws_) {
 
 /* later */
 static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client);
+                                 char first, char last, char client,
+                                 unsigned char rsv);
 
 /*******************************************************************************
 Create/Destroy the websocket object
@@ -327,13 +780,17 @@ static void destroy_ws(ws_s *ws) {
     ws->on_close(ws->fd, ws->udata);
   if (ws->msg)
     fiobj_free(ws->msg);
+#if HAVE_ZLIB
+  ws_deflate_destroy(ws);
+#endif
   clear_subscriptions(ws);
   free_ws_buffer(ws, ws->buffer);
   free(ws);
 }
 
 void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
-                      websocket_settings_s *args, void *data, size_t length) {
+                      websocket_settings_s *args, FIOBJ extensions, void *data,
+                      size_t length) {
   ws_s *ws = new_websocket(uuid);
   if (!ws) {
     perror("FATAL ERROR: couldn't allocate Websocket protocol object");
@@ -360,6 +817,18 @@ void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
     ws->max_msg_size = (1024 * 256);
     facil_set_timeout(uuid, 40);
   }
+  // setup any negotiated extensions
+  if (extensions) {
+#if HAVE_ZLIB
+    if (!args->deflate || ws_deflate_init(ws, extensions))
+#endif
+    {
+      // an extension we didn't offer (or can't support)
+      facil_attach(uuid, (protocol_s *)ws);
+      websocket_close(ws);
+      return;
+    }
+  }
 
   if (data && length) {
     if (length > ws->buffer.size) {
@@ -418,123 +887,149 @@ Writing to the Websocket
 #endif
 
 static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client) {
+                                 char first, char last, char client,
+                                 unsigned char rsv) {
   if (len <= WS_MAX_FRAME_SIZE) {
     void *buff = fio_malloc(len + 16);
     len = (client ? websocket_client_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0)
+                                          first, last, rsv)
                   : websocket_server_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0));
+                                          first, last, rsv));
     sock_write2(.uuid = fd, .buffer = buff, .length = len, .dealloc = fio_free);
   } else {
     /* frame fragmentation is better for large data then large frames */
     while (len > WS_MAX_FRAME_SIZE) {
-      websocket_write_impl(fd, data, WS_MAX_FRAME_SIZE, text, first, 0, client);
+      websocket_write_impl(fd, data, WS_MAX_FRAME_SIZE, text, first, 0, client,
+                           rsv);
       data = ((uint8_t *)data) + WS_MAX_FRAME_SIZE;
       first = 0;
+      rsv = 0; /* RSV1 (compression) is only set for the first frame */
       len -= WS_MAX_FRAME_SIZE;
     }
-    websocket_write_impl(fd, data, len, text, first, 1, client);
+    websocket_write_impl(fd, data, len, text, first, 1, client, rsv);
   }
   return;
 }
 
-/* *****************************************************************************
-UTF-8 testing. This part was practically copied from:
-https://stackoverflow.com/a/22135005/4025095
-and
-http://bjoern.hoehrmann.de/utf-8/decoder/dfa
-***************************************************************************** */
-/* Copyright (c) 2008-2009 Bjoern Hoehrmann <bjoern@hoehrmann.de> */
-/* See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details. */
-
-#define UTF8_ACCEPT 0
-#define UTF8_REJECT 1
-
-static const uint8_t utf8d[] = {
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0, // 00..1f
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0, // 20..3f
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0, // 40..5f
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-    0,   0,   0,   0,   0,   0,   0,   0,   0,   0, // 60..7f
-    1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
-    1,   1,   1,   1,   1,   9,   9,   9,   9,   9,   9,
-    9,   9,   9,   9,   9,   9,   9,   9,   9,   9, // 80..9f
-    7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,
-    7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,
-    7,   7,   7,   7,   7,   7,   7,   7,   7,   7, // a0..bf
-    8,   8,   2,   2,   2,   2,   2,   2,   2,   2,   2,
-    2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
-    2,   2,   2,   2,   2,   2,   2,   2,   2,   2, // c0..df
-    0xa, 0x3, 0x3, 0x3, 0x3, 0x3, 0x3, 0x3, 0x3, 0x3, 0x3,
-    0x3, 0x3, 0x4, 0x3, 0x3, // e0..ef
-    0xb, 0x6, 0x6, 0x6, 0x5, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8,
-    0x8, 0x8, 0x8, 0x8, 0x8, // f0..ff
-    0x0, 0x1, 0x2, 0x3, 0x5, 0x8, 0x7, 0x1, 0x1, 0x1, 0x4,
-    0x6, 0x1, 0x1, 0x1, 0x1, // s0..s0
-    1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
-    1,   1,   1,   1,   1,   1,   0,   1,   1,   1,   1,
-    1,   0,   1,   0,   1,   1,   1,   1,   1,   1, // s1..s2
-    1,   2,   1,   1,   1,   1,   1,   2,   1,   2,   1,
-    1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
-    1,   2,   1,   1,   1,   1,   1,   1,   1,   1, // s3..s4
-    1,   2,   1,   1,   1,   1,   1,   1,   1,   2,   1,
-    1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
-    1,   3,   1,   3,   1,   1,   1,   1,   1,   1, // s5..s6
-    1,   3,   1,   1,   1,   1,   1,   3,   1,   3,   1,
-    1,   1,   1,   1,   1,   1,   3,   1,   1,   1,   1,
-    1,   1,   1,   1,   1,   1,   1,   1,   1,   1, // s7..s8
-};
-
-static inline uint32_t validate_utf8(uint8_t *str, size_t len) {
-  uint32_t state = 0;
-  while (len) {
-    uint32_t type = utf8d[*str];
-    state = utf8d[256 + state * 16 + type];
-    if (state == UTF8_REJECT)
-      return 0;
-    len--;
-    str++;
+#if HAVE_ZLIB
+/** Compresses and writes a message (permessage-deflate). */
+static int ws_deflate_write(ws_s *ws, void *data, size_t len, uint8_t text) {
+  ws_deflate_s *d = ws->deflate;
+  /* with a per connection context, the order of the messages is important */
+  const uint8_t locked = !ws_deflate_tx_shared(d);
+  if (locked)
+    spn_lock(&d->lock);
+  z_stream *zs = ws_deflate_tx(d);
+  void *out = zs ? ws_deflate_compress(zs, data, &len) : NULL;
+  if (out)
+    websocket_write_impl(ws->fd, out, len, text, 1, 1, ws->is_client, 4);
+  if (locked)
+    spn_unlock(&d->lock);
+  if (!out) {
+    /* the compression context might be corrupted */
+    websocket_close(ws);
+    return -1;
   }
-  return state == 0;
+  fio_free(out);
+  return 0;
 }
+#endif
 
 /* *****************************************************************************
 Multi-client broadcast optimizations
 ***************************************************************************** */
 
+/** The metadata attached to optimized (broadcast) messages. */
+typedef struct {
+  /** the message, wrapped in a server frame. */
+  sock_shared_s *wrapped;
+#if HAVE_ZLIB
+  /** the compressed message, wrapped in a server frame (created lazily). */
+  sock_shared_s *deflated;
+  /** the raw message. */
+  FIOBJ raw;
+  /** protects `deflated`. */
+  spn_lock_i lock;
+#endif
+  /** the message's opcode. */
+  unsigned char opcode;
+} websocket_optimized_s;
+
 static void websocket_optimize_free(facil_msg_s *msg, void *metadata) {
-  fiobj_free((FIOBJ)metadata);
+  websocket_optimized_s *opt = metadata;
+  sock_shared_free(opt->wrapped);
+#if HAVE_ZLIB
+  sock_shared_free(opt->deflated);
+  fiobj_free(opt->raw);
+#endif
+  free(opt);
   (void)msg;
 }
 
-static inline facil_msg_metadata_s websocket_optimize(fio_cstr_s msg,
-                                                      unsigned char opcode) {
-  FIOBJ out = fiobj_str_buf(msg.len + 10);
-  fiobj_str_resize(out,
-                   websocket_server_wrap(fiobj_obj2cstr(out).data, msg.data,
-                                         msg.len, opcode, 1, 1, 0));
+static inline facil_msg_metadata_s
+websocket_optimize(FIOBJ raw, fio_cstr_s msg, unsigned char opcode) {
+  websocket_optimized_s *opt = malloc(sizeof(*opt));
+  HTTP_ASSERT(opt, "WebSocket broadcast optimization allocation failed");
+  *opt = (websocket_optimized_s){
+      .wrapped = sock_shared_new(NULL, msg.len + 10),
+#if HAVE_ZLIB
+      .raw = fiobj_dup(raw),
+      .lock = SPN_LOCK_INIT,
+#endif
+      .opcode = opcode,
+  };
+  HTTP_ASSERT(opt->wrapped, "WebSocket broadcast frame allocation failed");
+  sock_shared_truncate(opt->wrapped,
+                       websocket_server_wrap(sock_shared_data(opt->wrapped),
+                                             msg.data, msg.len, opcode, 1, 1,
+                                             0));
   facil_msg_metadata_s ret = {
       .on_finish = websocket_optimize_free,
-      .metadata = (void *)out,
+      .metadata = (void *)opt,
   };
   return ret;
+  (void)raw;
 }
+
+#if HAVE_ZLIB
+/**
+ * Returns the compressed frame for connections that reset their compression
+ * context for every message, so all these subscribers share the same frame.
+ *
+ * The message is compressed once, by the first subscriber that needs it.
+ */
+static sock_shared_s *
+websocket_optimized_deflated(websocket_optimized_s *opt) {
+  spn_lock(&opt->lock);
+  if (!opt->deflated) {
+    fio_cstr_s raw = fiobj_obj2cstr(opt->raw);
+    size_t len = raw.len;
+    z_stream *zs;
+    void *out = NULL;
+    if (len >= WEBSOCKET_DEFLATE_MIN_SIZE && (zs = ws_deflate_shared_tx()))
+      out = ws_deflate_compress(zs, raw.data, &len);
+    if (out && (opt->deflated = sock_shared_new(NULL, len + 10))) {
+      sock_shared_truncate(opt->deflated,
+                           websocket_server_wrap(sock_shared_data(opt->deflated),
+                                                 out, len, opt->opcode, 1, 1,
+                                                 4));
+    } else {
+      opt->deflated = sock_shared_dup(opt->wrapped);
+    }
+    fio_free(out);
+  }
+  spn_unlock(&opt->lock);
+  return opt->deflated;
+}
+#endif
 static facil_msg_metadata_s
 websocket_optimize_generic(facil_msg_s *msg, FIOBJ raw_ch, FIOBJ raw_msg) {
   fio_cstr_s tmp = fiobj_obj2cstr(raw_msg);
   unsigned char opcode = 2;
-  if (tmp.len <= (2 << 19) && validate_utf8((uint8_t *)tmp.data, tmp.len)) {
+  if (websocket_utf8_valid(tmp.data, tmp.len)) {
     opcode = 1;
   }
-  facil_msg_metadata_s ret = websocket_optimize(tmp, opcode);
+  facil_msg_metadata_s ret = websocket_optimize(raw_msg, tmp, opcode);
   ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB;
   return ret;
   (void)msg;
@@ -544,7 +1039,7 @@ websocket_optimize_generic(facil_msg_s *msg, FIOBJ raw_ch, FIOBJ raw_msg) {
 static facil_msg_metadata_s
 websocket_optimize_text(facil_msg_s *msg, FIOBJ raw_ch, FIOBJ raw_msg) {
   fio_cstr_s tmp = fiobj_obj2cstr(raw_msg);
-  facil_msg_metadata_s ret = websocket_optimize(tmp, 1);
+  facil_msg_metadata_s ret = websocket_optimize(raw_msg, tmp, 1);
   ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB_TEXT;
   return ret;
   (void)msg;
@@ -554,7 +1049,7 @@ websocket_optimize_text(facil_msg_s *msg, FIOBJ raw_ch, FIOBJ raw_msg) {
 static facil_msg_metadata_s
 websocket_optimize_binary(facil_msg_s *msg, FIOBJ raw_ch, FIOBJ raw_msg) {
   fio_cstr_s tmp = fiobj_obj2cstr(raw_msg);
-  facil_msg_metadata_s ret = websocket_optimize(tmp, 2);
+  facil_msg_metadata_s ret = websocket_optimize(raw_msg, tmp, 2);
   ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB_BINARY;
   return ret;
   (void)msg;
@@ -650,26 +1145,37 @@ static inline void websocket_on_pubsub_message_direct_internal(facil_msg_s *msg,
     return;
   }
   FIOBJ message = FIOBJ_INVALID;
-  FIOBJ pre_wrapped = FIOBJ_INVALID;
+  websocket_optimized_s *pre_wrapped = NULL;
   switch (txt) {
   case 0:
-    pre_wrapped =
-        (FIOBJ)facil_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB_BINARY);
+    pre_wrapped = facil_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB_BINARY);
     break;
   case 1:
-    pre_wrapped =
-        (FIOBJ)facil_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB_TEXT);
+    pre_wrapped = facil_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB_TEXT);
     break;
   case 2:
-    pre_wrapped = (FIOBJ)facil_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB);
+    pre_wrapped = facil_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB);
     break;
   default:
     break;
   }
   if (pre_wrapped) {
     // fprintf(stderr, "INFO: WebSocket Pub/Sub optimized for broadcast\n");
-    fiobj_send_free((intptr_t)msg->udata1, fiobj_dup(pre_wrapped));
+#if HAVE_ZLIB
+    ws_deflate_s *d = ((ws_s *)pr)->deflate;
+    if (d && !ws_deflate_tx_shared(d)) {
+      /* the compression context belongs to the connection, can't share */
+      txt = (pre_wrapped->opcode == 1);
+    } else {
+      sock_write_shared((intptr_t)msg->udata1,
+                        d ? websocket_optimized_deflated(pre_wrapped)
+                          : pre_wrapped->wrapped);
+      goto finish;
+    }
+#else
+    sock_write_shared((intptr_t)msg->udata1, pre_wrapped->wrapped);
     goto finish;
+#endif
   }
   fio_cstr_s tmp;
   if (FIOBJ_TYPE_IS(msg->msg, FIOBJ_T_STRING)) {
@@ -677,9 +1183,7 @@ static inline void websocket_on_pubsub_message_direct_internal(facil_msg_s *msg,
     tmp = fiobj_obj2cstr(message);
     if (txt == 2) {
       /* unknown text state */
-      txt =
-          (tmp.len >= (2 << 14) ? 0
-                                : validate_utf8((uint8_t *)tmp.data, tmp.len));
+      txt = websocket_utf8_valid(tmp.data, tmp.len);
     }
   } else {
     message = fiobj_obj2json(msg->msg, 0);
@@ -801,7 +1305,11 @@ uint8_t websocket_is_client(ws_s *ws) { return ws->is_client; }
 /** Writes data to the websocket. Returns -1 on failure (0 on success). */
 int websocket_write(ws_s *ws, void *data, size_t size, uint8_t is_text) {
   if (sock_isvalid(ws->fd)) {
-    websocket_write_impl(ws->fd, data, size, is_text, 1, 1, ws->is_client);
+#if HAVE_ZLIB
+    if (ws->deflate && size >= WEBSOCKET_DEFLATE_MIN_SIZE)
+      return ws_deflate_write(ws, data, size, is_text);
+#endif
+    websocket_write_impl(ws->fd, data, size, is_text, 1, 1, ws->is_client, 0);
     return 0;
   }
   return -1;
@@ -976,3 +1484,257 @@ websocket_write_each(struct websocket_write_each_args_s args) {
              .arg = multi, .on_complete = ws_finish_multi_write);
   return 0;
 }
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+#if DEBUG
+
+#define TEST_ASSERT(cond, ...)                                                 \
+  if (!(cond)) {                                                               \
+    fprintf(stderr, "* " __VA_ARGS__);                                         \
+    fprintf(stderr, "Testing failed.\n");                                      \
+    exit(-1);                                                                  \
+  }
+
+#if HAVE_ZLIB
+/* collects the received messages (`udata` points to a FIOBJ String). */
+static void websocket_test_on_message(ws_s *ws, char *data, size_t size,
+                                      uint8_t is_text) {
+  FIOBJ *msg = ws->udata;
+  fiobj_free(*msg);
+  *msg = fiobj_str_new(data, size);
+  TEST_ASSERT(is_text, "websocket message type error\n");
+}
+
+/*
+ * Sends a (compressed) message from `tx` to `rx`, in `fragments` frames.
+ *
+ * Returns the length of the compressed message.
+ */
+static size_t websocket_test_send(ws_s *tx, ws_s *rx, char *msg, size_t len,
+                                  size_t fragments, uint8_t compress) {
+  size_t data_len = len;
+  void *data = msg;
+  if (compress) {
+    z_stream *zs = ws_deflate_tx(tx->deflate);
+    data = zs ? ws_deflate_compress(zs, msg, &data_len) : NULL;
+    TEST_ASSERT(data, "permessage-deflate compression failed\n");
+  }
+  const size_t step = data_len / fragments + 1;
+  uint8_t *buffer = fio_malloc(data_len + ((fragments + 1) * 16));
+  size_t used = 0;
+  for (size_t pos = 0; pos < data_len; pos += step) {
+    const size_t part = (data_len - pos < step) ? data_len - pos : step;
+    const uint8_t first = (pos == 0);
+    const uint8_t last = (pos + part == data_len);
+    const uint8_t rsv = (first && compress) ? 4 : 0;
+    used += (tx->is_client
+                 ? websocket_client_wrap(buffer + used, (uint8_t *)data + pos,
+                                         part, 1, first, last, rsv)
+                 : websocket_server_wrap(buffer + used, (uint8_t *)data + pos,
+                                         part, 1, first, last, rsv));
+  }
+  /* a message that fails to decompress never arrives */
+  fiobj_free(*(FIOBJ *)rx->udata);
+  *(FIOBJ *)rx->udata = FIOBJ_INVALID;
+  TEST_ASSERT(!websocket_consume(buffer, used, rx, !rx->is_client),
+              "websocket frames weren't consumed\n");
+  fio_free(buffer);
+  if (compress)
+    fio_free(data);
+  return data_len;
+}
+
+/* negotiates the extension, as the client and server handshakes would. */
+static void websocket_test_connect(uint8_t deflate, ws_s *server,
+                                   ws_s *client, const char *offer) {
+  websocket_settings_s args = {.deflate = deflate};
+  FIOBJ offered = offer ? fiobj_str_new(offer, strlen(offer))
+                        : websocket_extensions_offer(&args);
+  FIOBJ response = websocket_extensions_accept(&args, offered);
+  TEST_ASSERT(response, "permessage-deflate offer declined: %s\n",
+              fiobj_obj2cstr(offered).data);
+  TEST_ASSERT(!ws_deflate_init(server, response) &&
+                  !ws_deflate_init(client, response),
+              "permessage-deflate response rejected: %s\n",
+              fiobj_obj2cstr(response).data);
+  fiobj_free(response);
+  fiobj_free(offered);
+}
+#endif
+
+void websocket_tests(void) {
+#if HAVE_ZLIB
+  fprintf(stderr, "=== Testing WebSocket permessage-deflate\n");
+  {
+    static const struct {
+      const char *ext;
+      int ret;
+      ws_deflate_params_s expected;
+    } cases[] = {
+        {"permessage-deflate", 0, {0, 0, 0, 0}},
+        {" permessage-deflate ; client_max_window_bits", 0, {0, 0, 0, 1}},
+        {"permessage-deflate; client_max_window_bits=9", 0, {0, 0, 0, 9}},
+        {"permessage-deflate; server_max_window_bits=10", 0, {0, 0, 10, 0}},
+        {"permessage-deflate; server_max_window_bits=\"15\"", 0, {0, 0, 15, 0}},
+        {"permessage-deflate; server_no_context_takeover; "
+         "client_no_context_takeover",
+         0,
+         {1, 1, 0, 0}},
+        {"permessage-deflate; server_max_window_bits", -1, {0, 0, 0, 0}},
+        {"permessage-deflate; server_max_window_bits=16", -1, {0, 0, 0, 0}},
+        {"permessage-deflate; server_max_window_bits=7", -1, {0, 0, 0, 0}},
+        {"permessage-deflate; server_max_window_bits=010", -1, {0, 0, 0, 0}},
+        {"permessage-deflate; client_max_window_bits=0", -1, {0, 0, 0, 0}},
+        {"permessage-deflate; client_no_context_takeover=1", -1, {0, 0, 0, 0}},
+        {"permessage-deflate; client_no_context_takeover; "
+         "client_no_context_takeover",
+         -1,
+         {0, 0, 0, 0}},
+        {"permessage-deflate; server_max_window_bits=10; "
+         "server_max_window_bits=11",
+         -1,
+         {0, 0, 0, 0}},
+        {"permessage-deflate; client_max_window_bits; client_max_window_bits",
+         -1,
+         {0, 0, 0, 0}},
+        {"permessage-deflate; unknown_parameter", -1, {0, 0, 0, 0}},
+        {"permessage-deflate x", -1, {0, 0, 0, 0}},
+        {"x-webkit-deflate-frame", -1, {0, 0, 0, 0}},
+        {NULL, 0, {0, 0, 0, 0}},
+    };
+    for (size_t i = 0; cases[i].ext; ++i) {
+      ws_deflate_params_s p;
+      const char *ext = cases[i].ext;
+      int ret = ws_deflate_params_parse(&p, ext, ext + strlen(ext));
+      TEST_ASSERT(ret == cases[i].ret &&
+                      (ret || !memcmp(&p, &cases[i].expected, sizeof(p))),
+                  "permessage-deflate parameters error: %s\n", ext);
+    }
+    /* the first supported offer is selected */
+    websocket_settings_s args = {.deflate = 1};
+    static const char *offer = "x-foo, "
+                               "permessage-deflate; server_max_window_bits=8, "
+                               "permessage-deflate; server_max_window_bits=9; "
+                               "client_max_window_bits";
+    FIOBJ offers = fiobj_str_new(offer, strlen(offer));
+    FIOBJ response = websocket_extensions_accept(&args, offers);
+    fio_cstr_s s = fiobj_obj2cstr(response);
+    TEST_ASSERT(s.data && !strcmp(s.data, "permessage-deflate; "
+                                          "server_max_window_bits=9"),
+                "permessage-deflate offer selection error: %s\n", s.data);
+    fiobj_free(response);
+    args.deflate = 2;
+    response = websocket_extensions_accept(&args, offers);
+    s = fiobj_obj2cstr(response);
+    TEST_ASSERT(s.data && !strcmp(s.data, "permessage-deflate; "
+                                          "server_no_context_takeover; "
+                                          "client_no_context_takeover; "
+                                          "server_max_window_bits=9"),
+                "permessage-deflate offer selection error: %s\n", s.data);
+    fiobj_free(response);
+    fiobj_free(offers);
+    offers = fiobj_str_new("permessage-deflate; server_max_window_bits=8", 44);
+    TEST_ASSERT(!websocket_extensions_accept(&args, offers),
+                "permessage-deflate 8 bit window should be declined\n");
+    fiobj_free(offers);
+    fprintf(stderr, "* negotiation passed.\n");
+  }
+  {
+    /* a compressible message and a large one (frames are reassembled) */
+    char small[1024];
+    const size_t large_len = 200000;
+    char *large = fio_malloc(large_len);
+    for (size_t i = 0; i < sizeof(small); ++i)
+      small[i] = "abcdefghij"[(i * 7) % 10];
+    for (size_t i = 0; i < large_len; ++i)
+      large[i] = 'a' + (char)((i * i + (i >> 7)) % 26);
+    static const struct {
+      uint8_t deflate;
+      const char *offer; /* NULL == the client's default offer */
+      uint8_t takeover;
+    } modes[] = {
+        {1, NULL, 1},
+        {2, NULL, 0},
+        {1, "permessage-deflate; server_max_window_bits=10", 1},
+        {1, "permessage-deflate; client_no_context_takeover", 1},
+        {0, NULL, 0},
+    };
+    for (size_t m = 0; modes[m].deflate; ++m) {
+      FIOBJ received = FIOBJ_INVALID;
+      /* errors close the connection, `fd` is invalid so nothing is sent */
+      ws_s server = {.fd = -1,
+                     .is_client = 0,
+                     .on_message = websocket_test_on_message,
+                     .max_msg_size = (1 << 20),
+                     .udata = &received};
+      ws_s client = server;
+      client.is_client = 1;
+      websocket_test_connect(modes[m].deflate, &server, &client,
+                             modes[m].offer);
+      for (size_t dir = 0; dir < 2; ++dir) {
+        ws_s *tx = dir ? &client : &server;
+        ws_s *rx = dir ? &server : &client;
+        const uint8_t takeover =
+            modes[m].takeover && !(tx->deflate->tx_reset);
+        size_t lengths[3];
+        for (size_t i = 0; i < 3; ++i) {
+          lengths[i] = websocket_test_send(tx, rx, small, sizeof(small),
+                                           1 + i, 1);
+          fio_cstr_s r = fiobj_obj2cstr(received);
+          TEST_ASSERT(r.len == sizeof(small) &&
+                          !memcmp(r.data, small, sizeof(small)),
+                      "permessage-deflate round trip error (mode %zu, %zu)\n",
+                      m, i);
+        }
+        /* with context takeover, repeated messages are (mostly) references */
+        TEST_ASSERT(takeover ? (lengths[1] < lengths[0] &&
+                                lengths[2] < lengths[0])
+                             : (lengths[1] == lengths[0] &&
+                                lengths[2] == lengths[0]),
+                    "permessage-deflate context takeover error (mode %zu, "
+                    "%zu, %zu, %zu)\n",
+                    m, lengths[0], lengths[1], lengths[2]);
+        /* an uncompressed fragmented message between compressed messages */
+        websocket_test_send(tx, rx, small, sizeof(small), 3, 0);
+        fio_cstr_s r = fiobj_obj2cstr(received);
+        TEST_ASSERT(r.len == sizeof(small) &&
+                        !memcmp(r.data, small, sizeof(small)),
+                    "uncompressed fragmented message error (mode %zu)\n", m);
+        websocket_test_send(tx, rx, large, large_len, 7, 1);
+        r = fiobj_obj2cstr(received);
+        TEST_ASSERT(r.len == large_len && !memcmp(r.data, large, large_len),
+                    "permessage-deflate fragmented message error (mode %zu)\n",
+                    m);
+        websocket_test_send(tx, rx, small, sizeof(small), 1, 1);
+        r = fiobj_obj2cstr(received);
+        TEST_ASSERT(r.len == sizeof(small) &&
+                        !memcmp(r.data, small, sizeof(small)),
+                    "permessage-deflate message error (mode %zu)\n", m);
+      }
+      {
+        /* messages decompressing past the size limit are rejected */
+        size_t len = large_len;
+        void *out = ws_deflate_compress(ws_deflate_tx(server.deflate), large,
+                                        &len);
+        TEST_ASSERT(out, "permessage-deflate compression failed\n");
+        TEST_ASSERT(ws_deflate_decompress(client.deflate, out, len,
+                                          large_len - 1) == -1,
+                    "permessage-deflate size limit ignored (mode %zu)\n", m);
+        fio_free(out);
+      }
+      ws_deflate_destroy(&server);
+      ws_deflate_destroy(&client);
+      fiobj_free(server.msg);
+      fiobj_free(client.msg);
+      fiobj_free(received);
+    }
+    fio_free(large);
+    fprintf(stderr, "* round trips and fragmented messages passed.\n");
+  }
+#endif
+}
+
+#undef TEST_ASSERT
+#endif
@@ -19,9 +19,27 @@ The protocol / service identifier.
 */
 extern char *WEBSOCKET_ID_STR;
 
-/** used internally: attaches the Websocket protocol to the socket. */
+/**
+ * used internally: attaches the Websocket protocol to the socket.
+ *
+ * `extensions` is the handshake's `sec-websocket-extensions` response value
+ * (or FIOBJ_INVALID).
+ */
 void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
-                      websocket_settings_s *args, void *data, size_t length);
+                      websocket_settings_s *args, FIOBJ extensions, void *data,
+                      size_t length);
+
+/**
+ * used internally: returns the `sec-websocket-extensions` value for a client's
+ * handshake (or FIOBJ_INVALID).
+ */
+FIOBJ websocket_extensions_offer(websocket_settings_s *args);
+
+/**
+ * used internally: selects a supported extension offer (server side), returning
+ * the `sec-websocket-extensions` response value (or FIOBJ_INVALID).
+ */
+FIOBJ websocket_extensions_accept(websocket_settings_s *args, FIOBJ offers);
 
 /* *****************************************************************************
 Websocket information
@@ -12,6 +12,20 @@ Feel free to copy, use and enjoy according to the license provided.
 #include "resp_parser.h"
 
 #define REDIS_READ_BUFFER 8192
+
+#ifndef REDIS_PIPELINE_WINDOW
+/**
+ * The default number of commands that may be sent before their replies arrive
+ * (see the `pipeline` argument for `redis_engine_create`).
+ */
+#define REDIS_PIPELINE_WINDOW 256
+#endif
+
+#ifndef REDIS_PIPELINE_COALESCE
+/** Queued commands are copied into a single write of up to this size. */
+#define REDIS_PIPELINE_COALESCE (64 * 1024)
+#endif
+
 /* *****************************************************************************
 The Redis Engine and Callbacks Object
 ***************************************************************************** */
@@ -29,7 +43,10 @@ typedef struct {
     uintptr_t ary_count;
     uintptr_t buf_pos;
   } pub_data, sub_data;
-  fio_ls_embd_s callbacks;
+  fio_ls_embd_s callbacks; /* commands that were sent, awaiting a reply */
+  fio_ls_embd_s queue;     /* commands waiting to be sent */
+  size_t pending;          /* the number of commands awaiting a reply */
+  size_t window;           /* the maximum number of pending commands */
   spn_lock_i lock;
   char *address;
   char *port;
@@ -38,7 +55,7 @@ typedef struct {
   size_t auth_len;
   size_t ref;
   uint8_t ping_int;
-  uint8_t sent;
+  uint8_t scheduled;
   uint8_t flag;
   uint8_t buf[];
 } redis_engine_s;
@@ -80,6 +97,9 @@ static inline void redis_free(redis_engine_s *r) {
     free(FIO_LS_EMBD_OBJ(redis_commands_s, node,
                          fio_ls_embd_pop(&r->callbacks)));
   }
+  while (fio_ls_embd_any(&r->queue)) {
+    free(FIO_LS_EMBD_OBJ(redis_commands_s, node, fio_ls_embd_pop(&r->queue)));
+  }
   free(r);
 }
 
@@ -105,35 +125,73 @@ static void redis_perform_callback(void *e, void *cmd_) {
   free(cmd);
 }
 
-/* send the necxt command in the queue */
+/*
+ * Sends the queued commands (while the pipeline's window allows), without
+ * waiting for replies. Replies are matched to the `callbacks` list in order.
+ *
+ * Writing while the lock is held keeps the order of the commands on the wire
+ * the same as their order in the `callbacks` list.
+ */
 static void redis_send_cmd_queue(void *r_, void *ignr) {
   redis_engine_s *r = r_;
-  if (!r->pub_data.uuid)
-    return;
   spn_lock(&r->lock);
-  if (r->sent == 0 && fio_ls_embd_any(&r->callbacks)) {
-    redis_commands_s *cmd =
-        FIO_LS_EMBD_OBJ(redis_commands_s, node, r->callbacks.prev);
-    intptr_t uuid = r->pub_data.uuid;
-    r->sent = 1;
-    spn_unlock(&r->lock);
-    // fprintf(stderr, "Sending: %s\n", cmd->cmd);
-    sock_write2(.uuid = uuid, .buffer = cmd->cmd, .length = cmd->cmd_len,
-                .dealloc = SOCK_DEALLOC_NOOP);
-  } else {
-    r->sent = 0;
-    spn_unlock(&r->lock);
+  r->scheduled = 0;
+  while (r->pub_data.uuid && r->pending < r->window &&
+         fio_ls_embd_any(&r->queue)) {
+    /* collect a batch of commands for a single write */
+    size_t count = 0;
+    size_t len = 0;
+    for (fio_ls_embd_s *pos = r->queue.next;
+         pos != &r->queue && r->pending + count < r->window; pos = pos->next) {
+      redis_commands_s *cmd = FIO_LS_EMBD_OBJ(redis_commands_s, node, pos);
+      if (count && len + cmd->cmd_len > REDIS_PIPELINE_COALESCE)
+        break;
+      len += cmd->cmd_len;
+      ++count;
+    }
+    r->pending += count;
+    if (count == 1) {
+      redis_commands_s *cmd = FIO_LS_EMBD_OBJ(redis_commands_s, node,
+                                              fio_ls_embd_shift(&r->queue));
+      fio_ls_embd_unshift(&r->callbacks, &cmd->node);
+      /* the command is freed only after a reply, so it can't be freed early */
+      sock_write2(.uuid = r->pub_data.uuid, .buffer = cmd->cmd,
+                  .length = cmd->cmd_len, .dealloc = SOCK_DEALLOC_NOOP);
+      continue;
+    }
+    uint8_t *buf = malloc(len);
+    if (!buf) {
+      perror("FATAL ERROR: (redis) can't allocate memory for pipelined "
+             "commands");
+      exit(errno);
+    }
+    uint8_t *pos = buf;
+    while (count--) {
+      redis_commands_s *cmd = FIO_LS_EMBD_OBJ(redis_commands_s, node,
+                                              fio_ls_embd_shift(&r->queue));
+      fio_ls_embd_unshift(&r->callbacks, &cmd->node);
+      memcpy(pos, cmd->cmd, cmd->cmd_len);
+      pos += cmd->cmd_len;
+    }
+    sock_write2(.uuid = r->pub_data.uuid, .buffer = buf, .length = len);
   }
+  spn_unlock(&r->lock);
   (void)ignr;
 }
 
+/* schedules `redis_send_cmd_queue`, unless already scheduled (lock held) */
+static inline uint8_t redis_schedule_send_locked(redis_engine_s *r) {
+  if (r->scheduled || r->pending >= r->window || !fio_ls_embd_any(&r->queue))
+    return 0;
+  r->scheduled = 1;
+  return 1;
+}
+
 static void redis_attach_cmd(redis_engine_s *r, redis_commands_s *cmd) {
   uint8_t schedule = 0;
   spn_lock(&r->lock);
-  fio_ls_embd_push(&r->callbacks, &cmd->node);
-  if (r->sent == 0) {
-    schedule = 1;
-  }
+  fio_ls_embd_unshift(&r->queue, &cmd->node);
+  schedule = redis_schedule_send_locked(r);
   spn_unlock(&r->lock);
   if (schedule) {
     defer(redis_send_cmd_queue, r, NULL);
@@ -143,10 +201,13 @@ static void redis_attach_cmd(redis_engine_s *r, redis_commands_s *cmd) {
 static void redis_cmd_reply(redis_engine_s *r, FIOBJ reply) {
   uint8_t schedule = 0;
   spn_lock(&r->lock);
-  r->sent = 0;
   fio_ls_embd_s *node = fio_ls_embd_shift(&r->callbacks);
-  schedule = fio_ls_embd_any(&r->callbacks);
+  if (node)
+    --r->pending;
+  schedule = redis_schedule_send_locked(r);
   spn_unlock(&r->lock);
+  if (schedule)
+    defer(redis_send_cmd_queue, r, NULL);
   if (!node) {
     /* TODO: possible ping? from server?! not likely... */
     fprintf(stderr,
@@ -154,12 +215,32 @@ static void redis_cmd_reply(redis_engine_s *r, FIOBJ reply) {
     return;
   }
   node->next = (void *)fiobj_dup(reply);
-  if (schedule)
-    defer(redis_send_cmd_queue, r, NULL);
   defer(redis_perform_callback, &r->en,
         FIO_LS_EMBD_OBJ(redis_commands_s, node, node));
 }
 
+static void redis_on_auth(pubsub_engine_s *e, FIOBJ reply, void *udata);
+
+/*
+ * Returns the commands that didn't receive a reply to the head of the queue,
+ * so they are resent (in order) once a new connection is established.
+ */
+static void redis_requeue_pending(redis_engine_s *r) {
+  spn_lock(&r->lock);
+  while (fio_ls_embd_any(&r->callbacks)) {
+    redis_commands_s *cmd = FIO_LS_EMBD_OBJ(redis_commands_s, node,
+                                            fio_ls_embd_pop(&r->callbacks));
+    if (cmd->callback == redis_on_auth) {
+      /* authentication is performed again for every connection */
+      free(cmd);
+      continue;
+    }
+    fio_ls_embd_push(&r->queue, &cmd->node);
+  }
+  r->pending = 0;
+  spn_unlock(&r->lock);
+}
+
 /* *****************************************************************************
 Connection Establishment
 ***************************************************************************** */
@@ -195,15 +276,10 @@ static void redis_on_pub_connect(intptr_t uuid, void *pr) {
         (redis_commands_s){.cmd_len = r->auth_len, .callback = redis_on_auth};
     memcpy(cmd->cmd, r->auth, r->auth_len);
     spn_lock(&r->lock);
-    fio_ls_embd_unshift(&r->callbacks, &cmd->node);
-    r->sent = 1;
+    fio_ls_embd_push(&r->queue, &cmd->node);
     spn_unlock(&r->lock);
-    sock_write2(.uuid = uuid, .buffer = cmd->cmd, .length = cmd->cmd_len,
-                .dealloc = SOCK_DEALLOC_NOOP);
-  } else {
-    r->sent = 0;
-    defer(redis_send_cmd_queue, r, NULL);
   }
+  redis_send_cmd_queue(r, NULL);
   fprintf(stderr, "INFO: (redis %d) publishing connection established.\n",
           (int)getpid());
 }
@@ -308,7 +384,7 @@ static void redis_pub_on_close(intptr_t uuid, protocol_s *pr) {
   fiobj_free(r->pub_data.ary ? r->pub_data.ary : r->pub_data.str);
   r->pub_data.ary = r->pub_data.str = FIOBJ_INVALID;
   r->pub_data.uuid = 0;
-  r->sent = 0;
+  redis_requeue_pending(r);
   if (r->flag && facil_is_running()) {
     fprintf(stderr,
             "WARNING: (redis %d) lost publishing connection to database\n",
@@ -349,7 +425,7 @@ static void redis_sub_ping(intptr_t uuid, protocol_s *pr) {
 
 static void redis_pub_ping(intptr_t uuid, protocol_s *pr) {
   redis_engine_s *r = prot2redis(pr);
-  if (r->sent) {
+  if (r->pending) {
     fprintf(stderr,
             "WARNING: (redis) Redis server unresponsive, disconnecting.\n");
     sock_close(uuid);
@@ -484,6 +560,8 @@ pubsub_engine_s *redis_engine_create(struct redis_engine_create_args args) {
       .flag = 1,
       .ping_int = args.ping_interval,
       .callbacks = FIO_LS_INIT(r->callbacks),
+      .queue = FIO_LS_INIT(r->queue),
+      .window = (args.pipeline ? args.pipeline : REDIS_PIPELINE_WINDOW),
       .port = (char *)r->buf + (REDIS_READ_BUFFER + REDIS_READ_BUFFER),
       .address = (char *)r->buf + (REDIS_READ_BUFFER + REDIS_READ_BUFFER) +
                  args.port.len + 1,
@@ -574,6 +652,9 @@ void redis_engine_destroy(pubsub_engine_s *e) {
  * The response will be sent back using the optional callback. `udata` is passed
  * along untouched.
  *
+ * Commands are pipelined (sent without waiting for previous replies) and
+ * callbacks are performed in the same order the commands were sent.
+ *
  * The message will be resent on network failures, until a response validates
  * the fact that the command was sent (or the engine is destroyed).
  *
@@ -616,7 +697,9 @@ Simple RESP formatting
  * Don't call `fiobj_free`, object will self-destruct.
  */
 static FIOBJ fiobj2resp_tmp(FIOBJ obj1, FIOBJ obj2) {
+  /* the temporary string isn't cleared */
   FIOBJ dest = fiobj_str_tmp();
+  fiobj_str_resize(dest, 0);
   if (!obj2 || FIOBJ_IS_NULL(obj2)) {
     fio_cstr_s s = fiobj_obj2cstr(obj1);
     fiobj_str_write(dest, "*1\r\n$", 5);
@@ -24,6 +24,13 @@ struct redis_engine_create_args {
   fio_cstr_s auth;
   /** A `ping` will be sent every `ping_interval` interval or inactivity. */
   uint8_t ping_interval;
+  /**
+   * The maximum number of commands sent before their replies arrive.
+   *
+   * Defaults to `REDIS_PIPELINE_WINDOW` (256). Use 1 to wait for each reply
+   * before sending the next command.
+   */
+  size_t pipeline;
 };
 
 /**
@@ -51,6 +58,9 @@ pubsub_engine_s *redis_engine_create(struct redis_engine_create_args);
  * The response will be sent back using the optional callback. `udata` is passed
  * along untouched.
  *
+ * Commands are pipelined (sent without waiting for previous replies) and
+ * callbacks are performed in the same order the commands were sent.
+ *
  * The message will be resent on network failures, until a response validates
  * the fact that the command was sent (or the engine is destroyed).
  *
@@ -0,0 +1,119 @@
+/*
+A readiness polling benchmark for the `evio` engines.
+
+The benchmark opens a number of socket pairs, polls one side of each pair for
+incoming data and repeatedly writes a byte to the other side. Every event is
+consumed and rearmed (ONE SHOT), which is the common case for `facil.io`.
+
+Since the `evio` engine is selected at compile time, compile this benchmark
+once per engine, i.e.:
+
+    gcc -O2 -Ilib/facil/core -o /tmp/evio_epoll tests/evio_bench.c \
+        lib/facil/core/evio*.c
+    gcc -O2 -Ilib/facil/core -DEVIO_ENGINE_URING -o /tmp/evio_uring \
+        tests/evio_bench.c lib/facil/core/evio*.c
+
+Run using: evio_bench [connections] [rounds]
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "evio.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+static int *fds;
+static size_t events_count;
+
+void evio_on_data(void *arg) {
+  const size_t i = (size_t)(uintptr_t)arg;
+  char tmp[8];
+  if (read(fds[i << 1], tmp, 8) <= 0) {
+    perror("ERROR: read failed");
+    exit(-1);
+  }
+  ++events_count;
+  evio_add_read(fds[i << 1], arg);
+}
+
+void evio_on_error(void *arg) {
+  fprintf(stderr, "ERROR: unexpected error event for %lu\n",
+          (unsigned long)(uintptr_t)arg);
+  exit(-1);
+}
+
+int main(int argc, char const *argv[]) {
+  size_t count = (argc > 1) ? (size_t)atol(argv[1]) : 4096;
+  size_t rounds = (argc > 2) ? (size_t)atol(argv[2]) : 256;
+  struct rlimit rlim = {.rlim_max = 0};
+  getrlimit(RLIMIT_NOFILE, &rlim);
+  rlim.rlim_cur = rlim.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rlim);
+  if ((count << 1) + 16 > rlim.rlim_cur)
+    count = (rlim.rlim_cur - 16) >> 1;
+
+  if (evio_create() == -1) {
+    perror("ERROR: couldn't initialize evio");
+    exit(-1);
+  }
+  fds = malloc(sizeof(*fds) * (count << 1));
+  for (size_t i = 0; i < count; ++i) {
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds + (i << 1))) {
+      perror("ERROR: socketpair failed");
+      exit(-1);
+    }
+    evio_add_read(fds[i << 1], (void *)(uintptr_t)i);
+  }
+  fprintf(stderr, "* Testing the %s engine with %lu connections X %lu rounds\n",
+#if defined(EVIO_ENGINE_URING)
+          "io_uring",
+#elif defined(EVIO_ENGINE_EPOLL)
+          "epoll",
+#else
+          "kqueue",
+#endif
+          (unsigned long)count, (unsigned long)rounds);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < count; ++i) {
+      if (write(fds[(i << 1) + 1], "x", 1) != 1) {
+        perror("ERROR: write failed");
+        exit(-1);
+      }
+    }
+    const size_t expected = events_count + count;
+    while (events_count < expected) {
+      if (evio_review(100) < 0 && errno != EINTR) {
+        perror("ERROR: evio_review failed");
+        exit(-1);
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) +
+                   ((double)(end.tv_nsec - start.tv_nsec) / 1000000000.0);
+  fprintf(stderr,
+          "* %lu events in %.3lf seconds (%.0lf events per second, "
+          "%.0lf nanoseconds per event)\n",
+          (unsigned long)events_count, seconds, events_count / seconds,
+          (seconds * 1000000000.0) / events_count);
+
+  for (size_t i = 0; i < (count << 1); ++i) {
+    if ((i & 1) == 0)
+      evio_remove(fds[i]);
+    close(fds[i]);
+  }
+  free(fds);
+  evio_close();
+  return 0;
+}
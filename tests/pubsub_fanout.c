@@ -0,0 +1,111 @@
+/*
+A pub/sub fan-out benchmark.
+
+The benchmark subscribes a number of subscribers to a single channel, publishes
+a number of messages to the channel (within the process) and measures the
+number of deliveries per second until every subscriber received every message.
+
+Every subscriber validates that messages arrive in the order they were
+published.
+
+Subscribers are handled in batches (one task per message and chunk of
+subscribers). To compare batch sizes, set the `FACIL_PUBSUB_BATCH` value (i.e.,
+`-DFACIL_PUBSUB_BATCH=1` for a task per subscriber).
+
+Compile using (from the repo's root):
+
+    gcc -O2 -Ilib -Ilib/facil/core -Ilib/facil/core/types \
+        -Ilib/facil/core/types/fiobj -o /tmp/pubsub_fanout \
+        tests/pubsub_fanout.c $(find lib/facil/core -name '*.c') \
+        -lpthread -lm
+
+Run using: pubsub_fanout [subscribers] [messages] [threads]
+*/
+#include "facil.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef FACIL_PUBSUB_BATCH
+#define FACIL_PUBSUB_BATCH 0 /* the library's default */
+#endif
+
+static size_t subscribers = 50000;
+static size_t messages = 100;
+static size_t *expected;
+static volatile size_t deliveries;
+static volatile size_t errors;
+static struct timespec start;
+
+static void bench_finish(void *ignr1, void *ignr2) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) +
+                   ((double)(end.tv_nsec - start.tv_nsec) / 1000000000.0);
+  fprintf(stderr,
+          "* %lu deliveries in %.3lf seconds (%.0lf deliveries/sec), "
+          "%lu ordering errors\n",
+          (unsigned long)deliveries, seconds, deliveries / seconds,
+          (unsigned long)errors);
+  kill(getpid(), SIGINT);
+  (void)ignr1;
+  (void)ignr2;
+}
+
+static void on_message(facil_msg_s *msg) {
+  size_t *next = msg->udata1;
+  if ((size_t)fiobj_obj2num(msg->msg) != *next)
+    __atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+  ++*next;
+  if (__atomic_add_fetch(&deliveries, 1, __ATOMIC_ACQ_REL) ==
+      subscribers * messages)
+    defer(bench_finish, NULL, NULL);
+}
+
+static void bench_start(void *ignr1, void *ignr2) {
+  FIOBJ channel = fiobj_str_new("fan-out", 7);
+  for (size_t i = 0; i < subscribers; ++i) {
+    facil_subscribe(.channel = channel, .on_message = on_message,
+                    .udata1 = expected + i);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < messages; ++i) {
+    FIOBJ msg = fiobj_str_buf(24);
+    fiobj_str_join(msg, fiobj_num_tmp(i));
+    facil_publish(.engine = FACIL_PUBSUB_PROCESS, .channel = channel,
+                  .message = msg);
+    fiobj_free(msg);
+  }
+  fiobj_free(channel);
+  (void)ignr1;
+  (void)ignr2;
+}
+
+static void bench_defer(void *ignr) { defer(bench_start, ignr, NULL); }
+
+int main(int argc, char const *argv[]) {
+  size_t threads = 4;
+  if (argc > 1 && atol(argv[1]) > 0)
+    subscribers = atol(argv[1]);
+  if (argc > 2 && atol(argv[2]) > 0)
+    messages = atol(argv[2]);
+  if (argc > 3 && atol(argv[3]) > 0)
+    threads = atol(argv[3]);
+  expected = calloc(subscribers, sizeof(*expected));
+  if (!expected) {
+    perror("ERROR: couldn't allocate memory");
+    exit(-1);
+  }
+  fprintf(stderr,
+          "* Publishing %lu messages to %lu subscribers using %lu threads "
+          "(batch size: %d, 0 == default)\n",
+          (unsigned long)messages, (unsigned long)subscribers,
+          (unsigned long)threads, FACIL_PUBSUB_BATCH);
+  facil_core_callback_add(FIO_CALL_ON_START, bench_defer, NULL);
+  facil_run(.threads = threads, .processes = 1);
+  free(expected);
+  return 0;
+}
@@ -0,0 +1,210 @@
+/*
+A Redis engine pipelining benchmark.
+
+The benchmark sends a number of `PING` commands using `redis_engine_send` and
+measures the number of replies per second for a growing pipeline window (the
+`pipeline` argument for `redis_engine_create`).
+
+Unless a port number is provided (for a running `redis-server`), a minimal
+RESP stand-in server is started on a background thread. The stand-in server
+replies `+PONG` to every command and may delay every reply batch by a number of
+microseconds, emulating network latency (this is where pipelining shines).
+
+Compile using (from the repo's root):
+
+    gcc -O2 -Ilib -Ilib/facil/core -Ilib/facil/core/types \
+        -Ilib/facil/core/types/fiobj -Ilib/facil/services -Ilib/facil/redis \
+        -o /tmp/redis_pipeline tests/redis_pipeline.c \
+        $(find lib/facil/core lib/facil/services lib/facil/redis -name '*.c') \
+        -lpthread -lm
+
+Run using: redis_pipeline [commands] [latency in microseconds] [redis port]
+*/
+#include "facil.h"
+#include "redis_engine.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* *****************************************************************************
+The RESP stand-in server
+***************************************************************************** */
+
+static size_t latency;
+
+/* returns the length of the first complete command, or 0. */
+static size_t resp_command_length(const char *buf, size_t len) {
+  const char *pos = buf;
+  const char *end = buf + len;
+  const char *eol = memchr(pos, '\n', end - pos);
+  if (!eol)
+    return 0;
+  if (*pos != '*') /* inline command */
+    return eol + 1 - buf;
+  long count = atol(pos + 1);
+  pos = eol + 1;
+  while (count-- > 0) {
+    if (pos >= end || !(eol = memchr(pos, '\n', end - pos)))
+      return 0;
+    pos = eol + 1 + atol(pos + 1) + 2;
+  }
+  return (pos <= end) ? (size_t)(pos - buf) : 0;
+}
+
+static void *resp_connection(void *fd_) {
+  const int fd = (int)(intptr_t)fd_;
+  static const char pong[] = "+PONG\r\n";
+  char *buf = malloc(1 << 16);
+  char *reply = malloc((1 << 16) / 14 * (sizeof(pong) - 1) + 1);
+  size_t len = 0;
+  ssize_t tmp;
+  while ((tmp = read(fd, buf + len, (1 << 16) - len)) > 0) {
+    size_t consumed = 0, cmd_len, reply_len = 0;
+    len += tmp;
+    while ((cmd_len = resp_command_length(buf + consumed, len - consumed))) {
+      consumed += cmd_len;
+      memcpy(reply + reply_len, pong, sizeof(pong) - 1);
+      reply_len += sizeof(pong) - 1;
+    }
+    memmove(buf, buf + consumed, len - consumed);
+    len -= consumed;
+    if (!reply_len)
+      continue;
+    if (latency)
+      usleep(latency);
+    for (size_t sent = 0; sent < reply_len; sent += tmp) {
+      if ((tmp = write(fd, reply + sent, reply_len - sent)) <= 0)
+        goto finish;
+    }
+  }
+finish:
+  close(fd);
+  free(reply);
+  free(buf);
+  return NULL;
+}
+
+static void *resp_server(void *srv_) {
+  const int srv = (int)(intptr_t)srv_;
+  int fd;
+  while ((fd = accept(srv, NULL, NULL)) >= 0) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, resp_connection, (void *)(intptr_t)fd);
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+/* starts the stand-in server, returning it's port number. */
+static int resp_server_start(void) {
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t addr_len = sizeof(addr);
+  int srv = socket(AF_INET, SOCK_STREAM, 0);
+  if (srv == -1 || bind(srv, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(srv, 16) ||
+      getsockname(srv, (struct sockaddr *)&addr, &addr_len)) {
+    perror("ERROR: couldn't start the RESP stand-in server");
+    exit(-1);
+  }
+  pthread_t thread;
+  pthread_create(&thread, NULL, resp_server, (void *)(intptr_t)srv);
+  pthread_detach(thread);
+  return ntohs(addr.sin_port);
+}
+
+/* *****************************************************************************
+The benchmark
+***************************************************************************** */
+
+static const size_t windows[] = {1, 4, 16, 64, 256, 1024, 0};
+static size_t window_index;
+static size_t commands = 100000;
+static size_t replies;
+static char port[16];
+static struct timespec start;
+static pubsub_engine_s *engine;
+
+static void bench_round(void *ignr1, void *ignr2);
+
+static void bench_next(void *ignr1, void *ignr2) {
+  redis_engine_destroy(engine);
+  engine = NULL;
+  ++window_index;
+  bench_round(ignr1, ignr2);
+}
+
+static void on_reply(pubsub_engine_s *e, FIOBJ reply, void *udata) {
+  if (++replies < commands)
+    return;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) +
+                   ((double)(end.tv_nsec - start.tv_nsec) / 1000000000.0);
+  fprintf(stderr,
+          "* window %5lu: %lu commands in %.3lf seconds (%.0lf ops/sec)\n",
+          (unsigned long)windows[window_index], (unsigned long)commands,
+          seconds, commands / seconds);
+  defer(bench_next, NULL, NULL);
+  (void)e;
+  (void)reply;
+  (void)udata;
+}
+
+static void on_warmup(pubsub_engine_s *e, FIOBJ reply, void *udata) {
+  /* the connection is established, start the clock */
+  FIOBJ cmd = fiobj_str_new("PING", 4);
+  replies = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < commands; ++i)
+    redis_engine_send(e, cmd, FIOBJ_INVALID, on_reply, NULL);
+  fiobj_free(cmd);
+  (void)reply;
+  (void)udata;
+}
+
+static void bench_round(void *ignr1, void *ignr2) {
+  if (!windows[window_index]) {
+    kill(getpid(), SIGINT);
+    return;
+  }
+  engine = redis_engine_create(.address = {.data = "127.0.0.1"},
+                               .port = {.data = port},
+                               .pipeline = windows[window_index]);
+  FIOBJ cmd = fiobj_str_new("PING", 4);
+  redis_engine_send(engine, cmd, FIOBJ_INVALID, on_warmup, NULL);
+  fiobj_free(cmd);
+  (void)ignr1;
+  (void)ignr2;
+}
+
+static void bench_start(void *ignr) {
+  /* engines should be created once the reactor is running */
+  defer(bench_round, ignr, NULL);
+}
+
+int main(int argc, char const *argv[]) {
+  if (argc > 1 && atol(argv[1]) > 0)
+    commands = atol(argv[1]);
+  if (argc > 2)
+    latency = atol(argv[2]);
+  if (argc > 3) {
+    snprintf(port, sizeof(port), "%s", argv[3]);
+  } else {
+    snprintf(port, sizeof(port), "%d", resp_server_start());
+  }
+  fprintf(stderr,
+          "* Sending %lu PING commands to port %s (%lu microseconds latency)\n",
+          (unsigned long)commands, port, (unsigned long)latency);
+  facil_core_callback_add(FIO_CALL_ON_START, bench_start, NULL);
+  facil_run(.threads = 1, .processes = 1);
+  return 0;
+}
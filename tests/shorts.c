@@ -29,6 +29,7 @@ int main(void) {
                   "OpenSSL isn't.\n\n");
 #endif
   mustache_test();
+  fio_arena_test();
   fio_malloc_test();
   fio_llist_test();
   fio_str_test();
@@ -37,6 +38,7 @@ int main(void) {
   fiobj_test();
   defer_test();
   sock_libtest();
+  facil_cluster_test();
   http_tests();
 #else
   fprintf(stderr, "DEBUG must be set to access tests.\n");
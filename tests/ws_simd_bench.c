@@ -0,0 +1,224 @@
+/*
+A WebSocket unmasking and UTF-8 validation benchmark.
+
+The benchmark measures the throughput (GB/s) of the `websocket_xmask` and
+`websocket_utf8_valid` kernels (SWAR, SSE2, AVX2) for message sizes between 16
+bytes and 16MB. UTF-8 validation is measured for both ASCII text and mixed
+(multi-byte) text.
+
+Before measuring, every kernel's results are compared to the portable kernel's
+results, including a round of random (mostly invalid) data.
+
+Compile using (from the repo's root):
+
+    gcc -O2 -Ilib/facil/http/parsers -o /tmp/ws_simd_bench \
+        tests/ws_simd_bench.c
+
+Run using: ws_simd_bench [max size in KB]
+*/
+#include "websocket_parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* the parser's callbacks aren't used, but they must exist */
+static void websocket_on_unwrapped(void *udata, void *msg, uint64_t len,
+                                   char first, char last, char text,
+                                   unsigned char rsv) {
+  (void)udata, (void)msg, (void)len, (void)first, (void)last, (void)text,
+      (void)rsv;
+}
+static void websocket_on_protocol_ping(void *udata, void *msg, uint64_t len) {
+  (void)udata, (void)msg, (void)len;
+}
+static void websocket_on_protocol_pong(void *udata, void *msg, uint64_t len) {
+  (void)udata, (void)msg, (void)len;
+}
+static void websocket_on_protocol_close(void *udata) { (void)udata; }
+static void websocket_on_protocol_error(void *udata) { (void)udata; }
+
+static const char *kernel_names[] = {"auto", "SWAR", "SSE2", "AVX2"};
+
+/* mixed text: ASCII, Hebrew, CJK and an emoji (1-4 byte characters). */
+static const char mixed_text[] =
+    "Hello world, \xD7\xA9\xD7\x9C\xD7\x95\xD7\x9D \xD7\xA2\xD7\x95\xD7\x9C"
+    "\xD7\x9D, \xE4\xBD\xA0\xE5\xA5\xBD\xE4\xB8\x96\xE7\x95\x8C "
+    "\xF0\x9F\x98\x80 ";
+
+static void fill(uint8_t *buf, size_t len, const char *src) {
+  const size_t src_len = strlen(src);
+  size_t pos = 0;
+  while (pos + src_len <= len) {
+    memcpy(buf + pos, src, src_len);
+    pos += src_len;
+  }
+  memset(buf + pos, ' ', len - pos);
+}
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + (t.tv_nsec / 1000000000.0);
+}
+
+/* *****************************************************************************
+Correctness
+***************************************************************************** */
+
+static const char *utf8_samples[] = {
+    "\xC0\x80",         /* overlong */
+    "\xE0\x80\x80",     /* overlong */
+    "\xF0\x80\x80\x80", /* overlong */
+    "\xED\xA0\x80",     /* surrogate */
+    "\xF4\x90\x80\x80", /* > U+10FFFF */
+    "\xF5\x80\x80\x80", /* invalid lead byte */
+    "\xFF",             /* invalid byte */
+    "\x80",             /* continuation without a lead byte */
+    "\xE4\xBD",         /* truncated */
+    "\xF0\x9F\x98",     /* truncated */
+    "\xC2\xA9",         /* valid */
+    "\xEF\xBF\xBF",     /* valid */
+    "\xF4\x8F\xBF\xBF", /* valid (U+10FFFF) */
+    NULL,
+};
+
+static int test_kernel(websocket_kernel_e kernel, uint8_t *buf, uint8_t *cmp) {
+  /* unmasking, every length and alignment up to 300 bytes */
+  for (size_t len = 0; len < 300; ++len) {
+    for (size_t offset = 0; offset < 8; ++offset) {
+      for (size_t i = 0; i < len; ++i)
+        buf[offset + i] = cmp[offset + i] = (uint8_t)(i * 7 + offset);
+      websocket_kernel_set(WEBSOCKET_KERNEL_SWAR);
+      websocket_xmask(cmp + offset, len, 0x9A3B2C1DU);
+      websocket_kernel_set(kernel);
+      websocket_xmask(buf + offset, len, 0x9A3B2C1DU);
+      if (memcmp(buf + offset, cmp + offset, len)) {
+        fprintf(stderr, "ERROR: %s unmasking failed (%zu bytes)\n",
+                kernel_names[kernel], len);
+        return -1;
+      }
+    }
+  }
+  /* UTF-8, every sample at every position of a 100 byte message */
+  for (size_t s = 0; utf8_samples[s]; ++s) {
+    const size_t sample_len = strlen(utf8_samples[s]);
+    for (size_t pos = 0; pos + sample_len <= 100; ++pos) {
+      memset(buf, 'a', 100);
+      memcpy(buf + pos, utf8_samples[s], sample_len);
+      websocket_kernel_set(WEBSOCKET_KERNEL_SWAR);
+      const int expected = websocket_utf8_valid(buf, 100);
+      websocket_kernel_set(kernel);
+      if (websocket_utf8_valid(buf, 100) != expected) {
+        fprintf(stderr, "ERROR: %s UTF-8 validation failed (sample %zu @ %zu)\n",
+                kernel_names[kernel], s, pos);
+        return -1;
+      }
+    }
+  }
+  /* UTF-8, random data (mostly from the mixed text, with random errors) */
+  srand(1);
+  for (size_t round = 0; round < 100000; ++round) {
+    const size_t len = rand() % 130;
+    size_t offset = rand() % (sizeof(mixed_text) - 1);
+    for (size_t i = 0; i < len; ++i) {
+      buf[i] = mixed_text[offset];
+      offset = (offset + 1) % (sizeof(mixed_text) - 1);
+    }
+    if (len && (rand() & 1))
+      buf[rand() % len] = (uint8_t)rand();
+    websocket_kernel_set(WEBSOCKET_KERNEL_SWAR);
+    const int expected = websocket_utf8_valid(buf, len);
+    websocket_kernel_set(kernel);
+    if (websocket_utf8_valid(buf, len) != expected) {
+      fprintf(stderr, "ERROR: %s UTF-8 validation failed (random round %zu)\n",
+              kernel_names[kernel], round);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* *****************************************************************************
+Benchmark
+***************************************************************************** */
+
+/* returns GB/s, running for roughly the same amount of data per size. */
+static double bench_xmask(uint8_t *buf, size_t len) {
+  const size_t rounds = 1 + ((size_t)1 << 28) / len;
+  const double start = now();
+  for (size_t i = 0; i < rounds; ++i) {
+    websocket_xmask(buf, len, 0x9A3B2C1DU);
+    __asm__ volatile("" ::: "memory");
+  }
+  return ((double)rounds * len) / ((now() - start) * 1000000000.0);
+}
+
+static double bench_utf8(uint8_t *buf, size_t len) {
+  const size_t rounds = 1 + ((size_t)1 << 28) / len;
+  size_t valid = 0;
+  const double start = now();
+  for (size_t i = 0; i < rounds; ++i) {
+    valid += websocket_utf8_valid(buf, len);
+    __asm__ volatile("" ::: "memory");
+  }
+  const double result =
+      ((double)rounds * len) / ((now() - start) * 1000000000.0);
+  if (valid != rounds) {
+    fprintf(stderr, "ERROR: UTF-8 validation failed during the benchmark\n");
+    exit(-1);
+  }
+  return result;
+}
+
+int main(int argc, char const *argv[]) {
+  size_t max = (size_t)16 << 20;
+  if (argc > 1 && atol(argv[1]) > 0)
+    max = (size_t)atol(argv[1]) << 10;
+  uint8_t *buf = malloc(max + 64);
+  uint8_t *cmp = malloc(max + 64);
+  uint8_t *ascii = malloc(max);
+  uint8_t *mixed = malloc(max);
+  if (!buf || !cmp || !ascii || !mixed) {
+    perror("ERROR: couldn't allocate memory");
+    exit(-1);
+  }
+  memset(buf, 'x', max);
+
+  for (int k = WEBSOCKET_KERNEL_SWAR; k <= WEBSOCKET_KERNEL_AVX2; ++k) {
+    if (websocket_kernel_set(k)) {
+      fprintf(stderr, "* %s kernel unsupported, skipping.\n", kernel_names[k]);
+      continue;
+    }
+    if (test_kernel(k, buf, cmp))
+      exit(-1);
+    fprintf(stderr, "* %s kernel passed the correctness tests.\n",
+            kernel_names[k]);
+  }
+
+  fprintf(stderr, "\n%10s %6s %12s %12s %12s\n", "size", "kernel",
+          "unmask GB/s", "ASCII GB/s", "mixed GB/s");
+  for (size_t len = 16; len <= max; len <<= 2) {
+    /* filled per size, so characters aren't cut at the end of the message */
+    fill(ascii, len, "The quick brown fox jumps over the lazy dog. ");
+    fill(mixed, len, mixed_text);
+    for (int k = WEBSOCKET_KERNEL_SWAR; k <= WEBSOCKET_KERNEL_AVX2; ++k) {
+      if (websocket_kernel_set(k))
+        continue;
+      const double xmask = bench_xmask(buf, len);
+      const double utf8_ascii = bench_utf8(ascii, len);
+      const double utf8_mixed = bench_utf8(mixed, len);
+      fprintf(stderr, "%10zu %6s %12.2lf %12.2lf %12.2lf\n", len,
+              kernel_names[k], xmask, utf8_ascii, utf8_mixed);
+    }
+  }
+  websocket_kernel_set(WEBSOCKET_KERNEL_AUTO);
+  fprintf(stderr, "\n* The automatic selection is: %s\n",
+          kernel_names[websocket_kernel_get()]);
+  free(mixed);
+  free(ascii);
+  free(cmp);
+  free(buf);
+  return 0;
+}